@@ -223,6 +223,13 @@ class BlockDataManager(object):
    def getSentValue(self, txIn):
       return self.bdv().getSentValue(txIn)
 
+   #############################################################################
+   @ActLikeASingletonBDM
+   def compactDatabases(self):
+      #the BDM thread reclaims the free space of the db files, the dbs stay
+      #online meanwhile
+      self.bdv().requestCompaction()
+
    #############################################################################
    @ActLikeASingletonBDM
    def getTopBlockHeight(self):
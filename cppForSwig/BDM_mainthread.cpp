@@ -358,6 +358,12 @@ try
          }
       }
 
+      if (bdm->compactFlag_ == true)
+      {
+         bdm->compactFlag_ = false;
+         bdm->compactDatabases();
+      }
+
       if (bdm->criticalError_.size())
       {
          throw runtime_error(bdm->criticalError_.c_str());
@@ -9,6 +9,7 @@
 #define BLOCKDATAMANAGERCONFIG_H
 
 #include "BinaryData.h"
+#include "lmdbpp.h"
 
 enum ARMORY_DB_TYPE
 {
@@ -27,6 +28,29 @@ enum DB_PRUNE_TYPE
   DB_PRUNE_WHATEVER
 };
 
+// how sub-history keys are laid out in the history db. Saved in its sdbi
+enum SSH_KEY_LAYOUT
+{
+  // DB_PREFIX_SCRIPT|scrAddr|hgtX, next to the ssh summary
+  SSH_KEYS_SCRADDR,
+  // DB_PREFIX_SUBSSH|id|hgtX, with the scrAddr mapped to a 4 byte id 
+  // under DB_PREFIX_SCRADDRID
+  SSH_KEYS_SCRADDR_ID
+};
+
+// how supernode writes tx and txout entries to the blkdata db. Saved in its 
+// sdbi. Each entry flags its own encoding, so reads don't depend on it. 
+// Turning it on raises the db to ARMORY_DB_VERSION_TXCOMPRESSION for good
+enum TXDATA_COMPRESSION
+{
+  TXDATA_RAW,
+  // txout amounts as compressed var_ints, P2PKH and P2SH scripts as their
+  // hash160
+  TXDATA_COMPRESS_TXOUT,
+  // as above, and LZ4 style compression of the fragged tx entries
+  TXDATA_COMPRESS_ALL
+};
+
 
 struct BlockDataManagerConfig
 {
@@ -40,6 +64,38 @@ struct BlockDataManagerConfig
    BinaryData genesisTxHash;
    BinaryData magicBytes;
    
+   // worker threads used to process blk files and block data in parallel,
+   // defaults to the number of cores
+   unsigned int threadCount;
+   
+   // raw block data is written to the db in batches, a batch is committed
+   // once it holds this many blocks or this many bytes, whichever comes first
+   unsigned int rawBlockBatchCount;
+   uint64_t rawBlockBatchBytes;
+   
+   // RAM a block scan may hold in pending writes and its utxo cache. Commit
+   // thresholds are derived from it at runtime. Defaults to a quarter of the
+   // physical memory, within [256MB, 16GB]
+   uint64_t scanMemoryBudget;
+   
+   // headers failing their proof of work are left out of the chain
+   bool verifyHeaderPoW;
+   
+   // how the lmdb envs are opened, see selectDbProfile for presets
+   LMDBTuning dbTuning;
+   
+   // history key layout new dbs are created with. Existing dbs keep the 
+   // layout they were built with, unless migrateHistoryKeys is set
+   SSH_KEY_LAYOUT historyKeyLayout;
+   
+   // moves the history keys of an existing db to historyKeyLayout when it
+   // is opened. Set it again to resume an interrupted migration
+   bool migrateHistoryKeys;
+   
+   // encoding of new tx entries in supernode. Can be changed on an 
+   // existing db, entries already written are left as they are
+   TXDATA_COMPRESSION txDataCompression;
+   
    void setGenesisBlockHash(const BinaryData &h)
    {
       genesisBlockHash = h;
@@ -55,6 +111,10 @@ struct BlockDataManagerConfig
    
    BlockDataManagerConfig();
    void selectNetwork(const string &netname);
+   
+   // "Default", "SSD" (fast random access storage, throughput first) 
+   // or "HDD" (spinning disks, safety first). Sets dbTuning
+   void selectDbProfile(const string &profile);
 };
 
 #endif
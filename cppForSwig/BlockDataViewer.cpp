@@ -328,6 +328,66 @@ Tx BlockDataViewer::getPrevTx(TxIn & txin) const
    return getTxByHash(op.getTxHash());
 }
 
+////////////////////////////////////////////////////////////////////////////////
+vector<Tx> BlockDataViewer::getTxsByHash(
+   const vector<BinaryData>& txHashes) const
+{
+   checkBDMisReady();
+   LMDBBlockDatabase::Snapshot snapshot(db_);
+
+   vector<Tx> txs = db_->getTxsByHash(txHashes);
+
+   // not in the blockchain, but maybe in the zero-conf tx list
+   for (unsigned i = 0; i < txs.size(); i++)
+   {
+      if (!txs[i].isInitialized())
+         txs[i] = zeroConfCont_.getTxByHash(txHashes[i]);
+   }
+
+   return txs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+vector<TxOut> BlockDataViewer::getPrevTxOuts(Tx & tx) const
+{
+   checkBDMisReady();
+   LMDBBlockDatabase::Snapshot snapshot(db_);
+
+   const uint32_t nTxIn = tx.getNumTxIn();
+   vector<OutPoint> outpoints;
+   vector<BinaryData> prevHashes;
+   outpoints.reserve(nTxIn);
+   prevHashes.reserve(nTxIn);
+
+   for (uint32_t i = 0; i < nTxIn; i++)
+   {
+      TxIn txin = tx.getTxInCopy(i);
+      outpoints.push_back(txin.getOutPoint());
+      
+      // coinbases have nothing to look up
+      if (txin.isCoinbase())
+         prevHashes.push_back(BinaryData(0));
+      else
+         prevHashes.push_back(outpoints.back().getTxHash());
+   }
+
+   vector<Tx> prevTxs = getTxsByHash(prevHashes);
+
+   vector<TxOut> txouts(nTxIn);
+   for (uint32_t i = 0; i < nTxIn; i++)
+   {
+      if (prevHashes[i].getSize() == 0)
+         continue;
+
+      if (!prevTxs[i].isInitialized())
+         throw runtime_error("couldn't find prev tx");
+
+      txouts[i] = prevTxs[i].getTxOutCopy(outpoints[i].getTxOutIndex());
+   }
+
+   return txouts;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 HashString BlockDataViewer::getSenderScrAddr(TxIn & txin) const
 {
@@ -412,6 +472,10 @@ vector<LedgerEntry> BlockDataViewer::getWalletsHistoryPage(uint32_t pageId,
 {
    checkBDMisReady();
 
+   // the page is built from many reads, have them all see the same state 
+   // of the db while the BDM thread keeps committing blocks
+   LMDBBlockDatabase::Snapshot snapshot(db_);
+
    return groups_[group_wallet].getHistoryPage(pageId, 
       rebuildLedger, remapWallets);
 }
@@ -429,6 +493,7 @@ vector<LedgerEntry> BlockDataViewer::getLockboxesHistoryPage(uint32_t pageId,
    bool rebuildLedger, bool remapWallets)
 {
    checkBDMisReady();
+   LMDBBlockDatabase::Snapshot snapshot(db_);
 
    return groups_[group_lockbox].getHistoryPage(pageId,
       rebuildLedger, remapWallets);
@@ -511,6 +576,7 @@ vector<UnspentTxOut> BlockDataViewer::getUnspentTxoutsForAddr160List(
    const vector<BinaryData>& scrAddrVec, bool ignoreZc) const
 {
    checkBDMisReady();
+   LMDBBlockDatabase::Snapshot snapshot(db_);
 
    ScrAddrFilter* saf = bdmPtr_->getScrAddrFilter();
 
@@ -600,7 +666,10 @@ WalletGroup BlockDataViewer::getStandAloneWalletGroup(
       }
    }
 
-   wg.pageHistory(true);
+   {
+      LMDBBlockDatabase::Snapshot snapshot(db_);
+      wg.pageHistory(true);
+   }
 
    return wg;
 }
@@ -666,7 +735,10 @@ LedgerDelegate BlockDataViewer::getLedgerDelegateForScrAddr(
    ScrAddrObj& sca = wlt->getScrAddrObjRef(scrAddr);
 
    auto getHist = [&](uint32_t pageID)->vector<LedgerEntry>
-   { return sca.getHistoryPageById(pageID); };
+   { 
+      LMDBBlockDatabase::Snapshot snapshot(db_);
+      return sca.getHistoryPageById(pageID); 
+   };
 
    auto getBlock = [&](uint32_t block)->uint32_t
    { return sca.getBlockInVicinity(block); };
@@ -681,41 +753,20 @@ LedgerDelegate BlockDataViewer::getLedgerDelegateForScrAddr(
 ////////////////////////////////////////////////////////////////////////////////
 uint32_t BlockDataViewer::getClosestBlockHeightForTime(uint32_t timestamp)
 {
-   //get timestamp of genesis block
-   auto& genBlock = blockchain().getGenesisBlock();
-   
-   //sanity check
-   if (timestamp < genBlock.getTimestamp())
-      return 0;
-
-   //get time diff and divide by average time per block (600 sec for Bitcoin)
-   uint32_t diff = timestamp - genBlock.getTimestamp();
-   int32_t blockHint = diff/600;
-
-   //look for a block in the hint vicinity with a timestamp lower than ours
-   while (blockHint > 0)
-   {
-      auto& block = blockchain().getHeaderByHeight(blockHint);
-      if (block.getTimestamp() < timestamp)
-         break;
-
-      blockHint -= 1000;
-   }
+   return blockchain().getClosestHeightForTime(timestamp);
+}
 
-   //another sanity check
-   if (blockHint < 0)
-      return 0;
+////////////////////////////////////////////////////////////////////////////////
+vector<uint32_t> BlockDataViewer::getClosestBlockHeightsForTimes(
+   const vector<uint32_t>& timestamps)
+{
+   vector<uint32_t> heights;
+   heights.reserve(timestamps.size());
 
-   for (uint32_t id = blockHint; id < blockchain().top().getBlockHeight() - 1; id++)
-   {
-      //not looking for a really precise block, 
-      //anything within the an hour of the timestamp is enough
-      auto& block = blockchain().getHeaderByHeight(id);
-      if (block.getTimestamp() + 3600 > timestamp)
-         return block.getBlockHeight();
-   }
+   for (auto timestamp : timestamps)
+      heights.push_back(blockchain().getClosestHeightForTime(timestamp));
 
-   return blockchain().top().getBlockHeight() - 1;
+   return heights;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
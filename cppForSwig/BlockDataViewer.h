@@ -143,6 +143,11 @@ public:
    Tx                getTxByHash(BinaryData const & txHash) const;
    TxOut             getPrevTxOut(TxIn & txin) const;
    Tx                getPrevTx(TxIn & txin) const;
+
+   // batch lookups, one pass over the db instead of one per hash/input.
+   // Results are in the order of the input, uninitialized when not found
+   vector<Tx>        getTxsByHash(const vector<BinaryData>& txHashes) const;
+   vector<TxOut>     getPrevTxOuts(Tx & tx) const;
    
    bool isTxMainBranch(const Tx &tx) const;
 
@@ -174,6 +179,9 @@ public:
 
    void flagRefresh(BDV_refresh refresh, const BinaryData& refreshId);
    void notifyMainThread(void) const { bdmPtr_->notifyMainThread(); }
+   // compacts the db files in the background, see 
+   // BlockDataManager_LevelDB::compactDatabases
+   void requestCompaction(void) { bdmPtr_->requestCompaction(); }
 
    StoredHeader getMainBlockFromDB(uint32_t height) const;
    StoredHeader getBlockFromDB(uint32_t height, uint8_t dupID) const;
@@ -227,6 +235,7 @@ public:
 
    uint32_t getBlockTimeByHeight(uint32_t) const;
    uint32_t getClosestBlockHeightForTime(uint32_t);
+   vector<uint32_t> getClosestBlockHeightsForTimes(const vector<uint32_t>&);
    
    LedgerDelegate getLedgerDelegateForWallets();
    LedgerDelegate getLedgerDelegateForLockboxes();
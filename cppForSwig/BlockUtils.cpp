@@ -9,6 +9,9 @@
 #include <algorithm>
 #include <time.h>
 #include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "BlockUtils.h"
 #include "BlockWriteBatcher.h"
 #include "lmdbpp.h"
@@ -17,62 +20,58 @@
 
 #include "ReorgUpdater.h"
 
-static bool scanFor(std::istream &in, const uint8_t * bytes, const unsigned len)
-{
-   std::vector<uint8_t> ahead(len); // the bytes matched
-   
-   in.read((char*)&ahead.front(), len);
-   unsigned count = in.gcount();
-   if (count < len) return false;
-   
-   unsigned offset=0; // the index mod len which we're in ahead
-   
-   do
-   {
-      bool found=true;
-      for (unsigned i=0; i < len; i++)
-      {
-         if (ahead[(i+offset)%len] != bytes[i])
-         {
-            found=false;
-            break;
-         }
-      }
-      if (found)
-         return true;
-      
-      ahead[offset++%len] = in.get();
-      
-   } while (!in.eof());
-   return false;
-}
+#ifdef _MSC_VER
+   #include <windows.h>
+#else
+   #include <unistd.h>
+#endif
 
+// returns the offset of the first occurence of bytes in in, UINT64_MAX if 
+// there is none. Runs of garbage or zero padding are skipped with memchr on
+// the first byte, which libc vectorizes, so we don't go through them
+// one byte at a time
 static uint64_t scanFor(const uint8_t *in, const uint64_t inLen,
    const uint8_t * bytes, const uint64_t len)
 {
-   uint64_t offset = 0; // the index mod len which we're in ahead
+   if (len == 0 || inLen < len)
+      return UINT64_MAX;
+
+   // the last position a match can start at
+   const uint8_t* const last = in + (inLen - len);
+   const uint8_t* ptr = in;
 
-   do
+   while (ptr <= last)
    {
-      bool found = true;
-      for (uint64_t i = 0; i < len; i++)
-      {
-         if (in[i] != bytes[i])
-         {
-            found = false;
-            break;
-         }
-      }
-      if (found)
-         return offset;
+      ptr = static_cast<const uint8_t*>(
+         memchr(ptr, bytes[0], size_t(last - ptr) + 1));
+      if (ptr == nullptr)
+         break;
 
-      in++;
-      offset++;
+      if (memcmp(ptr + 1, bytes + 1, len - 1) == 0)
+         return ptr - in;
+
+      ptr++;
+   }
 
-   } while (offset + len< inLen);
    return UINT64_MAX;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+struct BlockDataManager_LevelDB::PreparedBlock
+{
+   // points into the mapped blk file, without the magic bytes and size
+   BinaryDataRef rawBlock_;
+   BlockFilePosition pos_;
+   uint32_t blockSize_ = 0;
+
+   BinaryData hash_;
+   
+   // Supernode only: the fully deserialized block
+   StoredHeader sbh_;
+   bool parseError_ = false;
+};
+
+////////////////////////////////////////////////////////////////////////////////
 class BlockDataManager_LevelDB::BitcoinQtBlockFiles
 {
    const string blkFileLocation_;
@@ -141,12 +140,28 @@ public:
       return blkFiles_[fnum].filesizeCumul;
    }
    
-   // find the location of the first block that is not in @p bc
+   // find the location of the first block that is not in @p bc.
+   // @p lastKnown is the furthest block along the blk files that we have 
+   // a recorded position for, if any. If it's where we think it is, we
+   // resume right after it, otherwise we go look through the files
    BlockFilePosition findFirstUnrecognizedBlockHeader(
-      Blockchain &bc
+      Blockchain &bc,
+      const BlockHeader* lastKnown = nullptr
    ) 
    {
-      map<HashString, BlockHeader> &allHeaders = bc.allHeaders();
+      // the genesis block needs to be loaded even if it's the last 
+      // block we know of, let the scan below deal with that
+      if (lastKnown != nullptr && 
+          (lastKnown->getBlockFileNum() != 0 || lastKnown->getOffset() != 0) &&
+          isBlockAt(*lastKnown))
+      {
+         return { 
+            lastKnown->getBlockFileNum(), 
+            lastKnown->getOffset() + lastKnown->getBlockSize() + 8
+         };
+      }
+
+      BlockHeaderStore &allHeaders = bc.allHeaders();
       
       size_t index=0;
       
@@ -154,7 +169,7 @@ public:
       {
          const BinaryData hash = getFirstHash(blkFiles_[index]);
 
-         if (allHeaders.find(hash) == allHeaders.end())
+         if (allHeaders.find(hash) == nullptr)
          { // not found in this file
             if (index == 0)
                return { 0, 0 };
@@ -176,28 +191,27 @@ public:
       {
       };
       
+      HashString blockhash(32);
+      unsigned blockCount = 0;
       const auto stopIfBlkHeaderRecognized =
-      [&allHeaders, &foundAtPosition] (
-         const BinaryData &blockheader,
+      [&allHeaders, &foundAtPosition, &blockhash, &blockCount] (
+         const BinaryDataRef &blockheader,
          const BlockFilePosition &pos,
          uint32_t blksize
       )
       {
          // always set our position so that eventually it's at the end
          foundAtPosition = pos;
+         blockCount++;
          
-         BlockHeader block;
-         BinaryRefReader brr(blockheader);
-         block.unserialize(brr);
+         BtcUtils::getHash256(blockheader.getPtr(), HEADER_SIZE, blockhash);
+         BlockHeader* bh = allHeaders.find(blockhash);
          
-         const HashString blockhash = block.getThisHash();
-         auto bhIter = allHeaders.find(blockhash);
-         
-         if(bhIter == allHeaders.end())
+         if(bh == nullptr)
             throw StopReading();
 
-         bhIter->second.setBlockFileNum(pos.first);
-         bhIter->second.setBlockFileOffset(pos.second);
+         bh->setBlockFileNum(pos.first);
+         bh->setBlockFileOffset(pos.second);
       };
       
       uint64_t returnedOffset = UINT64_MAX;
@@ -217,8 +231,9 @@ public:
 
       // but we never find the genesis block, because
       // it always appears in Blockchain even if unloaded, and
-      // we need to load it
-      if (foundAtPosition.first == 0 && foundAtPosition.second==293)
+      // we need to load it. Check the block count rather than the offset
+      // of the block following it, there may be garbage between the two
+      if (foundAtPosition.first == 0 && blockCount == 2)
          return { 0, 0 };
       if (returnedOffset != UINT64_MAX)
          foundAtPosition.second = returnedOffset;
@@ -229,7 +244,7 @@ public:
    BlockFilePosition readHeaders(
       BlockFilePosition startAt,
       const function<void(
-         const BinaryData &,
+         const BinaryDataRef &,
          const BlockFilePosition &pos,
          uint32_t blksize
       )> &blockDataCallback
@@ -254,14 +269,21 @@ public:
       return { startAt.first-1, finishOffset };
    }
    
+   // Reads the raw blocks from startAt up to stopAt. Every block goes 
+   // through prepareBlock first, then through blockDataCallback. 
+   // 
+   // With more than one thread, a pool of readers maps and prepares different
+   // blk files concurrently, while blockDataCallback is still called from
+   // this thread only, once per block and in file order. Readers stop 
+   // picking up new files once the blocks prepared ahead of the writer hold
+   // maxBytesAhead bytes, which keeps the prepared data in RAM bounded.
    BlockFilePosition readRawBlocks(
       BlockFilePosition startAt,
       BlockFilePosition stopAt,
-      const function<void(
-         const BinaryData &,
-         const BlockFilePosition &pos,
-         uint32_t blksize
-      )> &blockDataCallback
+      unsigned nThreads,
+      uint64_t maxBytesAhead,
+      const function<void(PreparedBlock&)> &prepareBlock,
+      const function<void(PreparedBlock&)> &blockDataCallback
    )
    {
       if (startAt.first == blkFiles_.size())
@@ -269,22 +291,95 @@ public:
       if (startAt.first > blkFiles_.size())
          throw std::runtime_error("blkFile out of range");
 
-      stopAt.first = (std::min)(stopAt.first, blkFiles_.size());
-         
-      uint64_t finishLocation=stopAt.second;
-      while (startAt.first <= stopAt.first)
+      if (stopAt.first >= blkFiles_.size())
       {
-         const BlkFile &f = blkFiles_[startAt.first];
-         const uint64_t stopAtOffset
-            = startAt.first < stopAt.first ? f.filesize : stopAt.second;
-         finishLocation = readRawBlocksFromFile(
-            f, startAt.second, stopAtOffset, blockDataCallback
-         );
-         startAt.second = 0;
-         startAt.first++;
+         stopAt.first = blkFiles_.size() - 1;
+         stopAt.second = blkFiles_.back().filesize;
       }
-      
-      return { startAt.first-1, finishLocation };
+
+      if (startAt.first > stopAt.first)
+         return startAt;
+
+      const size_t fileCount = stopAt.first - startAt.first + 1;
+      if (nThreads > fileCount)
+         nThreads = fileCount;
+
+      uint64_t finishLocation;
+      if (nThreads < 2)
+      {
+         const auto prepareAndCommit = [&](PreparedBlock& block)->void
+         {
+            prepareBlock(block);
+            commitBlock(block, blockDataCallback);
+         };
+
+         finishLocation = stopAt.second;
+         while (startAt.first <= stopAt.first)
+         {
+            const BlkFile &f = blkFiles_[startAt.first];
+            const uint64_t stopAtOffset
+               = startAt.first < stopAt.first ? f.filesize : stopAt.second;
+
+            finishLocation = startAt.second;
+            if (startAt.second < stopAtOffset)
+            {
+               MapAndSize mas = getMapOfFile(f.path, f.filesize);
+               try
+               {
+                  finishLocation = readRawBlocksFromFile(
+                     f, mas, startAt.second, stopAtOffset, prepareAndCommit
+                  );
+               }
+               catch (...)
+               {
+                  unmapFile(mas);
+                  throw;
+               }
+               unmapFile(mas);
+            }
+
+            LOGINFO << "Reading raw blocks finished at file "
+               << f.fnum << " offset " << finishLocation;
+
+            startAt.second = 0;
+            startAt.first++;
+         }
+
+         return { startAt.first-1, finishLocation };
+      }
+
+      return readRawBlocksParallel(
+         startAt, stopAt, nThreads, maxBytesAhead, 
+         prepareBlock, blockDataCallback
+      );
+   }
+
+   // checks that the blk files hold the block for bh at its recorded
+   // position, reading only its header
+   bool isBlockAt(const BlockHeader& bh) const
+   {
+      if (!bh.hasFilePos() || bh.getBlockFileNum() >= blkFiles_.size())
+         return false;
+
+      const BlkFile &f = blkFiles_[bh.getBlockFileNum()];
+      const uint64_t offset = bh.getOffset();
+      if (offset + 8 + bh.getBlockSize() > f.filesize)
+         return false;
+
+      MapAndSize mas = getMapOfFile(
+         f.path, offset + 8 + HEADER_SIZE, MapAccess::Random);
+
+      bool found = false;
+      if (memcmp(mas.filemap_ + offset, magicBytes_.getPtr(), 4) == 0 &&
+          READ_UINT32_LE(mas.filemap_ + offset + 4) == bh.getBlockSize())
+      {
+         BinaryData hash(32);
+         BtcUtils::getHash256(mas.filemap_ + offset + 8, HEADER_SIZE, hash);
+         found = hash == bh.getThisHash();
+      }
+
+      unmapFile(mas);
+      return found;
    }
 
    void getFileAndPosForBlockHash(BlockHeader& blk)
@@ -298,20 +393,17 @@ public:
 
       const BinaryData& thisHash = blk.getThisHash();
 
+      HashString blockhash(32);
       const auto stopIfBlkHeaderRecognized =
-         [&thisHash, &filePos](
-         const BinaryData &blockheader,
+         [&thisHash, &filePos, &blockhash](
+         const BinaryDataRef &blockheader,
          const BlockFilePosition &pos,
          uint32_t blksize
          )
       {
          filePos = pos;
 
-         BlockHeader block;
-         BinaryRefReader brr(blockheader);
-         block.unserialize(brr);
-
-         const HashString blockhash = block.getThisHash();
+         BtcUtils::getHash256(blockheader.getPtr(), HEADER_SIZE, blockhash);
          if (blockhash == thisHash)
             throw StopReading();
       };
@@ -337,15 +429,24 @@ public:
       blk.setBlockFileOffset(filePos.second);
    }
 
-private:
-
    struct MapAndSize
    {
       uint8_t* filemap_;
       uint64_t size_;
    };
 
-   MapAndSize getMapOfFile(string path, size_t fileSize)
+   // how we're going to walk a mapped file, passed on to the kernel as
+   // a read ahead hint
+   enum class MapAccess
+   {
+      Sequential,
+      Random
+   };
+
+   MapAndSize getMapOfFile(
+      string path, size_t fileSize, 
+      MapAccess access = MapAccess::Sequential
+   ) const
    {
       MapAndSize mas;
 
@@ -381,16 +482,19 @@ private:
 
          mas.filemap_ = (uint8_t*)mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
          mas.size_ = fileSize;
+         close(fd);
 
-         if(mas.filemap_ == NULL)
+         if(mas.filemap_ == MAP_FAILED)
             throw std::runtime_error("failed to map file");
-         close(fd);
+
+         madvise(mas.filemap_, fileSize, 
+            access == MapAccess::Random ? MADV_RANDOM : MADV_SEQUENTIAL);
       #endif
 
       return mas;
    }
 
-   void unmapFile(MapAndSize& mas)
+   void unmapFile(MapAndSize& mas) const
    {
       #ifdef WIN32
       if (!UnmapViewOfFile(mas.filemap_))
@@ -400,22 +504,36 @@ private:
          throw std::runtime_error("failed to unmap file");
       #endif
    }
-   // read blocks from f, starting at offset blockFileOffset,
+
+private:
+   void commitBlock(
+      PreparedBlock& block,
+      const function<void(PreparedBlock&)> &blockDataCallback
+   ) const
+   {
+      try
+      {
+         blockDataCallback(block);
+      }
+      catch (std::exception &e)
+      {
+         // this might very well just mean that we tried to load
+         // blkdata past where we loaded headers. This isn't a problem
+         LOGERR << e.what() << " (error encountered processing block at byte "
+            << block.pos_.second << " file "
+            << blkFiles_[block.pos_.first].path 
+            << ", blocksize " << block.blockSize_ << ")";
+      }
+   }
+
+   // read blocks from the mapped file f, starting at offset blockFileOffset,
    // returning the offset we finished at
    uint64_t readRawBlocksFromFile(
-      const BlkFile &f, uint64_t blockFileOffset, uint64_t stopBefore,
-      const function<void(
-         const BinaryData &,
-         const BlockFilePosition &pos,
-         uint32_t blksize
-      )> &blockDataCallback
-   )
+      const BlkFile &f, const MapAndSize& mas,
+      uint64_t blockFileOffset, uint64_t stopBefore,
+      const function<void(PreparedBlock&)> &blockCallback
+   ) const
    {
-      // short circuit
-      if (blockFileOffset >= stopBefore)
-         return blockFileOffset;
-      
-      MapAndSize mas = getMapOfFile(f.path, f.filesize);
       BinaryData fileMagic(4);
       memcpy(fileMagic.getPtr(), mas.filemap_, 4);
       if( fileMagic != magicBytes_ )
@@ -428,7 +546,7 @@ private:
       uint64_t pos = blockFileOffset;
       
       {
-         BinaryDataRef magic, szstr, rawBlk;
+         BinaryDataRef magic, szstr;
          // read the file, we can't go past what we think is the end,
          // because we haven't gone past that in Headers
          while(pos < (std::min)(f.filesize, stopBefore))
@@ -440,7 +558,9 @@ private:
                
             if(magic != magicBytes_)
             {
-               // start scanning for MagicBytes
+               // start scanning for MagicBytes, from the byte after the 
+               // one we expected them at
+               pos -= 3;
                uint64_t offset = scanFor(mas.filemap_ + pos, f.filesize - pos,
                   magicBytes_.getPtr(), magicBytes_.getSize());
                if (offset == UINT64_MAX)
@@ -453,124 +573,329 @@ private:
                LOGERR << "Next block header found at offset " << pos-4;
             }
             
+            if(pos + 4 >= f.filesize) 
+               break;
             szstr = BinaryDataRef(mas.filemap_ + pos, 4);
             pos += 4;
             uint32_t blkSize = READ_UINT32_LE(szstr.getPtr());
-            if(pos >= f.filesize) 
+
+            if (pos + blkSize > f.filesize)
+            {
+               LOGERR << "Block at offset " << blockFileOffset 
+                  << " runs past the end of file " << f.path;
                break;
+            }
 
-            rawBlk = BinaryDataRef(mas.filemap_ +pos, blkSize);
+            PreparedBlock block;
+            block.rawBlock_ = BinaryDataRef(mas.filemap_ + pos, blkSize);
+            block.pos_ = { f.fnum, blockFileOffset };
+            block.blockSize_ = blkSize;
             pos += blkSize;
             
+            blockCallback(block);
+            blockFileOffset = pos;
+         }
+      }
+      
+      return blockFileOffset;
+   }
+
+   // RAM a prepared block holds until it is committed: the mapped block,
+   // plus its deserialized copy in supernode
+   static uint64_t preparedBytes(const PreparedBlock& block)
+   {
+      uint64_t bytes = block.blockSize_;
+      if (block.sbh_.isInitialized())
+         bytes += block.sbh_.numBytes_;
+
+      return bytes;
+   }
+
+   BlockFilePosition readRawBlocksParallel(
+      const BlockFilePosition& startAt,
+      const BlockFilePosition& stopAt,
+      unsigned nThreads,
+      uint64_t maxBytesAhead,
+      const function<void(PreparedBlock&)> &prepareBlock,
+      const function<void(PreparedBlock&)> &blockDataCallback
+   )
+   {
+      struct BlkFileJob
+      {
+         MapAndSize mas_ = { nullptr, 0 };
+         vector<PreparedBlock> blocks_;
+         uint64_t finishOffset_ = 0;
+         
+         // what this job counts against maxBytesAhead: the raw size of its
+         // range when claimed, grown as prepared blocks go past it
+         uint64_t bytesAccounted_ = 0;
+         bool ready_ = false;
+         exception_ptr error_;
+      };
+
+      vector<BlkFileJob> jobs(stopAt.first - startAt.first + 1);
+
+      mutex mu;
+      condition_variable cv;
+      size_t nextJob = 0;
+      size_t jobsCommitted = 0;
+      bool abort = false;
+
+      // bytes held by the files claimed and not yet committed. A reader 
+      // only claims a new file while this is under maxBytesAhead, unless 
+      // it's the file the writer waits on
+      uint64_t bytesAhead = 0;
+
+      const auto rangeOf = [&](size_t id)->pair<uint64_t, uint64_t>
+      {
+         const BlkFile &f = blkFiles_[startAt.first + id];
+         const uint64_t startOffset = id == 0 ? startAt.second : 0;
+         const uint64_t stopAtOffset =
+            startAt.first + id < stopAt.first ? f.filesize : stopAt.second;
+
+         return make_pair(startOffset, max(startOffset, stopAtOffset));
+      };
+
+      const auto readerThread = [&](void)->void
+      {
+         while (1)
+         {
+            size_t id;
+            {
+               unique_lock<mutex> lock(mu);
+               cv.wait(lock, [&](void)->bool
+               {
+                  return abort || nextJob >= jobs.size() ||
+                     nextJob == jobsCommitted || bytesAhead < maxBytesAhead;
+               });
+
+               if (abort || nextJob >= jobs.size())
+                  return;
+               id = nextJob++;
+
+               auto range = rangeOf(id);
+               jobs[id].bytesAccounted_ = range.second - range.first;
+               bytesAhead += jobs[id].bytesAccounted_;
+            }
+
+            BlkFileJob& job = jobs[id];
             try
             {
-               blockDataCallback(rawBlk, { f.fnum, blockFileOffset }, blkSize);
+               const BlkFile &f = blkFiles_[startAt.first + id];
+               const auto range = rangeOf(id);
+               const uint64_t startOffset = range.first;
+               const uint64_t stopAtOffset = range.second;
+
+               job.finishOffset_ = startOffset;
+               if (startOffset < stopAtOffset)
+               {
+                  job.mas_ = getMapOfFile(f.path, f.filesize);
+
+                  uint64_t jobBytes = 0;
+                  const auto prepareAndQueue = [&](PreparedBlock& block)->void
+                  {
+                     prepareBlock(block);
+                     jobBytes += preparedBytes(block);
+                     job.blocks_.push_back(move(block));
+
+                     if (jobBytes > job.bytesAccounted_)
+                     {
+                        unique_lock<mutex> lock(mu);
+                        bytesAhead += jobBytes - job.bytesAccounted_;
+                        job.bytesAccounted_ = jobBytes;
+                     }
+                  };
+
+                  job.finishOffset_ = readRawBlocksFromFile(
+                     f, job.mas_, startOffset, stopAtOffset, prepareAndQueue
+                  );
+               }
             }
-            catch (std::exception &e)
+            catch (...)
             {
-               // this might very well just mean that we tried to load
-               // blkdata past where we loaded headers. This isn't a problem
-               LOGERR << e.what() << " (error encountered processing block at byte "
-                  << blockFileOffset << " file "
-                  << f.path << ", blocksize " << blkSize << ")";
+               job.error_ = current_exception();
             }
-            blockFileOffset = pos;
+
+            {
+               unique_lock<mutex> lock(mu);
+               job.ready_ = true;
+            }
+            cv.notify_all();
+         }
+      };
+
+      vector<thread> readers;
+      for (unsigned i = 0; i < nThreads; i++)
+         readers.push_back(thread(readerThread));
+
+      const auto releaseJob = [this](BlkFileJob& job)->void
+      {
+         vector<PreparedBlock>().swap(job.blocks_);
+         if (job.mas_.filemap_ != nullptr)
+         {
+            unmapFile(job.mas_);
+            job.mas_.filemap_ = nullptr;
+         }
+      };
+
+      const auto stopReaders = [&](void)->void
+      {
+         {
+            unique_lock<mutex> lock(mu);
+            abort = true;
+         }
+         cv.notify_all();
+
+         for (auto& readerThr : readers)
+            readerThr.join();
+
+         for (auto& job : jobs)
+            releaseJob(job);
+      };
+
+      uint64_t finishLocation = stopAt.second;
+      try
+      {
+         for (size_t id = 0; id < jobs.size(); id++)
+         {
+            BlkFileJob& job = jobs[id];
+            {
+               unique_lock<mutex> lock(mu);
+               cv.wait(lock, [&job](void)->bool { return job.ready_; });
+            }
+
+            if (job.error_)
+               rethrow_exception(job.error_);
+
+            for (auto& block : job.blocks_)
+               commitBlock(block, blockDataCallback);
+
+            finishLocation = job.finishOffset_;
+            LOGINFO << "Reading raw blocks finished at file "
+               << blkFiles_[startAt.first + id].fnum 
+               << " offset " << finishLocation;
+
+            releaseJob(job);
+
+            {
+               unique_lock<mutex> lock(mu);
+               jobsCommitted = id + 1;
+               bytesAhead -= job.bytesAccounted_;
+               job.bytesAccounted_ = 0;
+            }
+            cv.notify_all();
          }
       }
-      
-      LOGINFO << "Reading raw blocks finished at file "
-         << f.fnum << " offset " << blockFileOffset;
-      
-      unmapFile(mas);
-      return blockFileOffset;
+      catch (...)
+      {
+         stopReaders();
+         throw;
+      }
+
+      stopReaders();
+      return { stopAt.first, finishLocation };
    }
    
+   // read the headers (plus the tx count var_int) of the blocks in f,
+   // starting at blockFileOffset, returning the offset we finished at.
+   // The callback gets a reference into the mapped file, it is only valid
+   // for the duration of the call
    uint64_t readHeadersFromFile(
       const BlkFile &f,
       uint64_t blockFileOffset,
       const function<void(
-         const BinaryData &,
+         const BinaryDataRef &,
          const BlockFilePosition &pos,
          uint32_t blksize
       )> &blockDataCallback
    ) const
    {
-      ifstream is(f.path, ios::binary);
-      {
-         BinaryData fileMagic(4);
-         is.read(reinterpret_cast<char*>(fileMagic.getPtr()), 4);
+      if (f.filesize == 0)
+         return blockFileOffset;
+
+      // we only touch the first few bytes of each block, but blocks are
+      // laid out back to back so read ahead still pays off
+      MapAndSize mas = getMapOfFile(f.path, f.filesize, MapAccess::Sequential);
 
-         if( fileMagic != magicBytes_)
+      try
+      {
+         if (f.filesize < 4 || 
+             memcmp(mas.filemap_, magicBytes_.getPtr(), 4) != 0)
          {
             std::ostringstream ss;
             ss << "Block file '" << f.path << "' is the wrong network! File: "
-               << fileMagic.toHexStr()
+               << BinaryDataRef(mas.filemap_, (std::min)(f.filesize, uint64_t(4))).toHexStr()
                << ", expecting " << magicBytes_.toHexStr();
             throw runtime_error(ss.str());
          }
-      }
-      is.seekg(blockFileOffset, ios::beg);
-      
-      {
-         const uint32_t HEAD_AND_NTX_SZ = HEADER_SIZE + 10; // enough
-         BinaryData magic(4), szstr(4), rawHead(HEAD_AND_NTX_SZ);
-         while(!is.eof())
+
+         const uint64_t HEAD_AND_NTX_SZ = HEADER_SIZE + 10; // enough
+         uint64_t pos = blockFileOffset;
+
+         while (pos + 8 <= f.filesize)
          {
-            is.read((char*)magic.getPtr(), 4);
-            if (is.eof())
-               break;
-               
-            if(magic != magicBytes_)
+            if (memcmp(mas.filemap_ + pos, magicBytes_.getPtr(), 4) != 0)
             {
-               // I have to start scanning for MagicBytes
-               if (!scanFor(is, magicBytes_.getPtr(), magicBytes_.getSize()))
-               {
+               // start scanning for MagicBytes, from the byte after the
+               // one we expected them at
+               const uint64_t offset = scanFor(
+                  mas.filemap_ + pos + 1, f.filesize - pos - 1,
+                  magicBytes_.getPtr(), magicBytes_.getSize());
+               if (offset == UINT64_MAX)
+                  break;
+
+               pos += offset + 1;
+               LOGERR << "Next block header found at offset " << pos;
+               if (pos + 8 > f.filesize)
                   break;
-               }
-               
-               LOGERR << "Next block header found at offset " << uint64_t(is.tellg())-4;
             }
-            
-            is.read(reinterpret_cast<char*>(szstr.getPtr()), 4);
-            uint32_t nextBlkSize = READ_UINT32_LE(szstr.getPtr());
-            if(is.eof()) break;
 
-            is.read(reinterpret_cast<char*>(rawHead.getPtr()), HEAD_AND_NTX_SZ); // plus #tx var_int
-            blockDataCallback(rawHead, { f.fnum, blockFileOffset }, nextBlkSize);
-            
-            blockFileOffset += nextBlkSize+8;
-            is.seekg(nextBlkSize - HEAD_AND_NTX_SZ, ios::cur);
+            const uint32_t nextBlkSize = READ_UINT32_LE(mas.filemap_ + pos + 4);
+            if (pos + 8 + HEADER_SIZE > f.filesize)
+               break;
+
+            const BinaryDataRef rawHead(mas.filemap_ + pos + 8,
+               (std::min)(HEAD_AND_NTX_SZ, f.filesize - pos - 8));
+            blockDataCallback(rawHead, { f.fnum, pos }, nextBlkSize);
+
+            pos += nextBlkSize + 8;
+            blockFileOffset = pos;
          }
       }
-      
+      catch (...)
+      {
+         unmapFile(mas);
+         throw;
+      }
+
+      unmapFile(mas);
       return blockFileOffset;
    }
       
 
    BinaryData getFirstHash(const BlkFile &f) const
    {
-      ifstream is(f.path, ios::binary);
-      is.seekg(0, ios::end);
-      if(is.tellg() < 88)
+      if(f.filesize < 88)
       {
          LOGERR << "File: " << f.path << " is less than 88 bytes!";
          return {};
       }
-      is.seekg(0, ios::beg);
       
-      BinaryData magic(4), szstr(4), rawHead(HEADER_SIZE);
+      // only map the first header
+      MapAndSize mas = getMapOfFile(f.path, 88, MapAccess::Random);
       
-      is.read(magic.getCharPtr(), 4);
-      is.read(szstr.getCharPtr(), 4);
-      if(magic != magicBytes_)
+      BinaryData h(32);
+      if(memcmp(mas.filemap_, magicBytes_.getPtr(), 4) != 0)
       {
          LOGERR << "Magic bytes mismatch.  Block file is for another network!";
-         return {};
+         h.clear();
+      }
+      else
+      {
+         BtcUtils::getHash256(mas.filemap_ + 8, HEADER_SIZE, h);
       }
       
-      is.read(rawHead.getCharPtr(), HEADER_SIZE);
-      BinaryData h(32);
-      BtcUtils::getHash256(rawHead, h);
+      unmapFile(mas);
       return h;
    }
 };
@@ -589,10 +914,47 @@ private:
 //  
 
 
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t defaultScanMemoryBudget(void)
+{
+   const uint64_t minBudget = 256ULL * 1024 * 1024;
+   const uint64_t maxBudget = 16ULL * 1024 * 1024 * 1024;
+
+   uint64_t physMem = 0;
+#ifdef _MSC_VER
+   MEMORYSTATUSEX memStatus;
+   memStatus.dwLength = sizeof(memStatus);
+   if (GlobalMemoryStatusEx(&memStatus))
+      physMem = memStatus.ullTotalPhys;
+#else
+   long pageCount = sysconf(_SC_PHYS_PAGES);
+   long pageSize = sysconf(_SC_PAGE_SIZE);
+   if (pageCount > 0 && pageSize > 0)
+      physMem = (uint64_t)pageCount * (uint64_t)pageSize;
+#endif
+
+   return min(max(physMem / 4, minBudget), maxBudget);
+}
+
 BlockDataManagerConfig::BlockDataManagerConfig()
 {
    armoryDbType = ARMORY_DB_BARE;
    pruneType = DB_PRUNE_NONE;
+
+   threadCount = thread::hardware_concurrency();
+   if (threadCount == 0)
+      threadCount = 1;
+
+   rawBlockBatchCount = 500;
+   rawBlockBatchBytes = 32 * 1024 * 1024;
+
+   scanMemoryBudget = defaultScanMemoryBudget();
+
+   verifyHeaderPoW = true;
+
+   historyKeyLayout = SSH_KEYS_SCRADDR;
+   migrateHistoryKeys = false;
+   txDataCompression = TXDATA_RAW;
 }
 
 void BlockDataManagerConfig::selectNetwork(const string &netname)
@@ -611,6 +973,45 @@ void BlockDataManagerConfig::selectNetwork(const string &netname)
    }
 }
 
+void BlockDataManagerConfig::selectDbProfile(const string &profile)
+{
+   // the maps grow in small steps, start them big enough to skip most of
+   // them. Keep it modest where address space is short
+   const size_t initialMapSize = sizeof(size_t) > 4 ?
+      size_t(1024) * 1024 * 1024 : size_t(64) * 1024 * 1024;
+
+   if (profile == "Default")
+   {
+      dbTuning = LMDBTuning();
+   }
+   else if (profile == "SSD")
+   {
+      // random reads are cheap and commits are frequent, so no read ahead
+      // and straight writes to the map. Durability only at checkpoints
+      dbTuning = LMDBTuning();
+      dbTuning.mapSize = initialMapSize;
+      dbTuning.writeMap = true;
+      dbTuning.mapAsync = true;
+      dbTuning.readAhead = false;
+      dbTuning.sync = LMDB_SYNC_NONE;
+      dbTuning.checkpointAfterUpdate = true;
+   }
+   else if (profile == "HDD")
+   {
+      // seeks are what's expensive, let the OS read ahead. A flush per 
+      // commit costs little next to that and keeps the db consistent 
+      // through a crash
+      dbTuning = LMDBTuning();
+      dbTuning.mapSize = initialMapSize;
+      dbTuning.readAhead = true;
+      dbTuning.sync = LMDB_SYNC_DATA;
+   }
+   else
+   {
+      throw runtime_error("unknown db profile " + profile);
+   }
+}
+
 
 class ProgressMeasurer
 {
@@ -645,23 +1046,114 @@ public:
          avgSpeed_ = speed;
       lastSample_ = to;
 
-      avgSpeed_ = smoothingFactor*speed + (1-smoothingFactor)*avgSpeed_;
-      
-      then_ = now;
-   }
+      avgSpeed_ = smoothingFactor*speed + (1-smoothingFactor)*avgSpeed_;
+      
+      then_ = now;
+   }
+
+   double fractionCompleted() const { return lastSample_/double(total_); }
+   
+   double unitsPerSecond() const { return avgSpeed_; }
+   
+   time_t remainingSeconds() const
+   {
+      return (total_-lastSample_)/unitsPerSecond();
+   }
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Hashes headers and checks their proof of work on several threads at once. 
+// Raw headers are queued with whatever the caller needs to insert them later
+// and are handed back to the callback in the order they were added, on the
+// thread that called add() or flush().
+template<typename Extra>
+class ParallelHeaderParser
+{
+public:
+   typedef function<void(BlockHeader&, bool validPoW, Extra&)> Callback;
+
+private:
+   static const size_t BATCH_SIZE = 8192;
+
+   const unsigned nThreads_;
+   const bool verifyPoW_;
+   const Callback callback_;
+
+   vector<uint8_t> rawHeaders_;
+   vector<Extra> extras_;
+   vector<BlockHeader> headers_;
+   vector<uint8_t> validPoW_;
+
+public:
+   ParallelHeaderParser(
+      unsigned nThreads, bool verifyPoW, const Callback& callback
+   )
+      : nThreads_(max(nThreads, 1u)), verifyPoW_(verifyPoW), callback_(callback)
+   {
+      rawHeaders_.reserve(BATCH_SIZE * HEADER_SIZE);
+      extras_.reserve(BATCH_SIZE);
+   }
+
+   void add(BinaryDataRef rawHeader, Extra&& extra)
+   {
+      if (rawHeader.getSize() < HEADER_SIZE)
+         throw BlockDeserializingException();
+
+      rawHeaders_.insert(rawHeaders_.end(),
+         rawHeader.getPtr(), rawHeader.getPtr() + HEADER_SIZE);
+      extras_.push_back(move(extra));
+
+      if (extras_.size() >= BATCH_SIZE)
+         flush();
+   }
+
+   void flush()
+   {
+      const size_t count = extras_.size();
+      if (count == 0)
+         return;
+
+      headers_.resize(count);
+      validPoW_.resize(count);
+
+      const auto parseRange = [this](size_t start, size_t end)->void
+      {
+         for (size_t i = start; i < end; i++)
+         {
+            BinaryDataRef raw(&rawHeaders_[i * HEADER_SIZE], HEADER_SIZE);
+            headers_[i].unserialize(raw);
+            validPoW_[i] = !verifyPoW_ || BtcUtils::verifyProofOfWork(
+               raw, headers_[i].getThisHashRef());
+         }
+      };
+
+      // small batches aren't worth starting threads for
+      const size_t nThreads = min<size_t>(nThreads_, count / 256 + 1);
+      const size_t perThread = (count + nThreads - 1) / nThreads;
 
-   double fractionCompleted() const { return lastSample_/double(total_); }
-   
-   double unitsPerSecond() const { return avgSpeed_; }
-   
-   time_t remainingSeconds() const
-   {
-      return (total_-lastSample_)/unitsPerSecond();
+      vector<thread> workers;
+      for (size_t t = 1; t < nThreads; t++)
+      {
+         const size_t start = min(count, t * perThread);
+         const size_t end = min(count, start + perThread);
+         workers.push_back(thread(parseRange, start, end));
+      }
+      parseRange(0, min(count, perThread));
+
+      for (auto& worker : workers)
+         worker.join();
+
+      for (size_t i = 0; i < count; i++)
+         callback_(headers_[i], validPoW_[i] != 0, extras_[i]);
+
+      rawHeaders_.clear();
+      extras_.clear();
    }
 };
 
 
-
 class BlockDataManager_LevelDB::BDM_ScrAddrFilter : public ScrAddrFilter
 {
    BlockDataManager_LevelDB *const bdm_;
@@ -790,7 +1282,10 @@ void BlockDataManager_LevelDB::openDatabase()
          config_.genesisTxHash,
          config_.magicBytes,
          config_.armoryDbType,
-         config_.pruneType);
+         config_.pruneType,
+         config_.dbTuning,
+         config_.historyKeyLayout,
+         config_.txDataCompression);
    }
    catch (runtime_error &e)
    {
@@ -806,6 +1301,9 @@ void BlockDataManager_LevelDB::openDatabase()
       throw runtime_error(ss.str());
    }
 
+   if (config_.migrateHistoryKeys)
+      iface_->migrateHistoryKeys(config_.historyKeyLayout);
+
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -833,27 +1331,52 @@ pair<BlockFilePosition, vector<BlockHeader*>>
    );
    uint64_t totalOffset=0;
    
-   auto blockHeaderCallback
-      = [&] (const BinaryData &blockdata, const BlockFilePosition &pos, uint32_t blksize)
+   struct HeaderLocation
+   {
+      BlockFilePosition pos_;
+      uint32_t blockSize_;
+      uint32_t nTx_;
+   };
+
+   const auto addHeader
+      = [&] (BlockHeader& block, bool validPoW, HeaderLocation& loc)
       {
-         BlockHeader block;
-         BinaryRefReader brr(blockdata);
-         block.unserialize(brr);
-         
-         const HashString blockhash = block.getThisHash();
-         
-         const uint32_t nTx = brr.get_var_int();
-         BlockHeader& addedBlock = blockchain().addNewBlock(blockhash, block);
+         if (!validPoW)
+         {
+            LOGERR << "Block header " 
+               << block.getThisHash().copySwapEndian().toHexStr()
+               << " in file " << loc.pos_.first << " at offset " 
+               << loc.pos_.second << " fails proof of work, skipping it";
+            return;
+         }
+
+         BlockHeader& addedBlock = 
+            blockchain().addNewBlock(block.getThisHash(), block);
 
          blockHeadersAdded.push_back(&addedBlock);
          //LOGINFO << "Added block header with hash " << addedBlock.getThisHash().copySwapEndian().toHexStr()
          //   << " from " << fnum << " offset " << offset;
          
          // is there any reason I can't just do this to "block"?
-         addedBlock.setBlockFileNum(pos.first);
-         addedBlock.setBlockFileOffset(pos.second);
-         addedBlock.setNumTx(nTx);
-         addedBlock.setBlockSize(blksize);
+         addedBlock.setBlockFileNum(loc.pos_.first);
+         addedBlock.setBlockFileOffset(loc.pos_.second);
+         addedBlock.setNumTx(loc.nTx_);
+         addedBlock.setBlockSize(loc.blockSize_);
+      };
+
+   // hashing and checking the headers is done in batches across threads,
+   // they come back out in file order
+   ParallelHeaderParser<HeaderLocation> parser(
+      config_.threadCount, config_.verifyHeaderPoW, addHeader);
+
+   auto blockHeaderCallback
+      = [&] (const BinaryDataRef &blockdata, const BlockFilePosition &pos, uint32_t blksize)
+      {
+         BinaryRefReader brr(blockdata);
+         BinaryDataRef rawHeader = brr.get_BinaryDataRef(HEADER_SIZE);
+         const uint32_t nTx = brr.get_var_int();
+
+         parser.add(rawHeader, HeaderLocation{ pos, blksize, nTx });
          
          totalOffset += blksize+8;
          progfilter.advance(totalOffset);
@@ -861,6 +1384,7 @@ pair<BlockFilePosition, vector<BlockHeader*>>
    
    const BlockFilePosition position
       = readBlockHeaders_->readHeaders(fileAndOffset, blockHeaderCallback);
+   parser.flush();
    
    return { position, blockHeadersAdded };
 }
@@ -1083,6 +1607,7 @@ void BlockDataManager_LevelDB::destroyAndResetDatabases(void)
    {
       LOGWARN << "Destroying databases;  will need to be rebuilt";
       iface_->destroyAndResetDatabases();
+      remove(headerSnapshotPath().c_str());
       return;
    }
    LOGERR << "Attempted to destroy databases, but no DB interface set";
@@ -1169,14 +1694,20 @@ void BlockDataManager_LevelDB::loadDiskState(
    LOGINFO << "Total blockchain bytes: " 
       << BtcUtils::numToStrWCommas(readBlockHeaders_->totalBlockchainBytes());
       
-   // load the headers from lmdb into blockchain()
-   loadBlockHeadersFromDB(progress);
+   // load the headers into blockchain(), from the snapshot if it is 
+   // current and from lmdb otherwise
+   const BlockHeader* lastIndexedHeader = nullptr;
+   const bool fromSnapshot = loadHeaderSnapshot(lastIndexedHeader);
+   if (!fromSnapshot)
+      lastIndexedHeader = loadBlockHeadersFromDB(progress);
 
    {
       progress(BDMPhase_OrganizingChain, 0, 0, 0);
-      // organize the blockchain we have so far
+      // organize the blockchain we have so far. None of it is organized
+      // yet so this goes through every header, but the ones from the 
+      // snapshot come with their cumulative work already
       const Blockchain::ReorganizationState state
-         = blockchain().forceOrganize();
+         = blockchain().organize();
       if(!state.prevTopBlockStillValid)
       {
          LOGERR << "Organize chain indicated reorg in process all headers!";
@@ -1205,7 +1736,7 @@ void BlockDataManager_LevelDB::loadDiskState(
    // loadBlockData then updates blkDataPosition_ again
    blkDataPosition_
       = readBlockHeaders_->findFirstUnrecognizedBlockHeader(
-         blockchain()
+         blockchain(), lastIndexedHeader
       );
    LOGINFO << "Left off at file " << blkDataPosition_.first
       << ", offset " << blkDataPosition_.second;
@@ -1218,17 +1749,22 @@ void BlockDataManager_LevelDB::loadDiskState(
       
    // now load the new headers found in the blkfiles
    BlockFilePosition readHeadersUpTo;
+   bool newHeaders;
    
    {
       ProgressWithPhase prog(BDMPhase_BlockHeaders, progress);
-      readHeadersUpTo = loadBlockHeadersStartingAt(prog, blkDataPosition_).first;
+      const auto headersRead = 
+         loadBlockHeadersStartingAt(prog, blkDataPosition_);
+      readHeadersUpTo = headersRead.first;
+      newHeaders = !headersRead.second.empty();
    }
    
    try
    {
-      // This will return true unless genesis block was reorg'd...
+      // only the headers just read from the blk files need organizing,
+      // the ones from the DB were taken care of above
       progress(BDMPhase_OrganizingChain, 0, 0, 0);
-      bool prevTopBlkStillValid = blockchain_.forceOrganize().prevTopBlockStillValid;
+      bool prevTopBlkStillValid = blockchain_.organize().prevTopBlockStillValid;
       if(!prevTopBlkStillValid)
       {
          LOGERR << "Organize chain indicated reorg in process all headers!";
@@ -1254,6 +1790,10 @@ void BlockDataManager_LevelDB::loadDiskState(
    //Now we can put the new headers found in blk files.
    blockchain_.putNewBareHeaders(iface_);
 
+   // the DB has every header now, bring the snapshot up to date with it
+   if (!fromSnapshot || newHeaders)
+      writeHeaderSnapshot();
+
    /////////////////////////////////////////////////////////////////////////////
    // Now we start the meat of this process...
    
@@ -1308,6 +1848,8 @@ void BlockDataManager_LevelDB::loadDiskState(
    
    LOGINFO << "Finished loading at file " << blkDataPosition_.first
       << ", offset " << blkDataPosition_.second;
+   
+   autoCheckpoint();
       
    BDMstate_ = BDM_ready;
 }
@@ -1324,28 +1866,53 @@ void BlockDataManager_LevelDB::loadBlockData(
       readBlockHeaders_->totalBlockchainBytes()
    );
 
-   uint64_t totalOffset=0;
-   
-   const auto blockCallback
-      = [&] (const BinaryData &blockdata, const BlockFilePosition &pos, uint32_t blksize)
-      {
-         LMDBEnv::Transaction tx;
+   // parsing and hashing run on the reader threads, blocks are
+   // committed from this thread in file order
+   const auto prepareCallback = [this](PreparedBlock& block)->void
+   {
+      prepareRawBlock(block);
+   };
+
+   // blocks are grouped in write transactions of up to rawBlockBatchCount
+   // blocks or rawBlockBatchBytes bytes. If we go down mid batch, only the
+   // uncommitted blocks are lost and findFirstBlockToApply will resume
+   // from the last block that made it to the db
+   LMDBEnv::Transaction tx;
+   unsigned batchBlockCount = 0;
+   uint64_t batchByteCount = 0;
+
+   const auto blockCallback = [&](PreparedBlock& block)->void
+   {
+      if (batchBlockCount == 0)
          iface_->beginDBTransaction(&tx, BLKDATA, LMDB::ReadWrite);
 
-         BinaryRefReader brr(blockdata);
-         addRawBlockToDB(brr, updateDupID);
-         
-         totalOffset += blksize;
-         progfilter.advance(
-            readBlockHeaders_->offsetAtStartOfFile(pos.first) + pos.second
-         );
-      };
+      batchBlockCount++;
+      batchByteCount += block.blockSize_;
+      addRawBlockToDB(block, updateDupID);
+
+      if (batchBlockCount >= config_.rawBlockBatchCount ||
+          batchByteCount >= config_.rawBlockBatchBytes)
+      {
+         tx.commit();
+         batchBlockCount = 0;
+         batchByteCount = 0;
+      }
+      
+      progfilter.advance(
+         readBlockHeaders_->offsetAtStartOfFile(block.pos_.first) + 
+         block.pos_.second
+      );
+   };
    
    LOGINFO << "Loading block data... file "
       << blkDataPosition_.first << " offset " << blkDataPosition_.second;
+   // prepared blocks waiting on the writer share the scan memory budget
    blkDataPosition_ = readBlockHeaders_->readRawBlocks(
-      blkDataPosition_, stopAt, blockCallback
+      blkDataPosition_, stopAt, config_.threadCount, 
+      config_.scanMemoryBudget, prepareCallback, blockCallback
    );
+
+   tx.commit();
 }
 
 uint32_t BlockDataManager_LevelDB::readBlkFileUpdate(
@@ -1402,6 +1969,7 @@ uint32_t BlockDataManager_LevelDB::readBlkFileUpdate(
             sbh.createFromBlockHeader(*bh);
             uint8_t dup = iface_->putBareHeader(sbh, updateDupID);
             bh->setDuplicateID(dup);
+            iface_->putBlockFilePosition(*bh);
          }
          if (callbacks.headersUpdated)
             callbacks.headersUpdated();
@@ -1441,6 +2009,8 @@ uint32_t BlockDataManager_LevelDB::readBlkFileUpdate(
       LOGERR << "Error adding block data: " << e.what();
    }
    
+   autoCheckpoint();
+
    // If an orphan block is found, I won't get here and therefor
    // the orphan block will have its header read again. Then, if 
    // the header gets a height, its blkdata is also read
@@ -1448,7 +2018,9 @@ uint32_t BlockDataManager_LevelDB::readBlkFileUpdate(
    return prevTopBlk;
 }
 
-void BlockDataManager_LevelDB::loadBlockHeadersFromDB(const ProgressCallback &progress)
+const BlockHeader* BlockDataManager_LevelDB::loadBlockHeadersFromDB(
+   const ProgressCallback &progress
+)
 {
    LOGINFO << "Reading headers from db";
    blockchain().clear();
@@ -1467,18 +2039,199 @@ void BlockDataManager_LevelDB::loadBlockHeadersFromDB(const ProgressCallback &pr
    
    ProgressCalculator calc(howManyBlocks);
    
-   const auto callback= [&] (const BlockHeader &h, uint32_t height, uint8_t dup)
+   // what the DB has on each header besides the header itself
+   struct DBHeaderInfo
+   {
+      BinaryData hash_;
+      uint32_t height_;
+      uint8_t dup_;
+      uint32_t blockSize_;
+   };
+
+   const auto addHeader = [&] (BlockHeader &h, bool validPoW, DBHeaderInfo& info)
    {
-      blockchain().addBlock(h.getThisHash(), h, height, dup);
+      if (info.hash_ != h.getThisHash())
+      {
+         LOGWARN << "Corruption detected: block header hash " <<
+            info.hash_.copySwapEndian().toHexStr() << " does not match "
+            << h.getThisHash().copySwapEndian().toHexStr();
+      }
+
+      if (!validPoW)
+      {
+         LOGERR << "Block header " << h.getThisHash().copySwapEndian().toHexStr()
+            << " in DB fails proof of work, skipping it";
+         return;
+      }
+
+      h.setBlockSize(info.blockSize_);
+      blockchain().addBlock(h.getThisHash(), h, info.height_, info.dup_);
       calc.advance(counter++);
       progress(BDMPhase_DBHeaders, calc.fractionCompleted(), calc.remainingSeconds(), counter);
    };
+
+   ParallelHeaderParser<DBHeaderInfo> parser(
+      config_.threadCount, config_.verifyHeaderPoW, addHeader);
+
+   const auto callback = [&] (const StoredHeader &sbh)
+   {
+      parser.add(sbh.dataCopy_.getRef(), DBHeaderInfo{ 
+         sbh.thisHash_, sbh.blockHeight_, sbh.duplicateID_, 
+         (uint32_t)sbh.numBytes_ });
+   };
    
    iface_->readAllHeaders(callback);
+   parser.flush();
    
    LOGINFO << "Found " << blockchain().allHeaders().size() << " headers in db";
+
+   // restore the blk file positions of the headers, keeping track of 
+   // the furthest one along
+   BlockHeaderStore &allHeaders = blockchain().allHeaders();
+   BlockHeader* lastIndexed = nullptr;
+
+   const auto posCallback = [&](
+      BinaryDataRef hash, uint32_t fnum, uint64_t offset, uint32_t size)
+   {
+      BlockHeader* bh = allHeaders.find(hash);
+      if (bh == nullptr)
+         return;
+
+      bh->setBlockFileNum(fnum);
+      bh->setBlockFileOffset(offset);
+      bh->setBlockSize(size);
+
+      if (lastIndexed == nullptr || 
+          make_pair(fnum, offset) > 
+          make_pair(lastIndexed->getBlockFileNum(), lastIndexed->getOffset()))
+         lastIndexed = bh;
+   };
+
+   iface_->readAllBlockFilePositions(posCallback);
+   return lastIndexed;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+string BlockDataManager_LevelDB::headerSnapshotPath(void) const
+{
+   return config_.levelDBLocation + "/headers.snapshot";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Loads the headers from the snapshot file if there is one and the DB still
+// has its top header. The snapshot can be behind the DB, headers past it 
+// are picked up from the blk files again starting at lastIndexed.
+bool BlockDataManager_LevelDB::loadHeaderSnapshot(
+   const BlockHeader* &lastIndexed)
+{
+   const string path = headerSnapshotPath();
+   const uint64_t filesize = BtcUtils::GetFileSize(path);
+   if (filesize == FILE_DOES_NOT_EXIST || filesize == 0)
+      return false;
+
+   const BlockHeader* top = nullptr;
+   try
+   {
+      auto mas = readBlockHeaders_->getMapOfFile(path, filesize);
+      try
+      {
+         top = blockchain_.loadHeaderSnapshot(
+            BinaryDataRef(mas.filemap_, filesize));
+      }
+      catch (...)
+      {
+         readBlockHeaders_->unmapFile(mas);
+         throw;
+      }
+      readBlockHeaders_->unmapFile(mas);
+   }
+   catch (std::exception &e)
+   {
+      LOGERR << "Failed to read header snapshot: " << e.what();
+      top = nullptr;
+   }
+
+   if (top == nullptr)
+   {
+      LOGWARN << "Header snapshot is unusable, reading headers from db";
+      blockchain_.clear();
+      return false;
+   }
+
+   {
+      LMDBEnv::Transaction tx;
+      iface_->beginDBTransaction(&tx, HEADERS, LMDB::ReadOnly);
+
+      BinaryRefReader brr = iface_->getValueReader(
+         HEADERS, DB_PREFIX_HEADHASH, top->getThisHashRef());
+
+      bool current = brr.getSize() != 0;
+      if (current)
+      {
+         StoredHeader sbh;
+         sbh.unserializeDBValue(HEADERS, brr);
+         current = sbh.blockHeight_ == top->getBlockHeight() &&
+            sbh.duplicateID_ == top->getDuplicateID();
+      }
+
+      if (!current)
+      {
+         LOGWARN << "Header snapshot doesn't match the db, reading headers from db";
+         blockchain_.clear();
+         return false;
+      }
+   }
+
+   lastIndexed = nullptr;
+   for (const BlockHeader& header : blockchain_.allHeaders())
+   {
+      if (!header.hasFilePos())
+         continue;
+
+      if (lastIndexed == nullptr ||
+          make_pair(header.getBlockFileNum(), header.getOffset()) >
+          make_pair(lastIndexed->getBlockFileNum(), lastIndexed->getOffset()))
+         lastIndexed = &header;
+   }
+
+   LOGINFO << "Loaded " << blockchain_.allHeaders().size()
+      << " headers from snapshot";
+   return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void BlockDataManager_LevelDB::writeHeaderSnapshot(void)
+{
+   BinaryWriter bw;
+   blockchain_.writeHeaderSnapshot(bw);
+
+   // write it next to the old one and swap them, so a crash mid write 
+   // doesn't leave a truncated snapshot behind
+   const string path = headerSnapshotPath();
+   const string tmpPath = path + ".tmp";
+   {
+      ofstream os(OS_TranslatePath(tmpPath.c_str()), ios::out | ios::binary);
+      if (!os.is_open())
+      {
+         LOGWARN << "Could not write header snapshot to " << tmpPath;
+         return;
+      }
+
+      os.write((const char*)bw.getData().getPtr(), bw.getSize());
+      if (!os.good())
+      {
+         LOGWARN << "Could not write header snapshot to " << tmpPath;
+         os.close();
+         remove(tmpPath.c_str());
+         return;
+      }
+   }
+
+   remove(path.c_str());
+   if (rename(tmpPath.c_str(), path.c_str()) != 0)
+      LOGWARN << "Could not move header snapshot in place at " << path;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 StoredHeader BlockDataManager_LevelDB::getBlockFromDB(uint32_t hgt, uint8_t dup) const
@@ -1522,77 +2275,86 @@ void BlockDataManager_LevelDB::deleteHistories(void)
    iface_->putStoredDBInfo(iface_->getDbSelect(HISTORY), sdbi);
    //////////
 
-   bool done = false;
    uint32_t i=0;
    //can't iterate and delete at the same time with LMDB
    vector<BinaryData> keysToDelete;
 
-   while (!done)
-   {
-      bool recycle = false;
+   //SSHs, and the sub-SSHs and scrAddr ids of SSH_KEYS_SCRADDR_ID
+   const DB_PREFIX prefixes[] = 
+      { DB_PREFIX_SCRIPT, DB_PREFIX_SUBSSH, DB_PREFIX_SCRADDRID };
 
+   for (auto prefix : prefixes)
+   {
+      bool done = false;
+      while (!done)
       {
-         LDBIter ldbIter(iface_->getIterator(iface_->getDbSelect(HISTORY)));
+         bool recycle = false;
 
-         try
-         {
-            if (!ldbIter.seekToStartsWith(DB_PREFIX_SCRIPT, BinaryData(0)))
-            {
-               done = true;
-               break;
-            }
-         }
-         catch (exception &e)
          {
-            LOGERR << "iter recycling snafu";
-            LOGERR << e.what();
-            done = true;
-            break;
-         }
+            LDBIter ldbIter(iface_->getIterator(iface_->getDbSelect(HISTORY)));
 
-         do
-         {
-            if ((++i % 10000) == 0)
+            try
             {
-               recycle = true;
-               break;
+               if (!ldbIter.seekToStartsWith(prefix, BinaryData(0)))
+               {
+                  done = true;
+                  break;
+               }
             }
-
-            BinaryData key = ldbIter.getKey();
-
-            if (key.getSize() == 0)
+            catch (exception &e)
             {
+               LOGERR << "iter recycling snafu";
+               LOGERR << e.what();
                done = true;
                break;
             }
 
-            if (key[0] != (uint8_t)DB_PREFIX_SCRIPT)
+            do
             {
-               done = true;
-               break;
-            }
+               if ((++i % 10000) == 0)
+               {
+                  recycle = true;
+                  break;
+               }
 
-            keysToDelete.push_back(key);
-         } while (ldbIter.advanceAndRead(DB_PREFIX_SCRIPT));
-      }
+               BinaryData key = ldbIter.getKey();
+
+               if (key.getSize() == 0)
+               {
+                  done = true;
+                  break;
+               }
 
-      for (auto& keytodel : keysToDelete)
-         iface_->deleteValue(iface_->getDbSelect(HISTORY), keytodel);
+               if (key[0] != (uint8_t)prefix)
+               {
+                  done = true;
+                  break;
+               }
 
-      keysToDelete.clear();
+               keysToDelete.push_back(key);
+            } while (ldbIter.advanceAndRead(prefix));
+         }
 
-      if (!recycle)
-      {
-         break;
-      }
+         for (auto& keytodel : keysToDelete)
+            iface_->deleteValue(iface_->getDbSelect(HISTORY), keytodel);
 
-      tx.commit();
-      tx.begin();
+         keysToDelete.clear();
+
+         if (!recycle)
+         {
+            break;
+         }
+
+         tx.commit();
+         tx.begin();
+      }
    }
 
    for (auto& keytodel : keysToDelete)
       iface_->deleteValue(iface_->getDbSelect(HISTORY), keytodel);
 
+   iface_->resetScrAddrIds();
+
    if (i)
       LOGINFO << "Deleted " << i << " SSH and subSSH entries";
 }
@@ -1611,12 +2373,15 @@ void BlockDataManager_LevelDB::wipeHistoryAndHintDB()
       sdbi.topScannedBlkHash_ = BinaryData(0);
 
       iface_->dbs_[HISTORY].drop();
+      iface_->invalidateValueCache(HISTORY);
       iface_->putStoredDBInfo(HISTORY, sdbi);
+      iface_->resetScrAddrIds();
    }
 
    LMDBEnv::Transaction tx;
    iface_->beginDBTransaction(&tx, TXHINTS, LMDB::ReadWrite);
    iface_->dbs_[TXHINTS].drop();
+   iface_->invalidateValueCache(TXHINTS);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1658,37 +2423,59 @@ bool BlockDataManager_LevelDB::verifyBlkFileIntegrity(void)
 */
    
 ////////////////////////////////////////////////////////////////////////////////
-// We must have already added this to the header map and DB and have a dupID
-void BlockDataManager_LevelDB::addRawBlockToDB(BinaryRefReader & brr,
-   bool updateDupID)
+// Parses and hashes a raw block. This only reads config_ and the block data,
+// so it is safe to run concurrently on the blk file reader threads
+void BlockDataManager_LevelDB::prepareRawBlock(PreparedBlock& block) const
 {
-   SCOPED_TIMER("addRawBlockToDB");
-
-   //if(sbh.stxMap_.size() == 0)
-   //{
-   //LOGERR << "Cannot add raw block to DB without any transactions";
-   //return false;
-   //}
-
-   BinaryDataRef first4 = brr.get_BinaryDataRef(4);
+   BinaryRefReader brr(block.rawBlock_);
+   if (brr.getSizeRemaining() < HEADER_SIZE)
+   {
+      block.parseError_ = true;
+      return;
+   }
 
    // Skip magic bytes and block sz if exist, put ptr at beginning of header
+   BinaryDataRef first4 = brr.get_BinaryDataRef(4);
    if (first4 == config_.magicBytes)
+   {
       brr.advance(4);
+      block.rawBlock_ = brr.get_BinaryDataRef(brr.getSizeRemaining());
+   }
+
+   if (config_.armoryDbType == ARMORY_DB_SUPER)
+   {
+      try
+      {
+         block.sbh_.unserializeFullBlock(block.rawBlock_, true, false);
+      }
+      catch (BlockDeserializingException &)
+      {
+         block.parseError_ = true;
+      }
+
+      block.hash_ = block.sbh_.thisHash_;
+   }
    else
-      brr.rewind(4);
+   {
+      BtcUtils::getHash256(
+         block.rawBlock_.getPtr(), HEADER_SIZE, block.hash_);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// We must have already added this to the header map and DB and have a dupID
+void BlockDataManager_LevelDB::addRawBlockToDB(PreparedBlock& block,
+   bool updateDupID)
+{
+   SCOPED_TIMER("addRawBlockToDB");
 
    // Again, we rely on the assumption that the header has already been
    // added to the headerMap and the DB, and we have its correct height 
    // and dupID
    if (config().armoryDbType == ARMORY_DB_SUPER)
    {
-      StoredHeader sbh;
-      try
-      {
-         sbh.unserializeFullBlock(brr, true, false);
-      }
-      catch (BlockDeserializingException &)
+      StoredHeader& sbh = block.sbh_;
+      if (block.parseError_)
       {
          if (sbh.hasBlockHeader_)
          {
@@ -1738,10 +2525,13 @@ void BlockDataManager_LevelDB::addRawBlockToDB(BinaryRefReader & brr,
    }
    else
    {
-      auto getBH = [this](const BinaryData& hash)->const BlockHeader&
-      { return this->blockchain_.getHeaderByHash(hash); };
-      
-      iface_->putRawBlockData(brr, getBH);
+      if (block.parseError_)
+         throw BlockDeserializingException(
+            "Error parsing block (corrupt?) and block header invalid");
+
+      const BlockHeader& bh = blockchain_.getHeaderByHash(block.hash_);
+      BinaryRefReader brr(block.rawBlock_);
+      iface_->putRawBlockData(brr, bh);
    }
 }
 
@@ -1771,6 +2561,23 @@ void BlockDataManager_LevelDB::wipeScrAddrsSSH(const vector<BinaryData>& saVec)
    {
       LDBIter ldbIter = iface_->getIterator(iface_->getDbSelect(HISTORY));
 
+      //the sub-SSHs don't sit next to the SSH with scrAddr ids
+      if (iface_->sshKeyLayout() == SSH_KEYS_SCRADDR_ID)
+      {
+         BinaryData subKeyPrefix = iface_->getSubSSHKeyPrefix(scrAddr);
+         if (subKeyPrefix.getSize() > 0 && 
+             ldbIter.seekToStartsWith(subKeyPrefix))
+         {
+            do
+            {
+               if (!ldbIter.getKeyRef().startsWith(subKeyPrefix))
+                  break;
+
+               keysToDelete.push_back(ldbIter.getKey());
+            } while (ldbIter.advanceAndRead(DB_PREFIX_SUBSSH));
+         }
+      }
+
       if (!ldbIter.seekToStartsWith(DB_PREFIX_SCRIPT, scrAddr))
          continue;
 
@@ -1795,6 +2602,57 @@ void BlockDataManager_LevelDB::wipeScrAddrsSSH(const vector<BinaryData>& saVec)
    }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void BlockDataManager_LevelDB::checkpoint(void)
+{
+   try
+   {
+      iface_->checkpoint();
+   }
+   catch (LMDBException &e)
+   {
+      // the data is still committed, it just isn't on disk yet
+      LOGERR << "Failed to flush the db to disk: " << e.what();
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BlockDataManager_LevelDB::autoCheckpoint(void)
+{
+   // with a sync policy every commit is on disk already
+   if (config_.dbTuning.checkpointAfterUpdate &&
+       config_.dbTuning.sync == LMDB_SYNC_NONE)
+      checkpoint();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BlockDataManager_LevelDB::compactDatabases(void)
+{
+   LOGINFO << "Compacting databases";
+   
+   try
+   {
+      bool complete;
+      uint64_t reclaimed = iface_->compactDatabases(&complete);
+      LOGINFO << "Compaction reclaimed " << reclaimed << " bytes";
+
+      // a reader held on through the swap, try again on the next pass
+      if (!complete)
+         compactFlag_ = true;
+   }
+   catch (LMDBException &e)
+   {
+      LOGERR << "Failed to compact the db: " << e.what();
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BlockDataManager_LevelDB::requestCompaction(void)
+{
+   compactFlag_ = true;
+   notifyMainThread();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 vector<string> BlockDataManager_LevelDB::getNextWalletIDToScan(void)
 {
@@ -1908,13 +2766,15 @@ void BlockDataManager_LevelDB::findFirstBlockToApply(void)
 
       if (bh->hasFilePos())
       {
-         blkDataPosition_ = { bh->getBlockFileNum(), bh->getOffset() + bh->getBlockSize() };
+         blkDataPosition_ = { 
+            bh->getBlockFileNum(), bh->getOffset() + bh->getBlockSize() + 8 
+         };
          return;
       }
 
       bh = &blockchain_.getHeaderByHash(nextHash);
       
-      if (!bh->hasFilePos())
+      if (!bh->hasFilePos() && !iface_->getBlockFilePosition(*bh))
          readBlockHeaders_->getFileAndPosForBlockHash(*bh);
 
       blkDataPosition_ = { bh->getBlockFileNum(), bh->getOffset() };
@@ -139,6 +139,10 @@ private:
 
 public:
    bool                               sideScanFlag_ = false;
+   // set by requestCompaction, the BDM thread compacts the db on its 
+   // next pass. compactDatabases sets it again when a reader kept it 
+   // from swapping a file in
+   bool                               compactFlag_ = false;
    typedef function<void(BDMPhase, double,unsigned, unsigned)> ProgressCallback;
    
    class Notifier
@@ -210,7 +214,10 @@ private:
       const BlockFilePosition &stopAt,
       bool updateDupID
    );
-   void loadBlockHeadersFromDB(const ProgressCallback &progress);
+   const BlockHeader* loadBlockHeadersFromDB(const ProgressCallback &progress);
+   string headerSnapshotPath(void) const;
+   bool loadHeaderSnapshot(const BlockHeader* &lastIndexed);
+   void writeHeaderSnapshot(void);
    pair<BlockFilePosition, vector<BlockHeader*> >
       loadBlockHeadersStartingAt(
          ProgressReporter &prog,
@@ -220,10 +227,16 @@ private:
    void deleteHistories(void);
    void wipeHistoryAndHintDB(void);
 
-   void addRawBlockToDB(BinaryRefReader & brr, bool updateDupID = true);
+   struct PreparedBlock;
+   void prepareRawBlock(PreparedBlock& block) const;
+   void addRawBlockToDB(PreparedBlock& block, bool updateDupID = true);
    uint32_t findFirstBlockToScan(void);
    void findFirstBlockToApply(void);
 
+   // checkpoint after a load or update, if dbTuning.checkpointAfterUpdate
+   // asks for it
+   void autoCheckpoint(void);
+
 public:
 
    BinaryData applyBlockRangeToDB(ProgressReporter &prog, 
@@ -269,6 +282,17 @@ public:
 
    void wipeScrAddrsSSH(const vector<BinaryData>& saVec);
 
+   // flushes everything committed so far to disk. Done after the initial 
+   // load and each update when dbTuning.checkpointAfterUpdate is set, call
+   // it for extra durability points in between
+   void checkpoint(void);
+
+   // reclaims the space the db files have accumulated from rewrites and 
+   // reorgs, without taking them offline. See LMDBEnv::compact
+   void compactDatabases(void);
+   // has the BDM thread run compactDatabases, returns right away
+   void requestCompaction(void);
+
    bool isRunning(void) const { return BDMstate_ != BDM_offline; }
    bool isReady(void) const   { return BDMstate_ == BDM_ready; }
 
@@ -17,6 +17,10 @@
 #include "win32_posix.h"
 #endif
 
+const uint64_t BlockWriteBatcher::COMMIT_BYTES_MIN;
+const uint64_t BlockWriteBatcher::COMMIT_BYTES_MAX;
+const uint64_t BlockWriteBatcher::UTXO_CACHE_BYTES_MAX;
+
 ////////////////////////////////////////////////////////////////////////////////
 static void updateBlkDataHeader(
       const BlockDataManagerConfig &config,
@@ -46,25 +50,14 @@ StoredTxOut* BlockWriteBatcher::makeSureSTXOInMap(
    BinaryData hashAndId = txHash;
    hashAndId.append(WRITE_UINT16_BE(txoId));
 
-   auto stxoIter = utxoMap_.find(hashAndId);
-   if (stxoIter != utxoMap_.end())
+   auto stxo = utxoCache_.take(hashAndId);
+   if (stxo != nullptr)
    {
-      stxoToUpdate_.push_back(stxoIter->second);
-      utxoMap_.erase(stxoIter);
-
-      return stxoToUpdate_.back().get();
-   }
-
-   stxoIter = utxoMapBackup_.find(hashAndId);
-   if (stxoIter != utxoMapBackup_.end())
-   {
-      stxoToUpdate_.push_back(stxoIter->second);
-      utxoMapBackup_.erase(stxoIter);
-
+      stxoToUpdate_.push_back(move(stxo));
       return stxoToUpdate_.back().get();
    }
 
-   shared_ptr<StoredTxOut> stxo(new StoredTxOut);
+   stxo = make_shared<StoredTxOut>();
    BinaryData dbKey;
    iface->getStoredTx_byHash(txHash, nullptr, &dbKey);
    dbKey.append(WRITE_UINT16_BE(txoId));
@@ -78,35 +71,22 @@ StoredTxOut* BlockWriteBatcher::makeSureSTXOInMap(
 
 ////////////////////////////////////////////////////////////////////////////////
 void BlockWriteBatcher::moveStxoToUTXOMap(
-   const shared_ptr<StoredTxOut>& thisTxOut)
+   shared_ptr<StoredTxOut> thisTxOut)
 {
-   stxoToUpdate_.push_back(thisTxOut);
    dbUpdateSize_ += sizeof(StoredTxOut)+thisTxOut->dataCopy_.getSize();
+   utxoCache_.insert(thisTxOut->hashAndId_, *thisTxOut);
 
-   utxoMap_[thisTxOut->hashAndId_] = thisTxOut; 
+   stxoToUpdate_.push_back(move(thisTxOut));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 StoredTxOut* BlockWriteBatcher::lookForUTXOInMap(const BinaryData& txHash, 
    const uint16_t& txoId)
 {
-   auto utxoIter = utxoMap_.find(txHash);
-   if (utxoIter != utxoMap_.end())
-   {
-      stxoToUpdate_.push_back(utxoIter->second);
-
-      if (config_.armoryDbType != ARMORY_DB_SUPER)
-         utxoMap_.erase(utxoIter);
-      return stxoToUpdate_.back().get();
-   }
-
-   utxoIter = utxoMapBackup_.find(txHash);
-   if (utxoIter != utxoMapBackup_.end())
+   auto stxo = utxoCache_.take(txHash);
+   if (stxo != nullptr)
    {
-      stxoToUpdate_.push_back(utxoIter->second);
-
-      if (config_.armoryDbType != ARMORY_DB_SUPER)
-         utxoMap_.erase(utxoIter);
+      stxoToUpdate_.push_back(move(stxo));
       return stxoToUpdate_.back().get();
    }
 
@@ -159,12 +139,13 @@ StoredSubHistory& BlockWriteBatcher::makeSureSubSSHInMap(
 
       subssh.hgtX_ = hgtX;
 
-      BinaryData key(uniqKey);
-      key.append(hgtX);
-
-      BinaryRefReader brr = iface_->getValueReader(historyDB_, DB_PREFIX_SCRIPT, key);
-      if (brr.getSize() > 0)
-         subssh.unserializeDBValue(brr);
+      BinaryData key = iface_->getSubSSHKey(uniqKey, hgtX);
+      if (key.getSize() > 0)
+      {
+         BinaryRefReader brr = iface_->getValueReader(historyDB_, key);
+         if (brr.getSize() > 0)
+            subssh.unserializeDBValue(brr);
+      }
       
       dbUpdateSize_ += UPDATE_BYTES_SUBSSH;
    }
@@ -188,13 +169,13 @@ StoredSubHistory& BlockWriteBatcher::makeSureSubSSHInMap_IgnoreDB(
 
       if (fetchHeight < currentBlockHeight)
       {
-         BinaryData key(uniqKey);
-         key.append(hgtX);
-
-         BinaryRefReader brr = iface_->getValueReader(
-            historyDB_, DB_PREFIX_SCRIPT, key);
-         if (brr.getSize() > 0)
-            subssh.unserializeDBValue(brr);
+         BinaryData key = iface_->getSubSSHKey(uniqKey, hgtX);
+         if (key.getSize() > 0)
+         {
+            BinaryRefReader brr = iface_->getValueReader(historyDB_, key);
+            if (brr.getSize() > 0)
+               subssh.unserializeDBValue(brr);
+         }
       }
 
       dbUpdateSize_ += UPDATE_BYTES_SUBSSH;
@@ -247,6 +228,9 @@ BlockWriteBatcher::BlockWriteBatcher(
       historyDB_ = HISTORY;
 
    parent_ = this;
+
+   bytesInFlight_.store(0, memory_order_relaxed);
+   adaptThresholds(0);
 }
 
 BlockWriteBatcher::~BlockWriteBatcher()
@@ -287,19 +271,24 @@ BinaryData BlockWriteBatcher::applyBlockToDB(shared_ptr<PulledBlock> pb,
    sud.blockHeight_ = pb->blockHeight_;
    sud.duplicateID_ = pb->duplicateID_;
    
-   sbhToUpdate_.push_back(move(*pb));
-
+   //only the header goes to the commit, pb itself is recycled by the caller
+   sbhToUpdate_.push_back(PulledBlock());
    auto& block = sbhToUpdate_.back();
+   static_cast<DBBlock&>(block) = *pb;
+
    // Apply all the tx to the update data
-   for (auto& stx : block.stxMap_)
+   for (auto& stx : pb->txs_)
    {
-      if (stx.second.dataCopy_.getSize() == 0)
+      if (!stx.inUse_)
+         continue;
+
+      if (stx.dataCopy_.getSize() == 0)
       {
          LOGERR << "bad STX data in applyBlockToDB at height " << block.blockHeight_;
          throw std::range_error("bad STX data while applying blocks");
       }
 
-      applyTxToBatchWriteData(stx.second, &sud, scrAddrData);
+      applyTxToBatchWriteData(stx, &sud, scrAddrData);
    }
 
    // At this point we should have a list of STX and SSH with all the correct
@@ -308,7 +297,7 @@ BinaryData BlockWriteBatcher::applyBlockToDB(shared_ptr<PulledBlock> pb,
    block.blockAppliedToDB_ = true;
    dbUpdateSize_ += block.numBytes_;
 
-   if (dbUpdateSize_ > UPDATE_BYTES_THRESH)
+   if (dbUpdateSize_ > commitThreshold_)
    {
       thread committhread = commit();
       if (committhread.joinable())
@@ -448,10 +437,16 @@ void BlockWriteBatcher::undoBlockFromDB(StoredUndoData & sud,
    // to include references to them.  We need to remove them now.
    // Use int32_t index so that -1 != UINT32_MAX and we go into inf loop
    //for(int16_t itx=pb.numTx_-1; itx>=0; itx--)
-   for (auto& stx : pb.stxMap_)
+   for (auto& stx : pb.txs_)
    {
-      for (auto& stxo : values(stx.second.stxoMap_))
+      if (!stx.inUse_)
+         continue;
+
+      for (auto& stxo : stx.stxos_)
       {
+         if (stxo == nullptr)
+            continue;
+
          BinaryData    stxoKey = stxo->getDBKey(false);
    
          // Then fetch the StoredScriptHistory of the StoredTxOut scraddress
@@ -504,7 +499,7 @@ void BlockWriteBatcher::undoBlockFromDB(StoredUndoData & sud,
    
    clearTransactions();
    
-   if (dbUpdateSize_ > UPDATE_BYTES_THRESH)
+   if (dbUpdateSize_ > commitThreshold_)
    {
       thread committhread = commit();
       if (committhread.joinable())
@@ -585,9 +580,12 @@ bool BlockWriteBatcher::parseTxOuts(
 {
    bool txIsMine = false;
 
-   for (auto& stxoPair : thisSTX.stxoMap_)
+   for (uint32_t i = 0; i < thisSTX.stxos_.size(); i++)
    {
-      auto& stxoToAdd = *stxoPair.second;
+      if (thisSTX.stxos_[i] == nullptr)
+         continue;
+
+      auto& stxoToAdd = *thisSTX.stxos_[i];
       const BinaryData& uniqKey = stxoToAdd.getScrAddress();
       BinaryData hgtX = stxoToAdd.getHgtX();
 
@@ -613,7 +611,7 @@ bool BlockWriteBatcher::parseTxOuts(
       // Add reference to the next STXO to the respective SSH object
       if (config_.armoryDbType == ARMORY_DB_SUPER)
       {
-         auto& txio = thisSTX.preprocessedUTXO_[stxoPair.first];
+         auto& txio = thisSTX.preprocessedUTXO_[i];
          subssh.txioMap_[txio.getDBKeyOfOutput()] = txio;
          dbUpdateSize_ += sizeof(TxIOPair)+8;
       }
@@ -659,7 +657,8 @@ bool BlockWriteBatcher::parseTxOuts(
          }
       }
 
-      moveStxoToUTXOMap(stxoPair.second);
+      //the commit owns it from here on, the block can't reuse it
+      moveStxoToUTXOMap(move(thisSTX.stxos_[i]));
    }
 
    return txIsMine;
@@ -699,7 +698,7 @@ thread BlockWriteBatcher::commit(bool finalCommit)
       // to accumulate some more, so do a commit() anyway at the end
       // of this function. lock_ is used as a flag to indicate 
       // commitThread is running.
-      if (!finalCommit && dbUpdateSize_ < UPDATE_BYTES_THRESH * 2)
+      if (!finalCommit && dbUpdateSize_ < commitThreshold_ * 2)
          return thread();
 
       isCommiting = true;
@@ -727,19 +726,13 @@ thread BlockWriteBatcher::commit(bool finalCommit)
    bwbWriteObj->parent_ = this;
 
 
-   if (config_.armoryDbType == ARMORY_DB_SUPER && 
-       utxoMap_.size() > UTXO_THRESHOLD)
-   {
-      utxoMapBackup_.clear();
-      utxoMapBackup_ = std::move(utxoMap_);
-      haveFullUTXOList_ = false;
-   }
-
    if (isCommiting)
    {
       //the write thread is already running and we cumulated enough data in the
       //read thread for the next write. Let's use that idle time to serialize
-      //the data to commit ahead of time
+      //the data to commit ahead of time. Renew the read txn first, in case
+      //an earlier write landed since the last reset
+      resetTransactions();
       bwbWriteObj->serializeData(subSshMap_);
    }
       
@@ -748,17 +741,52 @@ thread BlockWriteBatcher::commit(bool finalCommit)
    bwbWriteObj->dbUpdateSize_ = dbUpdateSize_;
    bwbWriteObj->updateSDBI_ = updateSDBI_;
    bwbWriteObj->deleteId_ = deleteId_;
-      
+   
+   scanStats_.commitCount_++;
+   scanStats_.bytesCommitted_ += dbUpdateSize_;
    dbUpdateSize_ = 0;
 
-   l.lock();
+   if (isCommiting)
+   {
+      auto waitStart = chrono::steady_clock::now();
+      l.lock();
+      
+      chrono::duration<double> waited = chrono::steady_clock::now() - waitStart;
+      scanStats_.writeWaitSec_ += waited.count();
+   }
+   else
+      l.lock();
+
    subSshMapToWrite_ = std::move(subSshMap_);
-   commitingObject_ = bwbWriteObj;
+   atomic_store(&commitingObject_, bwbWriteObj);
 
-   if (isCommiting)
+   //the previous write thread may have landed since the scan thread last 
+   //checked resetTxn_, and its subSsh were just moved out of 
+   //subSshMapToWrite_, so renew the read txn to see them in the DB
+   if (isCommiting || resetTxn_ != 0)
       resetTransactions();
 
+   //Supernode falls back to the DB for utxo the cache doesn't have. All 
+   //writes prior to this one have landed at this point, so the oldest 
+   //generation can go.
+   if (config_.armoryDbType == ARMORY_DB_SUPER && 
+       utxoCache_.bytes() > utxoCacheBudget_)
+   {
+      utxoCache_.evictOldest();
+      haveFullUTXOList_ = false;
+   }
+
+   adaptThresholds(bwbWriteObj->dbUpdateSize_);
+
    thread committhread(writeToDB, bwbWriteObj);
+   l.unlock();
+
+   //Wait for the write thread to grab writeLock_ before returning. Otherwise 
+   //the next commit() could get the lock first, take the write thread as done
+   //and move a new subSshMap_ over the one it has yet to serialize.
+   unique_lock<mutex> startLock(bwbWriteObj->writeStartLock_);
+   while (!bwbWriteObj->writeStarted_)
+      bwbWriteObj->writeStartCV_.wait(startLock);
 
    return committhread;
 }
@@ -797,18 +825,18 @@ void BlockWriteBatcher::prepareSshToModify(const ScrAddrFilter& sasd)
       auto& ssh = (*sshToModify_)[saPair.first];
       getSshHeader(ssh, saPair.first);
 
+      BinaryData subKeyPrefix;
       if (ssh.totalTxioCount_ != 0)
-      {
-         BinaryWriter bwKey(saPair.first.getSize() + 1);
-         bwKey.put_uint8_t((uint8_t)DB_PREFIX_SCRIPT);
-         bwKey.put_BinaryData(saPair.first);
+         subKeyPrefix = iface_->getSubSSHKeyPrefix(saPair.first);
 
+      if (subKeyPrefix.getSize() != 0)
+      {
          LDBIter dbIter = iface_->getIterator(HISTORY);
 
-         dbIter.seekToExact(bwKey.getDataRef());
-         while (dbIter.getKeyRef().startsWith(bwKey.getDataRef()))
+         dbIter.seekTo(subKeyPrefix);
+         while (dbIter.getKeyRef().startsWith(subKeyPrefix))
          {
-            if (dbIter.getKeyRef().getSize()==bwKey.getSize() +4)
+            if (dbIter.getKeyRef().getSize()==subKeyPrefix.getSize() +4)
             {
                //grab subssh
                StoredSubHistory subssh;
@@ -823,23 +851,23 @@ void BlockWriteBatcher::prepareSshToModify(const ScrAddrFilter& sasd)
                      if (txio.second.isUTXO())
                      {
                         BinaryData dbKey = txio.second.getDBKeyOfOutput();
-                        shared_ptr<StoredTxOut> stxo(new StoredTxOut);
-                        iface_->getStoredTxOut(*stxo, dbKey);
+                        StoredTxOut stxo;
+                        iface_->getStoredTxOut(stxo, dbKey);
 
                         BinaryData txHash = iface_->getTxHashForLdbKey(dbKey.getSliceRef(0, 6));
 
                         BinaryWriter bwUtxoKey(34);
                         bwUtxoKey.put_BinaryData(txHash);
-                        bwUtxoKey.put_uint16_t(stxo->txOutIndex_, BE);
+                        bwUtxoKey.put_uint16_t(stxo.txOutIndex_, BE);
 
-                        utxoMap_[bwUtxoKey.getDataRef()] = stxo;
+                        utxoCache_.insert(bwUtxoKey.getData(), stxo);
                         utxoCount++;
                      }
                   }
                }
             }
                
-            dbIter.advanceAndRead(DB_PREFIX_SCRIPT);
+            dbIter.advanceAndRead((DB_PREFIX)subKeyPrefix[0]);
          }
       }
    }
@@ -851,9 +879,30 @@ void BlockWriteBatcher::writeToDB(shared_ptr<BlockWriteBatcher> bwb)
    unique_lock<mutex> lock(bwb->parent_->writeLock_);
    LMDBBlockDatabase *db = bwb->iface_;
 
+   //let commit() return now that we hold writeLock_
+   {
+      unique_lock<mutex> startLock(bwb->writeStartLock_);
+      bwb->writeStarted_ = true;
+      bwb->writeStartCV_.notify_all();
+   }
+
    bwb->dataToCommit_.serializeData(*bwb, bwb->parent_->subSshMapToWrite_);
 
+   uint64_t serializedBytes = bwb->dataToCommit_.size();
+   bwb->parent_->bytesInFlight_.fetch_add(
+      serializedBytes, memory_order_relaxed);
+
    {
+      //the put methods below nest in these, so the whole batch goes in a 
+      //single commit per env and readers never see half of it. Txhints
+      //commit first, history last, see LMDBBlockDatabase::Snapshot
+      LMDBEnv::Transaction historyTx;
+      db->beginDBTransaction(&historyTx, HISTORY, LMDB::ReadWrite);
+
+      LMDBEnv::Transaction txHintsTx;
+      if (db->armoryDbType() != ARMORY_DB_SUPER)
+         txHintsTx.open(db->dbEnv_[TXHINTS].get(), LMDB::ReadWrite);
+
       bwb->dataToCommit_.putSSH(db);
       bwb->dataToCommit_.putSTX(db);
       bwb->dataToCommit_.putSBH(db);
@@ -862,11 +911,15 @@ void BlockWriteBatcher::writeToDB(shared_ptr<BlockWriteBatcher> bwb)
 
       if (bwb->mostRecentBlockApplied_ != 0 && bwb->updateSDBI_ == true)
          bwb->dataToCommit_.updateSDBI(db);
-
-      //final commit
-      bwb->parent_->commitingObject_.reset();
    }
 
+   bwb->parent_->bytesInFlight_.fetch_sub(
+      serializedBytes, memory_order_relaxed);
+
+   //final commit
+   atomic_store(&bwb->parent_->commitingObject_, 
+      shared_ptr<BlockWriteBatcher>());
+
    BlockWriteBatcher* bwbParent = bwb->parent_;
 
    //signal the readonly transaction to reset
@@ -876,6 +929,39 @@ void BlockWriteBatcher::writeToDB(shared_ptr<BlockWriteBatcher> bwb)
    lock.unlock();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+uint64_t BlockWriteBatcher::commitThresholdFor(
+   uint64_t budget, uint64_t usedBytes)
+{
+   uint64_t bytesLeft = budget > usedBytes ? budget - usedBytes : 0;
+   return min(max(bytesLeft / 2, COMMIT_BYTES_MIN), COMMIT_BYTES_MAX);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BlockWriteBatcher::adaptThresholds(uint64_t pendingBytes)
+{
+   /***
+   Called on each commit with the size of the batch just handed over. What 
+   counts against the budget is that batch, the serialized data of the 
+   running write and, in supernode, the utxo cache. The cache gets half the 
+   budget, it is trimmed at commit time.
+   ***/
+
+   const uint64_t budget = config_.scanMemoryBudget;
+   uint64_t usedBytes = pendingBytes + 
+      bytesInFlight_.load(memory_order_relaxed);
+
+   if (config_.armoryDbType == ARMORY_DB_SUPER)
+   {
+      utxoCacheBudget_ = min(budget / 2, UTXO_CACHE_BYTES_MAX);
+      usedBytes += utxoCache_.bytes();
+   }
+   else
+      utxoCacheBudget_ = 0;
+
+   commitThreshold_ = commitThresholdFor(budget, usedBytes);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void BlockWriteBatcher::resetTransactions(void)
 {
@@ -892,108 +978,166 @@ void BlockWriteBatcher::clearTransactions(void)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void BlockWriteBatcher::grabBlocksFromDB(shared_ptr<LoadedBlockData> blockData,
-   LMDBBlockDatabase* db)
+bool BlockWriteBatcher::LoadedBlockData::pushBlock(uint32_t hgt, 
+   shared_ptr<PulledBlock> pb)
 {
-   /***
-   Grab blocks from the DB, put each block in the current block's nextBlock_
-   ***/
+   unique_lock<mutex> lock(lock_);
+
+   //the block the scan thread is waiting on always gets in, otherwise wait 
+   //for the buffer to drain
+   while (!interrupted_ && hgt != nextToScan_ &&
+      bufferLoad_ >= bufferCap_)
+      grabCV_.wait(lock);
+
+   if (interrupted_)
+      return false;
 
-   //TIMER_START("grabBlocksFromDB");
+   if (pb != nullptr)
+      bufferLoad_ += pb->numBytes_;
 
-   uint32_t hgt = blockData->topLoadedBlock_;
+   loadedBlocks_[hgt] = pb;
 
-   //find last block
-   shared_ptr<PulledBlock> *lastBlock = &blockData->block_;
-   unique_lock<mutex> grabLock(blockData->grabLock_);
+   if (hgt == nextToScan_)
+      scanCV_.notify_all();
+
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+shared_ptr<PulledBlock> BlockWriteBatcher::LoadedBlockData::popBlock(void)
+{
+   unique_lock<mutex> lock(lock_);
 
    while (1)
    {
-      //create read only db txn within main loop, so that it is rewed
-      //after each sleep period
-      LMDBEnv::Transaction tx(db->dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
-      LDBIter ldbIter = db->getIterator(BLKDATA);
+      if (interrupted_)
+         return nullptr;
+
+      auto blockIter = loadedBlocks_.begin();
+      if (blockIter != loadedBlocks_.end() && blockIter->first == nextToScan_)
+         break;
+
+      scanCV_.wait(lock);
+   }
 
-      uint8_t dupID = db->getValidDupIDForHeight(hgt);
-      if (!ldbIter.seekToExact(DBUtils::getBlkDataKey(hgt, dupID)))
+   auto blockIter = loadedBlocks_.begin();
+   auto pb = blockIter->second;
+   loadedBlocks_.erase(blockIter);
+   
+   if (pb != nullptr)
+      bufferLoad_ -= pb->numBytes_;
+   ++nextToScan_;
+
+   grabCV_.notify_all();
+   return pb;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BlockWriteBatcher::LoadedBlockData::interrupt(void)
+{
+   unique_lock<mutex> lock(lock_);
+   interrupted_ = true;
+
+   grabCV_.notify_all();
+   scanCV_.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+shared_ptr<PulledBlock> PulledBlockPool::get(void)
+{
+   shared_ptr<PulledBlock> pb;
+
+   {
+      unique_lock<mutex> lock(lock_);
+      if (pool_.size() > 0)
       {
-         unique_lock<mutex> assignLock(blockData->assignLock_);
-         *lastBlock = blockData->interruptBlock_;
-         LOGERR << "Header heigh&dup is not in BLKDATA DB";
-         LOGERR << "(" << hgt << ", " << dupID << ")";
-         return;
+         pb = move(pool_.back());
+         pool_.pop_back();
       }
+   }
+
+   if (pb == nullptr)
+      return make_shared<PulledBlock>();
+
+   //clearing here keeps the work off the scan thread
+   pb->clear();
+   return pb;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void PulledBlockPool::recycle(shared_ptr<PulledBlock> pb)
+{
+   if (pb == nullptr || pb.use_count() > 1)
+      return;
+
+   unique_lock<mutex> lock(lock_);
+   if (pool_.size() < maxPooled_)
+      pool_.push_back(move(pb));
+}
 
-      while (blockData->bufferLoad_.load(memory_order_acquire)
-         < UPDATE_BYTES_THRESH)
+////////////////////////////////////////////////////////////////////////////////
+size_t PulledBlockPool::size(void) const
+{
+   unique_lock<mutex> lock(lock_);
+   return pool_.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BlockWriteBatcher::grabBlocksFromDB(shared_ptr<LoadedBlockData> blockData,
+   LMDBBlockDatabase* db)
+{
+   /***
+   Loader thread. Claim the next height, pull the block in a read only txn of
+   its own (this deserializes the block and preprocesses its tx) and hand it 
+   to the scan thread. Several of these run concurrently.
+   ***/
+
+   while (1)
+   {
+      uint32_t hgt = blockData->nextToLoad_.fetch_add(1, memory_order_relaxed);
+      if (hgt > blockData->endBlock_)
+         return;
+
+      shared_ptr<PulledBlock> pb = blockData->pool_.get();
+
+      try
       {
-         if (hgt > blockData->endBlock_)
-            return;
+         LMDBEnv::Transaction tx(db->dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
+         LDBIter ldbIter = db->getIterator(BLKDATA);
 
          uint8_t dupID = db->getValidDupIDForHeight(hgt);
          if (dupID == UINT8_MAX)
          {
-            unique_lock<mutex> assignLock(blockData->assignLock_);
-            *lastBlock = blockData->interruptBlock_;
             LOGERR << "No block in DB at height " << hgt;
-            return;
+            pb.reset();
          }
-
-         //make sure iterator is at the right position
-         auto expected = DBUtils::heightAndDupToHgtx(hgt, dupID);
-         auto key = ldbIter.getKeyRef().getSliceRef(1, 4);
-         if (key != expected)
+         else if (!ldbIter.seekToExact(DBUtils::getBlkDataKey(hgt, dupID)))
          {
-            //in case the iterator is not at the right key, set it
-            if (!ldbIter.seekToExact(DBUtils::getBlkDataKey(hgt, dupID)))
-            {
-               unique_lock<mutex> assignLock(blockData->assignLock_);
-               *lastBlock = blockData->interruptBlock_;
-               LOGERR << "Header heigh&dup is not in BLKDATA DB";
-               LOGERR << "(" << hgt << ", " << dupID << ")";
-               return;
-            }
+            LOGERR << "Header heigh&dup is not in BLKDATA DB";
+            LOGERR << "(" << hgt << ", " << dupID << ")";
+            pb.reset();
          }
-
-         shared_ptr<PulledBlock> pb(new PulledBlock());
-         if (!pullBlockAtIter(*pb, ldbIter, db))
+         else if (!pullBlockAtIter(*pb, ldbIter, db))
          {
-            unique_lock<mutex> assignLock(blockData->assignLock_);
-            *lastBlock = blockData->interruptBlock_;
             LOGERR << "No block in DB at height " << hgt;
-            return;
+            pb.reset();
          }
-
-         //increment bufferLoad
-         blockData->bufferLoad_.fetch_add(
-            pb->numBytes_, memory_order_release);
-
-         //assign newly grabbed block to shared_ptr
-         {
-            unique_lock<mutex> assignLock(blockData->assignLock_);
-            *lastBlock = pb;
-
-            //let's try to wake up the scan thread
-            unique_lock<mutex> mu(blockData->scanLock_, defer_lock);
-            if (mu.try_lock())
-               blockData->scanCV_.notify_all();
-         }
-
-         //set shared_ptr to next empty block
-         lastBlock = &pb->nextBlock_;
-
-         blockData->topLoadedBlock_ = hgt;
-         ++hgt;
+      }
+      catch (exception &e)
+      {
+         LOGERR << "Failed to load block at height " << hgt << ": " << e.what();
+         pb.reset();
+      }
+      catch (...)
+      {
+         LOGERR << "Failed to load block at height " << hgt;
+         pb.reset();
       }
 
-      if (hgt > blockData->endBlock_)
+      //a null block stops the scan thread at this height
+      if (!blockData->pushBlock(hgt, pb) || pb == nullptr)
          return;
-
-      //sleep 10sec or until process thread signals block buffer is low
-      blockData->grabCV_.wait_for(grabLock, chrono::seconds(10));
    }
-
-   //TIMER_STOP("grabBlocksFromDB");
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1009,35 +1153,37 @@ BinaryData BlockWriteBatcher::applyBlocksToDB(ProgressFilter &progress,
    BinaryData lastScannedBlockHash;
    resetTransactions();
 
-   try
-   {
-      shared_ptr<PulledBlock> block;
-      thread grabThread(grabBlocksFromDB, blockData, iface_);
-      grabThread.detach();
+   LOGINFO << "Scanning blocks " << blockData->startBlock_ << " to " 
+      << blockData->endBlock_ << ", memory budget: " 
+      << config_.scanMemoryBudget << " bytes, commit threshold: " 
+      << commitThreshold_ << " bytes";
 
-      uint64_t totalBlockDataProcessed=0;
-      unique_lock<mutex> scanLock(blockData->scanLock_);
+   auto scanStart = chrono::steady_clock::now();
+   scanStats_ = ScanStats();
+   scanStats_.valueCacheStart_ = iface_->getValueCacheStats();
+   blockData->bufferCap_ = commitThreshold_;
 
-      //wait until the shared_ptr has been assigned some data
-      while (1)
-      {
-         unique_lock<mutex> assignLock(blockData->assignLock_);
-         block = blockData->block_;
-         if (block != nullptr)
-            break;
-      }
+   unsigned loaderCount = config_.threadCount;
+   if (loaderCount == 0)
+      loaderCount = 1;
 
-      if (block == blockData->interruptBlock_)
+   vector<thread> loaders;
+   for (unsigned i = 0; i < loaderCount; i++)
+      loaders.push_back(thread(grabBlocksFromDB, blockData, iface_));
+
+   auto stopLoaders = [&blockData, &loaders](void)->void
+   {
+      blockData->interrupt();
+      for (auto& loader : loaders)
       {
-         string errorMessage("The scanning process "
-            "interrupted unexpectedly, Armory will now shutdown. "
-            "You will have to proceed to \"Help -> Rebuild and Rescan\" "
-            "on the next start. If the error persists, contact support. "
-            "Refer to your log file for more details on the error.");
-
-         criticalError_(errorMessage);
-         return lastScannedBlockHash;
+         if (loader.joinable())
+            loader.join();
       }
+   };
+
+   try
+   {
+      uint64_t totalBlockDataProcessed=0;
 
       for (uint32_t i = blockData->startBlock_;
          i <= blockData->endBlock_;
@@ -1050,54 +1196,12 @@ BinaryData BlockWriteBatcher::applyBlocksToDB(ProgressFilter &progress,
             clearSubSshMap(id);
          }
 
-         if (i > blockData->endBlock_)
-            break;
-         
-         uint32_t blockSize = block->numBytes_;
-
-         //decrement bufferload
-         blockData->bufferLoad_.fetch_sub(
-            blockSize, memory_order_release);
-
-         //scan block
-         lastScannedBlockHash = 
-            applyBlockToDB(block, blockData->scrAddrFilter_);
-
-         if (i == blockData->endBlock_)
-            break;
-
-         if (blockData->bufferLoad_.load(memory_order_consume)
-            < UPDATE_BYTES_THRESH / 2)
+         //wait until the next block in line is loaded
+         shared_ptr<PulledBlock> block = blockData->popBlock();
+         if (block == nullptr)
          {
-            /***
-            Buffer is running low. Try to take ownership of the blockData
-            mutex. If that succeeds, the grab thread is sleeping, so 
-            signal it to wake. Otherwise the grab thread is already running 
-            and is lagging behind the processing thread (very unlikely)
-            ***/
-            unique_lock<mutex> lock(blockData->grabLock_, defer_lock);
-            if(lock.try_lock())
-               blockData->grabCV_.notify_all();
-         }
+            stopLoaders();
 
-         //wait until next block is available
-         while (1)
-         {
-            {
-               unique_lock<mutex> assignLock(blockData->assignLock_);
-               block = blockData->block_->nextBlock_;
-            }
-
-            if (block != nullptr)
-               break;
-            
-            //wait for grabThread signal
-            blockData->scanCV_.wait_for(scanLock, chrono::seconds(2));
-         }
-
-         //check if next block is valid
-         if (block == blockData->interruptBlock_)
-         {
             string errorMessage("The scanning process "
                "interrupted unexpectedly, Armory will now shutdown. "
                "You will have to proceed to \"Help -> Rebuild and Rescan\" "
@@ -1105,13 +1209,16 @@ BinaryData BlockWriteBatcher::applyBlocksToDB(ProgressFilter &progress,
                "Refer to your log file for more details on the error.");
 
             criticalError_(errorMessage);
-
             return lastScannedBlockHash;
          }
 
-         //assign next block to current
-         blockData->block_ = block;
- 
+         uint32_t blockSize = block->numBytes_;
+
+         //scan block
+         lastScannedBlockHash = 
+            applyBlockToDB(block, blockData->scrAddrFilter_);
+         blockData->pool_.recycle(move(block));
+
          if (i % 2500 == 2499)
             LOGWARN << "Finished applying blocks up to " << (i + 1);
 
@@ -1119,10 +1226,31 @@ BinaryData BlockWriteBatcher::applyBlocksToDB(ProgressFilter &progress,
          progress.advance(totalBlockDataProcessed);
       }
       
+      stopLoaders();
       clearTransactions();
+
+      chrono::duration<double> scanTime = 
+         chrono::steady_clock::now() - scanStart;
+      
+      LOGINFO << "Scanned " << totalBlockDataProcessed << " bytes of blocks in "
+         << scanTime.count() << "s, " << scanStats_.commitCount_ 
+         << " commits of " 
+         << (scanStats_.commitCount_ ? 
+            scanStats_.bytesCommitted_ / scanStats_.commitCount_ : 0)
+         << " bytes on average, " << scanStats_.writeWaitSec_ 
+         << "s waiting on writes, commit threshold now " << commitThreshold_
+         << " bytes, utxo cache " << utxoCache_.bytes() << " bytes";
+
+      const DBValueCache::Stats cacheStats = iface_->getValueCacheStats();
+      LOGINFO << "Value cache: " 
+         << cacheStats.hits_ - scanStats_.valueCacheStart_.hits_ << " hits, "
+         << cacheStats.misses_ - scanStats_.valueCacheStart_.misses_ 
+         << " misses during the scan, " << cacheStats.entries_ 
+         << " entries holding " << cacheStats.bytes_ << " bytes";
    }
    catch (...)
    {
+      stopLoaders();
       clearTransactions();
       throw;
    }
@@ -1149,8 +1277,11 @@ BinaryData BlockWriteBatcher::scanBlocks(
    
    prepareSshToModify(scf);
 
+   //a few spare blocks per loader is enough to keep them from allocating
+   size_t maxPooled = max(config_.threadCount, 1U) * 4;
+
    shared_ptr<LoadedBlockData> tempBlockData = 
-      make_shared<LoadedBlockData>(startBlock, endBlock, scf);
+      make_shared<LoadedBlockData>(startBlock, endBlock, scf, maxPooled);
 
    return applyBlocksToDB(prog, tempBlockData);
 }
@@ -1191,15 +1322,20 @@ map<BinaryData, StoredScriptHistory>& BlockWriteBatcher::getSSHMap(
    const map<BinaryData, map<BinaryData, StoredSubHistory> >& subsshMap)
 {
    {
-      shared_ptr<BlockWriteBatcher> commitingObj = parent_->commitingObject_;
+      shared_ptr<BlockWriteBatcher> commitingObj = 
+         atomic_load(&parent_->commitingObject_);
       if (commitingObj != nullptr)
       {
          if (&commitingObj->dataToCommit_ != &dataToCommit_)
          {
+            //this batch builds on the ssh of the one being written, wait 
+            //for the write thread to be done with them
+            auto& commitingData = commitingObj->dataToCommit_;
+            unique_lock<mutex> lock(commitingData.lock_);
+            while (!commitingData.sshReady_)
+               commitingData.sshReadyCV_.wait(lock);
+
             sshToModify_ = commitingObj->sshToModify_;
-            
-            if(!commitingObj->dataToCommit_.sshReady_)
-               unique_lock<mutex> lock(commitingObj->dataToCommit_.lock_);
          }
       }
       else parent_->resetTransactions();
@@ -1224,81 +1360,390 @@ map<BinaryData, StoredScriptHistory>& BlockWriteBatcher::getSSHMap(
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+/// UtxoCache
+////////////////////////////////////////////////////////////////////////////////
+size_t UtxoCache::hashKey(const uint8_t* key)
+{
+   //the key starts with a tx hash, that's as good as it gets, just fold the 
+   //txout index in
+   size_t hashVal;
+   memcpy(&hashVal, key, sizeof(size_t));
+   
+   return hashVal ^ 
+      ((size_t)READ_UINT16_BE(key + 32) * (size_t)0x9E3779B97F4A7C15ULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+UtxoCache::Entry* UtxoCache::Generation::find(const uint8_t* key)
+{
+   if (count_ == 0)
+      return nullptr;
+
+   const size_t mask = slots_.size() - 1;
+   size_t pos = hashKey(key) & mask;
+
+   while (1)
+   {
+      Entry& entry = slots_[pos];
+      if (entry.state_ == SLOT_EMPTY)
+         return nullptr;
+
+      if (entry.state_ == SLOT_USED && 
+          memcmp(entry.key_, key, KEY_SIZE) == 0)
+         return &entry;
+
+      pos = (pos + 1) & mask;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+UtxoCache::Entry& UtxoCache::Generation::slotFor(const uint8_t* key)
+{
+   //keep the table under 70% filled, erased slots included
+   if ((filled_ + 1) * 10 > slots_.size() * 7)
+   {
+      size_t slotCount = slots_.size() ? slots_.size() : 64;
+      while ((count_ + 1) * 10 > slotCount * 5)
+         slotCount *= 2;
+
+      rehash(slotCount);
+   }
+
+   const size_t mask = slots_.size() - 1;
+   size_t pos = hashKey(key) & mask;
+   Entry* erased = nullptr;
+
+   while (1)
+   {
+      Entry& entry = slots_[pos];
+      if (entry.state_ == SLOT_EMPTY)
+         break;
+
+      if (entry.state_ == SLOT_USED)
+      {
+         if (memcmp(entry.key_, key, KEY_SIZE) == 0)
+            return entry;
+      }
+      else if (erased == nullptr)
+         erased = &entry;
+
+      pos = (pos + 1) & mask;
+   }
+
+   Entry& entry = erased != nullptr ? *erased : slots_[pos];
+   if (erased == nullptr)
+      ++filled_;
+   ++count_;
+
+   memcpy(entry.key_, key, KEY_SIZE);
+   entry.state_ = SLOT_USED;
+   return entry;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void UtxoCache::Generation::rehash(size_t slotCount)
+{
+   //rebuilding the table is also when the arena sheds the bytes of erased 
+   //entries
+   vector<Entry> oldSlots(slotCount);
+   oldSlots.swap(slots_);
+
+   vector<uint8_t> oldArena;
+   oldArena.swap(arena_);
+   arena_.reserve(oldArena.size());
+
+   const size_t mask = slots_.size() - 1;
+   for (auto& oldEntry : oldSlots)
+   {
+      if (oldEntry.state_ != SLOT_USED)
+         continue;
+
+      size_t pos = hashKey(oldEntry.key_) & mask;
+      while (slots_[pos].state_ != SLOT_EMPTY)
+         pos = (pos + 1) & mask;
+
+      Entry& entry = slots_[pos];
+      entry = oldEntry;
+      entry.offset_ = arena_.size();
+
+      auto dataPtr = &oldArena[oldEntry.offset_];
+      arena_.insert(arena_.end(), 
+         dataPtr, dataPtr + oldEntry.txOutSize_ + oldEntry.scrAddrSize_);
+   }
+
+   filled_ = count_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void UtxoCache::Generation::clear(void)
+{
+   vector<Entry>().swap(slots_);
+   vector<uint8_t>().swap(arena_);
+
+   count_ = 0;
+   filled_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void UtxoCache::insert(const BinaryData& hashAndId, const StoredTxOut& stxo)
+{
+   if (hashAndId.getSize() != KEY_SIZE)
+   {
+      LOGERR << "invalid utxo key size: " << hashAndId.getSize();
+      return;
+   }
+
+   //a fresh copy lives in the current generation only
+   auto previousEntry = previous_.find(hashAndId.getPtr());
+   if (previousEntry != nullptr)
+   {
+      previousEntry->state_ = SLOT_ERASED;
+      --previous_.count_;
+   }
+
+   const BinaryData& scrAddr = stxo.getScrAddress();
+   BinaryData dbKey = stxo.getDBKey(false);
+
+   Entry& entry = current_.slotFor(hashAndId.getPtr());
+   memcpy(entry.dbKey_, dbKey.getPtr(), 8);
+   entry.txVersion_ = (uint8_t)stxo.txVersion_;
+   entry.isCoinbase_ = stxo.isCoinbase_;
+   entry.scrAddrSize_ = (uint8_t)scrAddr.getSize();
+   entry.txOutSize_ = stxo.dataCopy_.getSize();
+   entry.offset_ = current_.arena_.size();
+
+   auto& arena = current_.arena_;
+   arena.insert(arena.end(), 
+      stxo.dataCopy_.getPtr(), stxo.dataCopy_.getPtr() + entry.txOutSize_);
+   arena.insert(arena.end(), 
+      scrAddr.getPtr(), scrAddr.getPtr() + entry.scrAddrSize_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+shared_ptr<StoredTxOut> UtxoCache::take(const BinaryData& hashAndId)
+{
+   if (hashAndId.getSize() != KEY_SIZE)
+      return nullptr;
+
+   Generation* gen = &current_;
+   Entry* entry = current_.find(hashAndId.getPtr());
+   if (entry == nullptr)
+   {
+      gen = &previous_;
+      entry = previous_.find(hashAndId.getPtr());
+      if (entry == nullptr)
+         return nullptr;
+   }
+
+   shared_ptr<StoredTxOut> stxo(new StoredTxOut);
+   const uint8_t* dataPtr = &gen->arena_[entry->offset_];
+   
+   stxo->dataCopy_ = BinaryData(dataPtr, entry->txOutSize_);
+   stxo->scrAddr_ = BinaryData(
+      dataPtr + entry->txOutSize_, entry->scrAddrSize_);
+   stxo->unserializeDBKey(BinaryDataRef(entry->dbKey_, 8));
+   stxo->txVersion_ = entry->txVersion_;
+   stxo->isCoinbase_ = entry->isCoinbase_ != 0;
+   stxo->spentness_ = TXOUT_UNSPENT;
+   stxo->parentHash_ = hashAndId.getSliceCopy(0, 32);
+   stxo->hashAndId_ = hashAndId;
+
+   entry->state_ = SLOT_ERASED;
+   --gen->count_;
+
+   return stxo;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void UtxoCache::evictOldest(void)
+{
+   previous_.clear();
+   swap(previous_, current_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void UtxoCache::clear(void)
+{
+   current_.clear();
+   previous_.clear();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// DataToCommit
+////////////////////////////////////////////////////////////////////////////////
+//count + 1 bounds cutting [begin, end) in count contiguous ranges, each 
+//with its position from begin
+template <typename Iter>
+static vector<pair<Iter, size_t>> splitRange(Iter begin, Iter end, 
+   size_t size, unsigned count)
+{
+   vector<pair<Iter, size_t>> bounds;
+   bounds.push_back(make_pair(begin, 0));
+
+   for (unsigned i = 1; i < count; i++)
+   {
+      auto next = bounds.back();
+      advance(next.first, size / count);
+      next.second += size / count;
+      bounds.push_back(next);
+   }
+
+   bounds.push_back(make_pair(end, size));
+   return bounds;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+unsigned DataToCommit::partitionCount(const BlockWriteBatcher& bwb,
+   size_t entryCount)
+{
+   size_t count = entryCount / SERIALIZE_PARTITION_MIN;
+   count = min(count, (size_t)max(bwb.config_.threadCount, 1U));
+
+   return (unsigned)max(count, (size_t)1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DataToCommit::runPartitions(unsigned count,
+   const function<void(unsigned)>& work)
+{
+   //the calling thread takes the first partition
+   vector<thread> workers;
+   for (unsigned i = 1; i < count; i++)
+      workers.push_back(thread(work, i));
+
+   auto joinWorkers = [&workers](void)->void
+   {
+      for (auto& worker : workers)
+      {
+         if (worker.joinable())
+            worker.join();
+      }
+   };
+
+   try
+   {
+      work(0);
+   }
+   catch (...)
+   {
+      joinWorkers();
+      throw;
+   }
+
+   joinWorkers();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DataToCommit::mergePartitions(vector<SerializedPartition>& parts,
+   map<BinaryData, BinaryWriter>& serialized,
+   set<BinaryData>& keysToDelete)
+{
+   for (auto& part : parts)
+   {
+      //contiguous partitions come in key order and the hint makes these 
+      //appends. Hashed buckets interleave, their entries get a lookup
+      for (auto& dataPair : part.serialized_)
+         serialized.insert(serialized.end(), move(dataPair));
+
+      keysToDelete.insert(
+         part.keysToDelete_.begin(), part.keysToDelete_.end());
+   }
+
+   parts.clear();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 set<BinaryData> DataToCommit::serializeSSH(BlockWriteBatcher& bwb,
    const map<BinaryData, map<BinaryData, StoredSubHistory> >& subsshMap)
 {
-   set<BinaryData> keysToDelete;
-
    auto dbType = bwb.config_.armoryDbType;
    auto pruneType = bwb.config_.pruneType;
 
    auto& sshMap = bwb.getSSHMap(subsshMap);
-   
-   for (auto& sshPair : sshMap)
+
+   //each thread gets a contiguous range of scrAddrs, the ssh objects are 
+   //only touched by the thread that owns their range
+   unsigned count = partitionCount(bwb, sshMap.size());
+   auto bounds = splitRange(sshMap.begin(), sshMap.end(), sshMap.size(), count);
+   vector<SerializedPartition> parts(count);
+
+   auto serializeRange = [&](unsigned id)->void
    {
-      BinaryData sshKey;
-      sshKey.append(WRITE_UINT8_LE(DB_PREFIX_SCRIPT));
-      sshKey.append(sshPair.first);
-      
-      auto& ssh = sshPair.second;
-      auto subsshIter = subsshMap.find(sshPair.first);
+      auto& keysToDelete = parts[id].keysToDelete_;
+      auto& serialized = parts[id].serialized_;
 
-      if (subsshIter != subsshMap.end())
+      for (auto sshIter = bounds[id].first; sshIter != bounds[id + 1].first;
+         ++sshIter)
       {
-         for (auto& subsshPair : subsshIter->second)
+         auto& sshPair = *sshIter;
+         BinaryData sshKey;
+         sshKey.append(WRITE_UINT8_LE(DB_PREFIX_SCRIPT));
+         sshKey.append(sshPair.first);
+      
+         auto& ssh = sshPair.second;
+         auto subsshIter = subsshMap.find(sshPair.first);
+
+         if (subsshIter != subsshMap.end())
          {
-            auto& subssh = subsshPair.second;
-            uint32_t extraTxioCount = 0;
-            uint32_t subsshHeight = DBUtils::hgtxToHeight(subsshPair.first);
-            if (subsshHeight > ssh.alreadyScannedUpToBlk_ ||
-               !ssh.alreadyScannedUpToBlk_ ||
-               subsshHeight > forceUpdateSshAtHeight_)
+            for (auto& subsshPair : subsshIter->second)
             {
-               for (const auto& txioPair : subssh.txioMap_)
+               auto& subssh = subsshPair.second;
+               uint32_t extraTxioCount = 0;
+               uint32_t subsshHeight = DBUtils::hgtxToHeight(subsshPair.first);
+               if (subsshHeight > ssh.alreadyScannedUpToBlk_ ||
+                  !ssh.alreadyScannedUpToBlk_ ||
+                  subsshHeight > forceUpdateSshAtHeight_)
                {
-                  auto& txio = txioPair.second;
-                     
-                  if (!txio.hasTxIn())
-                  {
-                     if (!txio.isMultisig())
-                        ssh.totalUnspent_ += txio.getValue();
-                  }
-                  else
+                  for (const auto& txioPair : subssh.txioMap_)
                   {
-                     if (!txio.flagged)
-                        ssh.totalUnspent_ -= txio.getValue();
+                     auto& txio = txioPair.second;
+                     
+                     if (!txio.hasTxIn())
+                     {
+                        if (!txio.isMultisig())
+                           ssh.totalUnspent_ += txio.getValue();
+                     }
                      else
-                        extraTxioCount++;
+                     {
+                        if (!txio.flagged)
+                           ssh.totalUnspent_ -= txio.getValue();
+                        else
+                           extraTxioCount++;
+                     }
                   }
+
+                  ssh.totalTxioCount_ += 
+                     subssh.txioMap_.size() + extraTxioCount;
                }
+            }
 
-               ssh.totalTxioCount_ += subssh.txioMap_.size() + extraTxioCount;
+            if (bwb.config_.armoryDbType == ARMORY_DB_SUPER)
+            {
+               if (ssh.totalTxioCount_ > 0)
+               {
+                  ssh.alreadyScannedUpToBlk_ = bwb.mostRecentBlockApplied_;
+                  BinaryWriter& bw = serialized[sshKey];
+                  ssh.serializeDBValue(bw, dbType, pruneType);
+               }
+               else
+                  keysToDelete.insert(sshKey);
             }
          }
 
-         if (bwb.config_.armoryDbType == ARMORY_DB_SUPER)
+         if (bwb.config_.armoryDbType != ARMORY_DB_SUPER)
          {
-            if (ssh.totalTxioCount_ > 0)
-            {
-               ssh.alreadyScannedUpToBlk_ = bwb.mostRecentBlockApplied_;
-               BinaryWriter& bw = serializedSshToModify_[sshKey];
-               ssh.serializeDBValue(bw, dbType, pruneType);
-            }
-            else
-               keysToDelete.insert(sshKey);
+            ssh.alreadyScannedUpToBlk_ = bwb.mostRecentBlockApplied_;
+            BinaryWriter& bw = serialized[sshKey];
+            ssh.serializeDBValue(bw, dbType, pruneType);
          }
       }
+   };
 
-      if (bwb.config_.armoryDbType != ARMORY_DB_SUPER)
-      {
-         ssh.alreadyScannedUpToBlk_ = bwb.mostRecentBlockApplied_;
-         BinaryWriter& bw = serializedSshToModify_[sshKey];
-         ssh.serializeDBValue(bw, dbType, pruneType);
-      }
-   }
+   runPartitions(count, serializeRange);
+
+   set<BinaryData> keysToDelete;
+   mergePartitions(parts, serializedSshToModify_, keysToDelete);
 
    sshReady_ = true;
 
@@ -1313,33 +1758,106 @@ void DataToCommit::serializeDataToCommit(BlockWriteBatcher& bwb,
 
    //subssh
    {
+      //New scrAddrs get their id here, putSSH writes them. Ids are handed 
+      //out in key order ahead of the serializer threads so they don't depend 
+      //on scheduling. Empty subs only get a key if the scrAddr had an id.
+      vector<pair<BinaryData, BinaryData>> keyPrefixes;
+      keyPrefixes.reserve(subsshMap.size());
+
       for (auto& sshPair : subsshMap)
       {
-         BinaryData sshKey;
-         sshKey.append(WRITE_UINT8_LE(DB_PREFIX_SCRIPT));
-         sshKey.append(sshPair.first);
+         BinaryData prefix = bwb.iface_->getSubSSHKeyPrefix(sshPair.first);
+         BinaryData newPrefix = prefix;
 
-         for (const auto& subsshPair : sshPair.second)
+         if (prefix.getSize() == 0)
          {
-            auto& subssh = subsshPair.second;
-
-            BinaryData subsshKey = sshKey + subssh.hgtX_;
-            if (subssh.txioMap_.size() != 0)
+            for (const auto& subsshPair : sshPair.second)
             {
-               BinaryWriter& bw = serializedSubSshToApply_[subsshKey];
-               subssh.serializeDBValue(bw, bwb.iface_, dbType, pruneType);
+               if (subsshPair.second.txioMap_.size() != 0)
+               {
+                  newPrefix = 
+                     bwb.iface_->getSubSSHKeyPrefix(sshPair.first, true);
+                  break;
+               }
             }
-            else
-               keysToDelete_.insert(subsshKey);
          }
+
+         keyPrefixes.push_back(make_pair(move(prefix), move(newPrefix)));
       }
+
+      unsigned count = partitionCount(bwb, subsshMap.size());
+      auto bounds = splitRange(
+         subsshMap.begin(), subsshMap.end(), subsshMap.size(), count);
+      vector<SerializedPartition> parts(count);
+
+      auto serializeRange = [&](unsigned id)->void
+      {
+         auto& part = parts[id];
+         size_t pos = bounds[id].second;
+
+         for (auto sshIter = bounds[id].first; sshIter != bounds[id + 1].first;
+            ++sshIter, ++pos)
+         {
+            auto& prefixes = keyPrefixes[pos];
+
+            for (const auto& subsshPair : sshIter->second)
+            {
+               auto& subssh = subsshPair.second;
+
+               if (subssh.txioMap_.size() != 0)
+               {
+                  BinaryData subsshKey = prefixes.second;
+                  subsshKey.append(subssh.hgtX_);
+                  BinaryWriter& bw = part.serialized_[subsshKey];
+                  subssh.serializeDBValue(bw, bwb.iface_, dbType, pruneType);
+               }
+               else if (prefixes.first.getSize() != 0)
+               {
+                  BinaryData subsshKey = prefixes.first;
+                  subsshKey.append(subssh.hgtX_);
+                  part.keysToDelete_.insert(subsshKey);
+               }
+            }
+         }
+      };
+
+      runPartitions(count, serializeRange);
+      mergePartitions(parts, serializedSubSshToApply_, keysToDelete_);
    }
    
    //stxout
-   for (auto& spentStxo : bwb.stxoToUpdate_)
    {
-      BinaryWriter& bw = serializedStxOutToModify_[spentStxo->getDBKey()];
-      spentStxo->serializeDBValue(bw, dbType, pruneType);
+      bool compressStxo = bwb.iface_->txDataCompression() != TXDATA_RAW;
+      
+      //an output created and spent in the same batch shows up twice, the 
+      //last state wins. Bucketing by output keeps both in the same 
+      //partition, in order
+      unsigned count = partitionCount(bwb, bwb.stxoToUpdate_.size());
+      vector<vector<StoredTxOut*>> buckets(count);
+      for (auto& stxo : bwb.stxoToUpdate_)
+      {
+         uint64_t outputId = 
+            ((uint64_t)stxo->blockHeight_ << 32) ^
+            ((uint64_t)stxo->duplicateID_ << 24) ^
+            ((uint64_t)stxo->txIndex_ << 16) ^ stxo->txOutIndex_;
+         buckets[outputId % count].push_back(stxo.get());
+      }
+
+      vector<SerializedPartition> parts(count);
+      auto serializeBucket = [&](unsigned id)->void
+      {
+         auto& serialized = parts[id].serialized_;
+         for (auto spentStxo : buckets[id])
+         {
+            BinaryWriter& bw = serialized[spentStxo->getDBKey()];
+            bw.reset();
+            spentStxo->serializeDBValue(
+               bw, dbType, pruneType, false, compressStxo);
+         }
+      };
+
+      runPartitions(count, serializeBucket);
+      mergePartitions(parts, serializedStxOutToModify_, keysToDelete_);
    }
 
    //sbh
@@ -1356,44 +1874,67 @@ void DataToCommit::serializeDataToCommit(BlockWriteBatcher& bwb,
    //txOutCount
    if (dbType != ARMORY_DB_SUPER)
    {
-      LMDBEnv::Transaction txHints(bwb.iface_->dbEnv_[TXHINTS].get(), LMDB::ReadOnly);
+      //the hints need a db lookup each, they are bucketed by hint key (the 
+      //hash prefix) so that txs sharing a hint entry stay in order together
+      unsigned count = partitionCount(bwb, bwb.txCountAndHint_.size());
+      vector<vector<const pair<const BinaryData, 
+         BlockWriteBatcher::CountAndHint>*>> buckets(count);
+
       for (auto& txData : bwb.txCountAndHint_)
       {
          BinaryWriter& bw = serializedTxCountAndHash_[txData.first];
          bw.put_uint32_t(txData.second.count_);
          bw.put_BinaryData(txData.second.hash_);
 
-         BinaryDataRef ldbKey = txData.first.getSliceRef(1, 6);
-         StoredTxHints sths;
-         bwb.iface_->getStoredTxHints(sths, txData.second.hash_);
+         uint32_t hintId = 0;
+         if (txData.second.hash_.getSize() >= 4)
+            hintId = READ_UINT32_LE(txData.second.hash_.getPtr());
+         buckets[hintId % count].push_back(&txData);
+      }
 
-         // Check whether the hint already exists in the DB
-         bool needToAddTxToHints = true;
-         bool needToUpdateHints = false;
-         for (uint32_t i = 0; i < sths.dbKeyList_.size(); i++)
+      vector<SerializedPartition> parts(count);
+      auto serializeBucket = [&](unsigned id)->void
+      {
+         LMDBEnv::Transaction txHints(
+            bwb.iface_->dbEnv_[TXHINTS].get(), LMDB::ReadOnly);
+         for (auto txDataPtr : buckets[id])
          {
-            if (sths.dbKeyList_[i] == ldbKey)
+            auto& txData = *txDataPtr;
+            BinaryDataRef ldbKey = txData.first.getSliceRef(1, 6);
+            StoredTxHints sths;
+            bwb.iface_->getStoredTxHints(sths, txData.second.hash_);
+
+            // Check whether the hint already exists in the DB
+            bool needToAddTxToHints = true;
+            bool needToUpdateHints = false;
+            for (uint32_t i = 0; i < sths.dbKeyList_.size(); i++)
+            {
+               if (sths.dbKeyList_[i] == ldbKey)
+               {
+                  needToAddTxToHints = false;
+                  needToUpdateHints = (sths.preferredDBKey_ != ldbKey);
+                  sths.preferredDBKey_ = ldbKey;
+                  break;
+               }
+            }
+
+            // Add it to the hint list if needed
+            if (needToAddTxToHints)
             {
-               needToAddTxToHints = false;
-               needToUpdateHints = (sths.preferredDBKey_ != ldbKey);
+               sths.dbKeyList_.push_back(ldbKey);
                sths.preferredDBKey_ = ldbKey;
-               break;
             }
-         }
 
-         // Add it to the hint list if needed
-         if (needToAddTxToHints)
-         {
-            sths.dbKeyList_.push_back(ldbKey);
-            sths.preferredDBKey_ = ldbKey;
+            if (needToAddTxToHints || needToUpdateHints)
+            {
+               BinaryWriter& bwHints = parts[id].serialized_[sths.getDBKey()];
+               sths.serializeDBValue(bwHints);
+            }
          }
+      };
 
-         if (needToAddTxToHints || needToUpdateHints)
-         {
-            BinaryWriter& bwHints = serializedTxHints_[sths.getDBKey()];
-            sths.serializeDBValue(bwHints);
-         }
-      }
+      runPartitions(count, serializeBucket);
+      mergePartitions(parts, serializedTxHints_, keysToDelete_);
    }
 
    //sdbi
@@ -1422,6 +1963,7 @@ void DataToCommit::serializeData(BlockWriteBatcher& bwb,
    thread serThread = thread(serialize);
 
    const auto& keysToDelete = serializeSSH(bwb, subsshMap);
+   sshReadyCV_.notify_all();
    lock.unlock();
 
    if (serThread.joinable())
@@ -1431,6 +1973,32 @@ void DataToCommit::serializeData(BlockWriteBatcher& bwb,
 
    isSerialized_ = true;
 }
+////////////////////////////////////////////////////////////////////////////////
+uint64_t DataToCommit::size(void)
+{
+   uint64_t totalSize = 0;
+   auto addMap = [&totalSize](map<BinaryData, BinaryWriter>& dataMap)
+   {
+      for (auto& dataPair : dataMap)
+      {
+         totalSize += dataPair.first.getSize() + 
+            dataPair.second.getSize();
+      }
+   };
+
+   addMap(serializedSubSshToApply_);
+   addMap(serializedSshToModify_);
+   addMap(serializedStxOutToModify_);
+   addMap(serializedSbhToUpdate_);
+   addMap(serializedTxCountAndHash_);
+   addMap(serializedTxHints_);
+
+   for (auto& key : keysToDelete_)
+      totalSize += key.getSize();
+
+   return totalSize;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void DataToCommit::putSSH(LMDBBlockDatabase* db)
 {
@@ -1448,6 +2016,8 @@ void DataToCommit::putSSH(LMDBBlockDatabase* db)
 
    for (auto subSshPair : serializedSubSshToApply_)
       db->putValue(dbs, subSshPair.first, subSshPair.second.getData());
+
+   db->putScrAddrIds();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -30,19 +30,50 @@ class ProgressFilter;
 
 struct PulledTx : public DBTx
 {
-   map<uint16_t, shared_ptr<StoredTxOut>> stxoMap_;
-   map<uint16_t, TxIOPair> preprocessedUTXO_;
+   //indexed by txout position, slots a fragged read did not fill are null
+   vector<shared_ptr<StoredTxOut>> stxos_;
+   vector<TxIOPair> preprocessedUTXO_;
    vector<size_t> txInIndexes_;
 
+   //txouts from a recycled block that the scan never handed to a commit
+   vector<shared_ptr<StoredTxOut>> spareStxos_;
+
+   //a recycled block keeps all its PulledTx, only the ones in use belong
+   //to the current block
+   bool inUse_ = false;
+
    ////
    virtual StoredTxOut& initAndGetStxoByIndex(uint16_t index)
    {
-      auto& thisStxo = stxoMap_[index];
-      thisStxo.reset(new StoredTxOut);
+      if (index >= stxos_.size())
+         stxos_.resize(index + 1);
+
+      auto& thisStxo = stxos_[index];
+      if (spareStxos_.size() > 0)
+      {
+         thisStxo = move(spareStxos_.back());
+         spareStxos_.pop_back();
+         *thisStxo = StoredTxOut();
+      }
+      else
+         thisStxo = make_shared<StoredTxOut>();
+
       thisStxo->txVersion_ = version_;
       return *thisStxo;
    }
 
+   size_t stxoCount(void) const
+   {
+      size_t count = 0;
+      for (auto& stxo : stxos_)
+      {
+         if (stxo != nullptr)
+            ++count;
+      }
+
+      return count;
+   }
+
    virtual bool haveAllTxOut(void) const
    {
       if (!isInitialized())
@@ -51,7 +82,7 @@ struct PulledTx : public DBTx
       if (!isFragged_)
          return true;
 
-      return stxoMap_.size() == numTxOut_;
+      return stxoCount() == numTxOut_;
    }
 
    virtual void unserialize(BinaryRefReader & brr, bool isFragged = false)
@@ -67,12 +98,42 @@ struct PulledTx : public DBTx
       BtcUtils::TxInCalcLength(dataCopy_.getPtr(), dataCopy_.getSize(),
          &txInIndexes_);
    }
+
+   //resets the tx for the next block but keeps its buffers around
+   void clear(void)
+   {
+      thisHash_.clear();
+      dataCopy_.clear();
+      lockTime_ = 0;
+      unixTime_ = 0;
+      isFragged_ = false;
+      version_ = 0;
+      blockHeight_ = UINT32_MAX;
+      duplicateID_ = UINT8_MAX;
+      txIndex_ = UINT16_MAX;
+      numTxOut_ = UINT16_MAX;
+      numBytes_ = UINT32_MAX;
+      fragBytes_ = UINT32_MAX;
+
+      //the scan moves the txouts it hands to a commit out of stxos_ (see 
+      //BlockWriteBatcher::parseTxOuts), the ones left never left the block
+      for (auto& stxo : stxos_)
+      {
+         if (stxo != nullptr)
+            spareStxos_.push_back(move(stxo));
+      }
+
+      stxos_.clear();
+      preprocessedUTXO_.clear();
+      txInIndexes_.clear();
+      inUse_ = false;
+   }
 };
 
 struct PulledBlock : public DBBlock
 {
-   map<uint16_t, PulledTx> stxMap_;
-   shared_ptr<PulledBlock> nextBlock_ = nullptr;
+   //indexed by tx position, check inUse_ before touching a tx
+   vector<PulledTx> txs_;
 
    ////
    PulledBlock(void) : DBBlock() {}
@@ -85,7 +146,7 @@ struct PulledBlock : public DBBlock
       dataCopy_ = move(pb.dataCopy_);
       thisHash_ = move(pb.thisHash_);
       merkle_ = move(pb.merkle_);
-      stxMap_ = move(pb.stxMap_);
+      txs_ = move(pb.txs_);
 
       numTx_ = pb.numTx_;
       numBytes_ = pb.numBytes_;
@@ -104,29 +165,64 @@ struct PulledBlock : public DBBlock
 
    virtual DBTx& getTxByIndex(uint16_t index)
    {
-      return stxMap_[index];
+      if (index >= txs_.size())
+         txs_.resize(index + 1);
+
+      auto& stx = txs_[index];
+      stx.inUse_ = true;
+      return stx;
+   }
+
+   //resets the block for the next height, the txs keep their buffers
+   void clear(void)
+   {
+      dataCopy_.clear();
+      thisHash_.clear();
+      merkle_.clear();
+      numTx_ = UINT32_MAX;
+      numBytes_ = UINT32_MAX;
+      blockHeight_ = UINT32_MAX;
+      duplicateID_ = UINT8_MAX;
+      merkleIsPartial_ = false;
+      isMainBranch_ = false;
+      blockAppliedToDB_ = false;
+      isPartial_ = false;
+      hasBlockHeader_ = false;
+
+      for (auto& stx : txs_)
+         stx.clear();
    }
 
    void preprocessTx(ARMORY_DB_TYPE dbType)
    {
-      for (auto& stx : stxMap_)
+      for (auto& stx : txs_)
       {
-         stx.second.computeTxInIndexes();
-         for (auto& stxo : stx.second.stxoMap_)
+         if (!stx.inUse_)
+            continue;
+
+         stx.computeTxInIndexes();
+         if (dbType == ARMORY_DB_SUPER)
+            stx.preprocessedUTXO_.resize(stx.stxos_.size());
+
+         for (uint32_t i = 0; i < stx.stxos_.size(); i++)
          {
-            stxo.second->getScrAddress();
-            stxo.second->getHgtX();
+            auto& stxo = stx.stxos_[i];
+            if (stxo == nullptr)
+               continue;
+
+            stxo->getScrAddress();
+            stxo->getHgtX();
 
-            stxo.second->hashAndId_ = stx.second.thisHash_;
-            stxo.second->hashAndId_.append(
-               WRITE_UINT16_BE(stxo.second->txOutIndex_));
+            stxo->hashAndId_ = stx.thisHash_;
+            stxo->hashAndId_.append(
+               WRITE_UINT16_BE(stxo->txOutIndex_));
             
             if (dbType == ARMORY_DB_SUPER)
             {
-               auto& txio = stx.second.preprocessedUTXO_[stxo.first];
-               txio.setTxOut(stxo.second->getDBKey(false));
-               txio.setValue(stxo.second->getValue());
-               txio.setFromCoinbase(stxo.second->isCoinbase_);
+               auto& txio = stx.preprocessedUTXO_[i];
+               txio.setTxOut(stxo->getDBKey(false));
+               txio.setValue(stxo->getValue());
+               txio.setFromCoinbase(stxo->isCoinbase_);
                txio.setMultisig(false);
                txio.setUTXO(true);
             }
@@ -177,6 +273,9 @@ struct PulledBlock : public DBBlock
 
       BtcUtils::getHash256(dataCopy_, thisHash_);
 
+      if (txs_.size() < nTx)
+         txs_.resize(nTx);
+
       for (uint32_t tx = 0; tx<nTx; tx++)
       {
          // We're going to have to come back to the beginning of the tx, later
@@ -189,12 +288,12 @@ struct PulledBlock : public DBBlock
          //save the hash for merkle computation
          allTxHashes.push_back(thisTx.getThisHash());
 
-         // Now add it to the map
-         PulledTx & stx = stxMap_[tx];
+         // Now add it to the block
+         PulledTx & stx = static_cast<PulledTx&>(getTxByIndex(tx));
 
          // Now copy the appropriate data from the vanilla Tx object
          //stx.createFromTx(thisTx, doFrag, true);
-         stx.dataCopy_ = BinaryData(thisTx.getPtr(), thisTx.getSize());
+         stx.dataCopy_.copyFrom(thisTx.getPtr(), thisTx.getSize());
          stx.thisHash_ = thisTx.getThisHash();
          stx.numTxOut_ = thisTx.getNumTxOut();
          stx.lockTime_ = thisTx.getLockTime();
@@ -230,6 +329,103 @@ struct PulledBlock : public DBBlock
    }
 };
 
+/***
+ Recycles PulledBlocks between the loader threads and the scan thread. The 
+ scan thread hands a block back once it is applied, a loader clears it and 
+ fills it with the next height, so the tx and txout buffers are reused 
+ instead of reallocated for every block. Blocks someone else still holds 
+ on to are dropped.
+***/
+class PulledBlockPool
+{
+public:
+   PulledBlockPool(size_t maxPooled) : maxPooled_(maxPooled) {}
+
+   shared_ptr<PulledBlock> get(void);
+   void recycle(shared_ptr<PulledBlock> pb);
+
+   size_t size(void) const;
+
+private:
+   const size_t maxPooled_;
+   vector<shared_ptr<PulledBlock>> pool_;
+   mutable mutex lock_;
+};
+
+/***
+ UTXO cache for the scan. Open addressing with linear probing over fixed 34 
+ byte outpoint keys (txHash | txOutIndex BE). An entry only carries the 
+ txout dbKey and a few flags, the raw txout and its scrAddr go in a per 
+ generation arena. take() rebuilds a StoredTxOut for the spend and drops the 
+ entry.
+
+ Eviction is by generation: evictOldest() drops the previous generation 
+ whole and starts a new one, so memory is bounded without per entry 
+ bookkeeping. Lookups check both generations.
+***/
+class UtxoCache
+{
+public:
+   static const size_t KEY_SIZE = 34;
+
+   void insert(const BinaryData& hashAndId, const StoredTxOut& stxo);
+   shared_ptr<StoredTxOut> take(const BinaryData& hashAndId);
+
+   void evictOldest(void);
+   void clear(void);
+
+   size_t size(void) const { return current_.count_ + previous_.count_; }
+   size_t bytes(void) const { return current_.bytes() + previous_.bytes(); }
+
+private:
+   enum SlotState
+   {
+      SLOT_EMPTY = 0,
+      SLOT_USED,
+      SLOT_ERASED
+   };
+
+   struct Entry
+   {
+      uint8_t  key_[KEY_SIZE];
+      uint8_t  dbKey_[8];
+      uint8_t  state_ = SLOT_EMPTY;
+      uint8_t  txVersion_;
+      uint8_t  isCoinbase_;
+      uint8_t  scrAddrSize_;
+
+      //arena offset of the raw txout, its scrAddr follows. 64 bit, a 
+      //generation is only bounded by the utxo cache budget
+      uint64_t offset_;
+      uint32_t txOutSize_;
+   };
+
+   struct Generation
+   {
+      vector<Entry>   slots_;
+      vector<uint8_t> arena_;
+
+      size_t count_ = 0;
+      
+      //used and erased slots, drives the rehash
+      size_t filled_ = 0;
+
+      Entry* find(const uint8_t* key);
+      Entry& slotFor(const uint8_t* key);
+      void rehash(size_t slotCount);
+      void clear(void);
+
+      size_t bytes(void) const
+      { return slots_.capacity() * sizeof(Entry) + arena_.capacity(); }
+   };
+
+   static size_t hashKey(const uint8_t* key);
+
+private:
+   Generation current_;
+   Generation previous_;
+};
+
 class BlockWriteBatcher;
 
 struct keyHasher
@@ -244,6 +440,23 @@ struct keyHasher
 
 struct DataToCommit
 {
+   //fewest entries worth a serializer thread of their own
+#if defined(_DEBUG) || defined(DEBUG )
+   //tiny so that unit tests go through the partitioned path
+   static const size_t SERIALIZE_PARTITION_MIN = 2;
+#else
+   static const size_t SERIALIZE_PARTITION_MIN = 4096;
+#endif
+
+   //What one serializer thread produces. Partitions hold disjoint keys and 
+   //are merged into the sorted maps below once all of them are done, so the
+   //result doesn't depend on the thread count or scheduling
+   struct SerializedPartition
+   {
+      map<BinaryData, BinaryWriter> serialized_;
+      set<BinaryData> keysToDelete_;
+   };
+
    map<BinaryData, BinaryWriter> serializedSubSshToApply_;
    map<BinaryData, BinaryWriter> serializedSshToModify_;
    map<BinaryData, BinaryWriter> serializedStxOutToModify_;
@@ -263,6 +476,7 @@ struct DataToCommit
    ARMORY_DB_TYPE dbType_;
 
    mutex lock_;
+   condition_variable sshReadyCV_;
 
    ////
    DataToCommit(ARMORY_DB_TYPE dbType) :
@@ -276,6 +490,17 @@ struct DataToCommit
    void serializeDataToCommit(BlockWriteBatcher& bwb,
       const map<BinaryData, map<BinaryData, StoredSubHistory> >& subsshMap);
 
+   static unsigned partitionCount(const BlockWriteBatcher& bwb, 
+      size_t entryCount);
+   static void runPartitions(unsigned count, 
+      const function<void(unsigned)>& work);
+   static void mergePartitions(vector<SerializedPartition>& parts,
+      map<BinaryData, BinaryWriter>& serialized, 
+      set<BinaryData>& keysToDelete);
+
+   //heap held by the serialized data
+   uint64_t size(void);
+
    void putSSH(LMDBBlockDatabase* db);
    void putSTX(LMDBBlockDatabase* db);
    void putSBH(LMDBBlockDatabase* db);
@@ -290,16 +515,21 @@ struct DataToCommit
 class BlockWriteBatcher
 {
    friend struct DataToCommit;
+   friend class DataToCommitTest;
 
 public:
+   //bounds on the commit threshold and utxo cache size derived from 
+   //config.scanMemoryBudget
 #if defined(_DEBUG) || defined(DEBUG )
-   //use a tiny update threshold to trigger multiple commit threads for 
-   //unit tests in debug builds
-   static const uint64_t UPDATE_BYTES_THRESH = 300;
-   static const uint32_t UTXO_THRESHOLD = 5;
+   //use tiny thresholds to trigger multiple commit threads for unit tests in 
+   //debug builds, whatever the budget
+   static const uint64_t COMMIT_BYTES_MIN = 300;
+   static const uint64_t COMMIT_BYTES_MAX = 600;
+   static const uint64_t UTXO_CACHE_BYTES_MAX = 2048;
 #else
-   static const uint64_t UPDATE_BYTES_THRESH = 50 * 1024 * 1024;
-   static const uint32_t UTXO_THRESHOLD = 100000;
+   static const uint64_t COMMIT_BYTES_MIN = 4 * 1024 * 1024;
+   static const uint64_t COMMIT_BYTES_MAX = 2048ULL * 1024 * 1024;
+   static const uint64_t UTXO_CACHE_BYTES_MAX = UINT64_MAX;
 #endif
    BlockWriteBatcher(const BlockDataManagerConfig &config, 
                      LMDBBlockDatabase* iface, 
@@ -313,35 +543,68 @@ public:
    void setUpdateSDBI(bool set) { updateSDBI_ = set; }
    void setCriticalErrorLambda(function<void(string)> lbd) { criticalError_ = lbd; }
 
+   //Half of what the budget has left once usedBytes are accounted for: 
+   //the batch being filled shares it with its serialized copy
+   static uint64_t commitThresholdFor(uint64_t budget, uint64_t usedBytes);
+
 private:
 
+   /***
+   Scan pipeline: loader threads claim heights, pull and deserialize blocks 
+   in parallel and push them here. The scan thread pops them back in height 
+   order, so only UTXO resolution in applyBlockToDB is serialized. Loaders 
+   block once bufferLoad_ reaches bufferCap_, unless they hold the next 
+   block to scan.
+   ***/
    struct LoadedBlockData
    {
-      shared_ptr<PulledBlock> block_ = nullptr;
-      shared_ptr<PulledBlock> interruptBlock_ = nullptr;
-
       uint32_t startBlock_ = 0;
       uint32_t endBlock_   = 0;
-      volatile atomic<uint32_t> bufferLoad_;
-      
-      uint32_t topLoadedBlock_ = 0;
-      
+
       ScrAddrFilter& scrAddrFilter_;
 
-      mutex scanLock_, grabLock_, assignLock_;
+      //next height for a loader thread to claim
+      atomic<uint32_t> nextToLoad_;
+
+      //loaded blocks waiting for the scan thread, a null block marks a 
+      //height that failed to load
+      map<uint32_t, shared_ptr<PulledBlock>> loadedBlocks_;
+      uint32_t nextToScan_ = 0;
+      uint64_t bufferLoad_ = 0;
+      uint64_t bufferCap_ = 0;
+      bool interrupted_ = false;
+
+      mutex lock_;
       condition_variable scanCV_, grabCV_;
 
+      PulledBlockPool pool_;
+
       ////
-      LoadedBlockData(uint32_t start, uint32_t end, ScrAddrFilter& scf) :
-         startBlock_(start), endBlock_(end), scrAddrFilter_(scf)
+      LoadedBlockData(uint32_t start, uint32_t end, ScrAddrFilter& scf,
+         size_t maxPooled) :
+         startBlock_(start), endBlock_(end), scrAddrFilter_(scf),
+         pool_(maxPooled)
       {
-         topLoadedBlock_ = start;
+         nextToLoad_.store(start, memory_order_relaxed);
+         nextToScan_ = start;
+      }
 
-         interruptBlock_ = make_shared<PulledBlock>();
-         interruptBlock_->nextBlock_ = interruptBlock_;
+      bool pushBlock(uint32_t hgt, shared_ptr<PulledBlock> pb);
+      shared_ptr<PulledBlock> popBlock(void);
+      void interrupt(void);
+   };
 
-         bufferLoad_.store(0, memory_order_relaxed);
-      }
+   //reported at the end of each scan
+   struct ScanStats
+   {
+      uint32_t commitCount_ = 0;
+      uint64_t bytesCommitted_ = 0;
+      
+      //time the scan thread spent waiting on a running write
+      double writeWaitSec_ = 0;
+
+      //the db value cache counters as the scan started
+      DBValueCache::Stats valueCacheStart_;
    };
 
    struct CountAndHint
@@ -370,6 +633,7 @@ private:
       StoredUndoData * sud,
       ScrAddrFilter& scrAddrData);
 
+   void adaptThresholds(uint64_t pendingBytes);
    void resetTransactions(void);
    void clearTransactions(void);
    
@@ -390,7 +654,7 @@ private:
 
    StoredTxOut* lookForUTXOInMap(const BinaryData& txHash, const uint16_t& txoId);
 
-   void moveStxoToUTXOMap(const shared_ptr<StoredTxOut>& thisTxOut);
+   void moveStxoToUTXOMap(shared_ptr<StoredTxOut> thisTxOut);
 
    void serializeData(
       const map<BinaryData, map<BinaryData, StoredSubHistory> >& subsshMap) 
@@ -429,8 +693,16 @@ private:
    // turn off batches by setting this to 0
    uint64_t dbUpdateSize_ = 0;
 
-   map<BinaryData, shared_ptr<StoredTxOut>>  utxoMap_;
-   map<BinaryData, shared_ptr<StoredTxOut>>  utxoMapBackup_;
+   //commit once dbUpdateSize_ goes past this, see adaptThresholds
+   uint64_t commitThreshold_;
+   uint64_t utxoCacheBudget_;
+
+   //serialized data held by the write threads, tracked on the parent
+   atomic<uint64_t> bytesInFlight_;
+
+   ScanStats scanStats_;
+
+   UtxoCache                                 utxoCache_;
    vector<shared_ptr<StoredTxOut> >          stxoToUpdate_;
 
    map<BinaryData, map<BinaryData, StoredSubHistory> >   subSshMapToWrite_;
@@ -471,6 +743,11 @@ private:
 
    //to sync commits 
    mutex writeLock_;
+
+   //set by the write thread once it holds its parent's writeLock_
+   mutex writeStartLock_;
+   condition_variable writeStartCV_;
+   bool writeStarted_ = false;
    bool updateSDBI_ = true;
 
    //
@@ -7,11 +7,104 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "Blockchain.h"
 #include "util.h"
+#include "crc.h"
+
+#include <algorithm>
 
 #ifdef max
 #undef max
 #endif
 
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Start BlockHeaderStore methods
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+const uint32_t BlockHeaderStore::EMPTY_SLOT;
+
+void BlockHeaderStore::clear()
+{
+   headers_.clear();
+   keys_.clear();
+   slots_.assign(1024, EMPTY_SLOT);
+}
+
+BlockHeader* BlockHeaderStore::find(BinaryDataRef hash)
+{
+   if (hash.getSize() != 32)
+      return nullptr;
+
+   const uint32_t index = slots_[findSlot(hash)];
+   if (index == EMPTY_SLOT)
+      return nullptr;
+
+   return &headers_[index];
+}
+
+const BlockHeader* BlockHeaderStore::find(BinaryDataRef hash) const
+{
+   return const_cast<BlockHeaderStore*>(this)->find(hash);
+}
+
+BlockHeader& BlockHeaderStore::operator[](BinaryDataRef hash)
+{
+   if (hash.getSize() != 32)
+      throw runtime_error("block header hash has to be 32 bytes");
+
+   size_t slot = findSlot(hash);
+   if (slots_[slot] != EMPTY_SLOT)
+      return headers_[slots_[slot]];
+
+   // keep the table at most 3/4 full, so probe sequences stay short
+   if ((headers_.size() + 1) * 4 > slots_.size() * 3)
+   {
+      growTable();
+      slot = findSlot(hash);
+   }
+
+   slots_[slot] = headers_.size();
+   keys_.insert(keys_.end(), hash.getPtr(), hash.getPtr() + 32);
+   headers_.emplace_back();
+   headers_.back().thisHash_.copyFrom(hash);
+   return headers_.back();
+}
+
+size_t BlockHeaderStore::findSlot(BinaryDataRef hash) const
+{
+   // block hashes are about as random as it gets, but the test chains 
+   // aren't, so mix the bits before picking a slot
+   uint64_t key;
+   memcpy(&key, hash.getPtr(), sizeof(key));
+   key *= 0x9E3779B97F4A7C15ULL;
+
+   const size_t mask = slots_.size() - 1;
+   size_t slot = (key >> 32) & mask;
+
+   while (1)
+   {
+      const uint32_t index = slots_[slot];
+      if (index == EMPTY_SLOT ||
+          memcmp(&keys_[size_t(index) * 32], hash.getPtr(), 32) == 0)
+         return slot;
+
+      slot = (slot + 1) & mask;
+   }
+}
+
+void BlockHeaderStore::growTable()
+{
+   slots_.assign(slots_.size() * 2, EMPTY_SLOT);
+
+   for (uint32_t i = 0; i < headers_.size(); i++)
+   {
+      const BinaryDataRef key(&keys_[size_t(i) * 32], 32);
+      slots_[findSlot(key)] = i;
+   }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -29,10 +122,12 @@ Blockchain::Blockchain(const HashString &genesisHash)
 void Blockchain::clear()
 {
    newlyParsedBlocks_.clear();
+   unorganizedBlocks_.clear();
    headersByHeight_.resize(0);
-   headerMap_.clear();
+   maxTimestampByHeight_.resize(0);
+   headers_.clear();
    topBlockPtr_ = genesisBlockBlockPtr_ =
-      &headerMap_[genesisHash_];
+      &headers_[genesisHash_];
 }
 
 BlockHeader& Blockchain::addBlock(
@@ -46,7 +141,33 @@ BlockHeader& Blockchain::addBlock(
       LOGWARN << "    Header Hash: " << blockhash.copySwapEndian().toHexStr();
    }
    
-   BlockHeader& bh = headerMap_[blockhash] = block;
+   BlockHeader& bh = headers_[blockhash];
+   if (bh.isInitialized_ && bh.difficultySum_ > 0)
+   {
+      // Same hash, same place in the chain. Keep what the last organize
+      // worked out for this header instead of sending it through again
+      const uint32_t   height       = bh.blockHeight_;
+      const uint8_t    dupId        = bh.duplicateID_;
+      const double     diffSum      = bh.difficultySum_;
+      const bool       isMain       = bh.isMainBranch_;
+      const bool       isFinished   = bh.isFinishedCalc_;
+      const BinaryData nextHash     = bh.nextHash_;
+
+      bh = block;
+      bh.blockHeight_    = height;
+      bh.duplicateID_    = dupId;
+      bh.difficultySum_  = diffSum;
+      bh.isMainBranch_   = isMain;
+      bh.isFinishedCalc_ = isFinished;
+      bh.isOrphan_       = false;
+      bh.nextHash_       = nextHash;
+   }
+   else
+   {
+      bh = block;
+      unorganizedBlocks_.push_back(&bh);
+   }
+
    return bh;
 }
 
@@ -95,11 +216,11 @@ Blockchain::ReorganizationState Blockchain::forceOrganize()
 void Blockchain::setDuplicateIDinRAM(
    LMDBBlockDatabase* iface, bool forceUpdateDupID)
 {
-   for (const auto& block : headerMap_)
+   for (const BlockHeader& block : headers_)
    {
-      if (block.second.isMainBranch_)
+      if (block.isMainBranch_)
          iface->setValidDupIDForHeight(
-            block.second.blockHeight_, block.second.duplicateID_);
+            block.blockHeight_, block.duplicateID_);
    }
 }
 
@@ -157,24 +278,39 @@ bool Blockchain::hasHeaderByHeight(unsigned height) const
 
 const BlockHeader& Blockchain::getHeaderByHash(HashString const & blkHash) const
 {
-   map<HashString, BlockHeader>::const_iterator it = headerMap_.find(blkHash);
-   if(ITER_NOT_IN_MAP(it, headerMap_))
+   const BlockHeader* bh = headers_.find(blkHash);
+   if(bh == nullptr)
       throw std::range_error("Cannot find block with hash " + blkHash.copySwapEndian().toHexStr());
    else
-      return it->second;
+      return *bh;
 }
 BlockHeader& Blockchain::getHeaderByHash(HashString const & blkHash)
 {
-   map<HashString, BlockHeader>::iterator it = headerMap_.find(blkHash);
-   if(ITER_NOT_IN_MAP(it, headerMap_))
+   BlockHeader* bh = headers_.find(blkHash);
+   if(bh == nullptr)
       throw std::range_error("Cannot find block with hash " + blkHash.copySwapEndian().toHexStr());
    else
-      return it->second;
+      return *bh;
 }
 
 bool Blockchain::hasHeaderWithHash(BinaryData const & txHash) const
 {
-   return KEY_IN_MAP(txHash, headerMap_);
+   return headers_.find(txHash) != nullptr;
+}
+
+uint32_t Blockchain::getClosestHeightForTime(uint32_t timestamp) const
+{
+   if (maxTimestampByHeight_.empty())
+      return 0;
+
+   // block timestamps can go backwards, their running max can't, so a 
+   // binary search over it finds the first height that reached timestamp
+   auto iter = lower_bound(
+      maxTimestampByHeight_.begin(), maxTimestampByHeight_.end(), timestamp);
+   if (iter == maxTimestampByHeight_.end())
+      return maxTimestampByHeight_.size() - 1;
+
+   return iter - maxTimestampByHeight_.begin();
 }
 
 const BlockHeader& Blockchain::getHeaderPtrForTxRef(const TxRef &txr) const
@@ -209,26 +345,30 @@ BlockHeader* Blockchain::organizeChain(bool forceRebuild)
 
    
    // If rebuild, we zero out any original organization data and do a 
-   // rebuild of the chain from scratch.  This will need to be done in
-   // the event that our first call to organizeChain returns false, which
-   // means part of blockchain that was previously valid, has become
-   // invalid.  Rather than get fancy, just rebuild all which takes less
-   // than a second, anyway.
+   // rebuild of the chain from scratch. Otherwise only the headers added
+   // since the last call are looked at, and a reorg only touches the
+   // blocks on the branches above the fork point.
+   vector<BlockHeader*> toOrganize;
    if(forceRebuild)
    {
-      map<HashString, BlockHeader>::iterator iter;
-      for( iter  = headerMap_.begin(); 
-           iter != headerMap_.end(); 
-           iter++)
+      for (BlockHeader& header : headers_)
       {
-         iter->second.difficultySum_  = -1;
-         iter->second.blockHeight_    =  0;
-         iter->second.isFinishedCalc_ =  false;
-         iter->second.nextHash_       =  BtcUtils::EmptyHash();
-         iter->second.isMainBranch_   =  false;
+         header.difficultySum_  = -1;
+         header.blockHeight_    =  0;
+         header.isFinishedCalc_ =  false;
+         header.nextHash_       =  BtcUtils::EmptyHash();
+         header.isMainBranch_   =  false;
+         toOrganize.push_back(&header);
       }
       topBlockPtr_ = NULL;
    }
+   else
+   {
+      // Headers organized before already have their difficulty sums, 
+      // only the ones added since then can change the top
+      toOrganize.swap(unorganizedBlocks_);
+   }
+   unorganizedBlocks_.clear();
 
    // Set genesis block
    BlockHeader & genBlock = getGenesisBlock();
@@ -244,29 +384,30 @@ BlockHeader* Blockchain::organizeChain(bool forceRebuild)
    if(topBlockPtr_ == NULL)
       topBlockPtr_ = &genBlock;
 
-   const BlockHeader& prevTopBlock = top();
+   BlockHeader& prevTopBlock = top();
    
-   // Iterate over all blocks, track the maximum difficulty-sum block
+   // Iterate over the new blocks, track the maximum difficulty-sum block
    double   maxDiffSum     = prevTopBlock.getDifficultySum();
-   for( BlockHeader &header : values(headerMap_))
+   for (BlockHeader* headerPtr : toOrganize)
    {
       // *** Walk down the chain following prevHash fields, until
       //     you find a "solved" block.  Then walk back up and 
       //     fill in the difficulty-sum values (do not set next-
       //     hash ptrs, as we don't know if this is the main branch)
       //     Method returns instantly if block is already "solved"
-      double thisDiffSum = traceChainDown(header);
+      double thisDiffSum = traceChainDown(*headerPtr);
 
-      if (header.isOrphan_)
+      if (headerPtr->isOrphan_)
       {
-         // disregard this block
+         // disregard this block for now, its parent may show up later
+         unorganizedBlocks_.push_back(headerPtr);
       }
       // Determine if this is the top block.  If it's the same diffsum
       // as the prev top block, don't do anything
       else if(thisDiffSum > maxDiffSum)
       {
          maxDiffSum     = thisDiffSum;
-         topBlockPtr_   = &header;
+         topBlockPtr_   = headerPtr;
       }
    }
 
@@ -296,7 +437,7 @@ BlockHeader* Blockchain::organizeChain(bool forceRebuild)
       //}
 
       HashString & childHash    = thisHeaderPtr->thisHash_;
-      thisHeaderPtr             = &(headerMap_[thisHeaderPtr->getPrevHash()]);
+      thisHeaderPtr             = &(headers_[thisHeaderPtr->getPrevHashRef()]);
       thisHeaderPtr->nextHash_  = childHash;
 
       if(thisHeaderPtr == &prevTopBlock)
@@ -307,14 +448,40 @@ BlockHeader* Blockchain::organizeChain(bool forceRebuild)
    thisHeaderPtr->isMainBranch_ = true;
    headersByHeight_[thisHeaderPtr->getBlockHeight()] = thisHeaderPtr;
 
+   // Only the heights from the branch point up changed, bring the running
+   // max of timestamps up to date for those
+   maxTimestampByHeight_.resize(headersByHeight_.size());
+   for (size_t height = thisHeaderPtr->getBlockHeight();
+        height < headersByHeight_.size(); height++)
+   {
+      const BlockHeader& header = *headersByHeight_[height];
+      uint32_t timestamp = 0;
+      if (header.getSize() >= HEADER_SIZE)
+         timestamp = header.getTimestamp();
+
+      if (height > 0)
+         timestamp = max(timestamp, maxTimestampByHeight_[height - 1]);
+      maxTimestampByHeight_[height] = timestamp;
+   }
+
 
-   // Force a full rebuild to make sure everything is marked properly
    // On a full rebuild, prevChainStillValid should ALWAYS be true
    if( !prevChainStillValid )
    {
       LOGWARN << "Reorg detected!";
 
-      organizeChain(true); // force-rebuild blockchain (takes less than 1s)
+      // thisHeaderPtr is where the new branch forks off the old one. The 
+      // difficulty sums don't change, only the old branch above the fork 
+      // has to be taken off the main chain
+      BlockHeader* oldHeaderPtr = &prevTopBlock;
+      while (oldHeaderPtr != thisHeaderPtr)
+      {
+         oldHeaderPtr->isFinishedCalc_ = false;
+         oldHeaderPtr->isMainBranch_   = false;
+         oldHeaderPtr->nextHash_       = BtcUtils::EmptyHash();
+         oldHeaderPtr = &(headers_[oldHeaderPtr->getPrevHashRef()]);
+      }
+
       return thisHeaderPtr;
    }
 
@@ -333,25 +500,24 @@ double Blockchain::traceChainDown(BlockHeader & bhpStart)
    if(bhpStart.difficultySum_ > 0)
       return bhpStart.difficultySum_;
 
-   // Prepare some data structures for walking down the chain
-   vector<BlockHeader*>   headerPtrStack(headerMap_.size());
-   vector<double>         difficultyStack(headerMap_.size());
-   uint32_t blkIdx = 0;
+   // Prepare some data structures for walking down the chain. These grow
+   // with how far we walk, rather than being sized for the whole chain up
+   // front, since most walks are only a few blocks long
+   vector<BlockHeader*>   headerPtrStack;
+   vector<double>         difficultyStack;
 
    // Walk down the chain of prevHash_ values, until we find a block
    // that has a definitive difficultySum value (i.e. >0). 
    BlockHeader* thisPtr = &bhpStart;
    while( thisPtr->difficultySum_ < 0)
    {
-      double thisDiff         = thisPtr->difficultyDbl_;
-      difficultyStack[blkIdx] = thisDiff;
-      headerPtrStack[blkIdx]  = thisPtr;
-      blkIdx++;
+      difficultyStack.push_back(thisPtr->difficultyDbl_);
+      headerPtrStack.push_back(thisPtr);
 
-      map<HashString, BlockHeader>::iterator iter = headerMap_.find(thisPtr->getPrevHash());
-      if(ITER_IN_MAP(iter, headerMap_))
+      BlockHeader* prevPtr = headers_.find(thisPtr->getPrevHashRef());
+      if(prevPtr != nullptr)
       {
-         thisPtr = &(iter->second);
+         thisPtr = prevPtr;
       }
       else
       {
@@ -367,7 +533,7 @@ double Blockchain::traceChainDown(BlockHeader & bhpStart)
    // (by pointer) and accumulate the difficulty values 
    double   seedDiffSum = thisPtr->difficultySum_;
    uint32_t blkHeight   = thisPtr->blockHeight_;
-   for(int32_t i=blkIdx-1; i>=0; i--)
+   for(int32_t i=int32_t(headerPtrStack.size())-1; i>=0; i--)
    {
       seedDiffSum += difficultyStack[i];
       blkHeight++;
@@ -396,27 +562,162 @@ void Blockchain::putBareHeaders(LMDBBlockDatabase *db, bool updateDupID)
    consider the next dup to be the first unknown block in DB until a new
    block file is created by Core.
    ***/
-   for (auto& block : headerMap_)
+   for (auto& block : headers_)
    {
       StoredHeader sbh;
-      sbh.createFromBlockHeader(block.second);
+      sbh.createFromBlockHeader(block);
       uint8_t dup = db->putBareHeader(sbh, updateDupID);
-      block.second.setDuplicateID(dup);  // make sure headerMap_ and DB agree
+      block.setDuplicateID(dup);  // make sure headers_ and DB agree
    }
 }
 
 /////////////////////////////////////////////////////////////////////////////
 void Blockchain::putNewBareHeaders(LMDBBlockDatabase *db)
 {
+   LMDBEnv::Transaction tx;
+   db->beginDBTransaction(&tx, HEADERS, LMDB::ReadWrite);
+
    for (auto& block : newlyParsedBlocks_)
    {
       StoredHeader sbh;
       sbh.createFromBlockHeader(*block);
       uint8_t dup = db->putBareHeader(sbh, true);
-      block->setDuplicateID(dup);  // make sure headerMap_ and DB agree
+      block->setDuplicateID(dup);  // make sure headers_ and DB agree
+      db->putBlockFilePosition(*block);
    }
 
    //once commited to the DB, they aren't considered new anymore, 
    //so clean up the container
    newlyParsedBlocks_.clear();
 }
+
+/////////////////////////////////////////////////////////////////////////////
+// Header snapshot layout, all little endian:
+//    magic (8) | version (4) | record size (4) | record count (4) |
+//    crc32 of the records (4) | genesis hash (32)
+// followed by one fixed size record per header:
+//    raw header (80) | hash (32) | height (4) | blk file num (4) |
+//    blk file offset (8) | block size (4) | numTx (4) | 
+//    difficulty sum (8, as the bits of the double) | dupID (1) | padding (3)
+static const char     HEADER_SNAPSHOT_MAGIC[] = "ARMHSNAP";
+static const uint32_t HEADER_SNAPSHOT_VERSION = 1;
+static const size_t   HEADER_SNAPSHOT_PREFIX_SIZE = 56;
+static const size_t   HEADER_SNAPSHOT_RECORD_SIZE = 148;
+
+static uint32_t headerSnapshotChecksum(const uint8_t* ptr, size_t size)
+{
+   CryptoPP::CRC32 crc;
+   crc.Update(ptr, size);
+
+   uint8_t digest[4];
+   crc.Final(digest);
+   return READ_UINT32_LE(digest);
+}
+
+void Blockchain::writeHeaderSnapshot(BinaryWriter &bw) const
+{
+   BinaryWriter records(headers_.size() * HEADER_SNAPSHOT_RECORD_SIZE);
+   for (const BlockHeader& header : headers_)
+   {
+      // the genesis placeholder has nothing worth saving
+      if (!header.isInitialized_ || header.dataCopy_.getSize() != HEADER_SIZE)
+         continue;
+
+      uint64_t diffSumBits;
+      memcpy(&diffSumBits, &header.difficultySum_, sizeof(diffSumBits));
+
+      records.put_BinaryData(header.dataCopy_);
+      records.put_BinaryData(header.thisHash_);
+      records.put_uint32_t(header.blockHeight_);
+      records.put_uint32_t(header.blkFileNum_);
+      records.put_uint64_t(header.hasFilePos() ? header.blkFileOffset_ : 0);
+      records.put_uint32_t(header.numBlockBytes_);
+      records.put_uint32_t(header.numTx_);
+      records.put_uint64_t(diffSumBits);
+      records.put_uint8_t(header.duplicateID_);
+      for (int i = 0; i < 3; i++)
+         records.put_uint8_t(0);
+   }
+
+   const BinaryData& recordData = records.getData();
+
+   bw.reserve(HEADER_SNAPSHOT_PREFIX_SIZE + recordData.getSize());
+   bw.put_BinaryData((const uint8_t*)HEADER_SNAPSHOT_MAGIC, 8);
+   bw.put_uint32_t(HEADER_SNAPSHOT_VERSION);
+   bw.put_uint32_t(HEADER_SNAPSHOT_RECORD_SIZE);
+   bw.put_uint32_t(recordData.getSize() / HEADER_SNAPSHOT_RECORD_SIZE);
+   bw.put_uint32_t(
+      headerSnapshotChecksum(recordData.getPtr(), recordData.getSize()));
+   bw.put_BinaryData(genesisHash_);
+   bw.put_BinaryData(recordData);
+}
+
+const BlockHeader* Blockchain::loadHeaderSnapshot(BinaryDataRef snapshot)
+{
+   if (snapshot.getSize() < HEADER_SNAPSHOT_PREFIX_SIZE)
+      return nullptr;
+
+   BinaryRefReader brr(snapshot);
+   if (memcmp(brr.getCurrPtr(), HEADER_SNAPSHOT_MAGIC, 8) != 0)
+      return nullptr;
+   brr.advance(8);
+
+   if (brr.get_uint32_t() != HEADER_SNAPSHOT_VERSION ||
+       brr.get_uint32_t() != HEADER_SNAPSHOT_RECORD_SIZE)
+      return nullptr;
+
+   const uint32_t count = brr.get_uint32_t();
+   const uint32_t checksum = brr.get_uint32_t();
+   if (brr.get_BinaryDataRef(32) != genesisHash_.getRef())
+      return nullptr;
+
+   const size_t recordBytes = size_t(count) * HEADER_SNAPSHOT_RECORD_SIZE;
+   if (brr.getSizeRemaining() != recordBytes)
+      return nullptr;
+
+   const uint8_t* records = brr.getCurrPtr();
+   if (headerSnapshotChecksum(records, recordBytes) != checksum)
+      return nullptr;
+
+   clear();
+
+   // the records carry their hash and cumulative work, so headers go 
+   // straight into the store, with nothing to hash or trace down
+   const BlockHeader* mostWork = nullptr;
+   for (uint32_t i = 0; i < count; i++)
+   {
+      const uint8_t* ptr = records + size_t(i) * HEADER_SNAPSHOT_RECORD_SIZE;
+      BinaryDataRef hash(ptr + HEADER_SIZE, 32);
+
+      BlockHeader& bh = headers_[hash];
+      bh.dataCopy_.copyFrom(ptr, HEADER_SIZE);
+      bh.difficultyDbl_ = BtcUtils::convertDiffBitsToDouble(
+         BinaryDataRef(ptr + 72, 4));
+      bh.blockHeight_   = READ_UINT32_LE(ptr + 112);
+      bh.blkFileNum_    = READ_UINT32_LE(ptr + 116);
+      bh.blkFileOffset_ = READ_UINT64_LE(ptr + 120);
+      bh.numBlockBytes_ = READ_UINT32_LE(ptr + 128);
+      bh.numTx_         = READ_UINT32_LE(ptr + 132);
+
+      const uint64_t diffSumBits = READ_UINT64_LE(ptr + 136);
+      memcpy(&bh.difficultySum_, &diffSumBits, sizeof(diffSumBits));
+
+      bh.duplicateID_    = ptr[144];
+      bh.nextHash_       = BinaryData(0);
+      bh.isInitialized_  = true;
+      bh.isMainBranch_   = false;
+      bh.isFinishedCalc_ = false;
+      bh.isOrphan_       = bh.difficultySum_ < 0;
+
+      unorganizedBlocks_.push_back(&bh);
+
+      if (!bh.isOrphan_ && 
+          (mostWork == nullptr || bh.difficultySum_ > mostWork->difficultySum_))
+         mostWork = &bh;
+   }
+
+   if (mostWork == nullptr)
+      clear();
+
+   return mostWork;
+}
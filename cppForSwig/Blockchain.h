@@ -13,6 +13,55 @@
 
 #include <deque>
 #include <map>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Holds every block header we know of, indexed by hash.
+//
+// Headers are appended to an arena and never move, so pointers to them stay
+// valid until clear(). The index is an open addressing table of arena
+// positions, probed by the hash. The 32 byte keys are packed back to back 
+// in a single buffer, in arena order, so a probe compares against flat 
+// memory instead of going through the header and its heap allocated hash.
+//
+class BlockHeaderStore
+{
+public:
+   typedef deque<BlockHeader>::iterator iterator;
+   typedef deque<BlockHeader>::const_iterator const_iterator;
+
+   BlockHeaderStore(void) { clear(); }
+
+   void clear(void);
+   size_t size(void) const { return headers_.size(); }
+
+   // returns nullptr if we don't have that header
+   BlockHeader* find(BinaryDataRef hash);
+   const BlockHeader* find(BinaryDataRef hash) const;
+
+   // returns the header for that hash, adding an empty one carrying only 
+   // the hash if it is new
+   BlockHeader& operator[](BinaryDataRef hash);
+
+   // iterates in the order headers were added
+   iterator begin(void) { return headers_.begin(); }
+   iterator end(void) { return headers_.end(); }
+   const_iterator begin(void) const { return headers_.begin(); }
+   const_iterator end(void) const { return headers_.end(); }
+
+private:
+   // the slot holding that hash, or the empty slot it would go in
+   size_t findSlot(BinaryDataRef hash) const;
+   void growTable(void);
+
+private:
+   static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+   deque<BlockHeader> headers_;
+   vector<uint8_t> keys_;
+   vector<uint32_t> slots_;
+};
 
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -55,6 +104,12 @@ public:
    BlockHeader& getGenesisBlock() const;
    BlockHeader& getHeaderByHeight(unsigned height) const;
    bool hasHeaderByHeight(unsigned height) const;
+
+   /**
+    * @return the lowest height at which the main chain got to timestamp,
+    * or the top height if it hasn't yet
+    **/
+   uint32_t getClosestHeightForTime(uint32_t timestamp) const;
    
    const BlockHeader& getHeaderByHash(HashString const & blkHash) const;
    BlockHeader& getHeaderByHash(HashString const & blkHash);
@@ -71,17 +126,31 @@ public:
    }
    
    /**
-    * @return a map of all headers, even with duplicates
+    * @return all headers, even with duplicates
     **/
-   map<HashString, BlockHeader>& allHeaders()
+   BlockHeaderStore& allHeaders()
    {
-      return headerMap_;
+      return headers_;
    }
-   const map<HashString, BlockHeader>& allHeaders() const
+   const BlockHeaderStore& allHeaders() const
    {
-      return headerMap_;
+      return headers_;
    }
 
+   /**
+    * Header snapshot: every header with its height, dupID, blk file 
+    * position and cumulative work, as fixed size records in one flat
+    * checksummed buffer. Loading it skips hashing and the HEADERS DB.
+    **/
+   void writeHeaderSnapshot(BinaryWriter &bw) const;
+   /**
+    * Replaces the headers with the ones in snapshot. Organize the chain
+    * afterwards.
+    * @return the header with the most work, or nullptr if the snapshot 
+    * is corrupt, empty or for another network
+    **/
+   const BlockHeader* loadHeaderSnapshot(BinaryDataRef snapshot);
+
    void putBareHeaders(LMDBBlockDatabase *db, bool updateDupID=true);
    void putNewBareHeaders(LMDBBlockDatabase *db);
 
@@ -96,9 +165,14 @@ private:
 
 private:
    const HashString genesisHash_;
-   map<HashString, BlockHeader> headerMap_;
+   BlockHeaderStore headers_;
    vector<BlockHeader*> newlyParsedBlocks_;
+   // headers organizeChain hasn't looked at yet, orphans stay in here
+   // until their parent shows up
+   vector<BlockHeader*> unorganizedBlocks_;
    deque<BlockHeader*> headersByHeight_;
+   // highest block timestamp up to each height, never decreases
+   deque<uint32_t> maxTimestampByHeight_;
    BlockHeader *topBlockPtr_;
    BlockHeader *genesisBlockBlockPtr_;
    Blockchain(const Blockchain&); // not defined
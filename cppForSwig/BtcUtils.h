@@ -845,9 +845,12 @@ public:
 
       if(fragged)
       {
-         offsetsOut->resize(nOut+1);
-         for(uint32_t i=0; i<nOut+1; i++)
-            (*offsetsOut)[i] = brr.getPosition();
+         if(offsetsOut != NULL)
+         {
+            offsetsOut->resize(nOut+1);
+            for(uint32_t i=0; i<nOut+1; i++)
+               (*offsetsOut)[i] = brr.getPosition();
+         }
       }
       else
       {
@@ -1339,6 +1342,64 @@ public:
        return dDiff;
    }
 
+   /////////////////////////////////////////////////////////////////////////////
+   // Expands the compact target in the diff bits to 32 bytes, little endian 
+   // like the block hash. Returns false if the bits don't encode a valid
+   // target (negative or more than 256 bits).
+   static bool convertDiffBitsToTarget(uint32_t diffBits, uint8_t* target)
+   {
+      memset(target, 0, 32);
+      if (diffBits & 0x00800000)
+         return false;
+
+      // target is mantissa * 256^(exponent-3), a mantissa byte that lands
+      // below byte 0 is shifted out
+      const int exponent = diffBits >> 24;
+      for (int i = 0; i < 3; i++)
+      {
+         const uint8_t val = (diffBits >> (8 * i)) & 0xff;
+         const int pos = exponent - 3 + i;
+         if (pos < 0)
+            continue;
+         if (pos >= 32)
+         {
+            if (val != 0)
+               return false;
+            continue;
+         }
+         target[pos] = val;
+      }
+
+      return true;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   static bool verifyProofOfWork(BinaryDataRef bh80, BinaryDataRef bhrHash)
+   {
+      if (bh80.getSize() < HEADER_SIZE || bhrHash.getSize() != 32)
+         return false;
+
+      uint8_t target[32];
+      if (!convertDiffBitsToTarget(READ_UINT32_LE(bh80.getPtr() + 72), target))
+         return false;
+
+      // compare as 256 bit numbers, most significant byte first
+      for (int i = 31; i >= 0; i--)
+      {
+         if (bhrHash[i] != target[i])
+            return bhrHash[i] < target[i];
+      }
+
+      return true;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   static bool verifyProofOfWork(BinaryDataRef bh80)
+   {
+      BinaryData theHash = getHash256(bh80);
+      return verifyProofOfWork(bh80, theHash.getRef());
+   }
+
 
    // This got more complicated when Bitcoin-Qt 0.8 switched from
    // blk0001.dat to blocks/blk00000.dat
@@ -1643,38 +1704,6 @@ public:
       return *vbd;
    }
 
-   /*
-   static bool verifyProofOfWork(BinaryDataRef bh80)
-   {
-      BinaryData theHash = getHash256(bh80);
-      return verifyProofOfWork(bh80, theHash.getRef());
-   }
-
-   static bool verifyProofOfWork(BinaryData bh80,
-                                 BinaryData const & theHash)
-   {
-      return verifyProofOfWork(bh80.getRef(), theHash.getRef());
-   }
-
-   static bool verifyProofOfWork(BinaryDataRef bh80, BinaryDataRef bhrHash)
-   {
-      // This is only approximate.  I can put in an exact verifier once 
-      // I figure out big integers better in C++, or another way to do
-      // the calculation.  I just want to make sure this isn't a completely
-      // bogus proof of work.
-      double diff = convertDiffBitsToDouble( BinaryDataRef(bh80.getPtr()+72, 4) );
-      double diffFactor = diff * (double)UINT32_MAX;
-      double nZeroBits  = int( log(diffFactor) / log(2.0));
-      int    nZeroBytes = int( log(diffFactor) / log(2.0) / 8.0);
-
-      // TODO: check that I'm comparing the correct end of the hash
-      for(uint32_t i=0; i<nZeroBytes; i++)
-         if(bhrHash[31-i]!=0)
-            return false;
-
-      return true;
-   }
-   */
 
 };
    
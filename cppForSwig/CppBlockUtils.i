@@ -61,6 +61,7 @@
 namespace std
 {
    %template(vector_int) std::vector<int>;
+   %template(vector_uint32_t) std::vector<uint32_t>;
    %template(vector_float) std::vector<float>;
    %template(vector_string) std::vector<string>;
    //%template(vector_BinaryData) std::vector<BinaryData>;
@@ -68,6 +69,7 @@ namespace std
    //%template(vector_LedgerEntryPtr) std::vector<const LedgerEntry*>;
    %template(vector_TxRefPtr) std::vector<TxRef*>;
    %template(vector_Tx) std::vector<Tx>;
+   %template(vector_TxOut) std::vector<TxOut>;
    %template(vector_BlockHeaderPtr) std::vector<BlockHeader>;
    %template(vector_UnspentTxOut) std::vector<UnspentTxOut>;
    %template(vector_AddressBookEntry) std::vector<AddressBookEntry>;
@@ -44,6 +44,10 @@ void StoredDBInfo::unserializeDBValue(BinaryRefReader & brr)
    armoryVer_  =                 bitunpack.getBits(4);
    armoryType_ = (ARMORY_DB_TYPE)bitunpack.getBits(4);
    pruneType_  = (DB_PRUNE_TYPE) bitunpack.getBits(4);
+   sshKeyLayout_ = (SSH_KEY_LAYOUT)bitunpack.getBits(4);
+   txCompression_ = (TXDATA_COMPRESSION)bitunpack.getBits(2);
+   sshKeyMigrating_ = bitunpack.getBit();
+   sshKeyMigrationTarget_ = (SSH_KEY_LAYOUT)bitunpack.getBits(4);
 
    if (brr.getSizeRemaining() == 32)
       brr.get_BinaryData(topScannedBlkHash_, 32);
@@ -56,6 +60,10 @@ void StoredDBInfo::serializeDBValue(BinaryWriter & bw ) const
    bitpack.putBits((uint32_t)armoryVer_,   4);
    bitpack.putBits((uint32_t)armoryType_,  4);
    bitpack.putBits((uint32_t)pruneType_,   4);
+   bitpack.putBits((uint32_t)sshKeyLayout_, 4);
+   bitpack.putBits((uint32_t)txCompression_, 2);
+   bitpack.putBit(sshKeyMigrating_);
+   bitpack.putBits((uint32_t)sshKeyMigrationTarget_, 4);
 
    bw.put_BinaryData(magic_);
    bw.put_BitPacker(bitpack);
@@ -721,10 +729,12 @@ void DBTx::unserializeDBValue(BinaryRefReader & brr)
    //    DBVersion      4 bits
    //    TxVersion      2 bits
    //    HowTxSer       4 bits   (FullTxOut, TxNoTxOuts, numTxOutOnly)
+   //    Compressed     1 bit    (tx data through DBUtils::compressBlock)
    BitUnpacker<uint16_t> bitunpack(brr); // flags
    unserArmVer_  =                    bitunpack.getBits(4);
    unserTxVer_   =                    bitunpack.getBits(2);
    unserTxType_  = (TX_SERIALIZE_TYPE)bitunpack.getBits(4);
+   bool isCompressed =                bitunpack.getBit();
 
    if(unserArmVer_ != ARMORY_DB_VERSION)
       LOGWARN << "Version mismatch in unserialize DB tx";
@@ -732,7 +742,22 @@ void DBTx::unserializeDBValue(BinaryRefReader & brr)
    brr.get_BinaryData(thisHash_, 32);
 
    if(unserTxType_ == TX_SER_FULL || unserTxType_ == TX_SER_FRAGGED)
-      unserialize(brr, unserTxType_==TX_SER_FRAGGED);
+   {
+      if (isCompressed)
+      {
+         BinaryData txData;
+         if (!DBUtils::uncompressBlock(brr, txData))
+         {
+            LOGERR << "Invalid compressed tx data";
+            return;
+         }
+
+         BinaryRefReader brrTx(txData);
+         unserialize(brrTx, unserTxType_==TX_SER_FRAGGED);
+      }
+      else
+         unserialize(brr, unserTxType_==TX_SER_FRAGGED);
+   }
    else
       numTxOut_ = (uint32_t)brr.get_var_int();
 
@@ -748,7 +773,8 @@ void DBTx::unserializeDBValue(BinaryRefReader & brr)
 void StoredTx::serializeDBValue(
       BinaryWriter &    bw,
       ARMORY_DB_TYPE dbType,
-      DB_PRUNE_TYPE
+      DB_PRUNE_TYPE,
+      bool compress
    ) const
 {
    TX_SERIALIZE_TYPE serType;
@@ -780,19 +806,32 @@ void StoredTx::serializeDBValue(
 
    uint16_t version = (uint16_t)READ_UINT32_LE(dataCopy_.getPtr());
 
+   BinaryData txData;
+   if(serType == TX_SER_FULL)
+      txData = getSerializedTx();
+   else if(serType == TX_SER_FRAGGED)
+      txData = getSerializedTxFragged();
+   
+   BinaryWriter bwCompressed;
+   if (compress && txData.getSize() > 0)
+      compress = DBUtils::compressBlock(bwCompressed, txData);
+   else
+      compress = false;
+
    BitPacker<uint16_t> bitpack;
    bitpack.putBits((uint16_t)ARMORY_DB_VERSION,  4);
    bitpack.putBits((uint16_t)version,            2);
    bitpack.putBits((uint16_t)serType,            4);
+   bitpack.putBit(compress);
 
    
    bw.put_BitPacker(bitpack);
    bw.put_BinaryData(thisHash_);
 
-   if(serType == TX_SER_FULL)
-      bw.put_BinaryData(getSerializedTx());
-   else if(serType == TX_SER_FRAGGED)
-      bw.put_BinaryData(getSerializedTxFragged());
+   if(compress)
+      bw.put_BinaryData(bwCompressed.getData());
+   else if(serType == TX_SER_FULL || serType == TX_SER_FRAGGED)
+      bw.put_BinaryData(txData);
    else
       bw.put_var_int(numTxOut_);
 }
@@ -971,20 +1010,35 @@ void StoredTxOut::unserializeDBValue(BinaryRefReader & brr)
    //    DBVersion   4 bits
    //    TxVersion   2 bits
    //    Spentness   2 bits
+   //    Coinbase    1 bit
+   //    Compressed  1 bit    (txout through DBUtils::compressTxOut)
    BitUnpacker<uint16_t> bitunpack(brr);
    unserArmVer_ =                  bitunpack.getBits(4);
    txVersion_   =                  bitunpack.getBits(2);
    spentness_   = (TXOUT_SPENTNESS)bitunpack.getBits(2);
    isCoinbase_  =                  bitunpack.getBit();
+   bool isCompressed =             bitunpack.getBit();
 
-   unserialize(brr);
+   if (isCompressed)
+   {
+      BinaryWriter bwTxOut;
+      if (!DBUtils::uncompressTxOut(brr, bwTxOut))
+      {
+         LOGERR << "Invalid compressed txout data";
+         return;
+      }
+
+      unserialize(bwTxOut.getDataRef());
+   }
+   else
+      unserialize(brr);
    if(spentness_ == TXOUT_SPENT && brr.getSizeRemaining()>=8)
       spentByTxInKey_ = brr.get_BinaryData(8); 
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 void StoredTxOut::serializeDBValue(BinaryWriter & bw, ARMORY_DB_TYPE dbType, DB_PRUNE_TYPE pruneType,
-                                   bool forceSaveSpentness) const
+                                   bool forceSaveSpentness, bool compress) const
 {
    TXOUT_SPENTNESS writeSpent = spentness_;
    
@@ -1005,14 +1059,22 @@ void StoredTxOut::serializeDBValue(BinaryWriter & bw, ARMORY_DB_TYPE dbType, DB_
       }
    }
 
+   BinaryWriter bwCompressed;
+   if (compress)
+      compress = DBUtils::compressTxOut(bwCompressed, dataCopy_);
+
    BitPacker<uint16_t> bitpack;
    bitpack.putBits((uint16_t)ARMORY_DB_VERSION,  4);
    bitpack.putBits((uint16_t)txVersion_,         2);
    bitpack.putBits((uint16_t)writeSpent,         2);
    bitpack.putBit(           isCoinbase_);
+   bitpack.putBit(           compress);
 
    bw.put_BitPacker(bitpack);
-   bw.put_BinaryData(dataCopy_);  // 8-byte value, var_int sz, pkscript
+   if (compress)
+      bw.put_BinaryData(bwCompressed.getData());
+   else
+      bw.put_BinaryData(dataCopy_);  // 8-byte value, var_int sz, pkscript
    
    if(writeSpent == TXOUT_SPENT)
    {
@@ -1755,8 +1817,15 @@ void StoredSubHistory::unserializeDBKey(BinaryDataRef key, bool withPrefix)
       sz -= 1;
    }
 
-   brr.get_BinaryData(uniqueKey_, sz-4);
-   brr.get_BinaryData(hgtX_, 4);
+   BinaryDataRef scrAddr = brr.get_BinaryDataRef(sz-4);
+   setKeyData(scrAddr, brr.get_BinaryDataRef(4));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void StoredSubHistory::setKeyData(BinaryDataRef scrAddr, BinaryDataRef hgtX)
+{
+   uniqueKey_ = scrAddr;
+   hgtX_ = hgtX;
 
    uint8_t* hgtXptr = (uint8_t*)hgtX_.getPtr();
    height_ = 0;
@@ -2585,4 +2654,317 @@ BinaryData DBUtils::heightAndDupToHgtx(uint32_t hgt, uint8_t dup)
    return WRITE_UINT32_BE(hgtxInt);
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// Amounts mostly end in zeros. This packs the count of trailing zeros with
+// the last non zero digit, so round amounts fit a 1 to 3 byte var_int
+static uint64_t compressAmount(uint64_t n)
+{
+   if (n == 0)
+      return 0;
+
+   int e = 0;
+   while ((n % 10) == 0 && e < 9)
+   {
+      n /= 10;
+      e++;
+   }
+
+   if (e < 9)
+   {
+      uint64_t d = n % 10;
+      n /= 10;
+      return 1 + (n * 9 + d - 1) * 10 + e;
+   }
+
+   return 1 + (n - 1) * 10 + 9;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static uint64_t uncompressAmount(uint64_t x)
+{
+   if (x == 0)
+      return 0;
+
+   x--;
+   int e = x % 10;
+   x /= 10;
+
+   uint64_t n;
+   if (e < 9)
+   {
+      uint64_t d = (x % 9) + 1;
+      x /= 9;
+      n = x * 10 + d;
+   }
+   else
+      n = x + 1;
+
+   while (e--)
+      n *= 10;
+
+   return n;
+}
+
+// script templates, in place of the script size
+#define TXOUT_SCRIPT_P2PKH 0
+#define TXOUT_SCRIPT_P2SH  1
+#define TXOUT_SCRIPT_RAW   2
+
+/////////////////////////////////////////////////////////////////////////////
+bool DBUtils::compressTxOut(BinaryWriter & bw, BinaryDataRef txOut)
+{
+   if (txOut.getSize() < 9)
+      return false;
+
+   BinaryRefReader brr(txOut);
+   uint64_t value = brr.get_uint64_t();
+   uint64_t scriptSize = brr.get_var_int();
+   if (scriptSize != brr.getSizeRemaining())
+      return false;
+
+   // amounts without trailing zeros grow about 9 fold, don't overflow
+   if (value > UINT64_MAX / 10)
+      return false;
+
+   BinaryDataRef script = brr.get_BinaryDataRef((uint32_t)scriptSize);
+   const uint8_t* ptr = script.getPtr();
+
+   BinaryWriter bwTxOut;
+   bwTxOut.put_var_int(compressAmount(value));
+
+   if (scriptSize == 25 && ptr[0] == 0x76 && ptr[1] == 0xa9 && 
+       ptr[2] == 0x14 && ptr[23] == 0x88 && ptr[24] == 0xac)
+   {
+      bwTxOut.put_var_int(TXOUT_SCRIPT_P2PKH);
+      bwTxOut.put_BinaryData(ptr + 3, 20);
+   }
+   else if (scriptSize == 23 && ptr[0] == 0xa9 && ptr[1] == 0x14 && 
+            ptr[22] == 0x87)
+   {
+      bwTxOut.put_var_int(TXOUT_SCRIPT_P2SH);
+      bwTxOut.put_BinaryData(ptr + 2, 20);
+   }
+   else
+   {
+      bwTxOut.put_var_int(scriptSize + TXOUT_SCRIPT_RAW);
+      bwTxOut.put_BinaryData(script);
+   }
+
+   if (bwTxOut.getSize() >= txOut.getSize())
+      return false;
+
+   bw.put_BinaryData(bwTxOut.getData());
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool DBUtils::uncompressTxOut(BinaryRefReader & brr, BinaryWriter & txOut)
+{
+   uint64_t value = uncompressAmount(brr.get_var_int());
+   uint64_t scriptType = brr.get_var_int();
+
+   txOut.put_uint64_t(value);
+
+   if (scriptType == TXOUT_SCRIPT_P2PKH)
+   {
+      if (brr.getSizeRemaining() < 20)
+         return false;
+
+      txOut.put_var_int(25);
+      txOut.put_uint8_t(0x76);
+      txOut.put_uint8_t(0xa9);
+      txOut.put_uint8_t(0x14);
+      txOut.put_BinaryData(brr.get_BinaryDataRef(20));
+      txOut.put_uint8_t(0x88);
+      txOut.put_uint8_t(0xac);
+   }
+   else if (scriptType == TXOUT_SCRIPT_P2SH)
+   {
+      if (brr.getSizeRemaining() < 20)
+         return false;
+
+      txOut.put_var_int(23);
+      txOut.put_uint8_t(0xa9);
+      txOut.put_uint8_t(0x14);
+      txOut.put_BinaryData(brr.get_BinaryDataRef(20));
+      txOut.put_uint8_t(0x87);
+   }
+   else
+   {
+      uint64_t scriptSize = scriptType - TXOUT_SCRIPT_RAW;
+      if (brr.getSizeRemaining() < scriptSize)
+         return false;
+
+      txOut.put_var_int(scriptSize);
+      txOut.put_BinaryData(brr.get_BinaryDataRef((uint32_t)scriptSize));
+   }
+
+   return true;
+}
+
+// LZ4 block format parameters
+#define LZ_MINMATCH     4
+#define LZ_LASTLITERALS 5
+#define LZ_MFLIMIT      12
+#define LZ_MAXOFFSET    65535
+#define LZ_HASHLOG      12
+
+/////////////////////////////////////////////////////////////////////////////
+static void lzPutLength(BinaryWriter & bw, size_t len)
+{
+   while (len >= 255)
+   {
+      bw.put_uint8_t(255);
+      len -= 255;
+   }
+   bw.put_uint8_t((uint8_t)len);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static void lzPutSequence(BinaryWriter & bw, const uint8_t* literals, 
+   size_t litLen, size_t offset, size_t matchLen)
+{
+   size_t matchCode = matchLen == 0 ? 0 : matchLen - LZ_MINMATCH;
+   uint8_t token = (uint8_t)((min<size_t>(litLen, 15) << 4) | 
+                              min<size_t>(matchCode, 15));
+   bw.put_uint8_t(token);
+   if (litLen >= 15)
+      lzPutLength(bw, litLen - 15);
+   bw.put_BinaryData(literals, (uint32_t)litLen);
+
+   if (matchLen == 0)
+      return;
+
+   bw.put_uint16_t((uint16_t)offset);
+   if (matchCode >= 15)
+      lzPutLength(bw, matchCode - 15);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool DBUtils::compressBlock(BinaryWriter & bw, BinaryDataRef data)
+{
+   const uint8_t* src = data.getPtr();
+   const size_t srcSize = data.getSize();
+
+   BinaryWriter bwBlock(srcSize);
+   size_t anchor = 0;
+
+   if (srcSize > LZ_MFLIMIT)
+   {
+      vector<uint32_t> table(1 << LZ_HASHLOG, UINT32_MAX);
+      const size_t matchLimit = srcSize - LZ_LASTLITERALS;
+      const size_t mfLimit = srcSize - LZ_MFLIMIT;
+
+      size_t pos = 0;
+      while (pos < mfLimit)
+      {
+         uint32_t seq = READ_UINT32_LE(src + pos);
+         uint32_t h = (seq * 2654435761U) >> (32 - LZ_HASHLOG);
+         uint32_t ref = table[h];
+         table[h] = (uint32_t)pos;
+
+         if (ref == UINT32_MAX || pos - ref > LZ_MAXOFFSET ||
+             READ_UINT32_LE(src + ref) != seq)
+         {
+            pos++;
+            continue;
+         }
+
+         size_t matchLen = LZ_MINMATCH;
+         while (pos + matchLen < matchLimit && 
+                src[ref + matchLen] == src[pos + matchLen])
+            matchLen++;
+
+         lzPutSequence(bwBlock, src + anchor, pos - anchor, pos - ref, 
+            matchLen);
+
+         pos += matchLen;
+         anchor = pos;
+      }
+   }
+
+   lzPutSequence(bwBlock, src + anchor, srcSize - anchor, 0, 0);
+
+   BinaryWriter bwSizes;
+   bwSizes.put_var_int(srcSize);
+   bwSizes.put_var_int(bwBlock.getSize());
+   if (bwSizes.getSize() + bwBlock.getSize() >= srcSize)
+      return false;
+
+   bw.put_BinaryData(bwSizes.getData());
+   bw.put_BinaryData(bwBlock.getData());
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool DBUtils::uncompressBlock(BinaryRefReader & brr, BinaryData & data)
+{
+   uint64_t rawSize = brr.get_var_int();
+   uint64_t blockSize = brr.get_var_int();
+   if (brr.getSizeRemaining() < blockSize || rawSize > UINT32_MAX)
+      return false;
+
+   BinaryDataRef block = brr.get_BinaryDataRef((uint32_t)blockSize);
+   const uint8_t* ip = block.getPtr();
+   const uint8_t* const ipEnd = ip + block.getSize();
+
+   data.resize((size_t)rawSize);
+   uint8_t* const dst = data.getPtr();
+   size_t op = 0;
+
+   auto getLength = [&ip, ipEnd](size_t len, bool& valid)->size_t
+   {
+      if (len != 15)
+         return len;
+
+      uint8_t b;
+      do
+      {
+         if (ip >= ipEnd)
+         {
+            valid = false;
+            return 0;
+         }
+         b = *ip++;
+         len += b;
+      } while (b == 255);
+      return len;
+   };
+
+   while (ip < ipEnd)
+   {
+      bool valid = true;
+      uint8_t token = *ip++;
+
+      size_t litLen = getLength(token >> 4, valid);
+      if (!valid || (size_t)(ipEnd - ip) < litLen || rawSize - op < litLen)
+         return false;
+
+      memcpy(dst + op, ip, litLen);
+      ip += litLen;
+      op += litLen;
+
+      // the last sequence has no match
+      if (ip == ipEnd)
+         break;
+
+      if (ipEnd - ip < 2)
+         return false;
+      size_t offset = READ_UINT16_LE(ip);
+      ip += 2;
+
+      size_t matchLen = getLength(token & 0x0f, valid) + LZ_MINMATCH;
+      if (!valid || offset == 0 || offset > op || rawSize - op < matchLen)
+         return false;
+
+      // matches can overlap their own output, copy byte by byte
+      const uint8_t* match = dst + op - offset;
+      for (size_t i = 0; i < matchLen; i++)
+         dst[op + i] = match[i];
+      op += matchLen;
+   }
+
+   return op == rawSize;
+}
+
 // kate: indent-width 3; replace-tabs on;
@@ -19,6 +19,10 @@
 #include <atomic>
 
 #define ARMORY_DB_VERSION   0x00
+// sdbi version of a supernode BLKDATA db once compressed tx entries may 
+// have been written to it, see TXDATA_COMPRESSION. It is never lowered 
+// again, builds that don't know it refuse the db
+#define ARMORY_DB_VERSION_TXCOMPRESSION   0x01
 #define ARMORY_DB_DEFAULT   ARMORY_DB_FULL
 #define UTXO_STORAGE        SCRIPT_UTXO_VECTOR
 
@@ -45,7 +49,10 @@ enum DB_PREFIX
   DB_PREFIX_UNDODATA,
   DB_PREFIX_TRIENODES,
   DB_PREFIX_COUNT,
-  DB_PREFIX_ZCDATA
+  DB_PREFIX_ZCDATA,
+  DB_PREFIX_BLKFILEPOS,
+  DB_PREFIX_SCRADDRID,
+  DB_PREFIX_SUBSSH
 };
 
 // In ARMORY_DB_PARTIAL and LITE, we may not store full tx, but we will know 
@@ -208,6 +215,18 @@ public:
    static bool checkPrefixByteWError( BinaryRefReader & brr, 
                                       DB_PREFIX prefix,
                                       bool rewindWhenDone=false);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Compact encodings for tx data entries, see TXDATA_COMPRESSION.
+   // The compress calls return false, and write nothing, when the data 
+   // doesn't get any smaller. The uncompress calls return false on 
+   // malformed input
+   static bool compressTxOut(BinaryWriter & bw, BinaryDataRef txOut);
+   static bool uncompressTxOut(BinaryRefReader & brr, BinaryWriter & txOut);
+
+   // LZ4 block format, preceded by the raw and compressed sizes
+   static bool compressBlock(BinaryWriter & bw, BinaryDataRef data);
+   static bool uncompressBlock(BinaryRefReader & brr, BinaryData & data);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -238,6 +257,12 @@ public:
    uint32_t        armoryVer_=ARMORY_DB_VERSION;
    ARMORY_DB_TYPE  armoryType_=ARMORY_DB_WHATEVER;
    DB_PRUNE_TYPE   pruneType_=DB_PRUNE_WHATEVER;
+   SSH_KEY_LAYOUT  sshKeyLayout_=SSH_KEYS_SCRADDR; // only used in HISTORY DB
+   // set while LMDBBlockDatabase::migrateHistoryKeys moves the HISTORY
+   // keys to sshKeyMigrationTarget_, the db then holds both layouts
+   bool            sshKeyMigrating_=false;
+   SSH_KEY_LAYOUT  sshKeyMigrationTarget_=SSH_KEYS_SCRADDR;
+   TXDATA_COMPRESSION txCompression_=TXDATA_RAW; // only used in BLKDATA DB
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -266,7 +291,8 @@ public:
    void       unserializeDBValue(BinaryRefReader &  brr);
    void       serializeDBValue(BinaryWriter & bw, ARMORY_DB_TYPE dbType,
       DB_PRUNE_TYPE pruneType,
-      bool forceSaveSpent = false) const;
+      bool forceSaveSpent = false,
+      bool compress = false) const;
    void       unserializeDBValue(BinaryData const & bd);
    void       unserializeDBValue(BinaryDataRef      bd);
    void       unserializeDBKey(BinaryDataRef key);
@@ -389,7 +415,8 @@ public:
 
    void         serializeDBValue(
       BinaryWriter &    bw,
-      ARMORY_DB_TYPE dbType, DB_PRUNE_TYPE pruneType
+      ARMORY_DB_TYPE dbType, DB_PRUNE_TYPE pruneType,
+      bool compress = false
       ) const;
 
    BinaryData getSerializedTx(void) const;
@@ -548,6 +575,11 @@ public:
    void       unserializeDBKey(BinaryDataRef key, bool withPrefix=true);
    void       getSummary(BinaryRefReader & brr);
 
+   // for keys that don't carry the scrAddr, see SSH_KEY_LAYOUT
+   void       setKeyData(BinaryDataRef scrAddr, BinaryDataRef hgtX);
+
+   // the key in the SSH_KEYS_SCRADDR layout, use 
+   // LMDBBlockDatabase::getSubSSHKey for the db's own
    BinaryData    getDBKey(bool withPrefix=true) const;
    SCRIPT_PREFIX getScriptType(void) const;
    //uint64_t      getTxioCount(void) const {return (uint64_t)txioMap_.size();}
@@ -1,6 +1,8 @@
 #include <limits.h>
 #include <iostream>
 #include <stdlib.h>
+#include <chrono>
+#include <thread>
 #include "gtest.h"
 
 #include "../log.h"
@@ -12,6 +14,7 @@
 #include "../EncryptionUtils.h"
 #include "../lmdb_wrapper.h"
 #include "../BlockUtils.h"
+#include "../BlockWriteBatcher.h"
 #include "../ScrAddrObj.h"
 #include "../BtcWallet.h"
 #include "../BlockDataViewer.h"
@@ -45,6 +48,15 @@
 
 #define TheBDM (*theBDM)
 
+// What tests configure the BDM from. The test chains aren't mined, their 
+// headers don't pass the proof of work check
+static BlockDataManagerConfig testConfig(void)
+{
+   BlockDataManagerConfig config;
+   config.verifyHeaderPoW = false;
+   return config;
+}
+
 static uint32_t getTopBlockHeightInDB(BlockDataManager_LevelDB &bdm, DB_SELECT db)
 {
    StoredDBInfo sdbi;
@@ -143,6 +155,21 @@ static void setBlocks(const std::vector<std::string> &files, const std::string &
       concatFile("../reorgTest/blk_" + f + ".dat", to);
 }
 
+// simulates the zero filled space bitcoind preallocates in blk files, or,
+// with a non zero seed, a corrupted stretch of file
+static void appendGarbage(const std::string &to, size_t count, uint32_t seed=0)
+{
+   std::vector<char> garbage(count, 0);
+   for (size_t i = 0; seed != 0 && i < count; i++)
+   {
+      seed = seed * 1103515245 + 12345;
+      garbage[i] = char(seed >> 16);
+   }
+
+   std::ofstream o(to, ios::app | ios::binary);
+   o.write(&garbage[0], count);
+}
+
 static void nullProgress(unsigned, double, unsigned, unsigned)
 {
 
@@ -2218,6 +2245,28 @@ TEST_F(BtcUtilsTest, BitsToDifficulty)
    EXPECT_DOUBLE_EQ(c, 10076292.883418716);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BtcUtilsTest, VerifyProofOfWork)
+{
+   uint8_t target[32];
+   EXPECT_TRUE(BtcUtils::convertDiffBitsToTarget(0x1d00ffff, target));
+   EXPECT_EQ(target[25], 0x00);
+   EXPECT_EQ(target[26], 0xff);
+   EXPECT_EQ(target[27], 0xff);
+   EXPECT_EQ(target[28], 0x00);
+
+   // negative and oversized targets
+   EXPECT_FALSE(BtcUtils::convertDiffBitsToTarget(0x1d800000, target));
+   EXPECT_FALSE(BtcUtils::convertDiffBitsToTarget(0x23000100, target));
+
+   EXPECT_TRUE(BtcUtils::verifyProofOfWork(rawHead_.getRef(), headHashLE_.getRef()));
+   EXPECT_TRUE(BtcUtils::verifyProofOfWork(rawHead_.getRef()));
+
+   BinaryData badNonce = rawHead_;
+   badNonce[76] ^= 0x01;
+   EXPECT_FALSE(BtcUtils::verifyProofOfWork(badNonce.getRef()));
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 TEST_F(BtcUtilsTest, ScriptToOpCodes)
@@ -2731,6 +2780,239 @@ TEST_F(BlockObjTest, DISABLED_RegisteredTxStuff)
    EXPECT_TRUE(false);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+TEST(BlockHeaderStoreTest, AddFindGrow)
+{
+   BlockHeaderStore store;
+   EXPECT_EQ(store.size(), 0);
+
+   // enough headers to grow the index a few times
+   const uint32_t count = 5000;
+   vector<BinaryData> hashes;
+   vector<BlockHeader*> ptrs;
+   for (uint32_t i = 0; i < count; i++)
+   {
+      BinaryData hash = BtcUtils::getHash256(WRITE_UINT32_LE(i));
+      BlockHeader& bh = store[hash];
+      bh.setBlockSize(i);
+
+      hashes.push_back(hash);
+      ptrs.push_back(&bh);
+   }
+   EXPECT_EQ(store.size(), count);
+
+   // headers don't move as the store grows
+   for (uint32_t i = 0; i < count; i++)
+   {
+      BlockHeader* bh = store.find(hashes[i]);
+      ASSERT_TRUE(bh != nullptr);
+      EXPECT_EQ(bh, ptrs[i]);
+      EXPECT_EQ(bh->getBlockSize(), i);
+   }
+
+   // adding an existing hash returns the same header
+   EXPECT_EQ(&store[hashes[10]], ptrs[10]);
+   EXPECT_EQ(store.size(), count);
+
+   // iteration follows the order headers were added in
+   uint32_t i = 0;
+   for (const BlockHeader& bh : store)
+      EXPECT_EQ(bh.getBlockSize(), i++);
+
+   EXPECT_TRUE(store.find(BtcUtils::getHash256(WRITE_UINT32_LE(count))) == nullptr);
+   EXPECT_TRUE(store.find(READHEX("00112233")) == nullptr);
+   EXPECT_THROW(store[READHEX("00112233")], runtime_error);
+
+   // the store keeps its own copy of the keys, overwriting a header 
+   // doesn't lose it
+   *ptrs[20] = BlockHeader();
+   EXPECT_EQ(store.find(hashes[20]), ptrs[20]);
+
+   store.clear();
+   EXPECT_EQ(store.size(), 0);
+   EXPECT_TRUE(store.find(hashes[0]) == nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// bare difficulty 1 header, the nonce tells siblings apart
+static BlockHeader makeBareHeader(
+   const BinaryData& prevHash, uint32_t nonce, uint32_t timestamp=1231006505)
+{
+   BinaryWriter bw;
+   bw.put_uint32_t(1);
+   bw.put_BinaryData(prevHash);
+   bw.put_BinaryData(BtcUtils::EmptyHash());
+   bw.put_uint32_t(timestamp);
+   bw.put_BinaryData(READHEX("ffff001d"));
+   bw.put_uint32_t(nonce);
+
+   BlockHeader bh;
+   bh.unserialize(bw.getDataRef());
+   return bh;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(BlockchainTest, IncrementalOrganize)
+{
+   auto makeHeader = [](const BinaryData& prevHash, uint32_t nonce)
+   { return makeBareHeader(prevHash, nonce); };
+
+   BlockHeader gen = makeHeader(BtcUtils::EmptyHash(), 0);
+   BlockHeader a = makeHeader(gen.getThisHash(), 1);
+   BlockHeader b = makeHeader(a.getThisHash(), 2);
+   BlockHeader b2 = makeHeader(a.getThisHash(), 3);
+   BlockHeader c2 = makeHeader(b2.getThisHash(), 4);
+   BlockHeader d2 = makeHeader(c2.getThisHash(), 5);
+
+   Blockchain bc(gen.getThisHash());
+   bc.addNewBlock(gen.getThisHash(), gen);
+   bc.addNewBlock(a.getThisHash(), a);
+   bc.addNewBlock(b.getThisHash(), b);
+
+   Blockchain::ReorganizationState state = bc.organize();
+   EXPECT_TRUE(state.prevTopBlockStillValid);
+   EXPECT_TRUE(state.hasNewTop);
+   EXPECT_EQ(bc.top().getThisHash(), b.getThisHash());
+   EXPECT_EQ(bc.top().getBlockHeight(), 2);
+
+   // d2 shows up before its parent, it can't go anywhere yet
+   bc.addNewBlock(d2.getThisHash(), d2);
+   state = bc.organize();
+   EXPECT_TRUE(state.prevTopBlockStillValid);
+   EXPECT_FALSE(state.hasNewTop);
+   EXPECT_TRUE(bc.getHeaderByHash(d2.getThisHash()).isOrphan());
+
+   // the rest of the branch makes it the longest chain
+   bc.addNewBlock(b2.getThisHash(), b2);
+   bc.addNewBlock(c2.getThisHash(), c2);
+   state = bc.organize();
+   EXPECT_FALSE(state.prevTopBlockStillValid);
+   EXPECT_TRUE(state.hasNewTop);
+   ASSERT_TRUE(state.reorgBranchPoint != nullptr);
+   EXPECT_EQ(state.reorgBranchPoint->getThisHash(), a.getThisHash());
+
+   EXPECT_EQ(bc.top().getThisHash(), d2.getThisHash());
+   EXPECT_EQ(bc.top().getBlockHeight(), 4);
+   EXPECT_FALSE(bc.getHeaderByHash(b.getThisHash()).isMainBranch());
+   EXPECT_TRUE(bc.getHeaderByHash(b2.getThisHash()).isMainBranch());
+   EXPECT_EQ(bc.getHeaderByHash(a.getThisHash()).getNextHash(), b2.getThisHash());
+   EXPECT_EQ(bc.getHeaderByHeight(2).getThisHash(), b2.getThisHash());
+   EXPECT_EQ(bc.getHeaderByHeight(4).getThisHash(), d2.getThisHash());
+
+   // seeing a known header again doesn't undo its organization
+   bc.addNewBlock(c2.getThisHash(), c2);
+   EXPECT_TRUE(bc.getHeaderByHash(c2.getThisHash()).isMainBranch());
+   EXPECT_EQ(bc.getHeaderByHash(c2.getThisHash()).getBlockHeight(), 3);
+   state = bc.organize();
+   EXPECT_TRUE(state.prevTopBlockStillValid);
+   EXPECT_FALSE(state.hasNewTop);
+
+   // a full rebuild lands on the same chain
+   state = bc.forceOrganize();
+   EXPECT_EQ(bc.top().getThisHash(), d2.getThisHash());
+   EXPECT_EQ(bc.getHeaderByHeight(3).getThisHash(), c2.getThisHash());
+   EXPECT_FALSE(bc.getHeaderByHash(b.getThisHash()).isMainBranch());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(BlockchainTest, ClosestHeightForTime)
+{
+   // miners' clocks disagree, height 3 goes back in time
+   const uint32_t times[] = { 1000, 1600, 2200, 1900, 2800, 3400 };
+
+   vector<BlockHeader> headers;
+   headers.push_back(makeBareHeader(BtcUtils::EmptyHash(), 0, times[0]));
+   for (uint32_t i = 1; i < 6; i++)
+      headers.push_back(
+         makeBareHeader(headers.back().getThisHash(), i, times[i]));
+
+   Blockchain bc(headers[0].getThisHash());
+   for (auto& bh : headers)
+      bc.addNewBlock(bh.getThisHash(), bh);
+   bc.organize();
+   ASSERT_EQ(bc.top().getBlockHeight(), 5);
+
+   EXPECT_EQ(bc.getClosestHeightForTime(0), 0);
+   EXPECT_EQ(bc.getClosestHeightForTime(1000), 0);
+   EXPECT_EQ(bc.getClosestHeightForTime(1001), 1);
+   EXPECT_EQ(bc.getClosestHeightForTime(1900), 2);
+   EXPECT_EQ(bc.getClosestHeightForTime(2300), 4);
+   EXPECT_EQ(bc.getClosestHeightForTime(3400), 5);
+   EXPECT_EQ(bc.getClosestHeightForTime(10000), 5);
+
+   // a reorg rewrites the index above the branch point
+   BlockHeader fork3 = makeBareHeader(headers[2].getThisHash(), 10, 2250);
+   BlockHeader fork4 = makeBareHeader(fork3.getThisHash(), 11, 2260);
+   BlockHeader fork5 = makeBareHeader(fork4.getThisHash(), 12, 2270);
+   BlockHeader fork6 = makeBareHeader(fork5.getThisHash(), 13, 2280);
+   bc.addNewBlock(fork3.getThisHash(), fork3);
+   bc.addNewBlock(fork4.getThisHash(), fork4);
+   bc.addNewBlock(fork5.getThisHash(), fork5);
+   bc.addNewBlock(fork6.getThisHash(), fork6);
+   bc.organize();
+   ASSERT_EQ(bc.top().getThisHash(), fork6.getThisHash());
+
+   EXPECT_EQ(bc.getClosestHeightForTime(1900), 2);
+   EXPECT_EQ(bc.getClosestHeightForTime(2255), 4);
+   EXPECT_EQ(bc.getClosestHeightForTime(2800), 6);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(BlockchainTest, HeaderSnapshot)
+{
+   vector<BlockHeader> headers;
+   headers.push_back(makeBareHeader(BtcUtils::EmptyHash(), 0));
+   for (uint32_t i = 1; i < 5; i++)
+      headers.push_back(makeBareHeader(headers.back().getThisHash(), i));
+   BlockHeader side = makeBareHeader(headers[2].getThisHash(), 100);
+
+   Blockchain bc(headers[0].getThisHash());
+   for (uint32_t i = 0; i < headers.size(); i++)
+   {
+      BlockHeader& bh = bc.addNewBlock(headers[i].getThisHash(), headers[i]);
+      bh.setBlockFileNum(0);
+      bh.setBlockFileOffset(i * 1000);
+      bh.setBlockSize(285);
+      bh.setNumTx(1);
+   }
+   bc.addNewBlock(side.getThisHash(), side).setDuplicateID(1);
+   bc.organize();
+
+   BinaryWriter bw;
+   bc.writeHeaderSnapshot(bw);
+
+   Blockchain loaded(headers[0].getThisHash());
+   const BlockHeader* mostWork = loaded.loadHeaderSnapshot(bw.getDataRef());
+   ASSERT_TRUE(mostWork != nullptr);
+   EXPECT_EQ(mostWork->getThisHash(), headers[4].getThisHash());
+   EXPECT_EQ(loaded.allHeaders().size(), 6);
+
+   loaded.organize();
+   EXPECT_EQ(loaded.top().getThisHash(), headers[4].getThisHash());
+   EXPECT_EQ(loaded.top().getBlockHeight(), 4);
+   EXPECT_EQ(loaded.top().getOffset(), 4000);
+   EXPECT_EQ(loaded.top().getBlockSize(), 285);
+   EXPECT_EQ(loaded.getHeaderByHeight(2).getThisHash(), headers[2].getThisHash());
+   EXPECT_DOUBLE_EQ(loaded.top().getDifficultySum(), bc.top().getDifficultySum());
+
+   const BlockHeader& loadedSide = loaded.getHeaderByHash(side.getThisHash());
+   EXPECT_FALSE(loadedSide.isMainBranch());
+   EXPECT_EQ(loadedSide.getBlockHeight(), 3);
+   EXPECT_EQ(loadedSide.getDuplicateID(), 1);
+   EXPECT_FALSE(loadedSide.hasFilePos());
+
+   // corrupt, truncated or for another genesis block
+   BinaryData corrupt = bw.getData();
+   corrupt[100] ^= 0xff;
+   Blockchain bc2(headers[0].getThisHash());
+   EXPECT_TRUE(bc2.loadHeaderSnapshot(corrupt.getRef()) == nullptr);
+   EXPECT_TRUE(bc2.loadHeaderSnapshot(
+      bw.getDataRef().getSliceRef(0, bw.getSize() - 1)) == nullptr);
+
+   Blockchain otherNet(headers[1].getThisHash());
+   EXPECT_TRUE(otherNet.loadHeaderSnapshot(bw.getDataRef()) == nullptr);
+}
+
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -3869,6 +4151,66 @@ TEST_F(StoredBlockObjTest, SHeaderFullBlock)
    EXPECT_EQ(bw.getDataRef(), rawBlock_.getRef());
 }
 
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(StoredBlockObjTest, PulledBlockRecycle)
+{
+   PulledBlockPool pool(1);
+
+   auto pb = pool.get();
+   pb->unserializeFullBlock(rawBlock_.getRef(), true, false);
+   ASSERT_EQ(pb->numTx_, 3);
+   ASSERT_EQ(pb->txs_.size(), 3);
+   EXPECT_EQ(pb->txs_[1].stxoCount(), pb->txs_[1].numTxOut_);
+   EXPECT_TRUE(pb->txs_[1].haveAllTxOut());
+
+   BinaryData blockHash = pb->thisHash_;
+   BinaryData txHash = pb->txs_[2].thisHash_;
+   //the scan moves the txouts it hands to a commit out of the block
+   auto heldStxo = move(pb->txs_[2].stxos_[0]);
+   set<StoredTxOut*> freeStxos;
+   for (auto& stxo : pb->txs_[1].stxos_)
+      freeStxos.insert(stxo.get());
+
+   //a block still in use elsewhere is not pooled
+   auto extraRef = pb;
+   pool.recycle(pb);
+   EXPECT_EQ(pool.size(), 0);
+   extraRef.reset();
+
+   PulledBlock* pbPtr = pb.get();
+   pool.recycle(move(pb));
+   EXPECT_EQ(pool.size(), 1);
+
+   //the pool is bounded
+   pool.recycle(make_shared<PulledBlock>());
+   EXPECT_EQ(pool.size(), 1);
+
+   //comes back cleared
+   pb = pool.get();
+   EXPECT_EQ(pb.get(), pbPtr);
+   EXPECT_EQ(pool.size(), 0);
+   EXPECT_TRUE(pb->isNull());
+   EXPECT_EQ(pb->numTx_, UINT32_MAX);
+   for (auto& stx : pb->txs_)
+   {
+      EXPECT_FALSE(stx.inUse_);
+      EXPECT_EQ(stx.stxos_.size(), 0);
+   }
+
+   //refilled, reusing only the txouts left in the block
+   pb->unserializeFullBlock(rawBlock_.getRef(), true, false);
+   EXPECT_EQ(pb->thisHash_, blockHash);
+   EXPECT_EQ(pb->txs_[2].thisHash_, txHash);
+   EXPECT_TRUE(pb->txs_[2].inUse_);
+   EXPECT_NE(pb->txs_[2].stxos_[0], heldStxo);
+   EXPECT_EQ(pb->txs_[2].stxos_[0]->getSerializedTxOut(), 
+      heldStxo->getSerializedTxOut());
+
+   ASSERT_EQ(pb->txs_[1].stxos_.size(), freeStxos.size());
+   for (auto& stxo : pb->txs_[1].stxos_)
+      EXPECT_EQ(freeStxos.count(stxo.get()), 1);
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 TEST_F(StoredBlockObjTest, SUndoDataSer)
@@ -4951,7 +5293,7 @@ protected:
 
 
    LMDBBlockDatabase* iface_;
-   BlockDataManagerConfig config_;
+   BlockDataManagerConfig config_ = testConfig();
    vector<pair<BinaryData, BinaryData> > expectOutH_;
    vector<pair<BinaryData, BinaryData> > expectOutB_;
 
@@ -5122,397 +5464,1087 @@ TEST_F(LMDBTest, PutGetDelete)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(LMDBTest, STxOutPutGet)
+TEST_F(LMDBTest, IteratorRefsOutliveTx)
 {
-   BinaryData TXP     = WRITE_UINT8_BE((uint8_t)DB_PREFIX_TXDATA);
-   BinaryData stxoVal = READHEX("0400") + rawTxOut0_;
-   BinaryData stxoKey = TXP + READHEX("01e078""0f""0007""0001");
-   
-   ASSERT_TRUE(standardOpenDBs());
-   LMDBEnv::Transaction txh(iface_->dbEnv_[HEADERS].get(), LMDB::ReadWrite);
-   LMDBEnv::Transaction txH(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType);
 
-   StoredTxOut stxo0;
-   stxo0.txVersion_   = 1;
-   stxo0.spentness_   = TXOUT_UNSPENT;
-   stxo0.blockHeight_ = 123000;
-   stxo0.duplicateID_ = 15;
-   stxo0.txIndex_     = 7;
-   stxo0.txOutIndex_  = 1;
-   stxo0.unserialize(rawTxOut0_);
-   iface_->putStoredTxOut(stxo0);
+   ASSERT_TRUE(iface_->databasesAreOpen());
 
-   // Construct expected output
-   addOutPairB(stxoKey, stxoVal);
-   ASSERT_TRUE(compareKVListRange(0,1, 0,2));
+   BinaryData keyA = READHEX("0a0001");
+   BinaryData keyB = READHEX("0a0002");
+   BinaryData valA = READHEX("abcd1234");
+   BinaryData valB = READHEX("5678ef");
 
-   StoredTxOut stxoGet;
-   iface_->getStoredTxOut(stxoGet, 123000, 15, 7, 1);
-   EXPECT_EQ(
-      serializeDBValue(stxoGet, ARMORY_DB_FULL, DB_PRUNE_NONE),
-      serializeDBValue(stxo0, ARMORY_DB_FULL, DB_PRUNE_NONE)
-   );
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+      iface_->putValue(HISTORY, keyA, valA);
+      iface_->putValue(HISTORY, keyB, valB);
+   }
 
-   //iface_->validDupByHeight_[123000] = 15;
-   //iface_->getStoredTxOut(stxoGet, 123000, 7, 1);
-   //EXPECT_EQ(serializeDBValue(stxoGet), serializeDBValue(stxo0));
-   
-   StoredTxOut stxo1;
-   stxo1.txVersion_   = 1;
-   stxo1.spentness_   = TXOUT_UNSPENT;
-   stxo1.blockHeight_ = 200333;
-   stxo1.duplicateID_ = 3;
-   stxo1.txIndex_     = 7;
-   stxo1.txOutIndex_  = 1;
-   stxo1.unserialize(rawTxOut1_);
-   stxoVal = READHEX("0400") + rawTxOut1_;
-   stxoKey = TXP + READHEX("030e8d""03""00070001");
-   iface_->putStoredTxOut(stxo1);
+   LMDB::Iterator iter;
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadOnly);
+
+      LDBIter ldbIter = iface_->getIterator(HISTORY);
+      ASSERT_TRUE(ldbIter.seekToExact(keyA));
+      EXPECT_EQ(ldbIter.getKeyRef(), keyA);
+      EXPECT_EQ(ldbIter.getValueRef(), valA);
+
+      // copies taken before the cursor moves stay put
+      BinaryData valCopy = ldbIter.getValue();
+      ASSERT_TRUE(ldbIter.advanceAndRead());
+      EXPECT_EQ(ldbIter.getKeyRef(), keyB);
+      EXPECT_EQ(valCopy, valA);
+
+      iter = iface_->dbs_[HISTORY].cursor();
+      iter.setCopyData(false);
+      iter.seek(CharacterArrayRef(keyB.getSize(), keyB.getPtr()));
+      ASSERT_TRUE(iter.isValid());
+   }
 
-   iface_->getStoredTxOut(stxoGet, 123000, 15, 7, 1);
-   EXPECT_EQ(
-      serializeDBValue(stxoGet, ARMORY_DB_FULL, DB_PRUNE_NONE),
-      serializeDBValue(stxo0, ARMORY_DB_FULL, DB_PRUNE_NONE)
-   );
-   iface_->getStoredTxOut(stxoGet, 200333,  3, 7, 1);
-   EXPECT_EQ(
-      serializeDBValue(stxoGet, ARMORY_DB_FULL, DB_PRUNE_NONE),
-      serializeDBValue(stxo1, ARMORY_DB_FULL, DB_PRUNE_NONE)
-   );
+   // the transaction is gone, the iterator kept its own copy
+   ASSERT_TRUE(iter.isValid());
+   EXPECT_EQ(iter.key(), string((const char*)keyB.getPtr(), keyB.getSize()));
+   EXPECT_EQ(iter.value(), string((const char*)valB.getPtr(), valB.getSize()));
+}
 
-   addOutPairB(stxoKey, stxoVal);
-   ASSERT_TRUE(compareKVListRange(0,1, 0,3));
+////////////////////////////////////////////////////////////////////////////////
+// Fills HISTORY with count 4 byte keys, each mapping to its own index
+static void fillIndexedValues(LMDBBlockDatabase* iface, uint32_t count)
+{
+   LMDBEnv::Transaction tx(iface->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+   for (uint32_t i = 0; i < count; i++)
+      iface->putValue(HISTORY, WRITE_UINT32_BE(i), WRITE_UINT32_LE(i));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Does reads lookups of random keys out of the count filled in, perTx to a 
+// transaction. Returns how many values didn't match
+static uint32_t readIndexedValues(LMDBBlockDatabase* iface, 
+   uint32_t count, uint32_t reads, uint32_t seed, uint32_t perTx)
+{
+   LMDBEnv* env = iface->dbEnv_[HISTORY].get();
+   uint32_t mismatches = 0;
+   uint32_t key = seed;
+
+   for (uint32_t i = 0; i < reads; i += perTx)
+   {
+      LMDBEnv::Transaction tx(env, LMDB::ReadOnly);
+      for (uint32_t j = 0; j < perTx; j++)
+      {
+         // nested transactions are bookkeeping only
+         LMDBEnv::Transaction nested(env, LMDB::ReadOnly);
+         key = (key * 1103515245 + 12345) % count;
+         BinaryRefReader brr = iface->getValueReader(
+            HISTORY, WRITE_UINT32_BE(key));
+         if (brr.getSize() != 4 || brr.get_uint32_t() != key)
+            mismatches++;
+      }
+   }
 
+   return mismatches;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(LMDBTest, PutFullBlockNoTx)
+TEST_F(LMDBTest, ConcurrentReadTransactions)
 {
-//    DBUtils::setArmoryDbType(ARMORY_DB_FULL);
-//    DBUtils::setDbPruneType(DB_PRUNE_NONE);
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType);
 
-   StoredHeader sbh;
-   BinaryRefReader brr(rawBlock_);
-   sbh.unserializeFullBlock(brr);
-   sbh.setKeyData(123000, UINT8_MAX);
+   ASSERT_TRUE(iface_->databasesAreOpen());
 
-   StoredHeadHgtList hhl;
-   hhl.height_ = 123000;
-   hhl.dupAndHashList_.push_back( pair<uint8_t, BinaryData>(0, sbh.thisHash_));
-   hhl.preferredDup_ = UINT8_MAX;
+   const uint32_t count = 1000;
+   fillIndexedValues(iface_, count);
 
-   BinaryData TXP   = WRITE_UINT8_BE((uint8_t)DB_PREFIX_TXDATA);
-   BinaryData HHP   = WRITE_UINT8_BE((uint8_t)DB_PREFIX_HEADHASH);
-   BinaryData HGP   = WRITE_UINT8_BE((uint8_t)DB_PREFIX_HEADHGT);
-   BinaryData hgtx  = READHEX("01e078""00");
-   BinaryData sbh_HH_key = HHP + sbh.thisHash_;
-   BinaryData sbh_HH_val = sbh.dataCopy_ + hgtx + READHEX("46040000");
-   BinaryData sbh_HG_key = hhl.getDBKey();
-   BinaryData sbh_HG_val = hhl.serializeDBValue();
-   
-   ASSERT_TRUE(standardOpenDBs());
-   LMDBEnv::Transaction txh(iface_->dbEnv_[HEADERS].get(), LMDB::ReadWrite);
-   LMDBEnv::Transaction txH(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+   vector<uint32_t> mismatches(4, 0);
+   vector<thread> readers;
+   for (uint32_t t = 0; t < mismatches.size(); t++)
+   {
+      readers.push_back(thread([&, t](void)->void
+         { mismatches[t] = readIndexedValues(iface_, count, count * 4, t, 16); }));
+   }
 
-   addOutPairH( sbh_HH_key, sbh_HH_val);
-   addOutPairH( sbh_HG_key, sbh_HG_val);
+   // the main thread can keep reading while the others do
+   EXPECT_EQ(readIndexedValues(iface_, count, count, 99, 1), 0);
 
-   brr.resetPosition();
-   testBlockHeader bh;
-   bh.unserialize(brr);
-   bh.setDuplicateID(0);
-   bh.setBlockHeight(123000);
+   for (auto& reader : readers)
+      reader.join();
 
-   auto getBH = [&](const BinaryData& hash)->const BlockHeader&
-   { return bh; };
-   uint8_t sdup = iface_->putRawBlockData(brr, getBH);
-   EXPECT_TRUE(compareKVListRange(0,1, 0,1));
-   EXPECT_EQ(sdup, 0);
+   for (auto mismatch : mismatches)
+      EXPECT_EQ(mismatch, 0);
 
-   // Try adding it again and see if get the correct dup again, and no touch DB
-   sdup = iface_->putRawBlockData(brr, getBH);
-   EXPECT_TRUE(compareKVListRange(0,1, 0, 1));
-   EXPECT_EQ(sdup, 0);
+   // every thread released its transaction, a write goes through
+   LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+   iface_->putValue(HISTORY, WRITE_UINT32_BE(count), WRITE_UINT32_LE(count));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(LMDBTest, PutGetBareHeader)
+// Short read transactions from a growing number of threads. With the 
+// transaction state kept per thread, the reads/s should go up with the 
+// thread count until the cores run out
+TEST_F(LMDBTest, DISABLED_ConcurrentReadScaling_usuallydisabled)
 {
-//    DBUtils::setArmoryDbType(ARMORY_DB_FULL);
-//    DBUtils::setDbPruneType(DB_PRUNE_NONE);
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType);
 
-   StoredHeader sbh;
-   BinaryRefReader brr(rawBlock_);
-   sbh.unserializeFullBlock(brr);
-   sbh.setKeyData(123000, UINT8_MAX);
-   BinaryData header0 = sbh.thisHash_;
+   ASSERT_TRUE(iface_->databasesAreOpen());
 
-   ASSERT_TRUE(standardOpenDBs());
-   LMDBEnv::Transaction txh(iface_->dbEnv_[HEADERS].get(), LMDB::ReadWrite);
-   LMDBEnv::Transaction txH(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+   const uint32_t count = 100000;
+   const uint32_t readsPerThread = 1000000;
+   fillIndexedValues(iface_, count);
 
-   uint8_t sdup = iface_->putBareHeader(sbh);
-   EXPECT_EQ(sdup, 0);
-   EXPECT_EQ(sbh.duplicateID_, 0);
+   const unsigned maxThreads = max(thread::hardware_concurrency(), 1U);
+   for (unsigned nThreads = 1; nThreads <= maxThreads; nThreads *= 2)
+   {
+      vector<thread> readers;
+      const auto start = chrono::steady_clock::now();
 
-   // Add a new header and make sure duplicate ID is done correctly
-   BinaryData newHeader = READHEX( 
-      "0000000105d3571220ef5f87c6ac0bc8bf5b33c02a9e6edf83c84d840109592c"
-      "0000000027523728e15f5fe1ac507bff92499eada4af8a0c485d5178e3f96568"
-      "c18f84994e0e4efc1c0175d646a91ad4");
-   BinaryData header1 = BtcUtils::getHash256(newHeader);
+      for (unsigned t = 0; t < nThreads; t++)
+      {
+         readers.push_back(thread([&, t](void)->void
+            { readIndexedValues(iface_, count, readsPerThread, t, 4); }));
+      }
 
-   StoredHeader sbh2;
-   sbh2.setHeaderData(newHeader);
-   sbh2.setKeyData(123000, UINT8_MAX);
-   
-   uint8_t newDup = iface_->putBareHeader(sbh2);
-   EXPECT_EQ(newDup, 1);
-   EXPECT_EQ(sbh2.duplicateID_, 1);
-   
-   // Now add a new, isMainBranch_ header
-   StoredHeader sbh3;
-   BinaryData anotherHead = READHEX(
-      "010000001d8f4ec0443e1f19f305e488c1085c95de7cc3fd25e0d2c5bb5d0000"
-      "000000009762547903d36881a86751f3f5049e23050113f779735ef82734ebf0"
-      "b4450081d8c8c84db3936a1a334b035b");
-   BinaryData header2 = BtcUtils::getHash256(anotherHead);
+      for (auto& reader : readers)
+         reader.join();
 
-   sbh3.setHeaderData(anotherHead);
-   sbh3.setKeyData(123000, UINT8_MAX);
-   sbh3.isMainBranch_ = true;
-   uint8_t anotherDup = iface_->putBareHeader(sbh3);
-   EXPECT_EQ(anotherDup, 2);
-   EXPECT_EQ(sbh3.duplicateID_, 2);
-   EXPECT_EQ(iface_->getValidDupIDForHeight(123000), 2);
-   
-   // Now test getting bare headers
-   StoredHeader sbh4;
-   iface_->getBareHeader(sbh4, 123000);
-   EXPECT_EQ(sbh4.thisHash_, header2);
-   EXPECT_EQ(sbh4.duplicateID_, 2);
-   
-   iface_->getBareHeader(sbh4, 123000, 1);
-   EXPECT_EQ(sbh4.thisHash_, header1);
-   EXPECT_EQ(sbh4.duplicateID_, 1);
-
-   // Re-add the same SBH3, make sure nothing changes
-   iface_->putBareHeader(sbh3);
-   EXPECT_EQ(sbh3.duplicateID_, 2);
-   EXPECT_EQ(iface_->getValidDupIDForHeight(123000), 2);
+      const chrono::duration<double> elapsed =
+         chrono::steady_clock::now() - start;
+      cout << nThreads << " threads: " 
+         << (nThreads * readsPerThread) / elapsed.count() << " reads/s" << endl;
+   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(LMDBTest, DISABLED_PutFullBlock)
+TEST_F(LMDBTest, TuningProfiles)
 {
-//    DBUtils::setArmoryDbType(ARMORY_DB_FULL);
-//    DBUtils::setDbPruneType(DB_PRUNE_NONE);
-   ASSERT_TRUE(standardOpenDBs());
+   EXPECT_THROW(config_.selectDbProfile("Floppy"), runtime_error);
 
-   StoredHeader sbh;
-   BinaryRefReader brr(rawBlock_);
-   sbh.unserializeFullBlock(brr);
-   sbh.setKeyData(123000);
+   config_.selectDbProfile("SSD");
+   EXPECT_TRUE(config_.dbTuning.writeMap);
+   EXPECT_FALSE(config_.dbTuning.readAhead);
+   EXPECT_TRUE(config_.dbTuning.checkpointAfterUpdate);
 
-   BinaryData rawHeader = READHEX(
-      "01000000eb10c9a996a2340a4d74eaab41421ed8664aa49d18538bab59010000"
-      "000000005a2f06efa9f2bd804f17877537f2080030cadbfa1eb50e02338117cc"
-      "604d91b9b7541a4ecfbb0a1a64f1ade7");
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType,
+      config_.dbTuning);
 
-   // Compute and write the headers to the expected-output
-   StoredHeadHgtList hhl;
-   hhl.height_ = 123000;
-   hhl.dupAndHashList_.push_back( pair<uint8_t, BinaryData>(0, sbh.thisHash_));
-   hhl.preferredDup_ = UINT8_MAX;
-   BinaryData HHP   = WRITE_UINT8_BE((uint8_t)DB_PREFIX_HEADHASH);
-   BinaryData HGP   = WRITE_UINT8_BE((uint8_t)DB_PREFIX_HEADHGT);
-   BinaryData sbh_HH_key = HHP + sbh.thisHash_;
-   BinaryData sbh_HH_val = rawHeader + READHEX("01e078""00") + READHEX("46040000");
-   BinaryData sbh_HG_key = hhl.getDBKey();
-   BinaryData sbh_HG_val = hhl.serializeDBValue();
-   // Only HEADHASH and HEADHGT entries get written
-   addOutPairH( sbh_HH_key, sbh_HH_val);
-   addOutPairH( sbh_HG_key, sbh_HG_val);
+   ASSERT_TRUE(iface_->databasesAreOpen());
 
-   // Now compute and write the BLKDATA
-   BinaryData TXP       = WRITE_UINT8_BE((uint8_t)DB_PREFIX_TXDATA);
-   BinaryData sbhKey    = TXP + READHEX("01e078""00");
-   BinaryData stx0Key   = sbhKey  + READHEX("0000");
-   BinaryData stx1Key   = sbhKey  + READHEX("0001");
-   BinaryData stx2Key   = sbhKey  + READHEX("0002");
-   BinaryData stxo00Key = stx0Key + READHEX("0000");
-   BinaryData stxo10Key = stx1Key + READHEX("0000");
-   BinaryData stxo11Key = stx1Key + READHEX("0001");
-   BinaryData stxo20Key = stx2Key + READHEX("0000");
-   BinaryData stxo21Key = stx2Key + READHEX("0001");
-   BinaryData stxo00Raw = READHEX( "00f2052a01000000""434104"
-      "c2239c4eedb3beb26785753463be3ec62b82f6acd62efb65f452f8806f2ede0b"
-      "338e31d1f69b1ce449558d7061aa1648ddc2bf680834d3986624006a272dc21cac");
-   BinaryData stxo10Raw = READHEX( "40420f0000000000"
-      "19""76a914adfa66f57ded1b655eb4ccd96ee07ca62bc1ddfd88ac");
-   BinaryData stxo11Raw = READHEX( "007d6a7d04000000"
-      "19""76a914981a0c9ae61fa8f8c96ae6f8e383d6e07e77133e88ac");
-   BinaryData stxo20Raw = READHEX( "2f66ac6105000000"
-      "19""76a914964642290c194e3bfab661c1085e47d67786d2d388ac");
-   BinaryData stxo21Raw = READHEX( "2f77e20000000000"
-      "19""76a9141486a7046affd935919a3cb4b50a8a0c233c286c88ac");
+   const uint32_t count = 20000;
+   fillIndexedValues(iface_, count);
+   iface_->checkpoint();
+   iface_->closeDatabases();
 
-   StoredTx & stx0 = sbh.stxMap_[0];
-   StoredTx & stx1 = sbh.stxMap_[1];
-   StoredTx & stx2 = sbh.stxMap_[2];
-   BinaryData hflags = READHEX("01340000");
-   BinaryData ntx    = READHEX("03000000");
-   BinaryData nbyte  = READHEX("46040000");
+   // a different profile opens the same files
+   config_.selectDbProfile("HDD");
+   EXPECT_EQ(config_.dbTuning.sync, LMDB_SYNC_DATA);
+   EXPECT_FALSE(config_.dbTuning.checkpointAfterUpdate);
 
-   // Add header to BLKDATA
-   addOutPairB(sbhKey, hflags + rawHeader + ntx + nbyte);
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType,
+      config_.dbTuning);
 
-   // Add Tx0 to BLKDATA
-   addOutPairB(stx0Key,   READHEX("0440") + stx0.thisHash_ + stx0.getSerializedTxFragged());
-   addOutPairB(stxo00Key, READHEX("0480") + stxo00Raw); // is coinbase
+   ASSERT_TRUE(iface_->databasesAreOpen());
+   EXPECT_EQ(readIndexedValues(iface_, count, count, 7, 100), 0);
 
-   // Add Tx1 to BLKDATA
-   addOutPairB(stx1Key,   READHEX("0440") + stx1.thisHash_ + stx1.getSerializedTxFragged());
-   addOutPairB(stxo10Key, READHEX("0400") + stxo10Raw);
-   addOutPairB(stxo11Key, READHEX("0400") + stxo11Raw);
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+      iface_->putValue(HISTORY, WRITE_UINT32_BE(count), WRITE_UINT32_LE(count));
+   }
+   
+   LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadOnly);
+   EXPECT_EQ(iface_->getValue(HISTORY, WRITE_UINT32_BE(count)),
+      WRITE_UINT32_LE(count));
+}
 
-   // Add Tx2 to BLKDATA
-   addOutPairB(stx2Key,   READHEX("0440") + stx2.thisHash_ + stx2.getSerializedTxFragged());
-   addOutPairB(stxo20Key, READHEX("0400") + stxo20Raw);
-   addOutPairB(stxo21Key, READHEX("0400") + stxo21Raw);
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(LMDBTest, AppendMode)
+{
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType);
 
-   // DuplicateID values get set when we putStoredHeader since we don't know
-   // what dupIDs have been taken until we try to put it in the database.
-   ASSERT_EQ(sbh.stxMap_.size(), 3);
-   for(uint32_t i=0; i<3; i++)
+   ASSERT_TRUE(iface_->databasesAreOpen());
+   EXPECT_TRUE(iface_->dbs_[BLKDATA].appendMode());
+   EXPECT_FALSE(iface_->dbs_[HISTORY].appendMode());
+
+   map<BinaryData, BinaryData> expected;
+   auto put = [&](uint32_t k, uint32_t v)->void
    {
-      ASSERT_EQ(sbh.stxMap_[i].blockHeight_,    123000);
-      ASSERT_EQ(sbh.stxMap_[i].duplicateID_, UINT8_MAX);
-      ASSERT_EQ(sbh.stxMap_[i].txIndex_,             i);
-      for(uint32_t j=0; j<sbh.stxMap_[i].stxoMap_.size(); j++)
-      {
-         sbh.stxMap_[i].stxoMap_[j].spentness_ = TXOUT_UNSPENT;
-         //sbh.stxoMap_[i].isCoinbase_ = (j==0);
+      iface_->putValue(BLKDATA, WRITE_UINT32_BE(k), WRITE_UINT32_LE(v));
+      expected[WRITE_UINT32_BE(k)] = WRITE_UINT32_LE(v);
+   };
 
-         ASSERT_EQ(sbh.stxMap_[i].stxoMap_[j].blockHeight_,    123000);
-         ASSERT_EQ(sbh.stxMap_[i].stxoMap_[j].duplicateID_, UINT8_MAX);
-         ASSERT_EQ(sbh.stxMap_[i].stxoMap_[j].txIndex_,             i);
-         ASSERT_EQ(sbh.stxMap_[i].stxoMap_[j].txOutIndex_,          j);
-      }
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[BLKDATA].get(), LMDB::ReadWrite);
+      
+      // in order, then a few out of order, overwrites and deletes
+      for (uint32_t i = 10; i < 5000; i += 2)
+         put(i, i);
+      put(5, 5);
+      put(11, 11);
+      put(100, 0);
+      put(4998, 1);
+
+      iface_->deleteValue(BLKDATA, WRITE_UINT32_BE(4998));
+      expected.erase(WRITE_UINT32_BE(4998));
+      put(4997, 4997);
+      put(6000, 6000);
    }
 
-   iface_->putStoredHeader(sbh);
+   {
+      // a different writer extends the db behind the cached last key
+      LMDBEnv::Transaction tx(iface_->dbEnv_[BLKDATA].get(), LMDB::ReadWrite);
+      iface_->dbs_[BLKDATA].setAppendMode(false);
+      put(7000, 7000);
+      iface_->dbs_[BLKDATA].setAppendMode(true);
+      put(6500, 6500);
+      put(8000, 8000);
+   }
 
-   ASSERT_TRUE(compareKVListRange(0,3, 0,9));
+   LMDBEnv::Transaction tx(iface_->dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
+   LDBIter ldbIter = iface_->getIterator(BLKDATA);
+   auto expIter = expected.begin();
+   // skip the sdbi
+   ASSERT_TRUE(ldbIter.seekTo(expIter->first));
+   do
+   {
+      ASSERT_TRUE(expIter != expected.end());
+      EXPECT_EQ(ldbIter.getKeyRef(), expIter->first);
+      EXPECT_EQ(ldbIter.getValueRef(), expIter->second);
+      ++expIter;
+   } while (ldbIter.advanceAndRead());
+   EXPECT_TRUE(expIter == expected.end());
 }
 
-
-
 ////////////////////////////////////////////////////////////////////////////////
-// Of course, this test only works if the previous test passes (but doesn't 
-// require a saved state, it just re-puts the full block into the DB).  I
-// did it this way, because I wasn't comfortable committing the pre-filled
-// DB to the repo.
-TEST_F(LMDBTest, DISABLED_GetFullBlock)
+TEST_F(LMDBTest, CompactWhileReading)
 {
-//    DBUtils::setArmoryDbType(ARMORY_DB_FULL);
-//    DBUtils::setDbPruneType(DB_PRUNE_NONE);
-   ASSERT_TRUE(standardOpenDBs());
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType);
 
-   StoredHeader sbh;
-   BinaryRefReader brr(rawBlock_);
-   sbh.unserializeFullBlock(brr);
-   sbh.setKeyData(123000);
-   sbh.isMainBranch_ = true;
+   ASSERT_TRUE(iface_->databasesAreOpen());
 
-   // Check the DBInfo before and after putting the valid header
-   StoredDBInfo sdbi;
-   iface_->getStoredDBInfo(HEADERS, sdbi);
-   EXPECT_EQ(sdbi.topBlkHgt_,  0);
-   EXPECT_EQ(sdbi.topBlkHash_, iface_->getGenesisBlockHash());
+   // fill, then drop 3 keys out of 4 to leave the file mostly free pages
+   const uint32_t count = 50000;
+   fillIndexedValues(iface_, count);
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+      for (uint32_t i = 0; i < count; i++)
+      {
+         if (i % 4 != 0)
+            iface_->deleteValue(HISTORY, WRITE_UINT32_BE(i));
+      }
+   }
 
-   iface_->putStoredHeader(sbh);
+   const string historyFile = config_.levelDBLocation + "/history";
+   const uint64_t sizeBefore = BtcUtils::GetFileSize(historyFile);
 
-   // Since we marked this block main-branch, it should have non-MAX validDup
-   EXPECT_EQ(iface_->getValidDupIDForHeight(123000), 0);
-   BinaryData headerHash = READHEX(
-      "7d97d862654e03d6c43b77820a40df894e3d6890784528e9cd05000000000000");
-   iface_->getStoredDBInfo(HEADERS, sdbi);
-   EXPECT_EQ(sdbi.topBlkHgt_,  123000);
-   EXPECT_EQ(sdbi.topBlkHash_, headerHash);
+   // a reader keeps going through the copy and the swap
+   atomic<bool> done(false);
+   uint32_t mismatches = 0, reads = 0;
+   thread reader([&](void)->void
+   {
+      LMDBEnv* env = iface_->dbEnv_[HISTORY].get();
+      uint32_t key = 0;
+      while (!done)
+      {
+         LMDBEnv::Transaction tx(env, LMDB::ReadOnly);
+         key = (key + 4) % count;
+         BinaryRefReader brr = iface_->getValueReader(
+            HISTORY, WRITE_UINT32_BE(key));
+         if (brr.getSize() != 4 || brr.get_uint32_t() != key)
+            mismatches++;
+         reads++;
+      }
+   });
 
-   BinaryData rawHeader = READHEX(
-      "01000000eb10c9a996a2340a4d74eaab41421ed8664aa49d18538bab59010000"
-      "000000005a2f06efa9f2bd804f17877537f2080030cadbfa1eb50e02338117cc"
-      "604d91b9b7541a4ecfbb0a1a64f1ade7");
+   EXPECT_GT(iface_->compactDatabases(), 0);
+   done = true;
+   reader.join();
 
-   ////////////////////
-   // Now test the get methods
-  
-   for(uint32_t i=0; i<4; i++)
-   {
-      StoredHeader sbhGet;
+   EXPECT_EQ(mismatches, 0);
+   EXPECT_GT(reads, 0);
+   EXPECT_LT(BtcUtils::GetFileSize(historyFile), sizeBefore);
+   EXPECT_EQ(BtcUtils::GetFileSize(historyFile + ".compact"), 
+      FILE_DOES_NOT_EXIST);
 
-      if(i==0)
-         EXPECT_TRUE(iface_->getStoredHeader(sbhGet, 123000, 0, false));
-      else if(i==1)
-         EXPECT_TRUE(iface_->getStoredHeader(sbhGet, headerHash, false));
-      else if(i==2)
-         EXPECT_TRUE(iface_->getStoredHeader(sbhGet, 123000, 0, true));
-      else if(i==3)
-         EXPECT_TRUE(iface_->getStoredHeader(sbhGet, headerHash, true));
+   // the dbs work as before on the new file
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+      iface_->putValue(HISTORY, WRITE_UINT32_BE(count), WRITE_UINT32_LE(count));
+   }
 
-      EXPECT_TRUE( sbhGet.isInitialized());
-      EXPECT_EQ(   sbhGet.dataCopy_,    rawHeader);
-      EXPECT_EQ(   sbhGet.thisHash_,    headerHash);
-      EXPECT_EQ(   sbhGet.numTx_,       3);
-      EXPECT_EQ(   sbhGet.numBytes_,    1094);
-      EXPECT_EQ(   sbhGet.blockHeight_, 123000);
-      EXPECT_EQ(   sbhGet.duplicateID_, 0);
-      EXPECT_EQ(   sbhGet.merkle_.getSize(), 0);
-      EXPECT_FALSE(sbhGet.merkleIsPartial_);
-      EXPECT_EQ(   sbhGet.unserArmVer_, 0);
-      EXPECT_EQ(   sbhGet.unserBlkVer_, 1);
-      EXPECT_EQ(   sbhGet.unserDbType_, ARMORY_DB_FULL);
-      EXPECT_EQ(   sbhGet.unserPrType_, DB_PRUNE_NONE);
+   iface_->closeDatabases();
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType);
 
-      if(i<2)
-         EXPECT_EQ( sbhGet.stxMap_.size(), 0);
-      else
+   LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadOnly);
+   for (uint32_t i = 0; i <= count; i++)
+   {
+      BinaryRefReader brr = iface_->getValueReader(
+         HISTORY, WRITE_UINT32_BE(i));
+      if (i % 4 != 0 && i != count)
       {
-         EXPECT_EQ( sbhGet.stxMap_.size(), 3);
-         EXPECT_EQ( sbhGet.stxMap_[1].blockHeight_, 123000);
-         EXPECT_EQ( sbhGet.stxMap_[1].duplicateID_,      0);
-         EXPECT_EQ( sbhGet.stxMap_[1].txIndex_,          1);
-         EXPECT_EQ( sbhGet.stxMap_[1].numTxOut_,         2);
-         EXPECT_EQ( sbhGet.stxMap_[1].numBytes_,       621);
-         EXPECT_EQ( sbhGet.stxMap_[0].stxoMap_[0].isCoinbase_, true);
-         EXPECT_EQ( sbhGet.stxMap_[0].stxoMap_[0].spentness_, TXOUT_SPENTUNK);
-         EXPECT_EQ( sbhGet.stxMap_[1].stxoMap_[0].isCoinbase_, false);
-         EXPECT_EQ( sbhGet.stxMap_[1].stxoMap_[0].blockHeight_, 123000);
-         EXPECT_EQ( sbhGet.stxMap_[1].stxoMap_[0].duplicateID_,      0);
-         EXPECT_EQ( sbhGet.stxMap_[1].stxoMap_[0].txIndex_,          1);
-         EXPECT_EQ( sbhGet.stxMap_[1].stxoMap_[0].txOutIndex_,       0);
+         EXPECT_EQ(brr.getSize(), 0);
+         continue;
       }
+
+      ASSERT_EQ(brr.getSize(), 4);
+      EXPECT_EQ(brr.get_uint32_t(), i);
    }
 
+   StoredDBInfo sdbi;
+   iface_->getStoredDBInfo(HISTORY, sdbi);
+   EXPECT_EQ(sdbi.magic_, config_.magicBytes);
 }
 
-
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(LMDBTest, PutGetStoredTxHints)
+TEST_F(LMDBTest, CompactWhileWriting)
 {
-   ASSERT_TRUE(standardOpenDBs());
-   LMDBEnv::Transaction tx(iface_->dbEnv_[TXHINTS].get(), LMDB::ReadWrite);
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType);
 
-   BinaryData prefix = READHEX("aabbccdd");
+   ASSERT_TRUE(iface_->databasesAreOpen());
 
-   StoredTxHints sths;
-   EXPECT_FALSE(iface_->getStoredTxHints(sths, prefix));
+   const uint32_t count = 50000;
+   fillIndexedValues(iface_, count);
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+      for (uint32_t i = 0; i < count; i++)
+      {
+         if (i % 4 != 0)
+            iface_->deleteValue(HISTORY, WRITE_UINT32_BE(i));
+      }
+   }
 
-   sths.txHashPrefix_ = prefix;
-   
-   ASSERT_TRUE(iface_->putStoredTxHints(sths));
+   const string historyFile = config_.levelDBLocation + "/history";
+   const uint64_t sizeBefore = BtcUtils::GetFileSize(historyFile);
+
+   // a writer that never lets up, every copy but the one holding it off 
+   // misses some of its writes
+   atomic<bool> done(false);
+   uint32_t written = 0;
+   thread writer([&](void)->void
+   {
+      LMDBEnv* env = iface_->dbEnv_[HISTORY].get();
+      while (!done)
+      {
+         LMDBEnv::Transaction tx(env, LMDB::ReadWrite);
+         const uint32_t key = count + written++;
+         iface_->putValue(HISTORY, WRITE_UINT32_BE(key), WRITE_UINT32_LE(key));
+      }
+   });
+
+   iface_->compactDatabases();
+   done = true;
+   writer.join();
+
+   EXPECT_GT(written, 0);
+   EXPECT_LT(BtcUtils::GetFileSize(historyFile), sizeBefore);
+   EXPECT_EQ(BtcUtils::GetFileSize(historyFile + ".compact"), 
+      FILE_DOES_NOT_EXIST);
+   EXPECT_EQ(BtcUtils::GetFileSize(historyFile + ".precompact"), 
+      FILE_DOES_NOT_EXIST);
+
+   // no write went missing in the swap
+   LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadOnly);
+   for (uint32_t i = 0; i < count + written; i++)
+   {
+      BinaryRefReader brr = iface_->getValueReader(
+         HISTORY, WRITE_UINT32_BE(i));
+      if (i < count && i % 4 != 0)
+      {
+         EXPECT_EQ(brr.getSize(), 0);
+         continue;
+      }
+
+      ASSERT_EQ(brr.getSize(), 4);
+      EXPECT_EQ(brr.get_uint32_t(), i);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(LMDBTest, CompactWithReaderHeldOpen)
+{
+   LMDBTuning tuning;
+   tuning.compactSwapWaitMs = 100;
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType,
+      tuning);
+
+   ASSERT_TRUE(iface_->databasesAreOpen());
+
+   const uint32_t count = 20000;
+   fillIndexedValues(iface_, count);
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+      for (uint32_t i = 0; i < count; i++)
+      {
+         if (i % 4 != 0)
+            iface_->deleteValue(HISTORY, WRITE_UINT32_BE(i));
+      }
+   }
+
+   const string historyFile = config_.levelDBLocation + "/history";
+   const uint64_t sizeBefore = BtcUtils::GetFileSize(historyFile);
+
+   // a reader that holds its transaction through the compaction
+   atomic<bool> holding(false), release(false);
+   thread holder([&](void)->void
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadOnly);
+      holding = true;
+      while (!release)
+         this_thread::sleep_for(chrono::milliseconds(1));
+   });
+   while (!holding)
+      this_thread::yield();
+
+   // and another one that keeps opening new ones
+   atomic<bool> done(false);
+   uint32_t mismatches = 0, reads = 0;
+   thread reader([&](void)->void
+   {
+      LMDBEnv* env = iface_->dbEnv_[HISTORY].get();
+      uint32_t key = 0;
+      while (!done)
+      {
+         LMDBEnv::Transaction tx(env, LMDB::ReadOnly);
+         key = (key + 4) % count;
+         BinaryRefReader brr = iface_->getValueReader(
+            HISTORY, WRITE_UINT32_BE(key));
+         if (brr.getSize() != 4 || brr.get_uint32_t() != key)
+            mismatches++;
+         reads++;
+      }
+   });
+
+   // compaction gives up on history instead of waiting on the holder
+   bool complete = true;
+   iface_->compactDatabases(&complete);
+   EXPECT_FALSE(complete);
+   EXPECT_EQ(BtcUtils::GetFileSize(historyFile), sizeBefore);
+   EXPECT_EQ(BtcUtils::GetFileSize(historyFile + ".compact"), 
+      FILE_DOES_NOT_EXIST);
+
+   // new transactions open while the holder is still at it
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadOnly);
+      BinaryRefReader brr = iface_->getValueReader(
+         HISTORY, WRITE_UINT32_BE(8));
+      ASSERT_EQ(brr.getSize(), 4);
+      EXPECT_EQ(brr.get_uint32_t(), 8);
+   }
+
+   done = true;
+   reader.join();
+   EXPECT_EQ(mismatches, 0);
+   EXPECT_GT(reads, 0);
+
+   // once the holder is done, the next pass goes through
+   release = true;
+   holder.join();
+
+   iface_->compactDatabases(&complete);
+   EXPECT_TRUE(complete);
+   EXPECT_LT(BtcUtils::GetFileSize(historyFile), sizeBefore);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(LMDBTest, SnapshotIsolation)
+{
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType);
+
+   ASSERT_TRUE(iface_->databasesAreOpen());
+
+   const uint32_t count = 1000;
+   fillIndexedValues(iface_, count);
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[TXHINTS].get(), LMDB::ReadWrite);
+      iface_->putValue(TXHINTS, WRITE_UINT32_BE(0), WRITE_UINT32_LE(0));
+   }
+
+   {
+      LMDBBlockDatabase::Snapshot snapshot(iface_);
+
+      // a writer commits to two envs while the snapshot is up, it 
+      // doesn't have to wait for it
+      thread writer([&](void)->void
+      {
+         LMDBEnv::Transaction historyTx(
+            iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+         LMDBEnv::Transaction txHintsTx(
+            iface_->dbEnv_[TXHINTS].get(), LMDB::ReadWrite);
+
+         for (uint32_t i = 0; i < count; i++)
+            iface_->putValue(HISTORY, WRITE_UINT32_BE(i), WRITE_UINT32_LE(i + 1));
+         iface_->deleteValue(HISTORY, WRITE_UINT32_BE(0));
+         iface_->putValue(TXHINTS, WRITE_UINT32_BE(0), WRITE_UINT32_LE(1));
+      });
+      writer.join();
+
+      // reads on this thread, with or without their own transaction, 
+      // still see the db from before the write
+      EXPECT_EQ(readIndexedValues(iface_, count, count, 3, 10), 0);
+      EXPECT_EQ(iface_->getValue(HISTORY, WRITE_UINT32_BE(0)), 
+         WRITE_UINT32_LE(0));
+      EXPECT_EQ(iface_->getValue(TXHINTS, WRITE_UINT32_BE(0)),
+         WRITE_UINT32_LE(0));
+
+      // another thread sees the new data
+      uint32_t seen = 0;
+      thread reader([&](void)->void
+      {
+         LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadOnly);
+         BinaryRefReader brr = iface_->getValueReader(
+            HISTORY, WRITE_UINT32_BE(5));
+         seen = brr.get_uint32_t();
+      });
+      reader.join();
+      EXPECT_EQ(seen, 6);
+   }
+
+   // a new snapshot sees the write
+   LMDBBlockDatabase::Snapshot snapshot(iface_);
+   EXPECT_EQ(iface_->getValueReader(HISTORY, WRITE_UINT32_BE(0)).getSize(), 0);
+   EXPECT_EQ(iface_->getValue(HISTORY, WRITE_UINT32_BE(5)), 
+      WRITE_UINT32_LE(6));
+   EXPECT_EQ(iface_->getValue(TXHINTS, WRITE_UINT32_BE(0)),
+      WRITE_UINT32_LE(1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(LMDBTest, ValueCache)
+{
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType);
+
+   ASSERT_TRUE(iface_->databasesAreOpen());
+
+   BinaryData txHash = READHEX(
+      "aaaaaaaa00000000000000000000000000000000000000000000000000000000");
+   BinaryData noTxHash = READHEX(
+      "bbbbbbbb00000000000000000000000000000000000000000000000000000000");
+
+   StoredTxHints sths;
+   sths.txHashPrefix_ = txHash.getSliceCopy(0, 4);
+   sths.dbKeyList_.push_back(READHEX("00000100""0001"));
+   sths.preferredDBKey_ = sths.dbKeyList_[0];
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[TXHINTS].get(), LMDB::ReadWrite);
+      iface_->putStoredTxHints(sths);
+   }
+
+   auto getNumHints = [&](BinaryDataRef hash)->size_t
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[TXHINTS].get(), LMDB::ReadOnly);
+      return iface_->getHintsForTxHash(hash).getNumHints();
+   };
+
+   // repeated lookups, of present and missing keys, come from the cache
+   DBValueCache::Stats before = iface_->getValueCacheStats();
+   EXPECT_EQ(getNumHints(txHash), 1);
+   EXPECT_EQ(getNumHints(txHash), 1);
+   EXPECT_EQ(getNumHints(noTxHash), 0);
+   EXPECT_EQ(getNumHints(noTxHash), 0);
+
+   DBValueCache::Stats after = iface_->getValueCacheStats();
+   EXPECT_EQ(after.misses_ - before.misses_, 2);
+   EXPECT_EQ(after.hits_ - before.hits_, 2);
+   EXPECT_EQ(after.entries_, 2);
+
+   // writes drop the key, the writer reads back its own data
+   sths.dbKeyList_.push_back(READHEX("00000200""0003"));
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[TXHINTS].get(), LMDB::ReadWrite);
+      iface_->putStoredTxHints(sths);
+      EXPECT_EQ(iface_->getHintsForTxHash(txHash).getNumHints(), 2);
+   }
+   EXPECT_EQ(getNumHints(txHash), 2);
+   EXPECT_EQ(getNumHints(txHash), 2);
+
+   // a reader on an older snapshot doesn't get the newer value
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[TXHINTS].get(), LMDB::ReadOnly);
+      EXPECT_EQ(iface_->getHintsForTxHash(txHash).getNumHints(), 2);
+
+      sths.dbKeyList_.push_back(READHEX("00000300""0000"));
+      thread writer([&](void)->void
+      {
+         LMDBEnv::Transaction tx(
+            iface_->dbEnv_[TXHINTS].get(), LMDB::ReadWrite);
+         iface_->putStoredTxHints(sths);
+      });
+      writer.join();
+
+      size_t seen = 0;
+      thread reader([&](void)->void
+      {
+         seen = getNumHints(txHash);
+      });
+      reader.join();
+
+      EXPECT_EQ(seen, 3);
+      EXPECT_EQ(iface_->getHintsForTxHash(txHash).getNumHints(), 2);
+   }
+   EXPECT_EQ(getNumHints(txHash), 3);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(LMDBTest, STxOutPutGet)
+{
+   BinaryData TXP     = WRITE_UINT8_BE((uint8_t)DB_PREFIX_TXDATA);
+   BinaryData stxoVal = READHEX("0400") + rawTxOut0_;
+   BinaryData stxoKey = TXP + READHEX("01e078""0f""0007""0001");
+   
+   ASSERT_TRUE(standardOpenDBs());
+   LMDBEnv::Transaction txh(iface_->dbEnv_[HEADERS].get(), LMDB::ReadWrite);
+   LMDBEnv::Transaction txH(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+
+   StoredTxOut stxo0;
+   stxo0.txVersion_   = 1;
+   stxo0.spentness_   = TXOUT_UNSPENT;
+   stxo0.blockHeight_ = 123000;
+   stxo0.duplicateID_ = 15;
+   stxo0.txIndex_     = 7;
+   stxo0.txOutIndex_  = 1;
+   stxo0.unserialize(rawTxOut0_);
+   iface_->putStoredTxOut(stxo0);
+
+   // Construct expected output
+   addOutPairB(stxoKey, stxoVal);
+   ASSERT_TRUE(compareKVListRange(0,1, 0,2));
+
+   StoredTxOut stxoGet;
+   iface_->getStoredTxOut(stxoGet, 123000, 15, 7, 1);
+   EXPECT_EQ(
+      serializeDBValue(stxoGet, ARMORY_DB_FULL, DB_PRUNE_NONE),
+      serializeDBValue(stxo0, ARMORY_DB_FULL, DB_PRUNE_NONE)
+   );
+
+   //iface_->validDupByHeight_[123000] = 15;
+   //iface_->getStoredTxOut(stxoGet, 123000, 7, 1);
+   //EXPECT_EQ(serializeDBValue(stxoGet), serializeDBValue(stxo0));
+   
+   StoredTxOut stxo1;
+   stxo1.txVersion_   = 1;
+   stxo1.spentness_   = TXOUT_UNSPENT;
+   stxo1.blockHeight_ = 200333;
+   stxo1.duplicateID_ = 3;
+   stxo1.txIndex_     = 7;
+   stxo1.txOutIndex_  = 1;
+   stxo1.unserialize(rawTxOut1_);
+   stxoVal = READHEX("0400") + rawTxOut1_;
+   stxoKey = TXP + READHEX("030e8d""03""00070001");
+   iface_->putStoredTxOut(stxo1);
+
+   iface_->getStoredTxOut(stxoGet, 123000, 15, 7, 1);
+   EXPECT_EQ(
+      serializeDBValue(stxoGet, ARMORY_DB_FULL, DB_PRUNE_NONE),
+      serializeDBValue(stxo0, ARMORY_DB_FULL, DB_PRUNE_NONE)
+   );
+   iface_->getStoredTxOut(stxoGet, 200333,  3, 7, 1);
+   EXPECT_EQ(
+      serializeDBValue(stxoGet, ARMORY_DB_FULL, DB_PRUNE_NONE),
+      serializeDBValue(stxo1, ARMORY_DB_FULL, DB_PRUNE_NONE)
+   );
+
+   addOutPairB(stxoKey, stxoVal);
+   ASSERT_TRUE(compareKVListRange(0,1, 0,3));
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(LMDBTest, PutFullBlockNoTx)
+{
+//    DBUtils::setArmoryDbType(ARMORY_DB_FULL);
+//    DBUtils::setDbPruneType(DB_PRUNE_NONE);
+
+   StoredHeader sbh;
+   BinaryRefReader brr(rawBlock_);
+   sbh.unserializeFullBlock(brr);
+   sbh.setKeyData(123000, UINT8_MAX);
+
+   StoredHeadHgtList hhl;
+   hhl.height_ = 123000;
+   hhl.dupAndHashList_.push_back( pair<uint8_t, BinaryData>(0, sbh.thisHash_));
+   hhl.preferredDup_ = UINT8_MAX;
+
+   BinaryData TXP   = WRITE_UINT8_BE((uint8_t)DB_PREFIX_TXDATA);
+   BinaryData HHP   = WRITE_UINT8_BE((uint8_t)DB_PREFIX_HEADHASH);
+   BinaryData HGP   = WRITE_UINT8_BE((uint8_t)DB_PREFIX_HEADHGT);
+   BinaryData hgtx  = READHEX("01e078""00");
+   BinaryData sbh_HH_key = HHP + sbh.thisHash_;
+   BinaryData sbh_HH_val = sbh.dataCopy_ + hgtx + READHEX("46040000");
+   BinaryData sbh_HG_key = hhl.getDBKey();
+   BinaryData sbh_HG_val = hhl.serializeDBValue();
+   
+   ASSERT_TRUE(standardOpenDBs());
+   LMDBEnv::Transaction txh(iface_->dbEnv_[HEADERS].get(), LMDB::ReadWrite);
+   LMDBEnv::Transaction txH(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+
+   addOutPairH( sbh_HH_key, sbh_HH_val);
+   addOutPairH( sbh_HG_key, sbh_HG_val);
+
+   brr.resetPosition();
+   testBlockHeader bh;
+   bh.unserialize(brr);
+   bh.setDuplicateID(0);
+   bh.setBlockHeight(123000);
+
+   auto getBH = [&](const BinaryData& hash)->const BlockHeader&
+   { return bh; };
+   uint8_t sdup = iface_->putRawBlockData(brr, getBH);
+   EXPECT_TRUE(compareKVListRange(0,1, 0,1));
+   EXPECT_EQ(sdup, 0);
+
+   // Try adding it again and see if get the correct dup again, and no touch DB
+   sdup = iface_->putRawBlockData(brr, getBH);
+   EXPECT_TRUE(compareKVListRange(0,1, 0, 1));
+   EXPECT_EQ(sdup, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(LMDBTest, PutGetBareHeader)
+{
+//    DBUtils::setArmoryDbType(ARMORY_DB_FULL);
+//    DBUtils::setDbPruneType(DB_PRUNE_NONE);
+
+   StoredHeader sbh;
+   BinaryRefReader brr(rawBlock_);
+   sbh.unserializeFullBlock(brr);
+   sbh.setKeyData(123000, UINT8_MAX);
+   BinaryData header0 = sbh.thisHash_;
+
+   ASSERT_TRUE(standardOpenDBs());
+   LMDBEnv::Transaction txh(iface_->dbEnv_[HEADERS].get(), LMDB::ReadWrite);
+   LMDBEnv::Transaction txH(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+
+   uint8_t sdup = iface_->putBareHeader(sbh);
+   EXPECT_EQ(sdup, 0);
+   EXPECT_EQ(sbh.duplicateID_, 0);
+
+   // Add a new header and make sure duplicate ID is done correctly
+   BinaryData newHeader = READHEX( 
+      "0000000105d3571220ef5f87c6ac0bc8bf5b33c02a9e6edf83c84d840109592c"
+      "0000000027523728e15f5fe1ac507bff92499eada4af8a0c485d5178e3f96568"
+      "c18f84994e0e4efc1c0175d646a91ad4");
+   BinaryData header1 = BtcUtils::getHash256(newHeader);
+
+   StoredHeader sbh2;
+   sbh2.setHeaderData(newHeader);
+   sbh2.setKeyData(123000, UINT8_MAX);
+   
+   uint8_t newDup = iface_->putBareHeader(sbh2);
+   EXPECT_EQ(newDup, 1);
+   EXPECT_EQ(sbh2.duplicateID_, 1);
+   
+   // Now add a new, isMainBranch_ header
+   StoredHeader sbh3;
+   BinaryData anotherHead = READHEX(
+      "010000001d8f4ec0443e1f19f305e488c1085c95de7cc3fd25e0d2c5bb5d0000"
+      "000000009762547903d36881a86751f3f5049e23050113f779735ef82734ebf0"
+      "b4450081d8c8c84db3936a1a334b035b");
+   BinaryData header2 = BtcUtils::getHash256(anotherHead);
+
+   sbh3.setHeaderData(anotherHead);
+   sbh3.setKeyData(123000, UINT8_MAX);
+   sbh3.isMainBranch_ = true;
+   uint8_t anotherDup = iface_->putBareHeader(sbh3);
+   EXPECT_EQ(anotherDup, 2);
+   EXPECT_EQ(sbh3.duplicateID_, 2);
+   EXPECT_EQ(iface_->getValidDupIDForHeight(123000), 2);
+   
+   // Now test getting bare headers
+   StoredHeader sbh4;
+   iface_->getBareHeader(sbh4, 123000);
+   EXPECT_EQ(sbh4.thisHash_, header2);
+   EXPECT_EQ(sbh4.duplicateID_, 2);
+   
+   iface_->getBareHeader(sbh4, 123000, 1);
+   EXPECT_EQ(sbh4.thisHash_, header1);
+   EXPECT_EQ(sbh4.duplicateID_, 1);
+
+   // Re-add the same SBH3, make sure nothing changes
+   iface_->putBareHeader(sbh3);
+   EXPECT_EQ(sbh3.duplicateID_, 2);
+   EXPECT_EQ(iface_->getValidDupIDForHeight(123000), 2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(LMDBTest, DISABLED_PutFullBlock)
+{
+//    DBUtils::setArmoryDbType(ARMORY_DB_FULL);
+//    DBUtils::setDbPruneType(DB_PRUNE_NONE);
+   ASSERT_TRUE(standardOpenDBs());
+
+   StoredHeader sbh;
+   BinaryRefReader brr(rawBlock_);
+   sbh.unserializeFullBlock(brr);
+   sbh.setKeyData(123000);
+
+   BinaryData rawHeader = READHEX(
+      "01000000eb10c9a996a2340a4d74eaab41421ed8664aa49d18538bab59010000"
+      "000000005a2f06efa9f2bd804f17877537f2080030cadbfa1eb50e02338117cc"
+      "604d91b9b7541a4ecfbb0a1a64f1ade7");
+
+   // Compute and write the headers to the expected-output
+   StoredHeadHgtList hhl;
+   hhl.height_ = 123000;
+   hhl.dupAndHashList_.push_back( pair<uint8_t, BinaryData>(0, sbh.thisHash_));
+   hhl.preferredDup_ = UINT8_MAX;
+   BinaryData HHP   = WRITE_UINT8_BE((uint8_t)DB_PREFIX_HEADHASH);
+   BinaryData HGP   = WRITE_UINT8_BE((uint8_t)DB_PREFIX_HEADHGT);
+   BinaryData sbh_HH_key = HHP + sbh.thisHash_;
+   BinaryData sbh_HH_val = rawHeader + READHEX("01e078""00") + READHEX("46040000");
+   BinaryData sbh_HG_key = hhl.getDBKey();
+   BinaryData sbh_HG_val = hhl.serializeDBValue();
+   // Only HEADHASH and HEADHGT entries get written
+   addOutPairH( sbh_HH_key, sbh_HH_val);
+   addOutPairH( sbh_HG_key, sbh_HG_val);
+
+   // Now compute and write the BLKDATA
+   BinaryData TXP       = WRITE_UINT8_BE((uint8_t)DB_PREFIX_TXDATA);
+   BinaryData sbhKey    = TXP + READHEX("01e078""00");
+   BinaryData stx0Key   = sbhKey  + READHEX("0000");
+   BinaryData stx1Key   = sbhKey  + READHEX("0001");
+   BinaryData stx2Key   = sbhKey  + READHEX("0002");
+   BinaryData stxo00Key = stx0Key + READHEX("0000");
+   BinaryData stxo10Key = stx1Key + READHEX("0000");
+   BinaryData stxo11Key = stx1Key + READHEX("0001");
+   BinaryData stxo20Key = stx2Key + READHEX("0000");
+   BinaryData stxo21Key = stx2Key + READHEX("0001");
+   BinaryData stxo00Raw = READHEX( "00f2052a01000000""434104"
+      "c2239c4eedb3beb26785753463be3ec62b82f6acd62efb65f452f8806f2ede0b"
+      "338e31d1f69b1ce449558d7061aa1648ddc2bf680834d3986624006a272dc21cac");
+   BinaryData stxo10Raw = READHEX( "40420f0000000000"
+      "19""76a914adfa66f57ded1b655eb4ccd96ee07ca62bc1ddfd88ac");
+   BinaryData stxo11Raw = READHEX( "007d6a7d04000000"
+      "19""76a914981a0c9ae61fa8f8c96ae6f8e383d6e07e77133e88ac");
+   BinaryData stxo20Raw = READHEX( "2f66ac6105000000"
+      "19""76a914964642290c194e3bfab661c1085e47d67786d2d388ac");
+   BinaryData stxo21Raw = READHEX( "2f77e20000000000"
+      "19""76a9141486a7046affd935919a3cb4b50a8a0c233c286c88ac");
+
+   StoredTx & stx0 = sbh.stxMap_[0];
+   StoredTx & stx1 = sbh.stxMap_[1];
+   StoredTx & stx2 = sbh.stxMap_[2];
+   BinaryData hflags = READHEX("01340000");
+   BinaryData ntx    = READHEX("03000000");
+   BinaryData nbyte  = READHEX("46040000");
+
+   // Add header to BLKDATA
+   addOutPairB(sbhKey, hflags + rawHeader + ntx + nbyte);
+
+   // Add Tx0 to BLKDATA
+   addOutPairB(stx0Key,   READHEX("0440") + stx0.thisHash_ + stx0.getSerializedTxFragged());
+   addOutPairB(stxo00Key, READHEX("0480") + stxo00Raw); // is coinbase
+
+   // Add Tx1 to BLKDATA
+   addOutPairB(stx1Key,   READHEX("0440") + stx1.thisHash_ + stx1.getSerializedTxFragged());
+   addOutPairB(stxo10Key, READHEX("0400") + stxo10Raw);
+   addOutPairB(stxo11Key, READHEX("0400") + stxo11Raw);
+
+   // Add Tx2 to BLKDATA
+   addOutPairB(stx2Key,   READHEX("0440") + stx2.thisHash_ + stx2.getSerializedTxFragged());
+   addOutPairB(stxo20Key, READHEX("0400") + stxo20Raw);
+   addOutPairB(stxo21Key, READHEX("0400") + stxo21Raw);
+
+   // DuplicateID values get set when we putStoredHeader since we don't know
+   // what dupIDs have been taken until we try to put it in the database.
+   ASSERT_EQ(sbh.stxMap_.size(), 3);
+   for(uint32_t i=0; i<3; i++)
+   {
+      ASSERT_EQ(sbh.stxMap_[i].blockHeight_,    123000);
+      ASSERT_EQ(sbh.stxMap_[i].duplicateID_, UINT8_MAX);
+      ASSERT_EQ(sbh.stxMap_[i].txIndex_,             i);
+      for(uint32_t j=0; j<sbh.stxMap_[i].stxoMap_.size(); j++)
+      {
+         sbh.stxMap_[i].stxoMap_[j].spentness_ = TXOUT_UNSPENT;
+         //sbh.stxoMap_[i].isCoinbase_ = (j==0);
+
+         ASSERT_EQ(sbh.stxMap_[i].stxoMap_[j].blockHeight_,    123000);
+         ASSERT_EQ(sbh.stxMap_[i].stxoMap_[j].duplicateID_, UINT8_MAX);
+         ASSERT_EQ(sbh.stxMap_[i].stxoMap_[j].txIndex_,             i);
+         ASSERT_EQ(sbh.stxMap_[i].stxoMap_[j].txOutIndex_,          j);
+      }
+   }
+
+   iface_->putStoredHeader(sbh);
+
+   ASSERT_TRUE(compareKVListRange(0,3, 0,9));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Of course, this test only works if the previous test passes (but doesn't 
+// require a saved state, it just re-puts the full block into the DB).  I
+// did it this way, because I wasn't comfortable committing the pre-filled
+// DB to the repo.
+TEST_F(LMDBTest, DISABLED_GetFullBlock)
+{
+//    DBUtils::setArmoryDbType(ARMORY_DB_FULL);
+//    DBUtils::setDbPruneType(DB_PRUNE_NONE);
+   ASSERT_TRUE(standardOpenDBs());
+
+   StoredHeader sbh;
+   BinaryRefReader brr(rawBlock_);
+   sbh.unserializeFullBlock(brr);
+   sbh.setKeyData(123000);
+   sbh.isMainBranch_ = true;
+
+   // Check the DBInfo before and after putting the valid header
+   StoredDBInfo sdbi;
+   iface_->getStoredDBInfo(HEADERS, sdbi);
+   EXPECT_EQ(sdbi.topBlkHgt_,  0);
+   EXPECT_EQ(sdbi.topBlkHash_, iface_->getGenesisBlockHash());
+
+   iface_->putStoredHeader(sbh);
+
+   // Since we marked this block main-branch, it should have non-MAX validDup
+   EXPECT_EQ(iface_->getValidDupIDForHeight(123000), 0);
+   BinaryData headerHash = READHEX(
+      "7d97d862654e03d6c43b77820a40df894e3d6890784528e9cd05000000000000");
+   iface_->getStoredDBInfo(HEADERS, sdbi);
+   EXPECT_EQ(sdbi.topBlkHgt_,  123000);
+   EXPECT_EQ(sdbi.topBlkHash_, headerHash);
+
+   BinaryData rawHeader = READHEX(
+      "01000000eb10c9a996a2340a4d74eaab41421ed8664aa49d18538bab59010000"
+      "000000005a2f06efa9f2bd804f17877537f2080030cadbfa1eb50e02338117cc"
+      "604d91b9b7541a4ecfbb0a1a64f1ade7");
+
+   ////////////////////
+   // Now test the get methods
+  
+   for(uint32_t i=0; i<4; i++)
+   {
+      StoredHeader sbhGet;
+
+      if(i==0)
+         EXPECT_TRUE(iface_->getStoredHeader(sbhGet, 123000, 0, false));
+      else if(i==1)
+         EXPECT_TRUE(iface_->getStoredHeader(sbhGet, headerHash, false));
+      else if(i==2)
+         EXPECT_TRUE(iface_->getStoredHeader(sbhGet, 123000, 0, true));
+      else if(i==3)
+         EXPECT_TRUE(iface_->getStoredHeader(sbhGet, headerHash, true));
+
+      EXPECT_TRUE( sbhGet.isInitialized());
+      EXPECT_EQ(   sbhGet.dataCopy_,    rawHeader);
+      EXPECT_EQ(   sbhGet.thisHash_,    headerHash);
+      EXPECT_EQ(   sbhGet.numTx_,       3);
+      EXPECT_EQ(   sbhGet.numBytes_,    1094);
+      EXPECT_EQ(   sbhGet.blockHeight_, 123000);
+      EXPECT_EQ(   sbhGet.duplicateID_, 0);
+      EXPECT_EQ(   sbhGet.merkle_.getSize(), 0);
+      EXPECT_FALSE(sbhGet.merkleIsPartial_);
+      EXPECT_EQ(   sbhGet.unserArmVer_, 0);
+      EXPECT_EQ(   sbhGet.unserBlkVer_, 1);
+      EXPECT_EQ(   sbhGet.unserDbType_, ARMORY_DB_FULL);
+      EXPECT_EQ(   sbhGet.unserPrType_, DB_PRUNE_NONE);
+
+      if(i<2)
+         EXPECT_EQ( sbhGet.stxMap_.size(), 0);
+      else
+      {
+         EXPECT_EQ( sbhGet.stxMap_.size(), 3);
+         EXPECT_EQ( sbhGet.stxMap_[1].blockHeight_, 123000);
+         EXPECT_EQ( sbhGet.stxMap_[1].duplicateID_,      0);
+         EXPECT_EQ( sbhGet.stxMap_[1].txIndex_,          1);
+         EXPECT_EQ( sbhGet.stxMap_[1].numTxOut_,         2);
+         EXPECT_EQ( sbhGet.stxMap_[1].numBytes_,       621);
+         EXPECT_EQ( sbhGet.stxMap_[0].stxoMap_[0].isCoinbase_, true);
+         EXPECT_EQ( sbhGet.stxMap_[0].stxoMap_[0].spentness_, TXOUT_SPENTUNK);
+         EXPECT_EQ( sbhGet.stxMap_[1].stxoMap_[0].isCoinbase_, false);
+         EXPECT_EQ( sbhGet.stxMap_[1].stxoMap_[0].blockHeight_, 123000);
+         EXPECT_EQ( sbhGet.stxMap_[1].stxoMap_[0].duplicateID_,      0);
+         EXPECT_EQ( sbhGet.stxMap_[1].stxoMap_[0].txIndex_,          1);
+         EXPECT_EQ( sbhGet.stxMap_[1].stxoMap_[0].txOutIndex_,       0);
+      }
+   }
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(LMDBTest, PutGetStoredTxHints)
+{
+   ASSERT_TRUE(standardOpenDBs());
+   LMDBEnv::Transaction tx(iface_->dbEnv_[TXHINTS].get(), LMDB::ReadWrite);
+
+   BinaryData prefix = READHEX("aabbccdd");
+
+   StoredTxHints sths;
+   EXPECT_FALSE(iface_->getStoredTxHints(sths, prefix));
+
+   sths.txHashPrefix_ = prefix;
+   
+   ASSERT_TRUE(iface_->putStoredTxHints(sths));
 
    BinaryData THP = WRITE_UINT8_BE((uint8_t)DB_PREFIX_TXHINTS);
    addOutPairB(THP + prefix, READHEX("00"));
@@ -5711,16 +6743,188 @@ TEST_F(LMDBTest, PutGetStoredScriptHistory)
    EXPECT_EQ(txioptr->getValue(), val1);
    EXPECT_FALSE(txioptr->isMultisig());
 
-   ASSERT_NE(sshtemp.subHistMap_.find(hgtX1), sshtemp.subHistMap_.end());
-   subptr = &sshtemp.subHistMap_[hgtX1];
-   EXPECT_EQ(subptr->uniqueKey_, uniq);
-   EXPECT_EQ(subptr->hgtX_, hgtX1);
-   ASSERT_EQ(subptr->txioMap_.size(), 1);
-   ASSERT_NE(subptr->txioMap_.find(dbkey3), subptr->txioMap_.end());
-   txioptr = &subptr->txioMap_[dbkey3];
-   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey3);
-   EXPECT_EQ(txioptr->getValue(), val3);
-   EXPECT_TRUE(txioptr->isMultisig());
+   ASSERT_NE(sshtemp.subHistMap_.find(hgtX1), sshtemp.subHistMap_.end());
+   subptr = &sshtemp.subHistMap_[hgtX1];
+   EXPECT_EQ(subptr->uniqueKey_, uniq);
+   EXPECT_EQ(subptr->hgtX_, hgtX1);
+   ASSERT_EQ(subptr->txioMap_.size(), 1);
+   ASSERT_NE(subptr->txioMap_.find(dbkey3), subptr->txioMap_.end());
+   txioptr = &subptr->txioMap_[dbkey3];
+   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey3);
+   EXPECT_EQ(txioptr->getValue(), val3);
+   EXPECT_TRUE(txioptr->isMultisig());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(LMDBTest, HistoryKeyLayoutMigration)
+{
+   auto openDBs = [this](SSH_KEY_LAYOUT layout)->void
+   {
+      iface_->openDatabases(
+         config_.levelDBLocation,
+         config_.genesisBlockHash,
+         config_.genesisTxHash,
+         config_.magicBytes,
+         config_.armoryDbType,
+         config_.pruneType,
+         config_.dbTuning,
+         layout);
+   };
+
+   // counts the sub-history entries stored under a prefix
+   auto countKeys = [this](DB_PREFIX prefix, size_t keySize)->uint32_t
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadOnly);
+      LDBIter ldbIter = iface_->getIterator(HISTORY);
+
+      uint32_t count = 0;
+      if (!ldbIter.seekToStartsWith(prefix))
+         return count;
+
+      do
+      {
+         if (ldbIter.getKeyRef().getSize() == keySize)
+            count++;
+      } while (ldbIter.advanceAndRead(prefix));
+
+      return count;
+   };
+
+   BinaryData dbkey0 = READHEX("0000ff00""0001""0001");
+   BinaryData dbkey1 = READHEX("0000ff00""0002""0002");
+   BinaryData dbkey3 = READHEX("00010000""0006""0006");
+   uint64_t   val0   = READ_UINT64_HEX_LE("0100000000000000");
+   uint64_t   val1   = READ_UINT64_HEX_LE("0002000000000000");
+   uint64_t   val3   = READ_UINT64_HEX_LE("0000000400000000");
+
+   TxIOPair txio0(dbkey0, val0);
+   TxIOPair txio1(dbkey1, val1);
+   TxIOPair txio3(dbkey3, val3);
+   txio3.setMultisig(true);
+
+   BinaryData hgtX0 = READHEX("0000ff00");
+   BinaryData hgtX1 = READHEX("00010000");
+   vector<BinaryData> uniqs =
+   {
+      READHEX("00""0000ffff0000ffff0000ffff0000ffff0000ffff"),
+      READHEX("00""1111ffff1111ffff1111ffff1111ffff1111ffff"),
+      READHEX("05""2222ffff2222ffff2222ffff2222ffff2222ffff")
+   };
+
+   openDBs(SSH_KEYS_SCRADDR);
+   ASSERT_TRUE(iface_->databasesAreOpen());
+   EXPECT_EQ(iface_->sshKeyLayout(), SSH_KEYS_SCRADDR);
+
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+      for (unsigned i = 0; i < 2; i++)
+      {
+         StoredScriptHistory ssh;
+         ssh.uniqueKey_ = uniqs[i];
+         ssh.insertTxio(txio0);
+         ssh.insertTxio(txio1);
+         ssh.insertTxio(txio3);
+         iface_->putStoredScriptHistory(ssh);
+      }
+   }
+   EXPECT_EQ(countKeys(DB_PREFIX_SCRIPT, 26), 4);
+   iface_->closeDatabases();
+
+   // reopening with the id layout keeps the layout of the db
+   openDBs(SSH_KEYS_SCRADDR_ID);
+   ASSERT_TRUE(iface_->databasesAreOpen());
+   EXPECT_EQ(iface_->sshKeyLayout(), SSH_KEYS_SCRADDR);
+   EXPECT_EQ(countKeys(DB_PREFIX_SCRIPT, 26), 4);
+   EXPECT_EQ(countKeys(DB_PREFIX_SUBSSH, 9), 0);
+
+   // until a migration is asked for
+   iface_->migrateHistoryKeys(SSH_KEYS_SCRADDR_ID);
+   EXPECT_EQ(iface_->sshKeyLayout(), SSH_KEYS_SCRADDR_ID);
+   EXPECT_EQ(countKeys(DB_PREFIX_SCRIPT, 26), 0);
+   EXPECT_EQ(countKeys(DB_PREFIX_SUBSSH, 9), 4);
+
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+      StoredDBInfo sdbi;
+      iface_->getStoredDBInfo(HISTORY, sdbi);
+      EXPECT_EQ(sdbi.sshKeyLayout_, SSH_KEYS_SCRADDR_ID);
+
+      // new scrAddrs get the next id
+      StoredScriptHistory ssh;
+      ssh.uniqueKey_ = uniqs[2];
+      ssh.insertTxio(txio3);
+      iface_->putStoredScriptHistory(ssh);
+   }
+   EXPECT_EQ(countKeys(DB_PREFIX_SUBSSH, 9), 5);
+   EXPECT_EQ(iface_->getSubSSHKey(uniqs[2], hgtX1),
+      READHEX("0c""00000002") + hgtX1);
+
+   for (unsigned i = 0; i < 2; i++)
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadOnly);
+      StoredScriptHistory ssh;
+      iface_->getStoredScriptHistory(ssh, uniqs[i]);
+      EXPECT_EQ(ssh.totalTxioCount_, 3);
+      EXPECT_EQ(ssh.totalUnspent_, val0 + val1);
+      ASSERT_EQ(ssh.subHistMap_.size(), 2);
+      EXPECT_EQ(ssh.subHistMap_[hgtX0].uniqueKey_, uniqs[i]);
+      EXPECT_EQ(ssh.subHistMap_[hgtX0].txioMap_.size(), 2);
+      EXPECT_EQ(ssh.subHistMap_[hgtX1].txioMap_.size(), 1);
+      EXPECT_TRUE(ssh.subHistMap_[hgtX1].txioMap_[dbkey3].isMultisig());
+
+      map<uint32_t, uint32_t> summary = iface_->getSSHSummary(uniqs[i],
+         UINT32_MAX);
+      EXPECT_EQ(summary.size(), 2);
+   }
+   iface_->closeDatabases();
+
+   // and back
+   openDBs(SSH_KEYS_SCRADDR);
+   ASSERT_TRUE(iface_->databasesAreOpen());
+   EXPECT_EQ(iface_->sshKeyLayout(), SSH_KEYS_SCRADDR_ID);
+   iface_->migrateHistoryKeys(SSH_KEYS_SCRADDR);
+   EXPECT_EQ(iface_->sshKeyLayout(), SSH_KEYS_SCRADDR);
+   EXPECT_EQ(countKeys(DB_PREFIX_SUBSSH, 9), 0);
+   EXPECT_EQ(countKeys(DB_PREFIX_SCRADDRID, 1), 0);
+   EXPECT_EQ(countKeys(DB_PREFIX_SCRIPT, 26), 5);
+
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadOnly);
+      StoredScriptHistory ssh;
+      iface_->getStoredScriptHistory(ssh, uniqs[2]);
+      EXPECT_EQ(ssh.totalTxioCount_, 1);
+      ASSERT_EQ(ssh.subHistMap_.size(), 1);
+      EXPECT_EQ(ssh.subHistMap_[hgtX1].txioMap_.size(), 1);
+   }
+
+   // a migration that was interrupted after flagging the sdbi is finished
+   // on the next open
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+      StoredDBInfo sdbi;
+      iface_->getStoredDBInfo(HISTORY, sdbi);
+      sdbi.sshKeyMigrating_ = true;
+      sdbi.sshKeyMigrationTarget_ = SSH_KEYS_SCRADDR_ID;
+      iface_->putStoredDBInfo(HISTORY, sdbi);
+   }
+   iface_->closeDatabases();
+
+   openDBs(SSH_KEYS_SCRADDR);
+   ASSERT_TRUE(iface_->databasesAreOpen());
+   EXPECT_EQ(iface_->sshKeyLayout(), SSH_KEYS_SCRADDR_ID);
+   EXPECT_EQ(countKeys(DB_PREFIX_SCRIPT, 26), 0);
+   EXPECT_EQ(countKeys(DB_PREFIX_SUBSSH, 9), 5);
+
+   LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadOnly);
+   StoredDBInfo sdbi;
+   iface_->getStoredDBInfo(HISTORY, sdbi);
+   EXPECT_EQ(sdbi.sshKeyLayout_, SSH_KEYS_SCRADDR_ID);
+   EXPECT_FALSE(sdbi.sshKeyMigrating_);
+
+   StoredScriptHistory ssh;
+   iface_->getStoredScriptHistory(ssh, uniqs[0]);
+   EXPECT_EQ(ssh.totalTxioCount_, 3);
+   EXPECT_EQ(ssh.subHistMap_.size(), 2);
 }
 
 
@@ -6092,7 +7296,7 @@ protected:
 
 
    LMDBBlockDatabase* iface_;
-   BlockDataManagerConfig config_;
+   BlockDataManagerConfig config_ = testConfig();
    LMDBEnv::Transaction* dbTx = nullptr;
    vector<pair<BinaryData, BinaryData> > expectOutH_;
    vector<pair<BinaryData, BinaryData> > expectOutB_;
@@ -6458,6 +7662,144 @@ TEST_F(LMDBTest_Super, PutFullTx)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(LMDBTest_Super, CompressedTxData)
+{
+   BinaryData stxKey = READHEX("01e078""0f""0007");
+   BinaryData stxo0Key = READHEX("01e078""0f""0007""0000");
+   BinaryData p2pk = READHEX(
+      "00f2052a01000000"
+      "434104c2239c4eedb3beb26785753463be3ec62b82f6acd62efb65f452f8806f"
+      "2ede0b338e31d1f69b1ce449558d7061aa1648ddc2bf680834d3986624006a27"
+      "2dc21cac");
+
+   // txout codec: templated scripts and raw ones both round trip
+   for (auto& rawTxOut : { rawTxOut0_, rawTxOut1_, p2pk })
+   {
+      BinaryWriter bw;
+      ASSERT_TRUE(DBUtils::compressTxOut(bw, rawTxOut));
+      EXPECT_LT(bw.getSize(), rawTxOut.getSize());
+
+      BinaryRefReader brr(bw.getDataRef());
+      BinaryWriter bwOut;
+      ASSERT_TRUE(DBUtils::uncompressTxOut(brr, bwOut));
+      EXPECT_EQ(bwOut.getData(), rawTxOut);
+      EXPECT_EQ(brr.getSizeRemaining(), 0);
+   }
+
+   // block codec only keeps its output when it saves space
+   BinaryData repeated;
+   for (uint32_t i = 0; i < 20; i++)
+      repeated.append(rawTxOut0_);
+
+   BinaryWriter bwBlock;
+   ASSERT_TRUE(DBUtils::compressBlock(bwBlock, repeated));
+   EXPECT_LT(bwBlock.getSize(), repeated.getSize() / 4);
+   BinaryRefReader brrBlock(bwBlock.getDataRef());
+   BinaryData uncompressed;
+   ASSERT_TRUE(DBUtils::uncompressBlock(brrBlock, uncompressed));
+   EXPECT_EQ(uncompressed, repeated);
+
+   BinaryWriter bwNoGain;
+   EXPECT_FALSE(DBUtils::compressBlock(bwNoGain, ghash_));
+
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType,
+      LMDBTuning(),
+      SSH_KEYS_SCRADDR,
+      TXDATA_COMPRESS_ALL);
+   ASSERT_TRUE(iface_->databasesAreOpen());
+   EXPECT_EQ(iface_->txDataCompression(), TXDATA_COMPRESS_ALL);
+
+   StoredTx stx;
+   stx.createFromTx(rawTxUnfrag_);
+   stx.setKeyData(123000, 15, 7);
+   for (auto& stxo : stx.stxoMap_)
+      stxo.second.spentness_ = TXOUT_UNSPENT;
+
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[BLKDATA].get(), LMDB::ReadWrite);
+      iface_->putStoredTx(stx);
+   }
+
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
+
+      // txouts are stored with the compressed bit set
+      BinaryDataRef stxoVal = 
+         iface_->getValueRef(BLKDATA, DB_PREFIX_TXDATA, stxo0Key);
+      ASSERT_GT(stxoVal.getSize(), 2);
+      EXPECT_EQ(stxoVal.getSliceCopy(0, 2), READHEX("0440"));
+      EXPECT_LT(stxoVal.getSize(), 2 + rawTxOut0_.getSize());
+
+      // the tx hash stays in the clear for hint lookups
+      BinaryDataRef stxVal = 
+         iface_->getValueRef(BLKDATA, DB_PREFIX_TXDATA, stxKey);
+      EXPECT_EQ(stxVal.getSliceCopy(2, 32), stx.thisHash_);
+
+      // and readers don't see the difference
+      StoredTxOut stxoGet;
+      iface_->getStoredTxOut(stxoGet, 123000, 15, 7, 0);
+      EXPECT_EQ(stxoGet.dataCopy_, rawTxOut0_);
+      EXPECT_EQ(iface_->getTxOutCopy(stxKey, 1).serialize(), rawTxOut1_);
+
+      Tx txGet = iface_->getFullTxCopy(stxKey);
+      EXPECT_EQ(txGet.serialize(), rawTxUnfrag_);
+      EXPECT_EQ(iface_->getTxInCopy(stxKey, 0).serialize(),
+         txGet.getTxInCopy(0).serialize());
+   }
+
+   // switching back to raw keeps the existing entries readable
+   iface_->closeDatabases();
+   iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType);
+   EXPECT_EQ(iface_->txDataCompression(), TXDATA_RAW);
+
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
+
+      // new writes are raw, but the db still says it holds compressed 
+      // entries
+      StoredDBInfo sdbi;
+      iface_->getStoredDBInfo(BLKDATA, sdbi);
+      EXPECT_EQ(sdbi.txCompression_, TXDATA_RAW);
+      EXPECT_EQ(sdbi.armoryVer_, ARMORY_DB_VERSION_TXCOMPRESSION);
+
+      StoredTx stxGet;
+      EXPECT_TRUE(iface_->getStoredTx(stxGet, 123000, (uint8_t)15, 7));
+      EXPECT_EQ(stxGet.getSerializedTx(), rawTxUnfrag_);
+   }
+
+   // a db version past what this build knows is refused
+   {
+      LMDBEnv::Transaction tx(iface_->dbEnv_[BLKDATA].get(), LMDB::ReadWrite);
+      StoredDBInfo sdbi;
+      iface_->getStoredDBInfo(BLKDATA, sdbi);
+      sdbi.armoryVer_ = ARMORY_DB_VERSION_TXCOMPRESSION + 1;
+      iface_->putStoredDBInfo(BLKDATA, sdbi);
+   }
+
+   iface_->closeDatabases();
+   EXPECT_THROW(iface_->openDatabases(
+      config_.levelDBLocation,
+      config_.genesisBlockHash,
+      config_.genesisTxHash,
+      config_.magicBytes,
+      config_.armoryDbType,
+      config_.pruneType), runtime_error);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 TEST_F(LMDBTest_Super, PutFullBlockNoTx)
 {
@@ -6909,77 +8251,449 @@ TEST_F(LMDBTest_Super, PutGetStoredScriptHistory)
    EXPECT_EQ(txioptr->getValue(), val0);
    EXPECT_FALSE(txioptr->isMultisig());
 
-   /////////////////////////////////////////////////////////////////////////////
-   // Two TxIOPairs in one sub history
-   ssh = sshorig;
-   sshtemp = StoredScriptHistory();
-   ssh.insertTxio(txio0);
-   ssh.insertTxio(txio1);
+   /////////////////////////////////////////////////////////////////////////////
+   // Two TxIOPairs in one sub history
+   ssh = sshorig;
+   sshtemp = StoredScriptHistory();
+   ssh.insertTxio(txio0);
+   ssh.insertTxio(txio1);
+
+   iface_->putStoredScriptHistory(ssh);
+   iface_->getStoredScriptHistory(sshtemp, uniq);
+
+   EXPECT_EQ(sshtemp.uniqueKey_, uniq);
+   EXPECT_EQ(sshtemp.alreadyScannedUpToBlk_, blk);
+   EXPECT_EQ(sshtemp.totalTxioCount_, 2);
+   EXPECT_EQ(sshtemp.totalUnspent_, val0 + val1);
+   EXPECT_EQ(sshtemp.subHistMap_.size(), 1);
+   ASSERT_NE(sshtemp.subHistMap_.find(hgtX0), sshtemp.subHistMap_.end());
+   subptr = &sshtemp.subHistMap_[hgtX0];
+   EXPECT_EQ(subptr->uniqueKey_, uniq);
+   EXPECT_EQ(subptr->hgtX_, hgtX0);
+   ASSERT_EQ(subptr->txioMap_.size(), 2);
+   ASSERT_NE(subptr->txioMap_.find(dbkey0), subptr->txioMap_.end());
+   txioptr = &subptr->txioMap_[dbkey0];
+   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey0);
+   EXPECT_EQ(txioptr->getValue(), val0);
+   EXPECT_FALSE(txioptr->isMultisig());
+   txioptr = &subptr->txioMap_[dbkey1];
+   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey1);
+   EXPECT_EQ(txioptr->getValue(), val1);
+   EXPECT_FALSE(txioptr->isMultisig());
+
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Add new sub-history with multisig
+   ssh = sshorig;
+   ssh.insertTxio(txio0);
+   ssh.insertTxio(txio1);
+   ssh.insertTxio(txio3);
+
+   iface_->putStoredScriptHistory(ssh);
+   iface_->getStoredScriptHistory(sshtemp, uniq);
+
+   EXPECT_EQ(sshtemp.uniqueKey_, uniq);
+   EXPECT_EQ(sshtemp.alreadyScannedUpToBlk_, blk);
+   EXPECT_EQ(sshtemp.totalTxioCount_, 3);
+   EXPECT_EQ(sshtemp.totalUnspent_, val0 + val1);
+   EXPECT_EQ(sshtemp.subHistMap_.size(), 2);
+
+   ASSERT_NE(sshtemp.subHistMap_.find(hgtX0), sshtemp.subHistMap_.end());
+   subptr = &sshtemp.subHistMap_[hgtX0];
+   EXPECT_EQ(subptr->uniqueKey_, uniq);
+   EXPECT_EQ(subptr->hgtX_, hgtX0);
+   ASSERT_EQ(subptr->txioMap_.size(), 2);
+   ASSERT_NE(subptr->txioMap_.find(dbkey0), subptr->txioMap_.end());
+   txioptr = &subptr->txioMap_[dbkey0];
+   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey0);
+   EXPECT_EQ(txioptr->getValue(), val0);
+   txioptr = &subptr->txioMap_[dbkey1];
+   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey1);
+   EXPECT_EQ(txioptr->getValue(), val1);
+   EXPECT_FALSE(txioptr->isMultisig());
+
+   ASSERT_NE(sshtemp.subHistMap_.find(hgtX1), sshtemp.subHistMap_.end());
+   subptr = &sshtemp.subHistMap_[hgtX1];
+   EXPECT_EQ(subptr->uniqueKey_, uniq);
+   EXPECT_EQ(subptr->hgtX_, hgtX1);
+   ASSERT_EQ(subptr->txioMap_.size(), 1);
+   ASSERT_NE(subptr->txioMap_.find(dbkey3), subptr->txioMap_.end());
+   txioptr = &subptr->txioMap_[dbkey3];
+   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey3);
+   EXPECT_EQ(txioptr->getValue(), val3);
+   EXPECT_TRUE(txioptr->isMultisig());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(UtxoCacheTest, InsertTakeEvict)
+{
+   auto makeStxo = [](uint32_t i)->StoredTxOut
+   {
+      StoredTxOut stxo;
+      BinaryWriter bw;
+      bw.put_uint64_t(1000 + i);
+      bw.put_var_int(25);
+      bw.put_BinaryData(READHEX("76a914"));
+      bw.put_BinaryData(BtcUtils::getHash160(WRITE_UINT32_LE(i)));
+      bw.put_BinaryData(READHEX("88ac"));
+
+      stxo.dataCopy_ = bw.getData();
+      stxo.txVersion_ = 1;
+      stxo.blockHeight_ = 100 + i;
+      stxo.duplicateID_ = 0;
+      stxo.txIndex_ = 2;
+      stxo.txOutIndex_ = i % 3;
+      stxo.isCoinbase_ = (i % 2) == 0;
+      return stxo;
+   };
+
+   auto makeKey = [](uint32_t i)->BinaryData
+   {
+      BinaryData key = BtcUtils::getHash256(WRITE_UINT32_LE(i));
+      key.append(WRITE_UINT16_BE(i % 3));
+      return key;
+   };
+
+   //enough entries to go through a few rehashes
+   UtxoCache cache;
+   for (uint32_t i = 0; i < 500; i++)
+      cache.insert(makeKey(i), makeStxo(i));
+   EXPECT_EQ(cache.size(), 500);
+
+   auto stxo = cache.take(makeKey(7));
+   ASSERT_NE(stxo, nullptr);
+   StoredTxOut expected = makeStxo(7);
+   EXPECT_EQ(stxo->dataCopy_, expected.dataCopy_);
+   EXPECT_EQ(stxo->getValue(), 1007);
+   EXPECT_EQ(stxo->getScrAddress(), expected.getScrAddress());
+   EXPECT_EQ(stxo->getDBKey(false), expected.getDBKey(false));
+   EXPECT_EQ(stxo->blockHeight_, 107);
+   EXPECT_EQ(stxo->txOutIndex_, 1);
+   EXPECT_EQ(stxo->txVersion_, 1);
+   EXPECT_FALSE(stxo->isCoinbase_);
+   EXPECT_EQ(stxo->spentness_, TXOUT_UNSPENT);
+   EXPECT_EQ(stxo->hashAndId_, makeKey(7));
+   EXPECT_EQ(stxo->parentHash_, makeKey(7).getSliceCopy(0, 32));
+
+   //taking spends the entry
+   EXPECT_EQ(cache.take(makeKey(7)), nullptr);
+   EXPECT_EQ(cache.size(), 499);
+
+   //erased slots get reused and purged without losing live entries
+   for (uint32_t i = 0; i < 400; i++)
+   {
+      if (i != 7)
+         EXPECT_NE(cache.take(makeKey(i)), nullptr);
+   }
+   for (uint32_t i = 500; i < 900; i++)
+      cache.insert(makeKey(i), makeStxo(i));
+   EXPECT_EQ(cache.size(), 500);
+
+   //the previous generation is still searched, the one before is gone
+   cache.evictOldest();
+   cache.insert(makeKey(1000), makeStxo(1000));
+   EXPECT_EQ(cache.size(), 501);
+
+   stxo = cache.take(makeKey(450));
+   ASSERT_NE(stxo, nullptr);
+   EXPECT_EQ(stxo->getValue(), 1450);
+
+   cache.evictOldest();
+   EXPECT_EQ(cache.size(), 1);
+   EXPECT_EQ(cache.take(makeKey(451)), nullptr);
+   EXPECT_NE(cache.take(makeKey(1000)), nullptr);
+   EXPECT_EQ(cache.size(), 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(BlockWriteBatcherTest, CommitThreshold)
+{
+   const uint64_t minThresh = BlockWriteBatcher::COMMIT_BYTES_MIN;
+   const uint64_t maxThresh = BlockWriteBatcher::COMMIT_BYTES_MAX;
+
+   //half of what's left of the budget
+   const uint64_t budget = minThresh + maxThresh;
+   EXPECT_EQ(BlockWriteBatcher::commitThresholdFor(budget, 0), budget / 2);
+   EXPECT_EQ(BlockWriteBatcher::commitThresholdFor(budget + 1000, 1000), 
+      budget / 2);
+
+   //clamped at both ends, an exhausted budget still commits
+   EXPECT_EQ(BlockWriteBatcher::commitThresholdFor(0, 0), minThresh);
+   EXPECT_EQ(BlockWriteBatcher::commitThresholdFor(budget, budget * 2), 
+      minThresh);
+   EXPECT_EQ(BlockWriteBatcher::commitThresholdFor(UINT64_MAX, 0), maxThresh);
+
+   BlockDataManagerConfig config;
+   EXPECT_GE(config.scanMemoryBudget, 256ULL * 1024 * 1024);
+   EXPECT_LE(config.scanMemoryBudget, 16ULL * 1024 * 1024 * 1024);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// BlockWriteBatcher befriends this fixture, tests go through it to fill a 
+// batch without scanning blocks
+class DataToCommitTest : public ::testing::Test
+{
+protected:
+   virtual void SetUp(void)
+   {
+#ifdef _MSC_VER
+      rmdir("./ldbtestdir");
+      mkdir("./ldbtestdir");
+#else
+      system("rm -rf ./ldbtestdir/*");
+#endif
+
+      auto isready = [](void)->bool { return true; };
+      iface_ = new LMDBBlockDatabase(isready);
+
+      config_.armoryDbType = ARMORY_DB_FULL;
+      config_.pruneType = DB_PRUNE_NONE;
+      config_.levelDBLocation = string("ldbtestdir");
+      config_.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
+      config_.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
+      config_.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
+
+      iface_->openDatabases(
+         config_.levelDBLocation,
+         config_.genesisBlockHash,
+         config_.genesisTxHash,
+         config_.magicBytes,
+         config_.armoryDbType,
+         config_.pruneType);
+   }
+
+   /////
+   virtual void TearDown(void)
+   {
+      iface_->closeDatabases();
+      delete iface_;
+      iface_ = NULL;
+
+#ifdef _MSC_VER
+      rmdir("./ldbtestdir/*");
+#else
+      system("rm -rf ./ldbtestdir/*");
+#endif
+
+      CLEANUP_ALL_TIMERS();
+   }
+
+   /////
+   // the same batch every time: subs, ssh, stxos and tx hints, in counts 
+   // that don't split evenly over the partitions
+   void fillBatch(BlockWriteBatcher& bwb)
+   {
+      bwb.sshToModify_ = make_shared<map<BinaryData, StoredScriptHistory>>();
+
+      for (uint32_t i = 0; i < 51; i++)
+      {
+         BinaryData scrAddr = WRITE_UINT8_LE((uint8_t)SCRIPT_PREFIX_HASH160);
+         scrAddr.append(BtcUtils::getHash160(WRITE_UINT32_LE(i)));
+
+         auto& ssh = (*bwb.sshToModify_)[scrAddr];
+         ssh.uniqueKey_ = scrAddr;
+         ssh.alreadyScannedUpToBlk_ = 1;
+
+         auto& subs = bwb.subSshMap_[scrAddr];
+         for (uint32_t h = 0; h < 3; h++)
+         {
+            BinaryData hgtX = DBUtils::heightAndDupToHgtx(100 + h, 0);
+            auto& subssh = subs[hgtX];
+            subssh.uniqueKey_ = scrAddr;
+            subssh.hgtX_ = hgtX;
+
+            //emptied subs get their key deleted
+            if ((i + h) % 5 == 0)
+               continue;
+
+            TxIOPair txio(
+               DBUtils::getBlkDataKeyNoPrefix(100 + h, 0, i, h), 1000 * i + h);
+            subssh.insertTxio(txio);
+         }
+      }
+
+      //outputs spent in the same batch show up twice, the last state wins
+      for (uint32_t i = 0; i < 101; i++)
+      {
+         auto stxo = make_shared<StoredTxOut>();
+         BinaryWriter bw;
+         bw.put_uint64_t(1000 + i);
+         bw.put_var_int(25);
+         bw.put_BinaryData(READHEX("76a914"));
+         bw.put_BinaryData(BtcUtils::getHash160(WRITE_UINT32_LE(i)));
+         bw.put_BinaryData(READHEX("88ac"));
+
+         stxo->dataCopy_ = bw.getData();
+         stxo->txVersion_ = 1;
+         stxo->blockHeight_ = 100 + i / 10;
+         stxo->duplicateID_ = 0;
+         stxo->txIndex_ = i % 10;
+         stxo->txOutIndex_ = i % 3;
+         stxo->spentness_ = TXOUT_UNSPENT;
+         bwb.stxoToUpdate_.push_back(stxo);
+
+         if (i % 4 == 0)
+         {
+            auto spent = make_shared<StoredTxOut>(*stxo);
+            spent->spentness_ = TXOUT_SPENT;
+            spent->spentByTxInKey_ = 
+               DBUtils::getBlkDataKeyNoPrefix(200, 0, i, 0);
+            bwb.stxoToUpdate_.push_back(spent);
+         }
+      }
+
+      //some txs share a hint entry
+      for (uint32_t i = 0; i < 61; i++)
+      {
+         BinaryData key = WRITE_UINT8_LE((uint8_t)DB_PREFIX_TXDATA);
+         key.append(DBUtils::getBlkDataKeyNoPrefix(100 + i / 10, 0, i % 10));
+
+         BinaryData hash = BtcUtils::getHash256(WRITE_UINT32_LE(i));
+         if (i % 7 == 0)
+         {
+            BinaryData shared = BtcUtils::getHash256(WRITE_UINT32_LE(0));
+            memcpy(hash.getPtr(), shared.getPtr(), 4);
+         }
+
+         auto& countAndHint = bwb.txCountAndHint_[key];
+         countAndHint.count_ = i % 3 + 1;
+         countAndHint.hash_ = hash;
+      }
+
+      bwb.mostRecentBlockApplied_ = 105;
+   }
+
+   /////
+   DataToCommit& serialize(BlockWriteBatcher& bwb)
+   {
+      bwb.serializeData(bwb.subSshMap_);
+      return bwb.dataToCommit_;
+   }
+
+   LMDBBlockDatabase* iface_;
+   BlockDataManagerConfig config_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(DataToCommitTest, PartitionedMerge)
+{
+   //the same entries serialized over any number of partitions merge into 
+   //the same sorted output
+   auto serialize = [](unsigned count)->map<BinaryData, BinaryWriter>
+   {
+      vector<DataToCommit::SerializedPartition> parts(count);
+      vector<unsigned> runs(count, 0);
+
+      auto work = [&](unsigned id)->void
+      {
+         ++runs[id];
+         for (uint32_t i = 0; i < 1000; i++)
+         {
+            if (i % count != id)
+               continue;
+
+            BinaryWriter& bw = parts[id].serialized_[WRITE_UINT32_BE(i * 7)];
+            bw.put_uint32_t(i);
+
+            if (i % 10 == 0)
+               parts[id].keysToDelete_.insert(WRITE_UINT32_BE(i));
+         }
+      };
 
-   iface_->putStoredScriptHistory(ssh);
-   iface_->getStoredScriptHistory(sshtemp, uniq);
+      DataToCommit::runPartitions(count, work);
+      for (auto run : runs)
+         EXPECT_EQ(run, 1);
 
-   EXPECT_EQ(sshtemp.uniqueKey_, uniq);
-   EXPECT_EQ(sshtemp.alreadyScannedUpToBlk_, blk);
-   EXPECT_EQ(sshtemp.totalTxioCount_, 2);
-   EXPECT_EQ(sshtemp.totalUnspent_, val0 + val1);
-   EXPECT_EQ(sshtemp.subHistMap_.size(), 1);
-   ASSERT_NE(sshtemp.subHistMap_.find(hgtX0), sshtemp.subHistMap_.end());
-   subptr = &sshtemp.subHistMap_[hgtX0];
-   EXPECT_EQ(subptr->uniqueKey_, uniq);
-   EXPECT_EQ(subptr->hgtX_, hgtX0);
-   ASSERT_EQ(subptr->txioMap_.size(), 2);
-   ASSERT_NE(subptr->txioMap_.find(dbkey0), subptr->txioMap_.end());
-   txioptr = &subptr->txioMap_[dbkey0];
-   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey0);
-   EXPECT_EQ(txioptr->getValue(), val0);
-   EXPECT_FALSE(txioptr->isMultisig());
-   txioptr = &subptr->txioMap_[dbkey1];
-   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey1);
-   EXPECT_EQ(txioptr->getValue(), val1);
-   EXPECT_FALSE(txioptr->isMultisig());
+      map<BinaryData, BinaryWriter> serialized;
+      set<BinaryData> keysToDelete;
+      DataToCommit::mergePartitions(parts, serialized, keysToDelete);
+      EXPECT_EQ(keysToDelete.size(), 100);
 
+      return serialized;
+   };
 
-   /////////////////////////////////////////////////////////////////////////////
-   // Add new sub-history with multisig
-   ssh = sshorig;
-   ssh.insertTxio(txio0);
-   ssh.insertTxio(txio1);
-   ssh.insertTxio(txio3);
+   auto reference = serialize(1);
+   ASSERT_EQ(reference.size(), 1000);
 
-   iface_->putStoredScriptHistory(ssh);
-   iface_->getStoredScriptHistory(sshtemp, uniq);
+   for (unsigned count : { 2, 3, 8 })
+   {
+      auto serialized = serialize(count);
+      ASSERT_EQ(serialized.size(), reference.size());
 
-   EXPECT_EQ(sshtemp.uniqueKey_, uniq);
-   EXPECT_EQ(sshtemp.alreadyScannedUpToBlk_, blk);
-   EXPECT_EQ(sshtemp.totalTxioCount_, 3);
-   EXPECT_EQ(sshtemp.totalUnspent_, val0 + val1);
-   EXPECT_EQ(sshtemp.subHistMap_.size(), 2);
+      auto refIter = reference.begin();
+      for (auto& dataPair : serialized)
+      {
+         EXPECT_EQ(dataPair.first, refIter->first);
+         EXPECT_EQ(dataPair.second.getData(), refIter->second.getData());
+         ++refIter;
+      }
+   }
+}
 
-   ASSERT_NE(sshtemp.subHistMap_.find(hgtX0), sshtemp.subHistMap_.end());
-   subptr = &sshtemp.subHistMap_[hgtX0];
-   EXPECT_EQ(subptr->uniqueKey_, uniq);
-   EXPECT_EQ(subptr->hgtX_, hgtX0);
-   ASSERT_EQ(subptr->txioMap_.size(), 2);
-   ASSERT_NE(subptr->txioMap_.find(dbkey0), subptr->txioMap_.end());
-   txioptr = &subptr->txioMap_[dbkey0];
-   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey0);
-   EXPECT_EQ(txioptr->getValue(), val0);
-   txioptr = &subptr->txioMap_[dbkey1];
-   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey1);
-   EXPECT_EQ(txioptr->getValue(), val1);
-   EXPECT_FALSE(txioptr->isMultisig());
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(DataToCommitTest, ThreadCountIndependent)
+{
+   auto compareMaps = [](map<BinaryData, BinaryWriter>& result,
+      map<BinaryData, BinaryWriter>& reference)->void
+   {
+      ASSERT_EQ(result.size(), reference.size());
 
-   ASSERT_NE(sshtemp.subHistMap_.find(hgtX1), sshtemp.subHistMap_.end());
-   subptr = &sshtemp.subHistMap_[hgtX1];
-   EXPECT_EQ(subptr->uniqueKey_, uniq);
-   EXPECT_EQ(subptr->hgtX_, hgtX1);
-   ASSERT_EQ(subptr->txioMap_.size(), 1);
-   ASSERT_NE(subptr->txioMap_.find(dbkey3), subptr->txioMap_.end());
-   txioptr = &subptr->txioMap_[dbkey3];
-   EXPECT_EQ(txioptr->getDBKeyOfOutput(), dbkey3);
-   EXPECT_EQ(txioptr->getValue(), val3);
-   EXPECT_TRUE(txioptr->isMultisig());
+      auto refIter = reference.begin();
+      for (auto& dataPair : result)
+      {
+         EXPECT_EQ(dataPair.first, refIter->first);
+         EXPECT_EQ(dataPair.second.getData(), refIter->second.getData());
+         ++refIter;
+      }
+   };
+
+   BlockDataManagerConfig config1 = config_;
+   config1.threadCount = 1;
+   BlockWriteBatcher reference(config1, iface_, true);
+   fillBatch(reference);
+   DataToCommit& refData = serialize(reference);
+
+   //51 scrAddrs with 3 subs each, a third of them emptied
+   EXPECT_EQ(refData.serializedSshToModify_.size(), 51);
+   EXPECT_EQ(refData.serializedSubSshToApply_.size() +
+      refData.keysToDelete_.size(), 51 * 3);
+   EXPECT_EQ(refData.serializedStxOutToModify_.size(), 101);
+   EXPECT_EQ(refData.serializedTxCountAndHash_.size(), 61);
+   EXPECT_EQ(refData.serializedTxHints_.size(), 61 - 61 / 7);
+
+   //twice with the same thread count for scheduling, then another count
+   for (unsigned threadCount : { 4, 4, 3 })
+   {
+      BlockDataManagerConfig config = config_;
+      config.threadCount = threadCount;
+      BlockWriteBatcher bwb(config, iface_, true);
+      fillBatch(bwb);
+      DataToCommit& data = serialize(bwb);
+
+      compareMaps(data.serializedSubSshToApply_, 
+         refData.serializedSubSshToApply_);
+      compareMaps(data.serializedSshToModify_, 
+         refData.serializedSshToModify_);
+      compareMaps(data.serializedStxOutToModify_, 
+         refData.serializedStxOutToModify_);
+      compareMaps(data.serializedSbhToUpdate_, 
+         refData.serializedSbhToUpdate_);
+      compareMaps(data.serializedTxCountAndHash_, 
+         refData.serializedTxCountAndHash_);
+      compareMaps(data.serializedTxHints_, refData.serializedTxHints_);
+      EXPECT_EQ(data.keysToDelete_, refData.keysToDelete_);
+   }
+
+   //the spent state was the last one in
+   StoredTxOut stxo;
+   BinaryData stxoKey = 
+      WRITE_UINT8_LE((uint8_t)DB_PREFIX_TXDATA) + 
+      DBUtils::getBlkDataKeyNoPrefix(100, 0, 4, 1);
+   auto stxoIter = refData.serializedStxOutToModify_.find(stxoKey);
+   ASSERT_NE(stxoIter, refData.serializedStxOutToModify_.end());
+   stxo.unserializeDBValue(stxoIter->second.getData());
+   EXPECT_EQ(stxo.spentness_, TXOUT_SPENT);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -7314,94 +9028,302 @@ protected:
    }
 
 
-   /////////////////////////////////////////////////////////////////////////////
-   virtual void TearDown(void)
+   /////////////////////////////////////////////////////////////////////////////
+   virtual void TearDown(void)
+   {
+      delete theBDM;
+      delete theBDV;
+
+      theBDM = nullptr;
+      theBDV = nullptr;
+      
+      rmdir(blkdir_);
+      rmdir(homedir_);
+
+      #ifdef _MSC_VER
+         rmdir("./ldbtestdir");
+         mkdir("./ldbtestdir");
+      #else
+         string delstr = ldbdir_ + "/*";
+         rmdir(delstr);
+      #endif
+      LOGENABLESTDOUT();
+      CLEANUP_ALL_TIMERS();
+   }
+
+   BlockDataManagerConfig config = testConfig();
+
+   LMDBBlockDatabase* iface_;
+   BinaryData magic_;
+   BinaryData ghash_;
+   BinaryData gentx_;
+   BinaryData zeros_;
+
+   string blkdir_;
+   string homedir_;
+   string ldbdir_;
+   string blk0dat_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsBare, BuildNoRegisterWlt)
+{
+   TheBDM.doInitialSyncOnLoad( nullProgress ); 
+}
+
+
+class BlockDir : public ::testing::Test
+{
+protected:
+   const string blkdir_  = "./blkfiletest";
+   const string homedir_ = "./fakehomedir";
+   const string ldbdir_  = "./ldbtestdir";
+   
+   string blk0dat_;
+
+   /////////////////////////////////////////////////////////////////////////////
+   virtual void SetUp()
+   {
+      LOGDISABLESTDOUT();
+      
+      mkdir(blkdir_);
+      mkdir(homedir_);
+      
+      blk0dat_ = BtcUtils::getBlkFilename(blkdir_, 0);
+   }
+   
+   /////////////////////////////////////////////////////////////////////////////
+   virtual void TearDown(void)
+   {
+      rmdir(blkdir_);
+      rmdir(homedir_);
+
+      #ifdef _MSC_VER
+         rmdir("./ldbtestdir");
+         mkdir("./ldbtestdir");
+      #else
+         string delstr = ldbdir_ + "/*";
+         rmdir(delstr);
+      #endif
+      LOGENABLESTDOUT();
+      CLEANUP_ALL_TIMERS();
+   }
+
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockDir, HeadersFirst)
+{
+   BlockDataManagerConfig config = testConfig();
+   config.armoryDbType = ARMORY_DB_BARE;
+   config.pruneType = DB_PRUNE_NONE;
+   config.blkFileLocation = blkdir_;
+   config.levelDBLocation = ldbdir_;
+   
+   config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
+   config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
+   config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
+      
+   // Put the first 5 blocks out of order
+   setBlocks({ "0", "1", "2", "4", "3", "5" }, blk0dat_);
+   
+   BlockDataManager_LevelDB bdm(config);
+   bdm.openDatabase();
+   
+
+   const std::vector<BinaryData> scraddrs
+   {
+      TestChain::scrAddrA,
+      TestChain::scrAddrB,
+      TestChain::scrAddrC
+   };
+
+   BlockDataViewer bdv(&bdm);
+   BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
+   
+   bdm.doInitialSyncOnLoad( nullProgress ); 
+   
+   bdv.scanWallets();
+   
+   // we should get the same balance as we do for test 'Load5Blocks'
+   const ScrAddrObj *scrobj;
+   
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
+   EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
+   EXPECT_EQ(scrobj->getFullBalance(), 70*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[2]);
+   EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockDir, HeadersFirstUpdate)
+{
+   BlockDataManagerConfig config = testConfig();
+   config.armoryDbType = ARMORY_DB_BARE;
+   config.pruneType = DB_PRUNE_NONE;
+   config.blkFileLocation = blkdir_;
+   config.levelDBLocation = ldbdir_;
+   
+   config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
+   config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
+   config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
+      
+   // Put the first 5 blocks out of order
+   setBlocks({ "0", "1", "2" }, blk0dat_);
+   
+   BlockDataManager_LevelDB bdm(config);
+   bdm.openDatabase();
+   
+
+   const std::vector<BinaryData> scraddrs
+   {
+      TestChain::scrAddrA,
+      TestChain::scrAddrB,
+      TestChain::scrAddrC
+   };
+
+   BlockDataViewer bdv(&bdm);
+   BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
+   
+   bdm.doInitialSyncOnLoad( nullProgress ); 
+   
+   bdv.scanWallets();
+   
+   appendBlocks({ "4", "3", "5" }, blk0dat_);
+   
+   bdm.readBlkFileUpdate();
+   bdv.scanWallets();
+   
+   // we should get the same balance as we do for test 'Load5Blocks'
+   const ScrAddrObj *scrobj;
+   
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
+   EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
+   EXPECT_EQ(scrobj->getFullBalance(), 70*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[2]);
+   EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockDir, HeadersFirstUpdateTwice)
+{
+   BlockDataManagerConfig config = testConfig();
+   config.armoryDbType = ARMORY_DB_BARE;
+   config.pruneType = DB_PRUNE_NONE;
+   config.blkFileLocation = blkdir_;
+   config.levelDBLocation = ldbdir_;
+   
+   config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
+   config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
+   config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
+      
+   // Put the first 5 blocks out of order
+   setBlocks({ "0", "1", "2" }, blk0dat_);
+   
+   BlockDataManager_LevelDB bdm(config);
+   bdm.openDatabase();
+   
+
+   const std::vector<BinaryData> scraddrs
    {
-      delete theBDM;
-      delete theBDV;
-
-      theBDM = nullptr;
-      theBDV = nullptr;
-      
-      rmdir(blkdir_);
-      rmdir(homedir_);
+      TestChain::scrAddrA,
+      TestChain::scrAddrB,
+      TestChain::scrAddrC
+   };
 
-      #ifdef _MSC_VER
-         rmdir("./ldbtestdir");
-         mkdir("./ldbtestdir");
-      #else
-         string delstr = ldbdir_ + "/*";
-         rmdir(delstr);
-      #endif
-      LOGENABLESTDOUT();
-      CLEANUP_ALL_TIMERS();
-   }
+   BlockDataViewer bdv(&bdm);
+   BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
+   
+   bdm.doInitialSyncOnLoad( nullProgress ); 
+   
+   bdv.scanWallets();
+   
+   appendBlocks({"5"}, blk0dat_);
+   appendBlocks({"4"}, blk0dat_);
 
-   BlockDataManagerConfig config;
+   bdm.readBlkFileUpdate();
+   bdv.scanWallets();
+   appendBlocks({"3"}, blk0dat_);
+   
+   bdm.readBlkFileUpdate();
+   bdv.scanWallets();
+   
+   // we should get the same balance as we do for test 'Load5Blocks'
+   const ScrAddrObj *scrobj;
+   
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
+   EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
+   EXPECT_EQ(scrobj->getFullBalance(), 70*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[2]);
+   EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
+}
 
-   LMDBBlockDatabase* iface_;
-   BinaryData magic_;
-   BinaryData ghash_;
-   BinaryData gentx_;
-   BinaryData zeros_;
 
-   string blkdir_;
-   string homedir_;
-   string ldbdir_;
-   string blk0dat_;
-};
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(BlockUtilsBare, BuildNoRegisterWlt)
-{
-   TheBDM.doInitialSyncOnLoad( nullProgress ); 
-}
-
-
-class BlockDir : public ::testing::Test
+TEST_F(BlockDir, AddBlockWhileUpdating)
 {
-protected:
-   const string blkdir_  = "./blkfiletest";
-   const string homedir_ = "./fakehomedir";
-   const string ldbdir_  = "./ldbtestdir";
+   BlockDataManagerConfig config = testConfig();
+   config.armoryDbType = ARMORY_DB_BARE;
+   config.pruneType = DB_PRUNE_NONE;
+   config.blkFileLocation = blkdir_;
+   config.levelDBLocation = ldbdir_;
    
-   string blk0dat_;
-
-   /////////////////////////////////////////////////////////////////////////////
-   virtual void SetUp()
-   {
-      LOGDISABLESTDOUT();
-      
-      mkdir(blkdir_);
-      mkdir(homedir_);
+   config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
+   config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
+   config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
       
-      blk0dat_ = BtcUtils::getBlkFilename(blkdir_, 0);
-   }
+   setBlocks({ "0", "1", "2" }, blk0dat_);
    
-   /////////////////////////////////////////////////////////////////////////////
-   virtual void TearDown(void)
+   BlockDataManager_LevelDB bdm(config);
+   bdm.openDatabase();
+   
+   const std::vector<BinaryData> scraddrs
    {
-      rmdir(blkdir_);
-      rmdir(homedir_);
+      TestChain::scrAddrA,
+      TestChain::scrAddrB,
+      TestChain::scrAddrC
+   };
 
-      #ifdef _MSC_VER
-         rmdir("./ldbtestdir");
-         mkdir("./ldbtestdir");
-      #else
-         string delstr = ldbdir_ + "/*";
-         rmdir(delstr);
-      #endif
-      LOGENABLESTDOUT();
-      CLEANUP_ALL_TIMERS();
-   }
+   BlockDataViewer bdv(&bdm);
+   BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
+   
+   bdm.doInitialSyncOnLoad( nullProgress ); 
+   
+   bdv.scanWallets();
+   
+   BlockDataManager_LevelDB::BlkFileUpdateCallbacks callbacks;
+   callbacks.headersRead = [&]()
+      {
+         appendBlocks({"3"}, blk0dat_);
+      };
+   
+   bdm.readBlkFileUpdate(callbacks);
+   bdv.scanWallets();
 
-};
+   appendBlocks({"4", "5"}, blk0dat_);
+   bdm.readBlkFileUpdate();
+   bdv.scanWallets();
 
+   // we should get the same balance as we do for test 'Load5Blocks'
+   const ScrAddrObj *scrobj;
+   
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
+   EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
+   EXPECT_EQ(scrobj->getFullBalance(), 70*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[2]);
+   EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(BlockDir, HeadersFirst)
+TEST_F(BlockDir, BlockFileSplit)
 {
-   BlockDataManagerConfig config;
+   BlockDataManagerConfig config = testConfig();
    config.armoryDbType = ARMORY_DB_BARE;
    config.pruneType = DB_PRUNE_NONE;
    config.blkFileLocation = blkdir_;
@@ -7410,31 +9332,126 @@ TEST_F(BlockDir, HeadersFirst)
    config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
    config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
    config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
-      
-   // Put the first 5 blocks out of order
-   setBlocks({ "0", "1", "2", "4", "3", "5" }, blk0dat_);
+   
+   setBlocks({ "0", "1" }, blk0dat_);
+   
+   std::string blk1dat = BtcUtils::getBlkFilename(blkdir_, 1);
+   setBlocks({ "2", "3", "4","5" }, blk1dat);
    
    BlockDataManager_LevelDB bdm(config);
    bdm.openDatabase();
    
-
    const std::vector<BinaryData> scraddrs
    {
-      TestChain::scrAddrA,
-      TestChain::scrAddrB,
-      TestChain::scrAddrC
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
    };
 
    BlockDataViewer bdv(&bdm);
    BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
    
    bdm.doInitialSyncOnLoad( nullProgress ); 
+   bdv.scanWallets();
+   
+   
    
+   // we should get the same balance as we do for test 'Load5Blocks'
+   const ScrAddrObj *scrobj;
+   
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
+   EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
+   EXPECT_EQ(scrobj->getFullBalance(), 70*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[2]);
+   EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockDir, BlockFileSplitParallel)
+{
+   BlockDataManagerConfig config = testConfig();
+   config.armoryDbType = ARMORY_DB_BARE;
+   config.pruneType = DB_PRUNE_NONE;
+   config.blkFileLocation = blkdir_;
+   config.levelDBLocation = ldbdir_;
+   config.threadCount = 2;
+
+   config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
+   config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
+   config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
+
+   // spread the blocks over more files than there are reader threads
+   setBlocks({ "0", "1" }, blk0dat_);
+   setBlocks({ "2" }, BtcUtils::getBlkFilename(blkdir_, 1));
+   setBlocks({ "3", "4" }, BtcUtils::getBlkFilename(blkdir_, 2));
+   setBlocks({ "5" }, BtcUtils::getBlkFilename(blkdir_, 3));
+
+   BlockDataManager_LevelDB bdm(config);
+   bdm.openDatabase();
+
+   const std::vector<BinaryData> scraddrs
+   {
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
+   };
+
+   BlockDataViewer bdv(&bdm);
+   BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
+
+   bdm.doInitialSyncOnLoad( nullProgress );
+   bdv.scanWallets();
+
+   EXPECT_EQ(bdm.blockchain().top().getBlockHeight(), 5);
+
+   const ScrAddrObj *scrobj;
+
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
+   EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
+   EXPECT_EQ(scrobj->getFullBalance(), 70*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[2]);
+   EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockDir, BlockFileSplitParallel_NoBytesAhead)
+{
+   BlockDataManagerConfig config = testConfig();
+   config.armoryDbType = ARMORY_DB_BARE;
+   config.pruneType = DB_PRUNE_NONE;
+   config.blkFileLocation = blkdir_;
+   config.levelDBLocation = ldbdir_;
+   config.threadCount = 4;
+
+   // no room for prepared blocks, the readers can only ever work on the
+   // file the writer is waiting for
+   config.scanMemoryBudget = 0;
+
+   config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
+   config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
+   config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
+
+   setBlocks({ "0", "1" }, blk0dat_);
+   setBlocks({ "2" }, BtcUtils::getBlkFilename(blkdir_, 1));
+   setBlocks({ "3", "4" }, BtcUtils::getBlkFilename(blkdir_, 2));
+   setBlocks({ "5" }, BtcUtils::getBlkFilename(blkdir_, 3));
+
+   BlockDataManager_LevelDB bdm(config);
+   bdm.openDatabase();
+
+   const std::vector<BinaryData> scraddrs
+   {
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
+   };
+
+   BlockDataViewer bdv(&bdm);
+   BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
+
+   bdm.doInitialSyncOnLoad( nullProgress );
    bdv.scanWallets();
-   
-   // we should get the same balance as we do for test 'Load5Blocks'
+
+   EXPECT_EQ(bdm.blockchain().top().getBlockHeight(), 5);
+
    const ScrAddrObj *scrobj;
-   
+
    scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
    EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
    scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
@@ -7444,47 +9461,46 @@ TEST_F(BlockDir, HeadersFirst)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(BlockDir, HeadersFirstUpdate)
+TEST_F(BlockDir, BlockFileBatchedWrites)
 {
-   BlockDataManagerConfig config;
+   BlockDataManagerConfig config = testConfig();
    config.armoryDbType = ARMORY_DB_BARE;
    config.pruneType = DB_PRUNE_NONE;
    config.blkFileLocation = blkdir_;
    config.levelDBLocation = ldbdir_;
-   
+
+   // a batch size that doesn't divide the block count, so that the last
+   // batch is committed partially filled
+   config.rawBlockBatchCount = 2;
+
    config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
    config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
    config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
-      
-   // Put the first 5 blocks out of order
+
    setBlocks({ "0", "1", "2" }, blk0dat_);
-   
+
    BlockDataManager_LevelDB bdm(config);
    bdm.openDatabase();
-   
 
    const std::vector<BinaryData> scraddrs
    {
-      TestChain::scrAddrA,
-      TestChain::scrAddrB,
-      TestChain::scrAddrC
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
    };
 
    BlockDataViewer bdv(&bdm);
    BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
-   
-   bdm.doInitialSyncOnLoad( nullProgress ); 
-   
+
+   bdm.doInitialSyncOnLoad( nullProgress );
    bdv.scanWallets();
-   
-   appendBlocks({ "4", "3", "5" }, blk0dat_);
-   
+
+   appendBlocks({ "3", "4", "5" }, BtcUtils::getBlkFilename(blkdir_, 1));
    bdm.readBlkFileUpdate();
    bdv.scanWallets();
-   
-   // we should get the same balance as we do for test 'Load5Blocks'
+
+   EXPECT_EQ(bdm.blockchain().top().getBlockHeight(), 5);
+
    const ScrAddrObj *scrobj;
-   
+
    scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
    EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
    scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
@@ -7494,52 +9510,61 @@ TEST_F(BlockDir, HeadersFirstUpdate)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(BlockDir, HeadersFirstUpdateTwice)
+TEST_F(BlockDir, BlockFilePositionIndex)
 {
-   BlockDataManagerConfig config;
+   BlockDataManagerConfig config = testConfig();
    config.armoryDbType = ARMORY_DB_BARE;
    config.pruneType = DB_PRUNE_NONE;
    config.blkFileLocation = blkdir_;
    config.levelDBLocation = ldbdir_;
-   
+
    config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
    config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
    config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
+
+   const std::string blk1dat = BtcUtils::getBlkFilename(blkdir_, 1);
+   setBlocks({ "0", "1" }, blk0dat_);
+   setBlocks({ "2" }, blk1dat);
+
+   {
+      BlockDataManager_LevelDB bdm(config);
+      bdm.openDatabase();
+      bdm.doInitialSyncOnLoad( nullProgress );
+
+      BlockHeader bh = bdm.blockchain().getHeaderByHash(TestChain::blkHash2);
+      bh.setBlockFileNum(UINT32_MAX);
+      bh.setBlockFileOffset(0);
       
-   // Put the first 5 blocks out of order
-   setBlocks({ "0", "1", "2" }, blk0dat_);
-   
+      ASSERT_TRUE(bdm.getIFace()->getBlockFilePosition(bh));
+      EXPECT_EQ(bh.getBlockFileNum(), 1);
+      EXPECT_EQ(bh.getOffset(), 0);
+   }
+
+   // restart on the same db, the positions should come from the index
+   appendBlocks({ "3", "4", "5" }, blk1dat);
+
    BlockDataManager_LevelDB bdm(config);
    bdm.openDatabase();
-   
 
    const std::vector<BinaryData> scraddrs
    {
-      TestChain::scrAddrA,
-      TestChain::scrAddrB,
-      TestChain::scrAddrC
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
    };
 
    BlockDataViewer bdv(&bdm);
    BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
-   
-   bdm.doInitialSyncOnLoad( nullProgress ); 
-   
-   bdv.scanWallets();
-   
-   appendBlocks({"5"}, blk0dat_);
-   appendBlocks({"4"}, blk0dat_);
 
-   bdm.readBlkFileUpdate();
+   bdm.doInitialSyncOnLoad( nullProgress );
    bdv.scanWallets();
-   appendBlocks({"3"}, blk0dat_);
-   
-   bdm.readBlkFileUpdate();
-   bdv.scanWallets();
-   
-   // we should get the same balance as we do for test 'Load5Blocks'
+
+   EXPECT_EQ(bdm.blockchain().top().getBlockHeight(), 5);
+
+   const BlockHeader& bh2 = bdm.blockchain().getHeaderByHash(TestChain::blkHash2);
+   EXPECT_EQ(bh2.getBlockFileNum(), 1);
+   EXPECT_EQ(bh2.getOffset(), 0);
+
    const ScrAddrObj *scrobj;
-   
+
    scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
    EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
    scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
@@ -7548,56 +9573,44 @@ TEST_F(BlockDir, HeadersFirstUpdateTwice)
    EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
 }
 
-
-
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(BlockDir, AddBlockWhileUpdating)
+TEST_F(BlockDir, PaddedAndCorruptedBlkFile)
 {
-   BlockDataManagerConfig config;
+   BlockDataManagerConfig config = testConfig();
    config.armoryDbType = ARMORY_DB_BARE;
    config.pruneType = DB_PRUNE_NONE;
    config.blkFileLocation = blkdir_;
    config.levelDBLocation = ldbdir_;
-   
+
    config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
    config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
    config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
-      
-   setBlocks({ "0", "1", "2" }, blk0dat_);
-   
+
+   setBlocks({ "0", "1" }, blk0dat_);
+   appendGarbage(blk0dat_, 100000, 42);
+   appendBlocks({ "2", "3" }, blk0dat_);
+   appendGarbage(blk0dat_, 3);
+   appendBlocks({ "4", "5" }, blk0dat_);
+   appendGarbage(blk0dat_, 1024 * 1024);
+
    BlockDataManager_LevelDB bdm(config);
    bdm.openDatabase();
-   
+
    const std::vector<BinaryData> scraddrs
    {
-      TestChain::scrAddrA,
-      TestChain::scrAddrB,
-      TestChain::scrAddrC
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
    };
 
    BlockDataViewer bdv(&bdm);
    BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
-   
-   bdm.doInitialSyncOnLoad( nullProgress ); 
-   
-   bdv.scanWallets();
-   
-   BlockDataManager_LevelDB::BlkFileUpdateCallbacks callbacks;
-   callbacks.headersRead = [&]()
-      {
-         appendBlocks({"3"}, blk0dat_);
-      };
-   
-   bdm.readBlkFileUpdate(callbacks);
-   bdv.scanWallets();
 
-   appendBlocks({"4", "5"}, blk0dat_);
-   bdm.readBlkFileUpdate();
+   bdm.doInitialSyncOnLoad( nullProgress );
    bdv.scanWallets();
 
-   // we should get the same balance as we do for test 'Load5Blocks'
+   EXPECT_EQ(bdm.blockchain().top().getBlockHeight(), 5);
+
    const ScrAddrObj *scrobj;
-   
+
    scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
    EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
    scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
@@ -7607,26 +9620,65 @@ TEST_F(BlockDir, AddBlockWhileUpdating)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(BlockDir, BlockFileSplit)
+TEST_F(BlockDir, HeaderOffsetsAfterGarbage)
 {
-   BlockDataManagerConfig config;
+   BlockDataManagerConfig config = testConfig();
    config.armoryDbType = ARMORY_DB_BARE;
    config.pruneType = DB_PRUNE_NONE;
    config.blkFileLocation = blkdir_;
    config.levelDBLocation = ldbdir_;
-   
+
    config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
    config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
    config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
-   
-   setBlocks({ "0", "1" }, blk0dat_);
-   
-   std::string blk1dat = BtcUtils::getBlkFilename(blkdir_, 1);
-   setBlocks({ "2", "3", "4","5" }, blk1dat);
-   
+
+   const vector<BinaryData> hashes
+   {
+      TestChain::blkHash0, TestChain::blkHash1, 
+      TestChain::blkHash2, TestChain::blkHash3, TestChain::blkHash4, 
+      TestChain::blkHash5
+   };
+   vector<uint64_t> offsets;
+
+   // garbage right after the genesis block: the first unrecognized header
+   // is block 1, past the garbage, and the genesis block still has to be
+   // loaded, so the load starts over at the beginning of the file
+   setBlocks({ "0" }, blk0dat_);
+   appendGarbage(blk0dat_, 1000);
+   offsets.push_back(0);
+   offsets.push_back(BtcUtils::GetFileSize(blk0dat_));
+   appendBlocks({ "1" }, blk0dat_);
+   appendGarbage(blk0dat_, 37, 7);
+   offsets.push_back(BtcUtils::GetFileSize(blk0dat_));
+   appendBlocks({ "2" }, blk0dat_);
+
+   {
+      BlockDataManager_LevelDB bdm(config);
+      bdm.openDatabase();
+      bdm.doInitialSyncOnLoad( nullProgress );
+
+      ASSERT_EQ(bdm.blockchain().top().getBlockHeight(), 2);
+      for (unsigned i = 0; i < offsets.size(); i++)
+      {
+         const BlockHeader& bh = bdm.blockchain().getHeaderByHash(hashes[i]);
+         EXPECT_EQ(bh.getBlockFileNum(), 0);
+         EXPECT_EQ(bh.getOffset(), offsets[i]);
+      }
+   }
+
+   // more garbage then new blocks, picked up on the next start
+   appendGarbage(blk0dat_, 5000, 3);
+   offsets.push_back(BtcUtils::GetFileSize(blk0dat_));
+   appendBlocks({ "3" }, blk0dat_);
+   appendGarbage(blk0dat_, 1);
+   offsets.push_back(BtcUtils::GetFileSize(blk0dat_));
+   appendBlocks({ "4" }, blk0dat_);
+   offsets.push_back(BtcUtils::GetFileSize(blk0dat_));
+   appendBlocks({ "5" }, blk0dat_);
+
    BlockDataManager_LevelDB bdm(config);
    bdm.openDatabase();
-   
+
    const std::vector<BinaryData> scraddrs
    {
       TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
@@ -7634,15 +9686,20 @@ TEST_F(BlockDir, BlockFileSplit)
 
    BlockDataViewer bdv(&bdm);
    BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
-   
-   bdm.doInitialSyncOnLoad( nullProgress ); 
+
+   bdm.doInitialSyncOnLoad( nullProgress );
    bdv.scanWallets();
-   
-   
-   
-   // we should get the same balance as we do for test 'Load5Blocks'
+
+   ASSERT_EQ(bdm.blockchain().top().getBlockHeight(), 5);
+   for (unsigned i = 0; i < offsets.size(); i++)
+   {
+      const BlockHeader& bh = bdm.blockchain().getHeaderByHash(hashes[i]);
+      EXPECT_EQ(bh.getBlockFileNum(), 0);
+      EXPECT_EQ(bh.getOffset(), offsets[i]);
+   }
+
    const ScrAddrObj *scrobj;
-   
+
    scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
    EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
    scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
@@ -7651,10 +9708,43 @@ TEST_F(BlockDir, BlockFileSplit)
    EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Times a load through large zero filled and corrupted stretches of blk file,
+// where most of the time goes into resyncing on the magic bytes
+TEST_F(BlockDir, DISABLED_ResyncTiming_usuallydisabled)
+{
+   BlockDataManagerConfig config = testConfig();
+   config.armoryDbType = ARMORY_DB_BARE;
+   config.pruneType = DB_PRUNE_NONE;
+   config.blkFileLocation = blkdir_;
+   config.levelDBLocation = ldbdir_;
+
+   config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
+   config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
+   config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
+
+   setBlocks({ "0", "1", "2" }, blk0dat_);
+   appendGarbage(blk0dat_, 128 * 1024 * 1024, 42);
+   appendBlocks({ "3", "4", "5" }, blk0dat_);
+   appendGarbage(blk0dat_, 128 * 1024 * 1024);
+
+   BlockDataManager_LevelDB bdm(config);
+   bdm.openDatabase();
+
+   const auto start = chrono::steady_clock::now();
+   bdm.doInitialSyncOnLoad( nullProgress );
+   const chrono::duration<double> elapsed = 
+      chrono::steady_clock::now() - start;
+
+   EXPECT_EQ(bdm.blockchain().top().getBlockHeight(), 5);
+   cout << "Loaded through 256MB of padding and garbage in " 
+      << elapsed.count() << "s" << endl;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 TEST_F(BlockDir, BlockFileSplitUpdate)
 {
-   BlockDataManagerConfig config;
+   BlockDataManagerConfig config = testConfig();
    config.armoryDbType = ARMORY_DB_BARE;
    config.pruneType = DB_PRUNE_NONE;
    config.blkFileLocation = blkdir_;
@@ -7745,6 +9835,136 @@ TEST_F(BlockUtilsBare, Load5Blocks)
    EXPECT_EQ(wltLB2->getFullBalance(), 30*COIN);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsBare, Load5Blocks_RequestCompaction)
+{
+   vector<BinaryData> scrAddrVec;
+   scrAddrVec.push_back(TestChain::scrAddrA);
+   scrAddrVec.push_back(TestChain::scrAddrB);
+   scrAddrVec.push_back(TestChain::scrAddrC);
+   BtcWallet* wlt;
+   regWallet(scrAddrVec, "wallet1", theBDV, &wlt);
+
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+   theBDV->scanWallets();
+
+   theBDV->requestCompaction();
+   EXPECT_EQ(TheBDM.compactFlag_, true);
+
+   //compact manually since there is no maintenance thread with unit tests
+   TheBDM.compactFlag_ = false;
+   TheBDM.compactDatabases();
+
+   //the wallet reads from the compacted files
+   theBDV->scanWallets(0, UINT32_MAX, BDV_refreshAndRescan);
+
+   const ScrAddrObj* scrObj;
+   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrA);
+   EXPECT_EQ(scrObj->getFullBalance(), 50*COIN);
+   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrB);
+   EXPECT_EQ(scrObj->getFullBalance(), 70*COIN);
+   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrC);
+   EXPECT_EQ(scrObj->getFullBalance(), 20*COIN);
+   EXPECT_EQ(wlt->getFullBalance(), 140*COIN);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsBare, Load5Blocks_BatchLookups)
+{
+   vector<BinaryData> scrAddrVec;
+   scrAddrVec.push_back(TestChain::scrAddrA);
+   scrAddrVec.push_back(TestChain::scrAddrB);
+   scrAddrVec.push_back(TestChain::scrAddrC);
+   BtcWallet* wlt;
+   regWallet(scrAddrVec, "wallet1", theBDV, &wlt);
+
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+   theBDV->scanWallets();
+
+   // collect every tx hash in the chain, plus one that isn't there
+   vector<BinaryData> hashes;
+   vector<BinaryData> keys;
+   for (uint32_t hgt = 0; hgt <= TheBDM.getTopBlockHeight(); hgt++)
+   {
+      uint32_t numTx = TheBDM.blockchain().getHeaderByHeight(hgt).getNumTx();
+      uint8_t dup = iface_->getValidDupIDForHeight(hgt);
+      for (uint16_t i = 0; i < numTx; i++)
+      {
+         keys.push_back(DBUtils::getBlkDataKeyNoPrefix(hgt, dup, i));
+         Tx tx = iface_->getFullTxCopy(keys.back());
+         ASSERT_TRUE(tx.isInitialized());
+         hashes.push_back(tx.getThisHash());
+      }
+   }
+   hashes.push_back(READHEX(
+      "ab00000000000000000000000000000000000000000000000000000000000000"));
+   ASSERT_GT(hashes.size(), 6);
+
+   // every tx of the chain by key, backwards then forwards, so blocks get
+   // several requests out of order and some twice
+   vector<BinaryData> batchKeys(keys.rbegin(), keys.rend());
+   batchKeys.insert(batchKeys.end(), keys.begin(), keys.end());
+   vector<Tx> keyTxs = iface_->getFullTxCopies(batchKeys);
+   ASSERT_EQ(keyTxs.size(), batchKeys.size());
+   for (unsigned i = 0; i < batchKeys.size(); i++)
+   {
+      ASSERT_TRUE(keyTxs[i].isInitialized());
+      EXPECT_EQ(keyTxs[i].serialize(), 
+         iface_->getFullTxCopy(batchKeys[i]).serialize());
+   }
+
+   vector<Tx> txs = theBDV->getTxsByHash(hashes);
+   ASSERT_EQ(txs.size(), hashes.size());
+   unsigned found = 0;
+   for (unsigned i = 0; i < hashes.size() - 1; i++)
+   {
+      // fullnode only hints txs that touch registered addresses
+      Tx single = theBDV->getTxByHash(hashes[i]);
+      ASSERT_EQ(txs[i].isInitialized(), single.isInitialized());
+      if (!single.isInitialized())
+         continue;
+
+      found++;
+      EXPECT_EQ(txs[i].getThisHash(), hashes[i]);
+      EXPECT_EQ(txs[i].serialize(), single.serialize());
+      EXPECT_EQ(txs[i].getTxRef().getDBKey(), single.getTxRef().getDBKey());
+   }
+   EXPECT_GT(found, 1);
+   EXPECT_FALSE(txs.back().isInitialized());
+
+   // prev outputs in one call match the per-input lookups
+   for (unsigned i = 0; i < txs.size() - 1; i++)
+   {
+      if (!txs[i].isInitialized())
+         continue;
+
+      vector<TxOut> prevOuts = theBDV->getPrevTxOuts(txs[i]);
+      ASSERT_EQ(prevOuts.size(), txs[i].getNumTxIn());
+      for (uint32_t j = 0; j < txs[i].getNumTxIn(); j++)
+      {
+         TxIn txin = txs[i].getTxInCopy(j);
+         if (txin.isCoinbase())
+            continue;
+         EXPECT_EQ(prevOuts[j].serialize(),
+            theBDV->getPrevTxOut(txin).serialize());
+      }
+   }
+
+   // utxo lists go through the batched history lookup
+   const ScrAddrObj* scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrB);
+   vector<UnspentTxOut> utxos = scrObj->getSpendableTxOutList();
+   uint64_t total = 0;
+   for (const auto& utxo : utxos)
+   {
+      Tx tx = theBDV->getTxByHash(utxo.getTxHash());
+      ASSERT_TRUE(tx.isInitialized());
+      EXPECT_EQ(tx.getTxOutCopy(utxo.getTxOutIndex()).getValue(),
+         utxo.getValue());
+      total += utxo.getValue();
+   }
+   EXPECT_EQ(total, scrObj->getFullBalance());
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 TEST_F(BlockUtilsBare, Load5Blocks_DamagedBlkFile)
 {
@@ -9519,7 +11739,7 @@ protected:
    BinaryData ghash_;
    BinaryData gentx_;
    BinaryData zeros_;
-   BlockDataManagerConfig config_;
+   BlockDataManagerConfig config_ = testConfig();
 
    string blkdir_;
    string homedir_;
@@ -9639,6 +11859,40 @@ TEST_F(BlockUtilsSuper, Load5Blocks)
    EXPECT_EQ(ssh.totalTxioCount_,      2);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsSuper, Load5Blocks_ManyLoaders)
+{
+   //more loader threads than blocks, they finish out of order and the scan 
+   //thread has to put them back in height order
+   delete theBDM;
+   config_.threadCount = 8;
+   theBDM = new BlockDataManager_LevelDB(config_);
+   theBDM->openDatabase();
+   iface_ = theBDM->getIFace();
+
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+
+   StoredScriptHistory ssh;
+
+   iface_->getStoredScriptHistory(ssh, TestChain::scrAddrB);
+   EXPECT_EQ(ssh.getScriptBalance(),   70*COIN);
+   EXPECT_EQ(ssh.getScriptReceived(), 230*COIN);
+   EXPECT_EQ(ssh.totalTxioCount_,      14);
+
+   iface_->getStoredScriptHistory(ssh, TestChain::scrAddrF);
+   EXPECT_EQ(ssh.getScriptBalance(),   5*COIN);
+   EXPECT_EQ(ssh.getScriptReceived(), 45*COIN);
+   EXPECT_EQ(ssh.totalTxioCount_,      7);
+
+   iface_->getStoredScriptHistory(ssh, TestChain::lb2ScrAddrP2SH);
+   EXPECT_EQ(ssh.getScriptBalance(),   0*COIN);
+   EXPECT_EQ(ssh.getScriptReceived(),  5*COIN);
+   EXPECT_EQ(ssh.totalTxioCount_,      2);
+
+   EXPECT_EQ(iface_->getTopBlockHeight(BLKDATA), 5);
+   EXPECT_EQ(iface_->getTopBlockHash(BLKDATA), TestChain::blkHash5);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 TEST_F(BlockUtilsSuper, Load5Blocks_ReloadBDM)
 {
@@ -10213,7 +12467,7 @@ protected:
       blk0dat_ = BtcUtils::getBlkFilename(blkdir_, 0);
       setBlocks({ "0", "1", "2", "3", "4", "5" }, blk0dat_);
       
-      BlockDataManagerConfig config;
+      BlockDataManagerConfig config = testConfig();
       config.armoryDbType = ARMORY_DB_SUPER;
       config.pruneType = DB_PRUNE_NONE;
       config.blkFileLocation = blkdir_;
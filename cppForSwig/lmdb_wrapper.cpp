@@ -25,6 +25,7 @@ struct MDB_val;
 LDBIter::LDBIter(LMDB::Iterator&& mv)
    : iter_(std::move(mv))
 { 
+   iter_.setCopyData(false);
    isDirty_ = true;
 }
 
@@ -32,12 +33,14 @@ LDBIter::LDBIter(LMDB::Iterator&& mv)
 LDBIter::LDBIter(LDBIter&& mv)
 : iter_(std::move(mv.iter_))
 {
+   iter_.setCopyData(false);
    isDirty_ = true;
 }
 
 LDBIter::LDBIter(const LDBIter& cp)
 : iter_(cp.iter_)
 {
+   iter_.setCopyData(false);
    isDirty_ = true;
 }
 
@@ -45,6 +48,8 @@ LDBIter::LDBIter(const LDBIter& cp)
 LDBIter& LDBIter::operator=(LMDB::Iterator&& mv)
 { 
    iter_ = std::move(mv);
+   iter_.setCopyData(false);
+   isDirty_ = true;
    return *this;
 }
 
@@ -52,15 +57,21 @@ LDBIter& LDBIter::operator=(LMDB::Iterator&& mv)
 LDBIter& LDBIter::operator=(LDBIter&& mv)
 { 
    iter_ = std::move(mv.iter_);
+   iter_.setCopyData(false);
+   isDirty_ = true;
    return *this;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 bool LDBIter::isValid(DB_PREFIX dbpref)
 {
-   if(!isValid() || iter_.key().size() == 0)
+   if(!isValid())
       return false;
-   return iter_.key()[0] == (char)dbpref;
+
+   const CharacterArrayRef key = iter_.keyRef();
+   if (key.len == 0)
+      return false;
+   return key.data[0] == (char)dbpref;
 }
 
 
@@ -97,10 +108,10 @@ bool LDBIter::readIterData(void)
       return false;
    }
 
-   currKey_ = BinaryData(iter_.key());
-   currValue_ = BinaryData(iter_.value());
-   currKeyReader_.setNewData( currKey_ );
-   currValueReader_.setNewData( currValue_ );
+   const CharacterArrayRef key = iter_.keyRef();
+   const CharacterArrayRef value = iter_.valueRef();
+   currKeyReader_.setNewData((const uint8_t*)key.data, key.len);
+   currValueReader_.setNewData((const uint8_t*)value.data, value.len);
    isDirty_ = false;
    return true;
 }
@@ -130,7 +141,7 @@ BinaryData LDBIter::getKey(void) const
       LOGERR << "Returning dirty key ref";
       return BinaryData(0);
    }
-   return currKey_;
+   return BinaryData(currKeyReader_.getRawRef());
 }
    
 ////////////////////////////////////////////////////////////////////////////////
@@ -141,7 +152,7 @@ BinaryData LDBIter::getValue(void) const
       LOGERR << "Returning dirty value ref";
       return BinaryData(0);
    }
-   return currValue_;
+   return BinaryData(currValueReader_.getRawRef());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -337,6 +348,182 @@ bool LDBIter::checkKeyStartsWith(DB_PREFIX prefix, BinaryDataRef key)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+DBValueCache::DBValueCache(size_t maxBytes) :
+   maxShardBytes_(maxBytes / DBVALUE_CACHE_SHARDS), hits_(0), misses_(0)
+{
+   clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BinaryData DBValueCache::getCacheKey(DB_SELECT db, BinaryDataRef key)
+{
+   BinaryWriter bw(key.getSize() + 1);
+   bw.put_uint8_t((uint8_t)db);
+   bw.put_BinaryData(key);
+   return bw.getData();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+DBValueCache::Shard& DBValueCache::getShard(BinaryDataRef cacheKey)
+{
+   // keys of a same kind share their leading bytes, use them all
+   uint32_t h = 2166136261U;
+   const uint8_t* ptr = cacheKey.getPtr();
+   for (uint32_t i = 0; i < cacheKey.getSize(); i++)
+      h = (h ^ ptr[i]) * 16777619U;
+
+   return shards_[h % DBVALUE_CACHE_SHARDS];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t DBValueCache::entrySize(const Entry& entry)
+{
+   return entry.key_.getSize() + entry.value_.getSize() + sizeof(Entry);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DBValueCache::erase(Shard& shard,
+   map<BinaryData, list<Entry>::iterator>::iterator iter)
+{
+   shard.bytes_ -= entrySize(*iter->second);
+   shard.lru_.erase(iter->second);
+   shard.entries_.erase(iter);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool DBValueCache::get(DB_SELECT db, BinaryDataRef key, size_t snapshotId,
+   BinaryData& value)
+{
+   BinaryData cacheKey = getCacheKey(db, key);
+   Shard& shard = getShard(cacheKey);
+
+   {
+      unique_lock<mutex> lock(shard.mu_);
+      auto iter = shard.entries_.find(cacheKey);
+      if (iter != shard.entries_.end() &&
+          iter->second->snapshotId_ <= snapshotId)
+      {
+         shard.lru_.splice(shard.lru_.begin(), shard.lru_, iter->second);
+         value = iter->second->value_;
+
+         hits_++;
+         return true;
+      }
+   }
+
+   misses_++;
+   return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DBValueCache::put(DB_SELECT db, BinaryDataRef key, BinaryDataRef value,
+   size_t snapshotId, size_t commitCount)
+{
+   // the reader may not see the last commit yet
+   if (snapshotId != commitCount)
+      return;
+
+   Entry entry;
+   entry.key_ = getCacheKey(db, key);
+   entry.value_ = value;
+   entry.snapshotId_ = snapshotId;
+
+   size_t size = entrySize(entry);
+   if (value.getSize() > DBVALUE_CACHE_MAX_ENTRY || size > maxShardBytes_)
+      return;
+
+   Shard& shard = getShard(entry.key_);
+   unique_lock<mutex> lock(shard.mu_);
+
+   // a write to that db isn't committed yet, the reader can't see it
+   if (shard.written_[db] && shard.lastWrite_[db] >= commitCount)
+      return;
+
+   auto iter = shard.entries_.find(entry.key_);
+   if (iter != shard.entries_.end())
+      erase(shard, iter);
+
+   while (shard.bytes_ + size > maxShardBytes_ && !shard.lru_.empty())
+      erase(shard, shard.entries_.find(shard.lru_.back().key_));
+
+   BinaryData cacheKey = entry.key_;
+   shard.lru_.push_front(move(entry));
+   shard.entries_[cacheKey] = shard.lru_.begin();
+   shard.bytes_ += size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DBValueCache::invalidate(DB_SELECT db, BinaryDataRef key,
+   size_t commitCount)
+{
+   BinaryData cacheKey = getCacheKey(db, key);
+   Shard& shard = getShard(cacheKey);
+
+   unique_lock<mutex> lock(shard.mu_);
+   shard.lastWrite_[db] = commitCount;
+   shard.written_[db] = true;
+
+   auto iter = shard.entries_.find(cacheKey);
+   if (iter != shard.entries_.end())
+      erase(shard, iter);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DBValueCache::invalidate(DB_SELECT db, size_t commitCount)
+{
+   for (auto& shard : shards_)
+   {
+      unique_lock<mutex> lock(shard.mu_);
+      shard.lastWrite_[db] = commitCount;
+      shard.written_[db] = true;
+
+      auto iter = shard.entries_.begin();
+      while (iter != shard.entries_.end())
+      {
+         auto thisIter = iter++;
+         if (thisIter->first.getPtr()[0] == (uint8_t)db)
+            erase(shard, thisIter);
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DBValueCache::clear(void)
+{
+   for (auto& shard : shards_)
+   {
+      unique_lock<mutex> lock(shard.mu_);
+      shard.lru_.clear();
+      shard.entries_.clear();
+      shard.bytes_ = 0;
+
+      for (unsigned i = 0; i < COUNT; i++)
+      {
+         shard.lastWrite_[i] = 0;
+         shard.written_[i] = false;
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+DBValueCache::Stats DBValueCache::getStats(void) const
+{
+   Stats stats;
+   stats.hits_ = hits_.load();
+   stats.misses_ = misses_.load();
+
+   for (auto& shard : shards_)
+   {
+      unique_lock<mutex> lock(shard.mu_);
+      stats.entries_ += shard.entries_.size();
+      stats.bytes_ += shard.bytes_;
+   }
+
+   return stats;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 LMDBBlockDatabase::LMDBBlockDatabase(function<bool(void)> isDBReady) :
 isDBReady_(isDBReady)
@@ -369,7 +556,10 @@ void LMDBBlockDatabase::openDatabases(
    BinaryData const & genesisTxHash,
    BinaryData const & magic,
    ARMORY_DB_TYPE     dbtype,
-   DB_PRUNE_TYPE      pruneType
+   DB_PRUNE_TYPE      pruneType,
+   const LMDBTuning & tuning,
+   SSH_KEY_LAYOUT     sshKeyLayout,
+   TXDATA_COMPRESSION txCompression
    )
 {
    baseDir_ = basedir;
@@ -393,7 +583,8 @@ void LMDBBlockDatabase::openDatabases(
       {
          openDatabasesSupernode(basedir,
             genesisBlkHash, genesisTxHash,
-            magic, dbtype, pruneType);
+            magic, dbtype, pruneType, tuning, sshKeyLayout,
+            txCompression);
       }
       catch (LMDBException &e)
       {
@@ -483,6 +674,7 @@ void LMDBBlockDatabase::openDatabases(
 
    armoryDbType_ = dbtype;
    dbPruneType_ = pruneType;
+   tuning_ = tuning;
 
    if (genesisBlkHash_.getSize() == 0 || magicBytes_.getSize() == 0)
    {
@@ -497,7 +689,7 @@ void LMDBBlockDatabase::openDatabases(
    for (int i = 0; i < COUNT; i++)
       dbEnv_[DB_SELECT(i)].reset(new LMDBEnv());
 
-   dbEnv_[BLKDATA]->open(dbBlkdataFilename());
+   dbEnv_[BLKDATA]->open(dbBlkdataFilename(), tuning_);
 
    //make sure it's a fullnode DB
    {
@@ -527,9 +719,9 @@ void LMDBBlockDatabase::openDatabases(
 
 
 
-   dbEnv_[HEADERS]->open(dbHeadersFilename());
-   dbEnv_[HISTORY]->open(dbHistoryFilename());
-   dbEnv_[TXHINTS]->open(dbTxhintsFilename());
+   dbEnv_[HEADERS]->open(dbHeadersFilename(), tuning_);
+   dbEnv_[HISTORY]->open(dbHistoryFilename(), tuning_);
+   dbEnv_[TXHINTS]->open(dbTxhintsFilename(), tuning_);
 
    map<DB_SELECT, string> DB_NAMES;
    DB_NAMES[HEADERS] = "headers";
@@ -546,6 +738,9 @@ void LMDBBlockDatabase::openDatabases(
 
          dbs_[CURRDB].open(dbEnv_[CURRDB].get(), db.second);
 
+         // blocks go in by increasing height|dup, mostly past the end
+         dbs_[CURRDB].setAppendMode(CURRDB == BLKDATA);
+
          //no SDBI in TXHINTS
          if (CURRDB == TXHINTS)
             continue;
@@ -563,6 +758,7 @@ void LMDBBlockDatabase::openDatabases(
             sdbi.topBlkHash_ = genesisBlkHash_;
             sdbi.armoryType_ = armoryDbType_;
             sdbi.pruneType_ = dbPruneType_;
+            sdbi.sshKeyLayout_ = sshKeyLayout;
             putStoredDBInfo(CURRDB, sdbi);
          }
          else
@@ -607,7 +803,12 @@ void LMDBBlockDatabase::openDatabases(
       throw;
    }
 
+   // fullnode keeps raw blocks in blkdata, there are no tx entries to
+   // compress
+   txCompression_ = TXDATA_RAW;
+
    dbIsOpen_ = true;
+   openHistoryKeys();
 }
 
 void LMDBBlockDatabase::openDatabasesSupernode(
@@ -616,7 +817,10 @@ void LMDBBlockDatabase::openDatabasesSupernode(
    BinaryData const & genesisTxHash,
    BinaryData const & magic,
    ARMORY_DB_TYPE     dbtype,
-   DB_PRUNE_TYPE      pruneType
+   DB_PRUNE_TYPE      pruneType,
+   const LMDBTuning & tuning,
+   SSH_KEY_LAYOUT     sshKeyLayout,
+   TXDATA_COMPRESSION txCompression
 )
 {
    SCOPED_TIMER("openDatabases");
@@ -630,6 +834,7 @@ void LMDBBlockDatabase::openDatabasesSupernode(
    
    armoryDbType_ = dbtype;
    dbPruneType_ = pruneType;
+   tuning_ = tuning;
 
    if(genesisBlkHash_.getSize() == 0 || magicBytes_.getSize() == 0)
    {
@@ -642,7 +847,7 @@ void LMDBBlockDatabase::openDatabasesSupernode(
    closeDatabasesSupernode();
    
    dbEnv_[BLKDATA].reset(new LMDBEnv());
-   dbEnv_[BLKDATA]->open(dbBlkdataFilename());
+   dbEnv_[BLKDATA]->open(dbBlkdataFilename(), tuning_);
    
    map<DB_SELECT, string> DB_NAMES;
    DB_NAMES[HEADERS] = "headers";
@@ -657,6 +862,10 @@ void LMDBBlockDatabase::openDatabasesSupernode(
 
          dbs_[CURRDB].open(dbEnv_[BLKDATA].get(), db.second);
 
+         // tx and txout keys are height|dup|txIdx|txOutIdx, they only
+         // land past the end while there are no higher prefixes around
+         dbs_[CURRDB].setAppendMode(CURRDB == BLKDATA);
+
          StoredDBInfo sdbi;
          getStoredDBInfo(CURRDB, sdbi, false); 
          if(!sdbi.isInitialized())
@@ -670,6 +879,10 @@ void LMDBBlockDatabase::openDatabasesSupernode(
             sdbi.topBlkHash_ = genesisBlkHash_;
             sdbi.armoryType_ = armoryDbType_;
             sdbi.pruneType_ = dbPruneType_;
+            sdbi.sshKeyLayout_ = sshKeyLayout;
+            sdbi.txCompression_ = txCompression;
+            if (CURRDB == BLKDATA && txCompression != TXDATA_RAW)
+               sdbi.armoryVer_ = ARMORY_DB_VERSION_TXCOMPRESSION;
             putStoredDBInfo(CURRDB, sdbi);
          }
          else
@@ -692,6 +905,32 @@ void LMDBBlockDatabase::openDatabasesSupernode(
             {
                throw runtime_error("Mismatch in DB type");
             }
+
+            if (sdbi.armoryVer_ > ARMORY_DB_VERSION_TXCOMPRESSION)
+            {
+               LOGERR << "DB version " << sdbi.armoryVer_
+                  << " is newer than this build can read";
+               throw runtime_error("Unknown DB version");
+            }
+
+            // tx entries flag their own encoding, so txCompression_ only 
+            // affects what gets written from now on. The version stays up 
+            // once compressed entries may be there, whatever the setting
+            if (CURRDB == BLKDATA)
+            {
+               bool changed = sdbi.txCompression_ != txCompression;
+               sdbi.txCompression_ = txCompression;
+
+               if (txCompression != TXDATA_RAW &&
+                   sdbi.armoryVer_ < ARMORY_DB_VERSION_TXCOMPRESSION)
+               {
+                  sdbi.armoryVer_ = ARMORY_DB_VERSION_TXCOMPRESSION;
+                  changed = true;
+               }
+
+               if (changed)
+                  putStoredDBInfo(CURRDB, sdbi);
+            }
          }
       }
    }
@@ -714,7 +953,10 @@ void LMDBBlockDatabase::openDatabasesSupernode(
       throw;
    }
    
+   txCompression_ = txCompression;
+
    dbIsOpen_ = true;
+   openHistoryKeys();
 }
 
 
@@ -737,6 +979,7 @@ void LMDBBlockDatabase::nukeHeadersDB(void)
       
       dbs_[HEADERS].erase(here.key());
    }
+   invalidateValueCache(HEADERS);
 
    StoredDBInfo sdbi;
    sdbi.magic_      = magicBytes_;
@@ -765,6 +1008,7 @@ void LMDBBlockDatabase::closeDatabases(void)
       if (dbEnv_[(DB_SELECT)db] != nullptr)
          dbEnv_[(DB_SELECT)db]->close();
    }
+   valueCache_.clear();
    dbIsOpen_ = false;
 }
 
@@ -776,10 +1020,84 @@ void LMDBBlockDatabase::closeDatabasesSupernode(void)
    dbs_[HEADERS].close();
    if (dbEnv_[BLKDATA] != nullptr)
       dbEnv_[BLKDATA]->close();
+   valueCache_.clear();
    dbIsOpen_ = false;
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+void LMDBBlockDatabase::checkpoint(void)
+{
+   for (auto& env : dbEnv_)
+   {
+      if (env.second != nullptr)
+         env.second->sync();
+   }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+LMDBBlockDatabase::Snapshot::Snapshot(const LMDBBlockDatabase* db)
+{
+   if (!db->databasesAreOpen())
+      throw runtime_error("Snapshot of a closed db");
+
+   if (db->armoryDbType_ == ARMORY_DB_SUPER)
+   {
+      txs_[BLKDATA].open(db->dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
+      return;
+   }
+
+   const DB_SELECT openOrder[] = { HISTORY, TXHINTS, BLKDATA, HEADERS };
+   for (auto dbs : openOrder)
+      txs_[dbs].open(db->dbEnv_[dbs].get(), LMDB::ReadOnly);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+uint64_t LMDBBlockDatabase::compactDatabases(bool* complete)
+{
+   SCOPED_TIMER("compactDatabases");
+
+   map<DB_SELECT, string> dbFiles;
+   dbFiles[BLKDATA] = dbBlkdataFilename();
+   if (armoryDbType_ != ARMORY_DB_SUPER)
+   {
+      dbFiles[HEADERS] = dbHeadersFilename();
+      dbFiles[HISTORY] = dbHistoryFilename();
+      dbFiles[TXHINTS] = dbTxhintsFilename();
+   }
+
+   if (complete != nullptr)
+      *complete = true;
+
+   uint64_t reclaimed = 0;
+   for (auto& dbFile : dbFiles)
+   {
+      if (dbEnv_[dbFile.first] == nullptr)
+         continue;
+
+      uint64_t sizeBefore = BtcUtils::GetFileSize(dbFile.second);
+      if (!dbEnv_[dbFile.first]->compact())
+      {
+         LOGINFO << "Transactions still open on " << dbFile.second
+            << ", left it as it was";
+         if (complete != nullptr)
+            *complete = false;
+         continue;
+      }
+
+      uint64_t sizeAfter = BtcUtils::GetFileSize(dbFile.second);
+      LOGINFO << "Compacted " << dbFile.second << " from " << sizeBefore
+         << " to " << sizeAfter << " bytes";
+
+      if (sizeAfter < sizeBefore)
+         reclaimed += sizeBefore - sizeAfter;
+   }
+
+   return reclaimed;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 void LMDBBlockDatabase::destroyAndResetDatabases(void)
 {
@@ -804,7 +1122,8 @@ void LMDBBlockDatabase::destroyAndResetDatabases(void)
    // Reopen the databases with the exact same parameters as before
    // The close & destroy operations shouldn't have changed any of that.
    openDatabases(baseDir_, genesisBlkHash_, genesisTxHash_, 
-      magicBytes_, armoryDbType_, dbPruneType_);
+      magicBytes_, armoryDbType_, dbPruneType_, tuning_, sshKeyLayout_,
+      txCompression_);
 }
 
 
@@ -916,6 +1235,78 @@ BinaryRefReader LMDBBlockDatabase::getValueReader(
    return BinaryRefReader(getValueRef(db, prefix, key));
 }
 
+/////////////////////////////////////////////////////////////////////////////
+vector<BinaryDataRef> LMDBBlockDatabase::getValueRefs(DB_SELECT db, 
+   const vector<BinaryData>& keysWithPrefix) const
+{
+   vector<CharacterArrayRef> keys;
+   keys.reserve(keysWithPrefix.size());
+   for (const auto& key : keysWithPrefix)
+      keys.push_back(CharacterArrayRef(key.getSize(), key.getPtr()));
+
+   vector<CharacterArrayRef> values = dbs_[db].getMany_NoCopy(keys);
+
+   vector<BinaryDataRef> refs;
+   refs.reserve(values.size());
+   for (const auto& value : values)
+   {
+      if (value.data)
+         refs.push_back(BinaryDataRef((uint8_t*)value.data, value.len));
+      else
+         refs.push_back(BinaryDataRef());
+   }
+
+   return refs;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+vector<BinaryDataRef> LMDBBlockDatabase::getValueRefs(DB_SELECT db, 
+   DB_PREFIX prefix, const vector<BinaryData>& keys) const
+{
+   vector<BinaryData> keysWithPrefix;
+   keysWithPrefix.reserve(keys.size());
+   for (const auto& key : keys)
+   {
+      BinaryData keyFull(key.getSize() + 1);
+      keyFull[0] = (uint8_t)prefix;
+      key.copyTo(keyFull.getPtr() + 1, key.getSize());
+      keysWithPrefix.push_back(move(keyFull));
+   }
+
+   return getValueRefs(db, keysWithPrefix);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+BinaryData LMDBBlockDatabase::getValueCached(DB_SELECT db, 
+   DB_PREFIX prefix, BinaryDataRef key) const
+{
+   BinaryWriter bw(key.getSize() + 1);
+   bw.put_uint8_t((uint8_t)prefix);
+   bw.put_BinaryData(key);
+
+   // without a transaction, let getValueRef complain about it
+   LMDBEnv* env = dbs_[db].getEnv();
+   size_t snapshotId = env != nullptr ? env->snapshotId() : SIZE_MAX;
+   if (snapshotId == SIZE_MAX)
+      return getValueRef(db, bw.getDataRef());
+
+   BinaryData value;
+   if (valueCache_.get(db, bw.getDataRef(), snapshotId, value))
+      return value;
+
+   value = getValueRef(db, bw.getDataRef());
+   valueCache_.put(db, bw.getDataRef(), value, snapshotId, 
+      env->commitCount());
+   return value;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void LMDBBlockDatabase::invalidateValueCache(DB_SELECT db)
+{
+   LMDBEnv* env = dbs_[db].getEnv();
+   valueCache_.invalidate(db, env != nullptr ? env->commitCount() : 0);
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // Header Key:  returns header hash
 // Tx Key:      returns tx hash
@@ -982,6 +1373,7 @@ void LMDBBlockDatabase::putValue(DB_SELECT db,
                                   BinaryDataRef key, 
                                   BinaryDataRef value)
 {
+   valueCache_.invalidate(db, key, dbs_[db].getEnv()->commitCount());
    dbs_[db].insert(
       CharacterArrayRef(key.getSize(), key.getPtr()),
       CharacterArrayRef(value.getSize(), value.getPtr())
@@ -1015,6 +1407,7 @@ void LMDBBlockDatabase::deleteValue(DB_SELECT db,
                                  BinaryDataRef key)
                  
 {
+   valueCache_.invalidate(db, key, dbs_[db].getEnv()->commitCount());
    dbs_[db].erase( CharacterArrayRef(key.getSize(), key.getPtr() ) );
 }
 
@@ -1129,43 +1522,38 @@ bool LMDBBlockDatabase::readStoredScriptHistoryAtIter(LDBIter & ldbIter,
    BinaryDataRef sshKey = ldbIter.getKeyRef();
    ssh.unserializeDBKey(sshKey, true);
    ssh.unserializeDBValue(ldbIter.getValueReader());
-      
-   size_t sz = sshKey.getSize();
-   BinaryData scrAddr(sshKey.getSliceRef(1, sz - 1));
-   size_t scrAddrSize = scrAddr.getSize();
-   (void)scrAddrSize;
 
+   BinaryData subKeyPrefix = getSubSSHKeyPrefix(ssh.uniqueKey_);
+   if (subKeyPrefix.getSize() == 0)
+      return false;
+
+   // In the legacy layout this lands on the SSH itself when starting from 
+   // 0, it is skipped below like any other key that isn't a sub-SSH
+   BinaryData firstKey(subKeyPrefix);
    if (startBlock != 0)
-   {
-      BinaryData dbkey_withHgtX(sshKey);
-      dbkey_withHgtX.append(DBUtils::heightAndDupToHgtx(startBlock, 0));
+      firstKey.append(DBUtils::heightAndDupToHgtx(startBlock, 0));
       
-      if (!ldbIter.seekTo(dbkey_withHgtX))
-         return false;
-   }
-   else
-   {
-      // If for some reason we hit the end of the DB without any tx, bail
-      if( !ldbIter.advanceAndRead(DB_PREFIX_SCRIPT))
-      {
-         //LOGERR << "No sub-SSH entries after the SSH";
-         return false;
-      }
-   }
+   // If for some reason we hit the end of the DB without any tx, bail
+   if (!ldbIter.seekTo(firstKey))
+      return false;
 
    // Now start iterating over the sub histories
+   DB_PREFIX subPrefix = (DB_PREFIX)subKeyPrefix[0];
+   size_t subKeySize = subKeyPrefix.getSize() + 4;
    map<BinaryData, StoredSubHistory>::iterator iter;
    size_t numTxioRead = 0;
    do
    {
-      size_t sz = ldbIter.getKeyRef().getSize();
-      BinaryDataRef keyNoPrefix= ldbIter.getKeyRef().getSliceRef(1,sz-1);
-      if(!keyNoPrefix.startsWith(ssh.uniqueKey_))
+      BinaryDataRef key = ldbIter.getKeyRef();
+      if (!key.startsWith(subKeyPrefix))
          break;
 
+      if (key.getSize() != subKeySize)
+         continue;
+
       pair<BinaryData, StoredSubHistory> keyValPair;
-      keyValPair.first = keyNoPrefix.getSliceCopy(sz-5, 4);
-      keyValPair.second.unserializeDBKey(ldbIter.getKeyRef());
+      keyValPair.first = key.getSliceCopy(subKeySize - 4, 4);
+      keyValPair.second.setKeyData(ssh.uniqueKey_, keyValPair.first);
 
       //iter is at the right ssh, make sure hgtX <= endBlock
       if (keyValPair.second.height_ > endBlock)
@@ -1174,7 +1562,7 @@ bool LMDBBlockDatabase::readStoredScriptHistoryAtIter(LDBIter & ldbIter,
       keyValPair.second.unserializeDBValue(ldbIter.getValueReader());
       iter = ssh.subHistMap_.insert(keyValPair).first;
       numTxioRead += iter->second.txioMap_.size(); 
-   } while( ldbIter.advanceAndRead(DB_PREFIX_SCRIPT) );
+   } while (ldbIter.advanceAndRead(subPrefix));
 
    return true;
 }
@@ -1204,10 +1592,12 @@ void LMDBBlockDatabase::putStoredScriptHistory( StoredScriptHistory & ssh)
    {
       StoredSubHistory & subssh = iter->second;
       if (subssh.txioMap_.size() > 0)
-         putValue(db, subssh.getDBKey(),
+         putValue(db, getSubSSHKey(ssh.uniqueKey_, subssh.hgtX_, true),
          serializeDBValue(subssh, this, armoryDbType_, dbPruneType_)
          );
    }
+
+   putScrAddrIds();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1237,8 +1627,11 @@ void LMDBBlockDatabase::putStoredSubHistory(StoredSubHistory & subssh)
       db = HISTORY;
 
    if (subssh.txioMap_.size() > 0)
-      putValue(db, subssh.getDBKey(),
+   {
+      putValue(db, getSubSSHKey(subssh.uniqueKey_, subssh.hgtX_, true),
          serializeDBValue(subssh, this, armoryDbType_, dbPruneType_));
+      putScrAddrIds();
+   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1290,62 +1683,434 @@ bool LMDBBlockDatabase::getStoredScriptHistory( StoredScriptHistory & ssh,
 bool LMDBBlockDatabase::getStoredSubHistoryAtHgtX(StoredSubHistory& subssh,
    const BinaryData& scrAddrStr, const BinaryData& hgtX) const
 {
-   BinaryWriter bw(scrAddrStr.getSize() + hgtX.getSize());
-   bw.put_BinaryData(scrAddrStr);
-   bw.put_BinaryData(hgtX);
+   LMDBEnv::Transaction tx;
+   beginDBTransaction(&tx, HISTORY, LMDB::ReadOnly);
+
+   BinaryData key = getSubSSHKey(scrAddrStr, hgtX);
+   if (key.getSize() == 0)
+      return false;
+
+   LDBIter ldbIter = getIterator(getDbSelect(HISTORY));
+
+   if (!ldbIter.seekToExact(key))
+      return false;
+
+   subssh.hgtX_ = hgtX;
+   subssh.unserializeDBValue(ldbIter.getValueReader());
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LMDBBlockDatabase::getStoredScriptHistoryByRawScript(
+                                             StoredScriptHistory & ssh,
+                                             BinaryDataRef script) const
+{
+   BinaryData uniqueKey = BtcUtils::getTxOutScrAddr(script);
+   getStoredScriptHistory(ssh, uniqueKey);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// This doesn't actually return a SUBhistory, it grabs it and adds it to the
+// regular-SSH object.  This does not affect balance or Txio count.  It's 
+// simply filling in data that the SSH may be expected to have.  
+bool LMDBBlockDatabase::fetchStoredSubHistory( StoredScriptHistory & ssh,
+                                            BinaryData hgtX,
+                                            bool createIfDNE,
+                                            bool forceReadDB)
+{
+   auto subIter = ssh.subHistMap_.find(hgtX);
+   if (!forceReadDB && ITER_IN_MAP(subIter, ssh.subHistMap_))
+   {
+      return true;
+   }
+
+   BinaryData key = getSubSSHKey(ssh.uniqueKey_, hgtX);
+   BinaryRefReader brr;
+   if (key.getSize() > 0)
+      brr = getValueReader(BLKDATA, key);
+
+   StoredSubHistory subssh;
+   subssh.uniqueKey_ = ssh.uniqueKey_;
+   subssh.hgtX_      = hgtX;
+
+   if(brr.getSize() > 0)
+      subssh.unserializeDBValue(brr);
+   else if(!createIfDNE)
+      return false;
+
+   ssh.mergeSubHistory(subssh);
+   
+   return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void LMDBBlockDatabase::openHistoryKeys(void)
+{
+   const DB_SELECT db = getDbSelect(HISTORY);
+
+   StoredDBInfo sdbi;
+   getStoredDBInfo(db, sdbi, false);
+   sshKeyLayout_ = sdbi.sshKeyLayout_;
+
+   resetScrAddrIds();
+   {
+      LMDBEnv::Transaction tx;
+      beginDBTransaction(&tx, HISTORY, LMDB::ReadOnly);
+
+      BinaryRefReader brr = 
+         getValueReader(db, WRITE_UINT8_LE((uint8_t)DB_PREFIX_SCRADDRID));
+      if (brr.getSize() == 4)
+         nextScrAddrId_ = brr.get_uint32_t();
+   }
+
+   //some scrAddrs may already be in the target layout, the db can't be 
+   //read until they all are
+   if (sdbi.sshKeyMigrating_)
+   {
+      LOGWARN << "History key migration was interrupted, resuming it";
+      migrateHistoryKeys(sdbi.sshKeyMigrationTarget_);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+uint32_t LMDBBlockDatabase::getScrAddrId(
+   BinaryDataRef scrAddr, bool assignId) const
+{
+   BinaryData scrAddrKey(scrAddr);
+
+   {
+      unique_lock<mutex> lock(scrAddrIdMutex_);
+
+      auto idIter = scrAddrIds_.find(scrAddrKey);
+      if (idIter != scrAddrIds_.end())
+         return idIter->second;
+
+      idIter = pendingScrAddrIds_.find(scrAddrKey);
+      if (idIter != pendingScrAddrIds_.end())
+         return idIter->second;
+   }
+
+   //not under the lock, opening a transaction waits out compactions
+   uint32_t id = UINT32_MAX;
+   {
+      LMDBEnv::Transaction tx;
+      beginDBTransaction(&tx, HISTORY, LMDB::ReadOnly);
+
+      BinaryRefReader brr = getValueReader(
+         getDbSelect(HISTORY), DB_PREFIX_SCRADDRID, scrAddr);
+      if (brr.getSize() == 4)
+         id = brr.get_uint32_t();
+   }
+
+   unique_lock<mutex> lock(scrAddrIdMutex_);
+
+   if (id == UINT32_MAX)
+   {
+      //it may have been assigned meanwhile
+      auto idIter = pendingScrAddrIds_.find(scrAddrKey);
+      if (idIter != pendingScrAddrIds_.end())
+         return idIter->second;
+
+      idIter = scrAddrIds_.find(scrAddrKey);
+      if (idIter != scrAddrIds_.end())
+         return idIter->second;
+
+      if (!assignId)
+         return UINT32_MAX;
+
+      id = nextScrAddrId_++;
+      pendingScrAddrIds_[scrAddrKey] = id;
+      return id;
+   }
+
+   if (scrAddrIds_.size() >= SCRADDRID_CACHE_SIZE)
+      scrAddrIds_.clear();
+
+   scrAddrIds_[scrAddrKey] = id;
+   return id;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BinaryData LMDBBlockDatabase::getSubSSHKeyPrefix(BinaryDataRef scrAddr,
+   SSH_KEY_LAYOUT layout, bool assignId) const
+{
+   if (layout == SSH_KEYS_SCRADDR)
+   {
+      BinaryWriter bw(scrAddr.getSize() + 1);
+      bw.put_uint8_t((uint8_t)DB_PREFIX_SCRIPT);
+      bw.put_BinaryData(scrAddr);
+      return bw.getData();
+   }
+
+   uint32_t id = getScrAddrId(scrAddr, assignId);
+   if (id == UINT32_MAX)
+      return BinaryData(0);
+
+   //big endian, so new ids land past the end of the db
+   BinaryWriter bw(5);
+   bw.put_uint8_t((uint8_t)DB_PREFIX_SUBSSH);
+   bw.put_uint32_t(id, BE);
+   return bw.getData();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BinaryData LMDBBlockDatabase::getSubSSHKeyPrefix(
+   BinaryDataRef scrAddr, bool assignId) const
+{
+   return getSubSSHKeyPrefix(scrAddr, sshKeyLayout_, assignId);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BinaryData LMDBBlockDatabase::getSubSSHKey(BinaryDataRef scrAddr, 
+   BinaryDataRef hgtX, bool assignId) const
+{
+   BinaryData key = getSubSSHKeyPrefix(scrAddr, sshKeyLayout_, assignId);
+   if (key.getSize() > 0)
+      key.append(hgtX);
+
+   return key;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LMDBBlockDatabase::putScrAddrIds(void)
+{
+   unique_lock<mutex> lock(scrAddrIdMutex_);
+
+   if (pendingScrAddrIds_.size() == 0)
+      return;
+
+   const DB_SELECT db = getDbSelect(HISTORY);
+   for (const auto& idPair : pendingScrAddrIds_)
+   {
+      putValue(db, DB_PREFIX_SCRADDRID, idPair.first, 
+         WRITE_UINT32_LE(idPair.second));
+   }
+
+   //the next id to hand out, keyed by the bare prefix
+   putValue(db, WRITE_UINT8_LE((uint8_t)DB_PREFIX_SCRADDRID),
+      WRITE_UINT32_LE(nextScrAddrId_));
+
+   if (scrAddrIds_.size() + pendingScrAddrIds_.size() > SCRADDRID_CACHE_SIZE)
+      scrAddrIds_.clear();
+
+   scrAddrIds_.insert(pendingScrAddrIds_.begin(), pendingScrAddrIds_.end());
+   pendingScrAddrIds_.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LMDBBlockDatabase::resetScrAddrIds(void)
+{
+   unique_lock<mutex> lock(scrAddrIdMutex_);
+
+   scrAddrIds_.clear();
+   pendingScrAddrIds_.clear();
+   nextScrAddrId_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LMDBBlockDatabase::migrateHistoryKeys(SSH_KEY_LAYOUT layout)
+{
+   const DB_SELECT db = getDbSelect(HISTORY);
+
+   //flag the migration before moving anything. Until it is cleared, along
+   //with the layout flip, opening the db resumes it
+   {
+      LMDBEnv::Transaction tx;
+      beginDBTransaction(&tx, HISTORY, LMDB::ReadWrite);
+
+      StoredDBInfo sdbi;
+      getStoredDBInfo(db, sdbi);
+      if (layout == sshKeyLayout_ && !sdbi.sshKeyMigrating_)
+         return;
+
+      sdbi.sshKeyMigrating_ = true;
+      sdbi.sshKeyMigrationTarget_ = layout;
+      putStoredDBInfo(db, sdbi);
+   }
+
+   LOGINFO << "Migrating history keys, this may take a while";
+
+   size_t scrAddrCount = 0;
+
+   //can't iterate and write at the same time with LMDB, so each pass 
+   //grabs scrAddrs with their sub-SSHs until it holds MIGRATE_BATCH_BYTES
+   //of them, then moves them. A scrAddr is never split across passes
+   struct SubSSHEntry
+   {
+      BinaryData scrAddr_;
+      BinaryData hgtX_;
+      BinaryData value_;
+   };
+
+   if (layout == SSH_KEYS_SCRADDR_ID)
+   {
+      //subs follow their SSH, with the hgtX appended to its key
+      BinaryData lastSSHKey;
+      bool done = false;
+
+      while (!done)
+      {
+         LMDBEnv::Transaction tx;
+         beginDBTransaction(&tx, HISTORY, LMDB::ReadWrite);
+
+         vector<SubSSHEntry> subs;
+         size_t batchCount = 0;
+         size_t batchBytes = 0;
+         done = true;
+
+         {
+            LDBIter ldbIter = getIterator(db);
+            bool valid;
+            if (lastSSHKey.getSize() == 0)
+            {
+               valid = ldbIter.seekToStartsWith(DB_PREFIX_SCRIPT);
+            }
+            else
+            {
+               //the last pass stopped right after this one
+               ldbIter.seekTo(lastSSHKey);
+               valid = ldbIter.advanceAndRead(DB_PREFIX_SCRIPT);
+            }
+
+            while (valid)
+            {
+               BinaryDataRef key = ldbIter.getKeyRef();
+               size_t sshKeySize = lastSSHKey.getSize();
+
+               if (sshKeySize > 0 && key.startsWith(lastSSHKey) &&
+                  key.getSize() == sshKeySize + 4)
+               {
+                  SubSSHEntry sub;
+                  sub.scrAddr_ = lastSSHKey.getSliceCopy(1, sshKeySize - 1);
+                  sub.hgtX_ = key.getSliceCopy(sshKeySize, 4);
+                  sub.value_ = ldbIter.getValue();
+                  batchBytes += key.getSize() + sub.value_.getSize();
+                  subs.push_back(move(sub));
+               }
+               else
+               {
+                  if (batchBytes >= MIGRATE_BATCH_BYTES)
+                  {
+                     done = false;
+                     break;
+                  }
+
+                  lastSSHKey = key;
+                  ++batchCount;
+               }
+
+               valid = ldbIter.advanceAndRead(DB_PREFIX_SCRIPT);
+            }
+         }
+
+         for (const auto& sub : subs)
+         {
+            BinaryData newKey = getSubSSHKeyPrefix(
+               sub.scrAddr_, SSH_KEYS_SCRADDR_ID, true);
+            newKey.append(sub.hgtX_);
+
+            putValue(db, newKey, sub.value_);
+            deleteValue(db, DB_PREFIX_SCRIPT, sub.scrAddr_ + sub.hgtX_);
+         }
+
+         putScrAddrIds();
+         scrAddrCount += batchCount;
+      }
+   }
+   else
+   {
+      //go through the dictionary, dropping each entry once its subs moved
+      while (true)
+      {
+         LMDBEnv::Transaction tx;
+         beginDBTransaction(&tx, HISTORY, LMDB::ReadWrite);
 
-   LMDBEnv::Transaction tx;
-   beginDBTransaction(&tx, HISTORY, LMDB::ReadOnly);
-   LDBIter ldbIter = getIterator(getDbSelect(HISTORY));
+         //scrAddr and the key prefix of its subs
+         vector<pair<BinaryData, BinaryData> > idKeys;
+         vector<SubSSHEntry> subs;
+         size_t batchBytes = 0;
+         {
+            LDBIter ldbIter = getIterator(db);
+            LDBIter subIter = getIterator(db);
+            bool valid = ldbIter.seekToStartsWith(DB_PREFIX_SCRADDRID);
 
-   if (!ldbIter.seekToExact(DB_PREFIX_SCRIPT, bw.getDataRef()))
-      return false;
+            while (valid && batchBytes < MIGRATE_BATCH_BYTES)
+            {
+               BinaryDataRef key = ldbIter.getKeyRef();
+
+               //the id counter has no scrAddr
+               if (key.getSize() > 1)
+               {
+                  BinaryWriter bw(5);
+                  bw.put_uint8_t((uint8_t)DB_PREFIX_SUBSSH);
+                  bw.put_uint32_t(ldbIter.getValueReader().get_uint32_t(), BE);
+
+                  idKeys.push_back(make_pair(
+                     key.getSliceCopy(1, key.getSize() - 1), bw.getData()));
+                  const auto& idPair = idKeys.back();
+
+                  bool subValid = subIter.seekToStartsWith(idPair.second);
+                  while (subValid)
+                  {
+                     SubSSHEntry sub;
+                     sub.scrAddr_ = idPair.first;
+                     sub.hgtX_ = subIter.getKeyRef().getSliceCopy(5, 4);
+                     sub.value_ = subIter.getValue();
+                     batchBytes += 
+                        subIter.getKeyRef().getSize() + sub.value_.getSize();
+                     subs.push_back(move(sub));
+
+                     subValid = subIter.advanceAndRead(DB_PREFIX_SUBSSH) &&
+                        subIter.getKeyRef().startsWith(idPair.second);
+                  }
+               }
+
+               valid = ldbIter.advanceAndRead(DB_PREFIX_SCRADDRID);
+            }
+         }
 
-   subssh.hgtX_ = hgtX;
-   subssh.unserializeDBValue(ldbIter.getValueReader());
-   return true;
-}
+         if (idKeys.size() == 0)
+         {
+            deleteValue(db, WRITE_UINT8_LE((uint8_t)DB_PREFIX_SCRADDRID));
+            break;
+         }
 
-////////////////////////////////////////////////////////////////////////////////
-void LMDBBlockDatabase::getStoredScriptHistoryByRawScript(
-                                             StoredScriptHistory & ssh,
-                                             BinaryDataRef script) const
-{
-   BinaryData uniqueKey = BtcUtils::getTxOutScrAddr(script);
-   getStoredScriptHistory(ssh, uniqueKey);
-}
+         //subs are in the same order as the scrAddrs they belong to
+         auto subIter = subs.cbegin();
+         for (const auto& idPair : idKeys)
+         {
+            for (; subIter != subs.cend() && 
+               subIter->scrAddr_ == idPair.first; ++subIter)
+            {
+               putValue(db, DB_PREFIX_SCRIPT, 
+                  idPair.first + subIter->hgtX_, subIter->value_);
+               deleteValue(db, idPair.second + subIter->hgtX_);
+            }
 
+            deleteValue(db, DB_PREFIX_SCRADDRID, idPair.first);
+         }
 
-/////////////////////////////////////////////////////////////////////////////
-// This doesn't actually return a SUBhistory, it grabs it and adds it to the
-// regular-SSH object.  This does not affect balance or Txio count.  It's 
-// simply filling in data that the SSH may be expected to have.  
-bool LMDBBlockDatabase::fetchStoredSubHistory( StoredScriptHistory & ssh,
-                                            BinaryData hgtX,
-                                            bool createIfDNE,
-                                            bool forceReadDB)
-{
-   auto subIter = ssh.subHistMap_.find(hgtX);
-   if (!forceReadDB && ITER_IN_MAP(subIter, ssh.subHistMap_))
-   {
-      return true;
-   }
+         scrAddrCount += idKeys.size();
+      }
 
-   BinaryData key = ssh.uniqueKey_ + hgtX; 
-   BinaryRefReader brr = getValueReader(BLKDATA, DB_PREFIX_SCRIPT, key);
+      resetScrAddrIds();
+   }
 
-   StoredSubHistory subssh;
-   subssh.uniqueKey_ = ssh.uniqueKey_;
-   subssh.hgtX_      = hgtX;
+   {
+      LMDBEnv::Transaction tx;
+      beginDBTransaction(&tx, HISTORY, LMDB::ReadWrite);
 
-   if(brr.getSize() > 0)
-      subssh.unserializeDBValue(brr);
-   else if(!createIfDNE)
-      return false;
+      StoredDBInfo sdbi;
+      getStoredDBInfo(db, sdbi);
+      sdbi.sshKeyLayout_ = layout;
+      sdbi.sshKeyMigrating_ = false;
+      putStoredDBInfo(db, sdbi);
+   }
 
-   ssh.mergeSubHistory(subssh);
-   
-   return true;
+   sshKeyLayout_ = layout;
+   LOGINFO << "Migrated the history keys of " << scrAddrCount << " scrAddrs";
 }
 
 
@@ -1384,36 +2149,53 @@ bool LMDBBlockDatabase::getFullUTXOMapForSSH(
    if(!ssh.haveFullHistoryLoaded())
       return false;
 
-   LMDBEnv::Transaction tx;
-   beginDBTransaction(&tx, HISTORY, LMDB::ReadOnly);
-
+   vector<const TxIOPair*> utxos;
+   for (const auto& ssPair : ssh.subHistMap_)
    {
-      for (const auto& ssPair : ssh.subHistMap_)
+      for (const auto& txioPair : ssPair.second.txioMap_)
       {
-         const StoredSubHistory & subSSH = ssPair.second;
-         for (const auto& txioPair : subSSH.txioMap_)
-         {
-            const TxIOPair & txio = txioPair.second;
-            if (txio.isUTXO())
-            {
-               BinaryData txoKey = txio.getDBKeyOfOutput();
-               BinaryData txKey = txio.getTxRefOfOutput().getDBKey();
-               uint16_t txoIdx = txio.getIndexOfOutput();
+         if (txioPair.second.isUTXO())
+            utxos.push_back(&txioPair.second);
+      }
+   }
+
+   //the txouts and the txs they're from sit next to each other under 
+   //TXDATA, fetch them all in one batch
+   vector<BinaryData> keys;
+   keys.reserve(utxos.size() * 2);
+   for (auto txio : utxos)
+   {
+      keys.push_back(txio->getDBKeyOfOutput());
+      keys.push_back(txio->getTxRefOfOutput().getDBKey());
+   }
 
+   const DB_SELECT dbs = getDbSelect(HISTORY);
+   LMDBEnv::Transaction tx;
+   beginDBTransaction(&tx, HISTORY, LMDB::ReadOnly);
+   vector<BinaryDataRef> values = getValueRefs(dbs, DB_PREFIX_TXDATA, keys);
 
-               StoredTxOut stxo;
-               getStoredTxOut(stxo, txoKey);
-               BinaryData txHash = getTxHashForLdbKey(txKey);
+   for (unsigned i = 0; i < utxos.size(); i++)
+   {
+      const TxIOPair & txio = *utxos[i];
+      const BinaryData& txoKey = keys[i * 2];
+      const BinaryData& txKey = keys[i * 2 + 1];
 
-               mapToFill[txoKey] = UnspentTxOut(
-                  txHash,
-                  txoIdx,
-                  stxo.blockHeight_,
-                  txio.getValue(),
-                  stxo.getScriptRef());
-            }
-         }
-      }
+      StoredTxOut stxo;
+      if (values[i * 2].getSize() > 0)
+         readStoredTxOut(stxo, txoKey, values[i * 2]);
+      else
+         getStoredTxOut(stxo, txoKey);
+
+      BinaryData txHash = readTxHash(DB_PREFIX_TXDATA, values[i * 2 + 1]);
+      if (txHash.getSize() == 0)
+         txHash = getTxHashForLdbKey(txKey);
+
+      mapToFill[txoKey] = UnspentTxOut(
+         txHash,
+         txio.getIndexOfOutput(),
+         stxo.blockHeight_,
+         txio.getValue(),
+         stxo.getScriptRef());
    }
 
    return true;
@@ -1465,7 +2247,7 @@ void LMDBBlockDatabase::addRegisteredScript(BinaryDataRef rawScript,
 //       that would get us since we are reading all the headers and doing
 //       a fresh organize/sort anyway.
 void LMDBBlockDatabase::readAllHeaders(
-   const function<void(const BlockHeader&, uint32_t, uint8_t)> &callback
+   const function<void(const StoredHeader&)> &callback
 )
 {
    LMDBEnv::Transaction tx;
@@ -1480,7 +2262,6 @@ void LMDBBlockDatabase::readAllHeaders(
    }
    
    StoredHeader sbh;
-   BlockHeader  regHead;
    do
    {
       ldbIter.resetReaders();
@@ -1494,19 +2275,88 @@ void LMDBBlockDatabase::readAllHeaders(
 
       ldbIter.getKeyReader().get_BinaryData(sbh.thisHash_, 32);
 
-      sbh.unserializeDBValue(HEADERS, ldbIter.getValueRef());
-      regHead.unserialize(sbh.dataCopy_);
-      regHead.setBlockSize(sbh.numBytes_);
+      // same layout DBBlock::unserializeDBValue reads, but the hash is 
+      // taken from the key instead of computing it here
+      BinaryRefReader& brr = ldbIter.getValueReader();
+      brr.get_BinaryData(sbh.dataCopy_, HEADER_SIZE);
+      BinaryData hgtx = brr.get_BinaryData(4);
+      sbh.blockHeight_ = DBUtils::hgtxToHeight(hgtx);
+      sbh.duplicateID_ = DBUtils::hgtxToDupID(hgtx);
+      sbh.numBytes_ = brr.get_uint32_t();
+      callback(sbh);
+
+   } while(ldbIter.advanceAndRead(DB_PREFIX_HEADHASH));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Value is: fnum (4) | offset (8) | block size (4)
+void LMDBBlockDatabase::putBlockFilePosition(const BlockHeader& bh)
+{
+   if (!bh.hasFilePos())
+      return;
+
+   BinaryWriter bw(16);
+   bw.put_uint32_t(bh.getBlockFileNum());
+   bw.put_uint64_t(bh.getOffset());
+   bw.put_uint32_t(bh.getBlockSize());
+
+   putValue(HEADERS, DB_PREFIX_BLKFILEPOS, 
+      bh.getThisHash().getRef(), bw.getDataRef());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool LMDBBlockDatabase::getBlockFilePosition(BlockHeader& bh) const
+{
+   LMDBEnv::Transaction tx;
+   beginDBTransaction(&tx, HEADERS, LMDB::ReadOnly);
+
+   BinaryRefReader brr = getValueReader(
+      HEADERS, DB_PREFIX_BLKFILEPOS, bh.getThisHash().getRef());
+   if (brr.getSizeRemaining() != 16)
+      return false;
+
+   bh.setBlockFileNum(brr.get_uint32_t());
+   bh.setBlockFileOffset(brr.get_uint64_t());
+   bh.setBlockSize(brr.get_uint32_t());
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LMDBBlockDatabase::readAllBlockFilePositions(
+   const function<void(
+      BinaryDataRef hash, uint32_t fnum, uint64_t offset, uint32_t size
+   )> &callback
+) const
+{
+   LMDBEnv::Transaction tx;
+   beginDBTransaction(&tx, HEADERS, LMDB::ReadOnly);
+
+   LDBIter ldbIter = getIterator(HEADERS);
+   if (!ldbIter.seekToStartsWith(DB_PREFIX_BLKFILEPOS))
+      return;
+
+   do
+   {
+      ldbIter.resetReaders();
+      if (!ldbIter.verifyPrefix(DB_PREFIX_BLKFILEPOS))
+         break;
 
-      if (sbh.thisHash_ != regHead.getThisHash())
+      BinaryRefReader& keyReader = ldbIter.getKeyReader();
+      BinaryRefReader& valReader = ldbIter.getValueReader();
+      if (keyReader.getSizeRemaining() != 32 || 
+          valReader.getSizeRemaining() != 16)
       {
-         LOGWARN << "Corruption detected: block header hash " <<
-            sbh.thisHash_.copySwapEndian().toHexStr() << " does not match "
-            << regHead.getThisHash().copySwapEndian().toHexStr();
+         LOGERR << "Invalid block file position entry in HEADERS DB";
+         continue;
       }
-      callback(regHead, sbh.blockHeight_, sbh.duplicateID_);
 
-   } while(ldbIter.advanceAndRead(DB_PREFIX_HEADHASH));
+      const BinaryDataRef hash = keyReader.get_BinaryDataRef(32);
+      const uint32_t fnum = valReader.get_uint32_t();
+      const uint64_t offset = valReader.get_uint64_t();
+      const uint32_t size = valReader.get_uint32_t();
+      callback(hash, fnum, offset, size);
+
+   } while (ldbIter.advanceAndRead(DB_PREFIX_BLKFILEPOS));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2002,7 +2852,8 @@ void LMDBBlockDatabase::putStoredTx( StoredTx & stx, bool withTxOut)
 
    // Now add the base Tx entry in the BLKDATA DB.
    BinaryWriter bw;
-   stx.serializeDBValue(bw, armoryDbType_, dbPruneType_);
+   stx.serializeDBValue(bw, armoryDbType_, dbPruneType_,
+      txCompression_ == TXDATA_COMPRESS_ALL);
    putValue(BLKDATA, DB_PREFIX_TXDATA, ldbKey, bw.getDataRef());
 
 
@@ -2413,9 +3264,11 @@ TxOut LMDBBlockDatabase::getTxOutCopy(
 
    TxRef parent(ldbKey6B);
 
-   brr.advance(2);
-   txoOut.unserialize_checked(
-      brr.getCurrPtr(), brr.getSizeRemaining(), 0, parent, (uint32_t)txOutIdx);
+   // the entry may be compressed, let StoredTxOut sort it out
+   StoredTxOut stxo;
+   stxo.unserializeDBValue(brr);
+   txoOut.unserialize_checked(stxo.dataCopy_.getPtr(), 
+      stxo.dataCopy_.getSize(), 0, parent, (uint32_t)txOutIdx);
    return txoOut;
 }
 
@@ -2442,6 +3295,7 @@ TxIn LMDBBlockDatabase::getTxInCopy(
       uint16_t txVer = bitunpack.getBits(2);
       (void)txVer;
       uint16_t txSer = bitunpack.getBits(4);
+      bool isCompressed = bitunpack.getBit();
 
       brr.advance(32);
 
@@ -2453,19 +3307,31 @@ TxIn LMDBBlockDatabase::getTxInCopy(
       }
       else
       {
+         BinaryData uncompressed;
+         BinaryDataRef txData(brr.getCurrPtr(), brr.getSizeRemaining());
+         if (isCompressed)
+         {
+            if (!DBUtils::uncompressBlock(brr, uncompressed))
+            {
+               LOGERR << "Invalid compressed tx entry";
+               return TxIn();
+            }
+            txData = uncompressed.getRef();
+         }
+
          bool isFragged = txSer == TX_SER_FRAGGED;
          vector<size_t> offsetsIn;
-         BtcUtils::StoredTxCalcLength(brr.getCurrPtr(), isFragged, &offsetsIn);
+         BtcUtils::StoredTxCalcLength(txData.getPtr(), isFragged, &offsetsIn);
          if ((uint32_t)(offsetsIn.size() - 1) < (uint32_t)(txInIdx + 1))
          {
             LOGERR << "Requested TxIn with index greater than numTxIn";
             return TxIn();
          }
          TxRef parent(ldbKey6B);
-         uint8_t const * txInStart = brr.exposeDataPtr() + 34 + offsetsIn[txInIdx];
+         uint8_t const * txInStart = txData.getPtr() + offsetsIn[txInIdx];
          uint32_t txInLength = offsetsIn[txInIdx + 1] - offsetsIn[txInIdx];
          TxIn txin;
-         txin.unserialize_checked(txInStart, brr.getSize() - 34 - offsetsIn[txInIdx], txInLength, parent, txInIdx);
+         txin.unserialize_checked(txInStart, txData.getSize() - offsetsIn[txInIdx], txInLength, parent, txInIdx);
          return txin;
       }
    }
@@ -2479,6 +3345,32 @@ TxIn LMDBBlockDatabase::getTxInCopy(
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+void LMDBBlockDatabase::readStoredTxOut(StoredTxOut & stxo, 
+   BinaryDataRef key8B, BinaryDataRef value)
+{
+   stxo.unserializeDBKey(key8B);
+
+   BinaryRefReader brr(value);
+   stxo.unserializeDBValue(brr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BinaryData LMDBBlockDatabase::readTxHash(DB_PREFIX prefix, 
+   BinaryDataRef value) const
+{
+   //zc entries and supernode tx entries keep the hash after 2 bytes of 
+   //flags, fullnode tx entries after the 4 byte txout count
+   size_t offset = 2;
+   if (prefix == DB_PREFIX_TXDATA && armoryDbType_ != ARMORY_DB_SUPER)
+      offset = 4;
+
+   if (value.getSize() < offset + 32)
+      return BinaryData(0);
+
+   return value.getSliceCopy(offset, 32);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 BinaryData LMDBBlockDatabase::getTxHashForLdbKey( BinaryDataRef ldbKey6B ) const
 {
@@ -2486,22 +3378,22 @@ BinaryData LMDBBlockDatabase::getTxHashForLdbKey( BinaryDataRef ldbKey6B ) const
    if (armoryDbType_ == ARMORY_DB_SUPER)
    {
       LMDBEnv::Transaction tx(dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
-      BinaryRefReader stxVal;
+      BinaryData val;
 
+      DB_PREFIX prefix = DB_PREFIX_TXDATA;
       if (!ldbKey6B.startsWith(ZCprefix_))
-         stxVal = getValueReader(BLKDATA, DB_PREFIX_TXDATA, ldbKey6B);
+         val = getValueCached(BLKDATA, prefix, ldbKey6B);
       else
-         stxVal = getValueReader(BLKDATA, DB_PREFIX_ZCDATA, ldbKey6B);
-
-      if (stxVal.getSize() == 0)
       {
-         LOGERR << "TxRef key does not exist in BLKDATA DB";
-         return BinaryData(0);
+         prefix = DB_PREFIX_ZCDATA;
+         val = getValueRef(BLKDATA, prefix, ldbKey6B);
       }
 
-      // We can't get here unless we found the precise Tx entry we were looking for
-      stxVal.advance(2);
-      return stxVal.get_BinaryData(32);
+      BinaryData txHash = readTxHash(prefix, val);
+      if (txHash.getSize() == 0)
+         LOGERR << "TxRef key does not exist in BLKDATA DB";
+
+      return txHash;
    }
    else
    {
@@ -2511,31 +3403,21 @@ BinaryData LMDBBlockDatabase::getTxHashForLdbKey( BinaryDataRef ldbKey6B ) const
 
          if (!ldbKey6B.startsWith(ZCprefix_))
          {
-            BinaryData keyFull(ldbKey6B.getSize() + 1);
-            keyFull[0] = (uint8_t)DB_PREFIX_TXDATA;
-            ldbKey6B.copyTo(keyFull.getPtr() + 1, ldbKey6B.getSize());
-
-            BinaryDataRef txData = getValueNoCopy(HISTORY, keyFull);
+            BinaryData txHash = readTxHash(DB_PREFIX_TXDATA,
+               getValueCached(HISTORY, DB_PREFIX_TXDATA, ldbKey6B));
 
-            if (txData.getSize() >= 36)
-            {
-               return txData.getSliceRef(4, 32);
-            }
+            if (txHash.getSize() != 0)
+               return txHash;
          }
          else
          {            
-            BinaryRefReader stxVal = 
-               getValueReader(HISTORY, DB_PREFIX_ZCDATA, ldbKey6B);
+            BinaryData txHash = readTxHash(DB_PREFIX_ZCDATA,
+               getValueRef(HISTORY, DB_PREFIX_ZCDATA, ldbKey6B));
 
-            if (stxVal.getSize() == 0)
-            {
+            if (txHash.getSize() == 0)
                LOGERR << "TxRef key does not exist in BLKDATA DB";
-               return BinaryData(0);
-            }
 
-            // We can't get here unless we found the precise Tx entry we were looking for
-            stxVal.advance(2);
-            return stxVal.get_BinaryData(32);
+            return txHash;
          }
       }
       //else pull the full block then grab the txhash
@@ -2574,12 +3456,13 @@ StoredTxHints LMDBBlockDatabase::getHintsForTxHash(BinaryDataRef txHash) const
    SCOPED_TIMER("getAllHintsForTxHash");
    StoredTxHints sths;
    sths.txHashPrefix_ = txHash.getSliceRef(0,4);
-   BinaryRefReader brr;
 
+   BinaryData val;
    if (armoryDbType_ == ARMORY_DB_SUPER)
-      brr = getValueReader(BLKDATA, DB_PREFIX_TXHINTS, sths.txHashPrefix_);
+      val = getValueCached(BLKDATA, DB_PREFIX_TXHINTS, sths.txHashPrefix_);
    else
-      brr = getValueReader(TXHINTS, DB_PREFIX_TXHINTS, sths.txHashPrefix_);
+      val = getValueCached(TXHINTS, DB_PREFIX_TXHINTS, sths.txHashPrefix_);
+   BinaryRefReader brr(val);
 
    if(brr.getSize() == 0)
    {
@@ -2592,6 +3475,191 @@ StoredTxHints LMDBBlockDatabase::getHintsForTxHash(BinaryDataRef txHash) const
    return sths;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+vector<StoredTxHints> LMDBBlockDatabase::getHintsForTxHashes(
+   const vector<BinaryData>& txHashes) const
+{
+   SCOPED_TIMER("getAllHintsForTxHash");
+   DB_SELECT dbs = armoryDbType_ == ARMORY_DB_SUPER ? BLKDATA : TXHINTS;
+
+   vector<BinaryData> prefixes;
+   prefixes.reserve(txHashes.size());
+   for (const auto& txHash : txHashes)
+   {
+      if (txHash.getSize() >= 4)
+         prefixes.push_back(txHash.getSliceCopy(0, 4));
+      else
+         prefixes.push_back(BinaryData(0));
+   }
+
+   LMDBEnv::Transaction tx(dbEnv_[dbs].get(), LMDB::ReadOnly);
+   vector<BinaryDataRef> values = 
+      getValueRefs(dbs, DB_PREFIX_TXHINTS, prefixes);
+
+   vector<StoredTxHints> hints(txHashes.size());
+   for (unsigned i = 0; i < txHashes.size(); i++)
+   {
+      hints[i].txHashPrefix_ = prefixes[i];
+      if (values[i].getSize() > 0)
+         hints[i].unserializeDBValue(values[i]);
+   }
+
+   return hints;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+vector<Tx> LMDBBlockDatabase::getFullTxCopies(
+   const vector<BinaryData>& ldbKeys6B) const
+{
+   SCOPED_TIMER("getFullTxCopy");
+   vector<Tx> txs(ldbKeys6B.size());
+
+   if (armoryDbType_ == ARMORY_DB_SUPER)
+   {
+      //txs are stored individually in supernode, nothing to share
+      LMDBEnv::Transaction tx(dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
+      for (unsigned i = 0; i < ldbKeys6B.size(); i++)
+         txs[i] = getFullTxCopy(ldbKeys6B[i]);
+
+      return txs;
+   }
+
+   //Fullnode, group the requests by block so that each block is fetched 
+   //and walked once, carving out all its requested txs on the way
+   map<BinaryData, vector<pair<uint16_t, unsigned>>> requestsPerBlock;
+   for (unsigned i = 0; i < ldbKeys6B.size(); i++)
+   {
+      const auto& key = ldbKeys6B[i];
+      if (key.getSize() != 6)
+      {
+         LOGERR << "TxRef key does not exist in BLKDATA DB";
+         continue;
+      }
+
+      uint16_t txid = READ_UINT16_BE(key.getSliceRef(4, 2));
+      requestsPerBlock[key.getSliceCopy(0, 4)].push_back(make_pair(txid, i));
+   }
+
+   //the map keeps the block keys sorted, so the lookups go in db order
+   vector<BinaryData> hgtxs;
+   hgtxs.reserve(requestsPerBlock.size());
+   for (const auto& blockRequests : requestsPerBlock)
+      hgtxs.push_back(blockRequests.first);
+
+   LMDBEnv::Transaction tx(dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
+   vector<BinaryDataRef> blocks = 
+      getValueRefs(BLKDATA, DB_PREFIX_TXDATA, hgtxs);
+
+   unsigned blockId = 0;
+   for (auto& blockRequests : requestsPerBlock)
+   {
+      const BinaryDataRef& block = blocks[blockId++];
+      if (block.getSize() <= HEADER_SIZE)
+      {
+         LOGERR << "TxRef key does not exist in BLKDATA DB";
+         continue;
+      }
+
+      auto& requests = blockRequests.second;
+      sort(requests.begin(), requests.end());
+
+      BinaryRefReader brr(block);
+      brr.advance(HEADER_SIZE);
+      uint32_t nTx = (uint32_t)brr.get_var_int();
+
+      uint32_t txPos = 0;
+      for (const auto& request : requests)
+      {
+         if (request.first >= nTx)
+         {
+            LOGERR << "Requested full Tx but not all TxOut available";
+            continue;
+         }
+
+         for (; txPos < request.first; txPos++)
+         {
+            uint32_t nBytes = BtcUtils::TxCalcLength(
+               brr.getCurrPtr(), brr.getSizeRemaining(), nullptr, nullptr);
+            brr.advance(nBytes);
+         }
+
+         //the same tx can be requested more than once
+         BinaryRefReader brrTx(brr.getCurrPtr(), brr.getSizeRemaining());
+         txs[request.second] = Tx(brrTx);
+      }
+   }
+
+   return txs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Same rules as getStoredTx_byHash: hints for a block off the main branch 
+// are skipped unless they're the only ones
+vector<Tx> LMDBBlockDatabase::getTxsByHash(
+   const vector<BinaryData>& txHashes) const
+{
+   SCOPED_TIMER("getStoredTx");
+   vector<Tx> txs(txHashes.size());
+
+   if (armoryDbType_ == ARMORY_DB_SUPER)
+   {
+      LMDBEnv::Transaction tx(dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
+      for (unsigned i = 0; i < txHashes.size(); i++)
+      {
+         StoredTx stx;
+         if (getStoredTx_byHashSuper(txHashes[i], &stx))
+            txs[i] = stx.getTxCopy();
+      }
+
+      return txs;
+   }
+
+   LMDBEnv::Transaction txHints(dbEnv_[TXHINTS].get(), LMDB::ReadOnly);
+   LMDBEnv::Transaction txBlkData(dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
+
+   vector<StoredTxHints> hints = getHintsForTxHashes(txHashes);
+
+   //all the candidates of all the hashes go in a single batch
+   vector<BinaryData> candidates;
+   vector<unsigned> candidateOwner;
+   for (unsigned i = 0; i < hints.size(); i++)
+   {
+      const size_t numHints = hints[i].getNumHints();
+      for (const auto& hint : hints[i].dbKeyList_)
+      {
+         uint32_t height;
+         uint8_t  dup;
+         uint16_t txIdx;
+         BinaryRefReader brrHint(hint);
+         DBUtils::readBlkDataKeyNoPrefix(brrHint, height, dup, txIdx);
+
+         if (dup != getValidDupIDForHeight(height) && numHints > 1)
+            continue;
+
+         candidates.push_back(hint);
+         candidateOwner.push_back(i);
+      }
+   }
+
+   vector<Tx> candidateTxs = getFullTxCopies(candidates);
+
+   for (unsigned i = 0; i < candidates.size(); i++)
+   {
+      Tx& candidate = candidateTxs[i];
+      Tx& result = txs[candidateOwner[i]];
+      if (result.isInitialized() || !candidate.isInitialized())
+         continue;
+
+      if (candidate.getThisHash() != txHashes[candidateOwner[i]])
+         continue;
+
+      candidate.setTxRef(TxRef(candidates[i]));
+      result = candidate;
+   }
+
+   return txs;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 bool LMDBBlockDatabase::getStoredTx( StoredTx & stx,
@@ -2926,7 +3994,8 @@ void LMDBBlockDatabase::putStoredTxOut( StoredTxOut const & stxo)
    SCOPED_TIMER("putStoredTx");
 
    BinaryData ldbKey = stxo.getDBKey(false);
-   BinaryData bw = serializeDBValue(stxo, armoryDbType_, dbPruneType_);
+   BinaryData bw = serializeDBValue(stxo, armoryDbType_, dbPruneType_,
+      false, txCompression_ != TXDATA_RAW);
    putValue(getDbSelect(HISTORY), DB_PREFIX_TXDATA, ldbKey, bw);
 }
 
@@ -2953,24 +4022,15 @@ bool LMDBBlockDatabase::getStoredTxOut(
 
    if (armoryDbType_ == ARMORY_DB_SUPER)
    {
-      BinaryData key = WRITE_UINT8_BE(DB_PREFIX_TXDATA);
-      key.append(DBkey);
-
       LMDBEnv::Transaction tx(dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
-      BinaryRefReader brr = getValueReader(BLKDATA, key);
-      if (brr.getSize() == 0)
+      BinaryData val = getValueCached(BLKDATA, DB_PREFIX_TXDATA, DBkey);
+      if (val.getSize() == 0)
       {
          LOGERR << "BLKDATA DB does not have the requested TxOut";
          return false;
       }
 
-      stxo.blockHeight_ = DBUtils::hgtxToHeight(DBkey.getSliceRef(0, 4));
-      stxo.duplicateID_ = DBUtils::hgtxToDupID(DBkey.getSliceRef(0, 4));
-      stxo.txIndex_ = READ_UINT16_BE(DBkey.getSliceRef(4, 2));
-      stxo.txOutIndex_ = READ_UINT16_BE(DBkey.getSliceRef(6, 2));
-
-      stxo.unserializeDBValue(brr);
-
+      readStoredTxOut(stxo, DBkey, val);
       return true;
    }
    else
@@ -2981,16 +4041,11 @@ bool LMDBBlockDatabase::getStoredTxOut(
          //block, since fullnode keeps track of all relevant stxos in the 
          //history db
          LMDBEnv::Transaction tx(dbEnv_[HISTORY].get(), LMDB::ReadOnly);
-         BinaryRefReader brr = getValueReader(HISTORY, DB_PREFIX_TXDATA, DBkey);
+         BinaryData val = getValueCached(HISTORY, DB_PREFIX_TXDATA, DBkey);
 
-         if (brr.getSize() > 0)
+         if (val.getSize() > 0)
          {
-            stxo.blockHeight_ = DBUtils::hgtxToHeight(DBkey.getSliceRef(0, 4));
-            stxo.duplicateID_ = DBUtils::hgtxToDupID(DBkey.getSliceRef(0, 4));
-            stxo.txIndex_ = READ_UINT16_BE(DBkey.getSliceRef(4, 2));
-            stxo.txOutIndex_ = READ_UINT16_BE(DBkey.getSliceRef(6, 2));
-
-            stxo.unserializeDBValue(brr);
+            readStoredTxOut(stxo, DBkey, val);
             return true;
          }
       }
@@ -3500,36 +4555,35 @@ map<uint32_t, uint32_t> LMDBBlockDatabase::getSSHSummary(BinaryDataRef scrAddrSt
    if (ssh.totalTxioCount_ == 0)
       return SSHsummary;
 
-   uint32_t sz = sshKey.getSize();
-   BinaryData scrAddr(sshKey.getSliceRef(1, sz - 1));
-   uint32_t scrAddrSize = scrAddr.getSize();
-   (void)scrAddrSize;
-
-   if (!ldbIter.advanceAndRead(DB_PREFIX_SCRIPT))
+   BinaryData subKeyPrefix = getSubSSHKeyPrefix(ssh.uniqueKey_);
+   if (subKeyPrefix.getSize() == 0 || !ldbIter.seekTo(subKeyPrefix))
    {
       LOGERR << "No sub-SSH entries after the SSH";
       return SSHsummary;
    }
 
    // Now start iterating over the sub histories
+   DB_PREFIX subPrefix = (DB_PREFIX)subKeyPrefix[0];
+   size_t subKeySize = subKeyPrefix.getSize() + 4;
    do
    {
-      uint32_t sz = ldbIter.getKeyRef().getSize();
-      BinaryDataRef keyNoPrefix = ldbIter.getKeyRef().getSliceRef(1, sz - 1);
-      if (!keyNoPrefix.startsWith(ssh.uniqueKey_))
+      BinaryDataRef key = ldbIter.getKeyRef();
+      if (!key.startsWith(subKeyPrefix))
          break;
 
-      pair<BinaryData, StoredSubHistory> keyValPair;
-      keyValPair.first = keyNoPrefix.getSliceCopy(sz - 5, 4);
-      keyValPair.second.unserializeDBKey(ldbIter.getKeyRef());
+      if (key.getSize() != subKeySize)
+         continue;
+
+      StoredSubHistory subssh;
+      subssh.setKeyData(ssh.uniqueKey_, key.getSliceRef(subKeySize - 4, 4));
 
       //iter is at the right ssh, make sure hgtX <= endBlock
-      if (keyValPair.second.height_ > endBlock)
+      if (subssh.height_ > endBlock)
          break;
 
-      keyValPair.second.getSummary(ldbIter.getValueReader());
-      SSHsummary[keyValPair.second.height_] = keyValPair.second.txioCount_;
-   } while (ldbIter.advanceAndRead(DB_PREFIX_SCRIPT));
+      subssh.getSummary(ldbIter.getValueReader());
+      SSHsummary[subssh.height_] = subssh.txioCount_;
+   } while (ldbIter.advanceAndRead(subPrefix));
 
    return SSHsummary;
 }
@@ -3616,10 +4670,23 @@ uint8_t LMDBBlockDatabase::putRawBlockData(BinaryRefReader& brr,
    }
 
    brr.resetPosition();
-   StoredHeader sbh;
-
    BlockHeader bhUnser(brr);
-   const BlockHeader & bh = getBH(bhUnser.getThisHash());
+   return putRawBlockData(brr, getBH(bhUnser.getThisHash()));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Same as above, for callers that already resolved the header of this block
+uint8_t LMDBBlockDatabase::putRawBlockData(BinaryRefReader& brr,
+   const BlockHeader& bh)
+{
+   if (armoryDbType_ == ARMORY_DB_SUPER)
+   {
+      LOGERR << "This method is not meant for supernode";
+      throw runtime_error("dbType incompatible with putRawBlockData");
+   }
+
+   brr.resetPosition();
+   StoredHeader sbh;
    sbh.blockHeight_ = bh.getBlockHeight();
    sbh.duplicateID_ = bh.getDuplicateID();
    sbh.isMainBranch_ = bh.isMainBranch();
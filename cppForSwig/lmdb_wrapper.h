@@ -36,6 +36,19 @@
 // It's actually that the ReadOptions::fill_cache arg needs to be false
 #define BULK_SCAN false
 
+// scrAddr ids kept in RAM, see LMDBBlockDatabase::getSubSSHKeyPrefix
+#define SCRADDRID_CACHE_SIZE 1000000
+
+// bytes of sub-history moved per transaction by 
+// LMDBBlockDatabase::migrateHistoryKeys
+#define MIGRATE_BATCH_BYTES (64*1024*1024)
+
+// bytes of values kept by DBValueCache, spread over its shards
+#define DBVALUE_CACHE_SIZE (32*1024*1024)
+#define DBVALUE_CACHE_SHARDS 16
+// larger values aren't worth evicting that many others for
+#define DBVALUE_CACHE_MAX_ENTRY (16*1024)
+
 class BlockHeader;
 class Tx;
 class TxIn;
@@ -109,7 +122,7 @@ class LDBIter
 public: 
 
    // fill_cache argument should be false for large bulk scans
-   LDBIter(void) { isDirty_=true;}
+   LDBIter(void) { isDirty_=true; iter_.setCopyData(false); }
    LDBIter(LMDB::Iterator&& move);
    LDBIter(LDBIter&& move);
    LDBIter(const LDBIter& cp);
@@ -161,10 +174,12 @@ public:
 
 private:
 
+   // iter_ doesn't copy the records out of the map, the readers point 
+   // straight into it. They are good until the iterator moves, the
+   // transaction ends or the db is written to in the same transaction.
+   // getKey() and getValue() return copies that outlive all that.
    LMDB::Iterator iter_;
 
-   mutable BinaryData       currKey_;
-   mutable BinaryData       currValue_;
    mutable BinaryRefReader  currKeyReader_;
    mutable BinaryRefReader  currValueReader_;
    bool isDirty_;
@@ -225,11 +240,106 @@ private:
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// LRU of raw values for keys that get looked up over and over (txouts, tx
+// hashes, tx hints), keyed by db and key. Missing keys are cached too, as 
+// an empty value. It's split in shards with their own lock, so threads 
+// looking up different keys don't wait on each other.
+//
+// Readers see the db as of their snapshot. An entry only serves readers 
+// whose snapshot is at least as recent as the one it was read from, and 
+// values are only added while nothing was written to their db since the 
+// reader's snapshot began. Writes must go through invalidate, which keeps 
+// the shard from taking that db's values until the next commit.
+class DBValueCache
+{
+public:
+   struct Stats
+   {
+      uint64_t hits_ = 0;
+      uint64_t misses_ = 0;
+      size_t entries_ = 0;
+      size_t bytes_ = 0;
+   };
+
+   DBValueCache(size_t maxBytes = DBVALUE_CACHE_SIZE);
+
+   // snapshotId/commitCount are those of the db's env, see LMDBEnv
+   bool get(DB_SELECT db, BinaryDataRef key, size_t snapshotId,
+      BinaryData& value);
+   void put(DB_SELECT db, BinaryDataRef key, BinaryDataRef value,
+      size_t snapshotId, size_t commitCount);
+   void invalidate(DB_SELECT db, BinaryDataRef key, size_t commitCount);
+   // for writes that aren't per key (dropped or wiped dbs)
+   void invalidate(DB_SELECT db, size_t commitCount);
+
+   // forget everything, for when the envs are (re)opened
+   void clear(void);
+
+   Stats getStats(void) const;
+
+private:
+   struct Entry
+   {
+      BinaryData key_;
+      BinaryData value_;
+      size_t snapshotId_;
+   };
+
+   struct Shard
+   {
+      mutable mutex mu_;
+      list<Entry> lru_; // most recently used first
+      map<BinaryData, list<Entry>::iterator> entries_;
+      size_t bytes_ = 0;
+
+      // commitCount of the last write to each db, if any
+      size_t lastWrite_[COUNT];
+      bool written_[COUNT];
+   };
+
+   DBValueCache(const DBValueCache&); // no copies
+
+   Shard& getShard(BinaryDataRef cacheKey);
+   static BinaryData getCacheKey(DB_SELECT db, BinaryDataRef key);
+   static size_t entrySize(const Entry& entry);
+   static void erase(Shard& shard, 
+      map<BinaryData, list<Entry>::iterator>::iterator iter);
+
+   const size_t maxShardBytes_;
+   Shard shards_[DBVALUE_CACHE_SHARDS];
+
+   atomic<uint64_t> hits_;
+   atomic<uint64_t> misses_;
+};
+
+
 ////////////////////////////////////////////////////////////////////////////////
 class LMDBBlockDatabase
 {
 public:
 
+   /////////////////////////////////////////////////////////////////////////////
+   // A read view of all the envs, pinned for as long as the object lives. 
+   // Every read made from the thread that created it sees the dbs as they 
+   // were at that point, however many batches the writers commit meanwhile.
+   // Writers don't wait on it, but the pages it sees can't be recycled, so 
+   // don't keep one around longer than a query. 
+   //
+   // Each env has its own transaction. They are opened history first: 
+   // writers commit history last, so whatever the history view points to
+   // is in the views of the other envs
+   class Snapshot
+   {
+   public:
+      Snapshot(const LMDBBlockDatabase* db);
+
+   private:
+      Snapshot(const Snapshot&); // no copies
+
+      LMDBEnv::Transaction txs_[COUNT];
+   };
+
    /////////////////////////////////////////////////////////////////////////////
    LMDBBlockDatabase(function<bool(void)> isDBReady);
    ~LMDBBlockDatabase(void);
@@ -240,7 +350,10 @@ public:
       BinaryData const & genesisTxHash,
       BinaryData const & magic,
       ARMORY_DB_TYPE     dbtype,
-      DB_PRUNE_TYPE      pruneType);
+      DB_PRUNE_TYPE      pruneType,
+      const LMDBTuning & tuning = LMDBTuning(),
+      SSH_KEY_LAYOUT     sshKeyLayout = SSH_KEYS_SCRADDR,
+      TXDATA_COMPRESSION txCompression = TXDATA_RAW);
 
    void openDatabasesSupernode(
       const string& basedir,
@@ -248,7 +361,10 @@ public:
       BinaryData const & genesisTxHash,
       BinaryData const & magic,
       ARMORY_DB_TYPE     dbtype,
-      DB_PRUNE_TYPE      pruneType);
+      DB_PRUNE_TYPE      pruneType,
+      const LMDBTuning & tuning = LMDBTuning(),
+      SSH_KEY_LAYOUT     sshKeyLayout = SSH_KEYS_SCRADDR,
+      TXDATA_COMPRESSION txCompression = TXDATA_RAW);
 
    /////////////////////////////////////////////////////////////////////////////
    void nukeHeadersDB(void);
@@ -257,6 +373,14 @@ public:
    void closeDatabases();
    void closeDatabasesSupernode(void);
 
+   // flushes all open envs to disk, see LMDBEnv::sync
+   void checkpoint(void);
+
+   // rewrites each env without its free pages, see LMDBEnv::compact. 
+   // Returns the disk space reclaimed, in bytes. complete is set to false 
+   // if an env was left as it was because of a long lived transaction
+   uint64_t compactDatabases(bool* complete = nullptr);
+
    /////////////////////////////////////////////////////////////////////////////
    void beginDBTransaction(LMDBEnv::Transaction* tx, 
       DB_SELECT db, LMDB::Mode mode) const
@@ -285,7 +409,7 @@ public:
    void destroyAndResetDatabases(void);
 
    /////////////////////////////////////////////////////////////////////////////
-   bool databasesAreOpen(void) { return dbIsOpen_; }
+   bool databasesAreOpen(void) const { return dbIsOpen_; }
 
    /////////////////////////////////////////////////////////////////////////////
    // Get latest block info
@@ -323,6 +447,28 @@ public:
    BinaryRefReader getValueReader(DB_SELECT db, BinaryDataRef keyWithPrefix) const;
    BinaryRefReader getValueReader(DB_SELECT db, DB_PREFIX prefix, BinaryDataRef key) const;
 
+   /////////////////////////////////////////////////////////////////////////////
+   // getValueRef for a batch of keys, resolved in a single sorted cursor walk.
+   // The refs point into the map: they need a transaction on db open around 
+   // the call and are good for as long as it stays open. Missing keys come 
+   // back as empty refs, in the same spot as their key
+   vector<BinaryDataRef> getValueRefs(DB_SELECT db, 
+      const vector<BinaryData>& keysWithPrefix) const;
+   vector<BinaryDataRef> getValueRefs(DB_SELECT db, DB_PREFIX prefix, 
+      const vector<BinaryData>& keys) const;
+
+   /////////////////////////////////////////////////////////////////////////////
+   // getValue through the value cache, for the lookups that come back to the
+   // same keys (txouts, tx hashes, hints). Needs a transaction on db like 
+   // the others. Values written with putValue/deleteValue are dropped from 
+   // the cache, anything else writing to the dbs has to call 
+   // invalidateValueCache
+   BinaryData getValueCached(DB_SELECT db, DB_PREFIX prefix, 
+      BinaryDataRef key) const;
+   void invalidateValueCache(DB_SELECT db);
+   DBValueCache::Stats getValueCacheStats(void) const
+      { return valueCache_.getStats(); }
+
    BinaryData getHashForDBKey(BinaryData dbkey);
    BinaryData getHashForDBKey(uint32_t hgt,
       uint8_t  dup,
@@ -362,10 +508,24 @@ public:
    bool dbIterIsValid(DB_SELECT db, DB_PREFIX prefix = DB_PREFIX_COUNT);
 
    /////////////////////////////////////////////////////////////////////////////
+   // Hands every header in the DB to callback as it is stored, hashing 
+   // them and checking the stored hash is left to the caller
    void readAllHeaders(
-      const function<void(const BlockHeader&, uint32_t, uint8_t)> &callback
+      const function<void(const StoredHeader&)> &callback
    );
 
+   /////////////////////////////////////////////////////////////////////////////
+   // Index of where each block sits in the blk files, keyed by block hash in
+   // the HEADERS DB. Lets us restart and locate blocks without rescanning 
+   // the blk files.
+   void putBlockFilePosition(const BlockHeader& bh);
+   bool getBlockFilePosition(BlockHeader& bh) const;
+   void readAllBlockFilePositions(
+      const function<void(
+         BinaryDataRef hash, uint32_t fnum, uint64_t offset, uint32_t size
+      )> &callback
+   ) const;
+
    /////////////////////////////////////////////////////////////////////////////
    // When we're not in supernode mode, we're going to need to track only 
    // specific addresses.  We will keep a list of those addresses here.
@@ -441,6 +601,7 @@ public:
    //for Fullnode
    uint8_t putRawBlockData(BinaryRefReader& brr, 
       function<const BlockHeader& (const BinaryData&)>);
+   uint8_t putRawBlockData(BinaryRefReader& brr, const BlockHeader& bh);
 
    //getStoredHeader detects the dbType and update the passed StoredHeader
    //accordingly
@@ -542,6 +703,34 @@ public:
       bool createIfDNE = false,
       bool forceReadAndMerge = false);
 
+   /////////////////////////////////////////////////////////////////////////////
+   // Sub-history keys, in the layout of the db (see SSH_KEY_LAYOUT). The
+   // prefix is what all the subs of a scrAddr start with, a sub's key is 
+   // the prefix followed by its hgtX.
+   // With SSH_KEYS_SCRADDR_ID, a scrAddr without an id gets an empty key,
+   // unless assignId is set. It then gets the next id, which is written 
+   // by the next putScrAddrIds call
+   BinaryData getSubSSHKeyPrefix(BinaryDataRef scrAddr, 
+      bool assignId = false) const;
+   BinaryData getSubSSHKey(BinaryDataRef scrAddr, BinaryDataRef hgtX,
+      bool assignId = false) const;
+   SSH_KEY_LAYOUT sshKeyLayout(void) const { return sshKeyLayout_; }
+   // how new tx entries are written, see TXDATA_COMPRESSION
+   TXDATA_COMPRESSION txDataCompression(void) const { return txCompression_; }
+
+   // writes the ids assigned since the last call, within a write 
+   // transaction on HISTORY
+   void putScrAddrIds(void);
+   // forgets all ids, for when the history entries are wiped
+   void resetScrAddrIds(void);
+
+   // moves all sub-histories to that layout and flags the db with it. 
+   // Opening a db never starts this on its own, it keeps the layout it was
+   // built with. Works in chunks, each in its own transaction. The sdbi 
+   // marks a run in progress, and opening the db finishes an interrupted
+   // one before anything reads it. Nothing else should use the db meanwhile
+   void migrateHistoryKeys(SSH_KEY_LAYOUT layout);
+
    // This could go in StoredBlockObj if it didn't need to lookup DB data
    bool     getFullUTXOMapForSSH(StoredScriptHistory & ssh,
       map<BinaryData, UnspentTxOut> & mapToFill,
@@ -616,6 +805,15 @@ public:
 
    StoredTxHints getHintsForTxHash(BinaryDataRef txHash) const;
 
+   // Batch versions of the above and of getStoredTx_byHash, for when there
+   // are many to resolve at once (inputs of a large tx, a wallet's utxos).
+   // Results come back in the order of the input, Txs that can't be found 
+   // are left uninitialized
+   vector<StoredTxHints> getHintsForTxHashes(
+      const vector<BinaryData>& txHashes) const;
+   vector<Tx> getFullTxCopies(const vector<BinaryData>& ldbKeys6B) const;
+   vector<Tx> getTxsByHash(const vector<BinaryData>& txHashes) const;
+
 
    ////////////////////////////////////////////////////////////////////////////
    bool markBlockHeaderValid(BinaryDataRef headHash);
@@ -657,6 +855,32 @@ private:
 
    ARMORY_DB_TYPE armoryDbType_;
    DB_PRUNE_TYPE dbPruneType_;
+   LMDBTuning tuning_;
+
+   SSH_KEY_LAYOUT sshKeyLayout_ = SSH_KEYS_SCRADDR;
+   TXDATA_COMPRESSION txCompression_ = TXDATA_RAW;
+
+   // scrAddr to id dictionary cache. Ids that aren't in the db yet sit in
+   // pendingScrAddrIds_ until putScrAddrIds. The cache is dropped when it
+   // grows past SCRADDRID_CACHE_SIZE, the pending ids never are
+   mutable mutex scrAddrIdMutex_;
+   mutable map<BinaryData, uint32_t> scrAddrIds_;
+   mutable map<BinaryData, uint32_t> pendingScrAddrIds_;
+   mutable uint32_t nextScrAddrId_ = 0;
+
+   mutable DBValueCache valueCache_;
+
+   void openHistoryKeys(void);
+   uint32_t getScrAddrId(BinaryDataRef scrAddr, bool assignId) const;
+   BinaryData getSubSSHKeyPrefix(BinaryDataRef scrAddr,
+      SSH_KEY_LAYOUT layout, bool assignId) const;
+
+   // decode TXDATA/ZCDATA entries from their key and value, for the single
+   // key and the batch reads alike. readTxHash returns an empty hash if the
+   // value is too short to hold one
+   static void readStoredTxOut(StoredTxOut & stxo, 
+      BinaryDataRef key8B, BinaryDataRef value);
+   BinaryData readTxHash(DB_PREFIX prefix, BinaryDataRef value) const;
 
 public:
 
@@ -7,6 +7,12 @@
 #include <cstring>
 #include <algorithm>
 #include <iostream>
+#include <thread>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 #ifndef _WIN32_
 #include <sys/types.h>
@@ -20,6 +26,60 @@ static std::string errorString(int rc)
    return mdb_strerror(rc);
 }
 
+// Each thread keeps its own transaction state, one entry per env it has a
+// transaction open on. Nobody but the owning thread touches it, so begin,
+// commit and cursor creation don't need a lock. Iterators hold on to 
+// their entry by pointer, which unordered_map keeps stable
+typedef std::unordered_map<const LMDBEnv*, LMDBThreadTxInfo> ThreadTxMap;
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+// VS2013 has no thread_local, and __declspec(thread) only takes PODs.
+// The map is leaked on thread exit, by then it is empty anyways
+static ThreadTxMap& txForThisThread()
+{
+   static __declspec(thread) ThreadTxMap *txMap = nullptr;
+   if (!txMap)
+      txMap = new ThreadTxMap();
+   return *txMap;
+}
+#else
+static ThreadTxMap& txForThisThread()
+{
+   static thread_local ThreadTxMap txMap;
+   return txMap;
+}
+#endif
+
+LMDBThreadTxInfo* LMDBEnv::threadTx() const
+{
+   ThreadTxMap &txMap = txForThisThread();
+   
+   auto txnIter = txMap.find(this);
+   if (txnIter == txMap.end())
+      return nullptr;
+   
+   return &txnIter->second;
+}
+
+size_t LMDBEnv::snapshotId() const
+{
+   LMDBThreadTxInfo *const thTx = threadTx();
+   if (!thTx)
+      return SIZE_MAX;
+   
+   return thTx->snapshotId_;
+}
+
+LMDBThreadTxInfo& LMDBEnv::threadTxSlot()
+{
+   return txForThisThread()[this];
+}
+
+void LMDBEnv::releaseThreadTx()
+{
+   txForThisThread().erase(this);
+}
+
 inline void LMDB::Iterator::checkHasDb() const
 {
    if (!db_)
@@ -44,7 +104,9 @@ inline void LMDB::Iterator::checkOk() const
       
       if (has_)
       {
-         const_cast<Iterator*>(this)->seek(key_);
+         // detachFromTx left a copy of the key behind
+         const std::string lastKey(key_);
+         const_cast<Iterator*>(this)->seek(lastKey);
          if (!has_)
             throw LMDBException("Cursor could not be regenerated");
       }
@@ -54,20 +116,11 @@ inline void LMDB::Iterator::checkOk() const
 
 void LMDB::Iterator::openCursor()
 {
-   const pthread_t tID = pthread_self();
-   LMDBEnv *const env = db_->env;
-   std::unique_lock<std::mutex> lock(env->threadTxMutex_);
-   
-   auto txnIter = env->txForThreads_.find(tID);
-   if (txnIter == env->txForThreads_.end())
-      throw std::runtime_error("Iterator must be created within Transaction");
-   
-   lock.unlock();
-   
-   if (txnIter->second.transactionLevel_ == 0)
+   LMDBThreadTxInfo *const thTx = db_->env->threadTx();
+   if (!thTx || thTx->transactionLevel_ == 0)
       throw std::runtime_error("Iterator must be created within Transaction");
    
-   txnPtr_ = &txnIter->second;
+   txnPtr_ = thTx;
   
    int rc = mdb_cursor_open(txnPtr_->txn_, db_->dbi, &csr_);
    if (rc != MDB_SUCCESS)
@@ -79,6 +132,66 @@ void LMDB::Iterator::openCursor()
    txnPtr_->iterators_.push_back(this);
 }
 
+void LMDB::Iterator::setCurrent(
+   void *key, size_t keySize, void *val, size_t valSize
+)
+{
+   has_ = true;
+   if (copyData_)
+   {
+      key_.assign(static_cast<char*>(key), keySize);
+      val_.assign(static_cast<char*>(val), valSize);
+      keyPtr_ = key_.data();
+      valPtr_ = val_.data();
+   }
+   else
+   {
+      keyPtr_ = static_cast<char*>(key);
+      valPtr_ = static_cast<char*>(val);
+   }
+   keySize_ = keySize;
+   valSize_ = valSize;
+   keyCopied_ = valCopied_ = ownsData_ = copyData_;
+}
+
+// the map pointers go away with the transaction, keep what the iterator
+// points to around so it can find its way back in the next one
+void LMDB::Iterator::detachFromTx()
+{
+   hasTx = false;
+   csr_ = nullptr;
+   txnPtr_ = nullptr;
+   
+   if (has_)
+   {
+      key();
+      value();
+      keyPtr_ = key_.data();
+      valPtr_ = val_.data();
+      ownsData_ = true;
+   }
+}
+
+const std::string& LMDB::Iterator::key() const
+{
+   if (!keyCopied_)
+   {
+      key_.assign(keyPtr_, keySize_);
+      keyCopied_ = true;
+   }
+   return key_;
+}
+
+const std::string& LMDB::Iterator::value() const
+{
+   if (!valCopied_)
+   {
+      val_.assign(valPtr_, valSize_);
+      valCopied_ = true;
+   }
+   return val_;
+}
+
 LMDB::Iterator::Iterator(LMDB *db)
    : db_(db), csr_(nullptr), has_(false)
 {
@@ -86,7 +199,8 @@ LMDB::Iterator::Iterator(LMDB *db)
 }
 
 LMDB::Iterator::Iterator(const Iterator &copy)
-   : db_(copy.db_), csr_(nullptr), has_(copy.has_), txnPtr_(copy.txnPtr_)
+   : db_(copy.db_), csr_(nullptr), has_(copy.has_), txnPtr_(copy.txnPtr_),
+   copyData_(copy.copyData_)
 {
    if (copy.txnPtr_ == nullptr)
       throw std::runtime_error("Iterator must be created within Transaction");
@@ -132,14 +246,30 @@ LMDB::Iterator& LMDB::Iterator::operator=(Iterator &&move)
    txnPtr_ = move.txnPtr_;
    std::swap(csr_, move.csr_);
    std::swap(has_, move.has_);
+   std::swap(copyData_, move.copyData_);
+   std::swap(keyPtr_, move.keyPtr_);
+   std::swap(valPtr_, move.valPtr_);
+   std::swap(keySize_, move.keySize_);
+   std::swap(valSize_, move.valSize_);
+   std::swap(keyCopied_, move.keyCopied_);
+   std::swap(valCopied_, move.valCopied_);
+   std::swap(ownsData_, move.ownsData_);
    std::swap(key_, move.key_);
    std::swap(val_, move.val_);
    std::swap(hasTx, move.hasTx);
    std::swap(db_, move.db_);
    
+   // short strings live inside the string object, they moved
+   if (ownsData_)
+   {
+      keyPtr_ = key_.data();
+      valPtr_ = val_.data();
+   }
+   
    move.reset();
    
-   txnPtr_->iterators_.push_back(this);
+   if (txnPtr_)
+      txnPtr_->iterators_.push_back(this);
 
    return *this;
 }
@@ -153,6 +283,7 @@ LMDB::Iterator& LMDB::Iterator::operator=(const Iterator &copy)
    db_ = copy.db_;
    has_ = copy.has_;
    txnPtr_ = copy.txnPtr_;
+   copyData_ = copy.copyData_;
 
    txnPtr_->iterators_.push_back(this);
    
@@ -160,7 +291,7 @@ LMDB::Iterator& LMDB::Iterator::operator=(const Iterator &copy)
    
    if (copy.has_)
    {
-      seek(copy.key_);
+      seek(copy.keyRef());
       if (!has_)
          throw LMDBException("Cursor could not be copied");
    }
@@ -179,7 +310,8 @@ bool LMDB::Iterator::operator==(const Iterator &other) const
       if (a || b) return false;
    }
    
-   return key() == other.key();
+   return keySize_ == other.keySize_ &&
+      std::memcmp(keyPtr_, other.keyPtr_, keySize_) == 0;
 }
 
 void LMDB::Iterator::advance()
@@ -196,11 +328,7 @@ void LMDB::Iterator::advance()
    else if (rc != MDB_SUCCESS)
       throw LMDBException("Failed to seek (" + errorString(rc) +")");
    else
-   {
-      has_ = true;
-      key_ = std::string(static_cast<char*>(mkey.mv_data), mkey.mv_size);
-      val_ = std::string(static_cast<char*>(mval.mv_data), mval.mv_size);
-   }
+      setCurrent(mkey.mv_data, mkey.mv_size, mval.mv_data, mval.mv_size);
 }
 
 void LMDB::Iterator::retreat()
@@ -217,11 +345,7 @@ void LMDB::Iterator::retreat()
    else if (rc != MDB_SUCCESS)
       throw LMDBException("Failed to seek (" + errorString(rc) +")");
    else
-   {
-      has_ = true;
-      key_ = std::string(static_cast<char*>(mkey.mv_data), mkey.mv_size);
-      val_ = std::string(static_cast<char*>(mval.mv_data), mval.mv_size);
-   }
+      setCurrent(mkey.mv_data, mkey.mv_size, mval.mv_data, mval.mv_size);
 }
 
 
@@ -239,11 +363,7 @@ void LMDB::Iterator::toFirst()
    else if (rc != MDB_SUCCESS)
       throw LMDBException("Failed to seek (" + errorString(rc) +")");
    else
-   {
-      has_ = true;
-      key_ = std::string(static_cast<char*>(mkey.mv_data), mkey.mv_size);
-      val_ = std::string(static_cast<char*>(mval.mv_data), mval.mv_size);
-   }
+      setCurrent(mkey.mv_data, mkey.mv_size, mval.mv_data, mval.mv_size);
 }
 
 void LMDB::Iterator::seek(const CharacterArrayRef &key, SeekBy e)
@@ -284,9 +404,7 @@ void LMDB::Iterator::seek(const CharacterArrayRef &key, SeekBy e)
       {
          // key is longer and the earlier bytes are the same,
          // therefor, mkey is before key
-         has_ = true;
-         key_ = std::string(static_cast<char*>(mkey.mv_data), mkey.mv_size);
-         val_ = std::string(static_cast<char*>(mval.mv_data), mval.mv_size);
+         setCurrent(mkey.mv_data, mkey.mv_size, mval.mv_data, mval.mv_size);
          return;
       }
       else
@@ -301,11 +419,7 @@ void LMDB::Iterator::seek(const CharacterArrayRef &key, SeekBy e)
    else if (rc != MDB_SUCCESS)
       throw LMDBException("Failed to seek (" + errorString(rc) +")");
    else
-   {
-      has_ = true;
-      key_ = std::string(static_cast<char*>(mkey.mv_data), mkey.mv_size);
-      val_ = std::string(static_cast<char*>(mval.mv_data), mval.mv_size);
-   }
+      setCurrent(mkey.mv_data, mkey.mv_size, mval.mv_data, mval.mv_size);
 }
 
 LMDBEnv::~LMDBEnv()
@@ -313,13 +427,20 @@ LMDBEnv::~LMDBEnv()
    close();
 }
 
-void LMDBEnv::open(const char *filename)
+void LMDBEnv::open(const char *filename, const LMDBTuning &tuning)
 {
    if (dbenv)
       throw std::logic_error("Database environment already open (close it first)");
 
-   txForThreads_.clear();
-   
+   filename_ = filename;
+   tuning_ = tuning;
+   openEnv();
+}
+
+void LMDBEnv::openEnv()
+{
+   const LMDBTuning &tuning = tuning_;
+   const char *filename = filename_.c_str();
    int rc;
 
    rc = mdb_env_create(&dbenv);
@@ -330,9 +451,61 @@ void LMDBEnv::open(const char *filename)
    if (rc != MDB_SUCCESS)
       throw LMDBException("Failed to set max dbs (" + errorString(rc) + ")");
    
-   rc = mdb_env_open(dbenv, filename, MDB_NOSYNC|MDB_NOSUBDIR, 0600);
+   if (tuning.mapSize != 0)
+   {
+      rc = mdb_env_set_mapsize(dbenv, tuning.mapSize);
+      if (rc != MDB_SUCCESS)
+         throw LMDBException("Failed to set map size (" + errorString(rc) + ")");
+   }
+   
+   if (tuning.maxReaders != 0)
+   {
+      rc = mdb_env_set_maxreaders(dbenv, tuning.maxReaders);
+      if (rc != MDB_SUCCESS)
+         throw LMDBException("Failed to set max readers (" + errorString(rc) + ")");
+   }
+   
+   unsigned int flags = MDB_NOSUBDIR;
+   
+   switch (tuning.sync)
+   {
+   case LMDB_SYNC_NONE:
+      flags |= MDB_NOSYNC;
+      break;
+   case LMDB_SYNC_DATA:
+      flags |= MDB_NOMETASYNC;
+      break;
+   case LMDB_SYNC_FULL:
+      break;
+   }
+   
+   if (tuning.writeMap)
+   {
+      flags |= MDB_WRITEMAP;
+      if (tuning.mapAsync)
+         flags |= MDB_MAPASYNC;
+   }
+   
+   if (!tuning.readAhead)
+      flags |= MDB_NORDAHEAD;
+   
+   rc = mdb_env_open(dbenv, filename, flags, 0600);
    if (rc != MDB_SUCCESS)
+   {
+      mdb_env_close(dbenv);
+      dbenv = nullptr;
       throw LMDBException("Failed to open db " + std::string(filename) + " (" + errorString(rc) + ")");
+   }
+}
+
+void LMDBEnv::sync()
+{
+   if (!dbenv)
+      return;
+   
+   int rc = mdb_env_sync(dbenv, 1);
+   if (rc != MDB_SUCCESS)
+      throw LMDBException("Failed to sync db env (" + errorString(rc) + ")");
 }
 
 void LMDBEnv::close()
@@ -344,6 +517,229 @@ void LMDBEnv::close()
    }
 }
 
+void LMDBEnv::reopenEnv()
+{
+   openEnv();
+   
+   try
+   {
+      // dbi handles belong to the env, get fresh ones for the new one
+      MDB_txn *txn;
+      int rc = mdb_txn_begin(dbenv, nullptr, 0, &txn);
+      if (rc != MDB_SUCCESS)
+         throw LMDBException("Failed to create transaction (" + errorString(rc) +")");
+      
+      for (LMDB *db : dbs_)
+      {
+         rc = mdb_open(txn, db->name_.c_str(), MDB_CREATE, &db->dbi);
+         if (rc != MDB_SUCCESS)
+         {
+            mdb_txn_abort(txn);
+            throw LMDBException("Failed to open dbi (" + errorString(rc) +")");
+         }
+      }
+      
+      rc = mdb_txn_commit(txn);
+      if (rc != MDB_SUCCESS)
+         throw LMDBException("Failed to commit (" + errorString(rc) +")");
+   }
+   catch (...)
+   {
+      close();
+      throw;
+   }
+}
+
+void LMDBEnv::enterTx(LMDB::Mode mode)
+{
+   while (true)
+   {
+      if (!txBlocked(mode))
+      {
+         openTxCount_++;
+         if (mode == LMDB::ReadWrite)
+            openWriteTxCount_++;
+         
+         // compact() sets its flag before it reads the counts, so either
+         // it sees this transaction or this sees the flag
+         if (!txBlocked(mode))
+            return;
+         
+         exitTx(mode);
+      }
+      
+      // compact() is swapping the file, or copying it with writes held off
+      std::unique_lock<std::mutex> lock(txMutex_);
+      txCondVar_.wait(lock, [this, mode](void)->bool
+         { return !txBlocked(mode); });
+   }
+}
+
+void LMDBEnv::exitTx(LMDB::Mode mode)
+{
+   openTxCount_--;
+   if (mode == LMDB::ReadWrite)
+      openWriteTxCount_--;
+   
+   if (swapping_ || holdWrites_)
+   {
+      // compact() checks the counts under the lock before it waits, 
+      // taking it here makes sure it is waiting by the time it's notified
+      {
+         std::unique_lock<std::mutex> lock(txMutex_);
+      }
+      txCondVar_.notify_all();
+   }
+}
+
+// copies that missed a write before compact() holds off writers
+static const unsigned COMPACT_ATTEMPTS = 3;
+
+bool LMDBEnv::compact()
+{
+   if (!dbenv)
+      throw std::logic_error("Database environment isn't open");
+   if (threadTx())
+      throw std::logic_error("Can't compact an env with a transaction open on it");
+   
+   for (unsigned i = 1; i <= COMPACT_ATTEMPTS; i++)
+   {
+      const CompactResult result = copyAndSwap(i == COMPACT_ATTEMPTS);
+      if (result != COMPACT_MISSED_WRITES)
+         return result == COMPACT_SWAPPED;
+   }
+   
+   return false;
+}
+
+LMDBEnv::CompactResult LMDBEnv::copyAndSwap(bool holdWrites)
+{
+   const std::string copyName = filename_ + ".compact";
+   const std::string backupName = filename_ + ".precompact";
+   remove(copyName.c_str());
+   
+   // lets the transactions waiting on the swap or the write hold through
+   auto release = [this](void)->void
+   {
+      {
+         std::unique_lock<std::mutex> lock(txMutex_);
+         swapping_ = false;
+         holdWrites_ = false;
+      }
+      txCondVar_.notify_all();
+   };
+   
+   if (holdWrites)
+   {
+      std::unique_lock<std::mutex> lock(txMutex_);
+      holdWrites_ = true;
+      txCondVar_.wait(lock, [this](void)->bool
+         { return openWriteTxCount_.load() == 0; });
+   }
+   
+   // not the env's last txnid: LMDB bumps it before new readers get to 
+   // see that txn, so the copy could start from the one before. Commits
+   // are counted once they are visible
+   const size_t commitsBefore = commitCount_.load();
+   
+   // the copy runs in its own read transaction, so it sees the env as it 
+   // is now and doesn't get in anyone's way
+   int rc = mdb_env_copy2(dbenv, copyName.c_str(), MDB_CP_COMPACT);
+   if (rc != MDB_SUCCESS)
+   {
+      release();
+      remove(copyName.c_str());
+      throw LMDBException("Failed to copy db env (" + errorString(rc) + ")");
+   }
+   
+   // a long lived reader doesn't get to hold up everyone else's 
+   // transactions for as long as it runs, only up to the wait
+   bool txClosed;
+   {
+      std::unique_lock<std::mutex> lock(txMutex_);
+      swapping_ = true;
+      txClosed = txCondVar_.wait_for(lock, 
+         std::chrono::milliseconds(tuning_.compactSwapWaitMs), 
+         [this](void)->bool { return openTxCount_.load() == 0; });
+   }
+   
+   if (!txClosed)
+   {
+      release();
+      remove(copyName.c_str());
+      return COMPACT_TX_OPEN;
+   }
+   
+   if (commitCount_.load() != commitsBefore)
+   {
+      release();
+      remove(copyName.c_str());
+      return COMPACT_MISSED_WRITES;
+   }
+   
+   close();
+   
+   // the original is kept as backupName until the copy is open. Both 
+   // replace the file in one step, it is never missing. Without hard 
+   // links the original is moved aside first, the file is missing until
+   // the copy takes its place
+   remove(backupName.c_str());
+#ifdef _WIN32
+   const bool swapped = ReplaceFileA(filename_.c_str(), copyName.c_str(),
+      backupName.c_str(), REPLACEFILE_IGNORE_MERGE_ERRORS, 
+      nullptr, nullptr) != 0;
+#else
+   const bool backedUp = 
+      link(filename_.c_str(), backupName.c_str()) == 0 ||
+      rename(filename_.c_str(), backupName.c_str()) == 0;
+   const bool swapped = backedUp &&
+      rename(copyName.c_str(), filename_.c_str()) == 0;
+#endif
+   
+   try
+   {
+      if (!swapped)
+         throw LMDBException("Failed to move compacted db in place of " + filename_);
+      
+      reopenEnv();
+   }
+   catch (...)
+   {
+      // go back to the original file. A failed ReplaceFile may have 
+      // moved it to backupName already
+#ifdef _WIN32
+      if (swapped || 
+         GetFileAttributesA(filename_.c_str()) == INVALID_FILE_ATTRIBUTES)
+      {
+         MoveFileExA(backupName.c_str(), filename_.c_str(), 
+            MOVEFILE_REPLACE_EXISTING);
+      }
+#else
+      if (backedUp)
+         rename(backupName.c_str(), filename_.c_str());
+#endif
+      
+      remove(backupName.c_str());
+      remove(copyName.c_str());
+      
+      try
+      {
+         reopenEnv();
+      }
+      catch (...)
+      {
+         // the env stays closed, transactions on it fail to begin
+      }
+      
+      release();
+      throw;
+   }
+   
+   remove(backupName.c_str());
+   release();
+   return COMPACT_SWAPPED;
+}
+
 LMDBEnv::Transaction::Transaction(LMDBEnv *env, LMDB::Mode mode)
    : env(env), mode_(mode)
 {
@@ -376,20 +772,24 @@ void LMDBEnv::Transaction::begin()
    
    began = true;
 
-   const pthread_t tID = pthread_self();
-   
-   std::unique_lock<std::mutex> lock(env->threadTxMutex_);
-   LMDBThreadTxInfo& thTx = env->txForThreads_[tID];
-   lock.unlock();
+   LMDBThreadTxInfo& thTx = env->threadTxSlot();
    
    if (thTx.transactionLevel_ != 0 && mode_ == LMDB::ReadWrite && thTx.mode_ == LMDB::ReadOnly)
       throw LMDBException("Cannot access ReadOnly Transaction in ReadWrite mode");
    
    if (thTx.transactionLevel_++ != 0)
       return;
+   
+   env->enterTx(mode_);
       
    if (!env->dbenv)
+   {
+      env->exitTx(mode_);
+      env->releaseThreadTx();
+      
+      began = false;
       throw LMDBException("Cannot start transaction without db env");
+   }
       
    int modef = MDB_RDONLY;
    thTx.mode_ = LMDB::ReadOnly;
@@ -400,12 +800,12 @@ void LMDBEnv::Transaction::begin()
       thTx.mode_ = LMDB::ReadWrite;
    }
 
+   thTx.snapshotId_ = env->commitCount_.load();
    int rc = mdb_txn_begin(env->dbenv, nullptr, modef, &thTx.txn_);
    if (rc != MDB_SUCCESS)
    {
-      lock.lock();
-      env->txForThreads_.erase(tID);
-      lock.unlock();
+      env->exitTx(mode_);
+      env->releaseThreadTx();
       
       began = false;
       throw LMDBException("Failed to create transaction (" + errorString(rc) +")");
@@ -431,33 +831,27 @@ void LMDBEnv::Transaction::commit()
    began=false;
 
    //look for an existing transaction in this thread
-   const pthread_t tID = pthread_self();
-   std::unique_lock<std::mutex> lock(env->threadTxMutex_);
-   auto txnIter = env->txForThreads_.find(tID);
-
-   if (txnIter == env->txForThreads_.end())
+   LMDBThreadTxInfo *const thTx = env->threadTx();
+   if (!thTx)
       throw LMDBException("Transaction bound to unknown thread");
-   lock.unlock();
-
-   LMDBThreadTxInfo& thTx = txnIter->second;
 
-   if (thTx.transactionLevel_-- == 1)
+   if (thTx->transactionLevel_-- == 1)
    {
-      int rc = mdb_txn_commit(thTx.txn_);
+      int rc = mdb_txn_commit(thTx->txn_);
+      if (rc == MDB_SUCCESS && thTx->mode_ == LMDB::ReadWrite)
+         env->commitCount_++;
       
-      for (LMDB::Iterator *i : thTx.iterators_)
-      {
-         i->hasTx=false;
-         i->csr_=nullptr;
-      }
+      for (LMDB::Iterator *i : thTx->iterators_)
+         i->detachFromTx();
+      
+      const LMDB::Mode mode = thTx->mode_;
+      env->releaseThreadTx();
+      env->exitTx(mode);
       
       if (rc != MDB_SUCCESS)
       {
          throw LMDBException("Failed to close env tx (" + errorString(rc) +")");
       }
-      
-      lock.lock();
-      env->txForThreads_.erase(txnIter);
    }
 }
 
@@ -484,14 +878,15 @@ void LMDB::close()
 {
    if (dbi != 0)
    {
-      {
-         std::unique_lock<std::mutex> lock(env->threadTxMutex_);
-         if (!env->txForThreads_.empty())
-            throw std::runtime_error("Tried to close database with open txes");
-      }
+      if (env->openTxCount_.load() != 0)
+         throw std::runtime_error("Tried to close database with open txes");
       mdb_dbi_close(env->dbenv, dbi);
       dbi=0;
+      lastKeyKnown_ = false;
       
+      env->dbs_.erase(
+         std::remove(env->dbs_.begin(), env->dbs_.end(), this), 
+         env->dbs_.end());
       env=nullptr;
    }
 }
@@ -505,20 +900,19 @@ void LMDB::open(LMDBEnv *env, const std::string &name)
    this->env = env;
    
    LMDBEnv::Transaction tx(env);
-   const pthread_t tID = pthread_self();
-   std::unique_lock<std::mutex> lock(env->threadTxMutex_);
-   auto txnIter = env->txForThreads_.find(tID);
-
-   if (txnIter == env->txForThreads_.end())
+   LMDBThreadTxInfo *const thTx = env->threadTx();
+   if (!thTx)
       throw LMDBException("Failed to insert: need transaction");
-   lock.unlock();
       
-   int rc = mdb_open(txnIter->second.txn_, name.c_str(), MDB_CREATE, &dbi);
+   int rc = mdb_open(thTx->txn_, name.c_str(), MDB_CREATE, &dbi);
    if (rc != MDB_SUCCESS)
    {
       // cleanup here
       throw LMDBException("Failed to open dbi (" + errorString(rc) +")");
    }
+   
+   name_ = name;
+   env->dbs_.push_back(this);
 }
 
 void LMDB::insert(
@@ -529,17 +923,34 @@ void LMDB::insert(
    MDB_val mkey = { key.len, const_cast<char*>(key.data) };
    MDB_val mval = { value.len, const_cast<char*>(value.data) };
    
-   const pthread_t tID = pthread_self();
-   
-   std::unique_lock<std::mutex> lock(env->threadTxMutex_);
-   
-   auto txnIter = env->txForThreads_.find(tID);
-
-   if (txnIter == env->txForThreads_.end())
+   LMDBThreadTxInfo *const thTx = env->threadTx();
+   if (!thTx)
       throw LMDBException("Failed to insert: need transaction");
-   lock.unlock();
    
-   int rc = mdb_put(txnIter->second.txn_, dbi, &mkey, &mval, 0);
+   if (appendMode_)
+   {
+      if (!lastKeyKnown_)
+         loadLastKey(thTx->txn_);
+      
+      MDB_val mlast = { lastKey_.size(), const_cast<char*>(lastKey_.data()) };
+      if (lastKey_.empty() || mdb_cmp(thTx->txn_, dbi, &mkey, &mlast) > 0)
+      {
+         int rc = mdb_put(thTx->txn_, dbi, &mkey, &mval, MDB_APPEND);
+         if (rc == MDB_SUCCESS)
+         {
+            lastKey_.assign(key.data, key.len);
+            return;
+         }
+         
+         if (rc != MDB_KEYEXIST)
+            throw LMDBException("Failed to insert (" + errorString(rc) + ")");
+         
+         // someone else wrote past lastKey_, look it up again next time
+         lastKeyKnown_ = false;
+      }
+   }
+   
+   int rc = mdb_put(thTx->txn_, dbi, &mkey, &mval, 0);
    if (rc != MDB_SUCCESS)
    {
       std::cout << "failed to insert data, returned following error string: " << errorString(rc) << std::endl;
@@ -547,18 +958,47 @@ void LMDB::insert(
    }
 }
 
-void LMDB::erase(const CharacterArrayRef& key)
+void LMDB::setAppendMode(bool on)
 {
-   const pthread_t tID = pthread_self();
-   std::unique_lock<std::mutex> lock(env->threadTxMutex_);
-   auto txnIter = env->txForThreads_.find(tID);
+   appendMode_ = on;
+   lastKeyKnown_ = false;
+}
 
-   if (txnIter == env->txForThreads_.end())
+void LMDB::loadLastKey(MDB_txn *txn)
+{
+   MDB_cursor *csr;
+   int rc = mdb_cursor_open(txn, dbi, &csr);
+   if (rc != MDB_SUCCESS)
+      throw LMDBException("Failed to open cursor (" + errorString(rc) + ")");
+   
+   MDB_val mkey, mval;
+   rc = mdb_cursor_get(csr, &mkey, &mval, MDB_LAST);
+   mdb_cursor_close(csr);
+   
+   if (rc == MDB_SUCCESS)
+      lastKey_.assign(static_cast<char*>(mkey.mv_data), mkey.mv_size);
+   else if (rc == MDB_NOTFOUND)
+      lastKey_.clear();
+   else
+      throw LMDBException("Failed to seek (" + errorString(rc) + ")");
+   
+   lastKeyKnown_ = true;
+}
+
+void LMDB::erase(const CharacterArrayRef& key)
+{
+   LMDBThreadTxInfo *const thTx = env->threadTx();
+   if (!thTx)
       throw LMDBException("Failed to insert: need transaction");
-   lock.unlock();
       
    MDB_val mkey = { key.len, const_cast<char*>(key.data) };
-   int rc = mdb_del(txnIter->second.txn_, dbi, &mkey, 0);
+   int rc = mdb_del(thTx->txn_, dbi, &mkey, 0);
+   
+   if (appendMode_ && lastKeyKnown_ && rc == MDB_SUCCESS &&
+      lastKey_.size() == key.len && 
+      std::memcmp(lastKey_.data(), key.data, key.len) == 0)
+      lastKeyKnown_ = false;
+   
    if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND)
    {
       std::cout << "failed to erase data, returned following error string: " << errorString(rc) << std::endl;
@@ -579,19 +1019,14 @@ CharacterArrayRef LMDB::get_NoCopy(const CharacterArrayRef& key) const
 {
    //simple get without the use of iterators
 
-   const pthread_t tID = pthread_self();
-   std::unique_lock<std::mutex> lock(env->threadTxMutex_);
-   
-   auto txnIter = env->txForThreads_.find(tID);
-   if (txnIter == env->txForThreads_.end())
+   LMDBThreadTxInfo *const thTx = env->threadTx();
+   if (!thTx)
       throw std::runtime_error("Need transaction to get data");
-   
-   lock.unlock();
 
    MDB_val mkey = { key.len, const_cast<char*>(key.data) };
    MDB_val mdata = { 0, 0 };
 
-   int rc = mdb_get(txnIter->second.txn_, dbi, &mkey, &mdata);
+   int rc = mdb_get(thTx->txn_, dbi, &mkey, &mdata);
    if (rc == MDB_NOTFOUND)
       return CharacterArrayRef(0, (char*)nullptr);
    
@@ -602,19 +1037,76 @@ CharacterArrayRef LMDB::get_NoCopy(const CharacterArrayRef& key) const
    return ref;
 }
 
-void LMDB::drop(void)
+std::vector<CharacterArrayRef> LMDB::getMany_NoCopy(
+   const std::vector<CharacterArrayRef>& keys) const
 {
-   const pthread_t tID = pthread_self();
-   std::unique_lock<std::mutex> lock(env->threadTxMutex_);
-
-   auto txnIter = env->txForThreads_.find(tID);
-   if (txnIter == env->txForThreads_.end())
+   LMDBThreadTxInfo *const thTx = env->threadTx();
+   if (!thTx)
       throw std::runtime_error("Need transaction to get data");
+   
+   std::vector<MDB_val> mkeys(keys.size());
+   std::vector<size_t> order(keys.size());
+   for (size_t i = 0; i < keys.size(); i++)
+   {
+      mkeys[i].mv_size = keys[i].len;
+      mkeys[i].mv_data = const_cast<char*>(keys[i].data);
+      order[i] = i;
+   }
+   
+   MDB_txn *const txn = thTx->txn_;
+   const MDB_dbi db = dbi;
+   std::sort(order.begin(), order.end(), 
+      [&mkeys, txn, db](size_t a, size_t b)->bool
+      { return mdb_cmp(txn, db, &mkeys[a], &mkeys[b]) < 0; });
+   
+   MDB_cursor *csr;
+   int rc = mdb_cursor_open(txn, dbi, &csr);
+   if (rc != MDB_SUCCESS)
+      throw LMDBException("Failed to open cursor (" + errorString(rc) + ")");
+   
+   std::vector<MDB_val> mvals(keys.size(), MDB_val{ 0, nullptr });
+   for (size_t i : order)
+   {
+      if (mkeys[i].mv_size == 0)
+         continue;
+      
+      // MDB_SET stays on the current page when the key falls within it
+      MDB_val mkey = mkeys[i];
+      rc = mdb_cursor_get(csr, &mkey, &mvals[i], MDB_SET);
+      if (rc == MDB_NOTFOUND)
+      {
+         mvals[i].mv_size = 0;
+         mvals[i].mv_data = nullptr;
+      }
+      else if (rc != MDB_SUCCESS)
+      {
+         mdb_cursor_close(csr);
+         throw LMDBException("Failed to get (" + errorString(rc) + ")");
+      }
+   }
+   mdb_cursor_close(csr);
+   
+   std::vector<CharacterArrayRef> values;
+   values.reserve(keys.size());
+   for (auto& mval : mvals)
+   {
+      values.push_back(CharacterArrayRef(
+         mval.mv_size, static_cast<char*>(mval.mv_data)));
+   }
+   
+   return values;
+}
 
-   lock.unlock();
+void LMDB::drop(void)
+{
+   LMDBThreadTxInfo *const thTx = env->threadTx();
+   if (!thTx)
+      throw std::runtime_error("Need transaction to get data");
 
-   if (mdb_drop(txnIter->second.txn_, dbi, 0) != MDB_SUCCESS)
+   if (mdb_drop(thTx->txn_, dbi, 0) != MDB_SUCCESS)
       throw std::runtime_error("Failed to drop DB!");
+   
+   lastKeyKnown_ = false;
 }
 
 // kate: indent-width 3; replace-tabs on;
@@ -7,6 +7,8 @@
 #include <unordered_map>
 #include <pthread.h>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 struct MDB_env;
 struct MDB_txn;
@@ -56,6 +58,57 @@ class LMDBEnv;
 //one mother-txn per thread
 struct LMDBThreadTxInfo;
 
+// how much a commit does to get the data to disk
+enum LMDBSyncPolicy
+{
+   // commits aren't flushed, the OS writes them out whenever it sees fit
+   // or at LMDBEnv::sync(). A system crash can undo the latest commits,
+   // and on a filesystem that reorders writes, corrupt the db
+   LMDB_SYNC_NONE,
+   // the data is flushed on commit, the meta page isn't. A system crash 
+   // can undo the last commit but leaves the db consistent
+   LMDB_SYNC_DATA,
+   // every commit is durable once it returns
+   LMDB_SYNC_FULL
+};
+
+// settings for LMDBEnv::open, they can't be changed on an open env
+struct LMDBTuning
+{
+   // size of the map the env starts with, 0 keeps the lmdb default. The
+   // map grows by itself as the db fills up, starting it near the final
+   // size saves the remaps on the way there
+   size_t mapSize=0;
+   
+   // slots in the reader table, 0 keeps the lmdb default
+   unsigned maxReaders=0;
+   
+   LMDBSyncPolicy sync=LMDB_SYNC_NONE;
+   
+   // MDB_WRITEMAP: write pages straight into the map instead of going 
+   // through malloc'ed copies. Cheaper commits, but a stray write through 
+   // a pointer into the map lands in the db
+   bool writeMap=false;
+   
+   // MDB_MAPASYNC: with writeMap, flushes are issued asynchronously. 
+   // Only matters when commits or sync() flush
+   bool mapAsync=false;
+   
+   // MDB_NORDAHEAD when false. Read ahead helps sequential scans on 
+   // spinning disks, and wastes RAM on random reads of a db larger than it
+   bool readAhead=true;
+   
+   // not used by LMDBEnv: the BlockDataManager flushes the env after its
+   // initial load and each update. Only worth it with LMDB_SYNC_NONE, the
+   // other policies flush every commit already
+   bool checkpointAfterUpdate=false;
+   
+   // how long LMDBEnv::compact waits on the transactions still open before
+   // it swaps the file in. New transactions are held off in the meantime,
+   // if some are still open when it runs out the file is left as it is
+   unsigned compactSwapWaitMs=500;
+};
+
 
 class LMDB
 {
@@ -71,8 +124,19 @@ public:
 private:
    LMDBEnv *env=nullptr;
    unsigned int dbi=0;
+   std::string name_;
+   
+   // append mode: inserts past the last key in the db skip the btree 
+   // search and fill pages all the way. lastKey_ is the largest key
+   // the db is known to hold, only touched by writers
+   bool appendMode_=false;
+   bool lastKeyKnown_=false;
+   std::string lastKey_;
       
    friend class Iterator;   
+   friend class LMDBEnv;
+   
+   void loadLastKey(MDB_txn *txn);
 
 public:
    // this class can be used like a C++ iterator,
@@ -89,13 +153,25 @@ public:
       mutable bool hasTx=true;
       bool has_=false;
       LMDBThreadTxInfo* txnPtr_=nullptr;
-      std::string key_, val_;
+      
+      // without copyData_, the key and value are pointers into the LMDB 
+      // map and only get copied into key_ and val_ when someone asks for
+      // them as strings, or when the transaction ends under the iterator
+      bool copyData_=true;
+      const char *keyPtr_=nullptr, *valPtr_=nullptr;
+      size_t keySize_=0, valSize_=0;
+      mutable bool keyCopied_=false, valCopied_=false;
+      // keyPtr_ and valPtr_ point at key_ and val_ rather than the map
+      bool ownsData_=false;
+      mutable std::string key_, val_;
          
       void reset();
       void checkHasDb() const;
       void checkOk() const;
       
       void openCursor();
+      void setCurrent(void *key, size_t keySize, void *val, size_t valSize);
+      void detachFromTx();
       
       Iterator(LMDB *db);
 
@@ -152,15 +228,28 @@ public:
       // seek this iterator to the first sequence
       void toFirst();
       
+      // don't copy keys and values out of the map as the cursor moves,
+      // keyRef() and valueRef() then point straight into it
+      void setCopyData(bool copy) { copyData_ = copy; }
+      bool copiesData() const { return copyData_; }
+      
       // returns the key currently pointed to, if no key is being pointed to
       // std::logic_error is returned (not LSMException). LSMException may
       // be thrown for other reasons. You can avoid logic_error by
       // calling isValid() first
-      const std::string& key() const { return key_; }
+      const std::string& key() const;
       
       // returns the value currently pointed to. Exceptions are thrown
       // under the same conditions as key()
-      const std::string& value() const { return val_; }
+      const std::string& value() const;
+      
+      // the key and value without a copy. When not copying data, these 
+      // are only good until the cursor moves, the transaction ends or 
+      // something is written to the db in the same transaction
+      CharacterArrayRef keyRef() const
+         { return CharacterArrayRef(keySize_, keyPtr_); }
+      CharacterArrayRef valueRef() const
+         { return CharacterArrayRef(valSize_, valPtr_); }
    };
    
    LMDB() { }
@@ -176,6 +265,9 @@ public:
    void close();
    
    void drop();
+   
+   // the env the db was opened on, nullptr if it isn't open
+   LMDBEnv* getEnv() const { return env; }
       
    // insert a value into the database, replacing
    // the one with a matching key if it is already there
@@ -184,6 +276,12 @@ public:
       const CharacterArrayRef& value
    );
    
+   // for bulk loads of mostly increasing keys: inserts whose key sorts
+   // after every key in the db are appended with MDB_APPEND, the rest
+   // go through the regular path
+   void setAppendMode(bool on);
+   bool appendMode() const { return appendMode_; }
+   
    // delete the entry with the given key, doing nothing
    // if such a key does not exist
    void erase(const CharacterArrayRef& key);
@@ -196,6 +294,13 @@ public:
    // location in memory
    CharacterArrayRef get_NoCopy(const CharacterArrayRef& key) const;
    
+   // get_NoCopy for a batch of keys. The keys are looked up in sorted
+   // order with a single cursor, so keys sharing a leaf page only pay for
+   // one descent. Returns the values in the order of keys, missing keys 
+   // come back with a null data pointer
+   std::vector<CharacterArrayRef> getMany_NoCopy(
+      const std::vector<CharacterArrayRef>& keys) const;
+   
    // create a cursor for scanning the database that points to the first
    // item
    Iterator begin() const
@@ -236,6 +341,9 @@ struct LMDBThreadTxInfo
    std::vector<LMDB::Iterator*> iterators_;
    unsigned transactionLevel_=0;
    LMDB::Mode mode_;
+   
+   // the env's commit count when the transaction began
+   size_t snapshotId_=0;
 };
 
 
@@ -246,9 +354,55 @@ public:
 
 private:
    MDB_env *dbenv=nullptr;
+   std::string filename_;
+   LMDBTuning tuning_;
+   
+   // the dbs opened on this env, compact() hands them their new dbi
+   std::vector<LMDB*> dbs_;
+
+   // the transaction state itself lives in a thread_local slot per env 
+   // (see lmdbpp.cpp), only the count of threads with a transaction open 
+   // is shared. Transactions only take txMutex_ while compact() runs, to
+   // wait on it or to wake it up
+   std::mutex txMutex_;
+   std::condition_variable txCondVar_;
+   std::atomic<unsigned> openTxCount_;
+   std::atomic<unsigned> openWriteTxCount_;
+   
+   // set while compact() swaps the file, new transactions wait it out
+   std::atomic<bool> swapping_;
+   // set while compact() copies the file with writes held off, new write
+   // transactions wait it out
+   std::atomic<bool> holdWrites_;
+   
+   // write transactions committed since the env was opened
+   std::atomic<size_t> commitCount_;
+   
+   void openEnv();
+   // openEnv, then fresh handles for the dbs in dbs_. Leaves the env 
+   // closed if that fails
+   void reopenEnv();
+   bool txBlocked(LMDB::Mode mode) const
+   { return swapping_ || (holdWrites_ && mode == LMDB::ReadWrite); }
+   void enterTx(LMDB::Mode mode);
+   void exitTx(LMDB::Mode mode);
+   
+   // how a copyAndSwap attempt ended
+   enum CompactResult
+   {
+      COMPACT_SWAPPED,
+      // a write was committed during the copy, the copy was dropped
+      COMPACT_MISSED_WRITES,
+      // transactions outlasted tuning_.compactSwapWaitMs, the copy was 
+      // dropped
+      COMPACT_TX_OPEN
+   };
+   CompactResult copyAndSwap(bool holdWrites);
 
-   std::mutex threadTxMutex_;
-   std::unordered_map<pthread_t, LMDBThreadTxInfo> txForThreads_;
+   // the calling thread's transaction on this env, nullptr if it has none
+   LMDBThreadTxInfo* threadTx() const;
+   LMDBThreadTxInfo& threadTxSlot();
+   void releaseThreadTx();
    
    friend class LMDB;
 
@@ -288,17 +442,45 @@ public:
       Transaction(const Transaction&); // no copies
    };
 
-   LMDBEnv() { }
+   LMDBEnv() 
+      : openTxCount_(0), openWriteTxCount_(0), 
+      swapping_(false), holdWrites_(false), commitCount_(0) 
+   { }
    ~LMDBEnv();
    
    // open a database by filename
-   void open(const char *filename);
-   void open(const std::string &filename)
-      { open(filename.c_str()); }
+   void open(const char *filename, const LMDBTuning &tuning = LMDBTuning());
+   void open(const std::string &filename, 
+      const LMDBTuning &tuning = LMDBTuning())
+      { open(filename.c_str(), tuning); }
 
    // close a database, doing nothing if one is presently not open
    void close();
    
+   // durability checkpoint: flush everything committed so far to disk,
+   // whatever the sync policy. Returns once it's there, does nothing if 
+   // the env isn't open
+   void sync();
+   
+   // writes a compacted copy of the env next to its file, free pages 
+   // dropped and the btrees laid out in order, then swaps it in. Readers 
+   // and writers on other threads carry on during the copy, only the swap 
+   // holds off new transactions, until the running ones are done. The 
+   // calling thread can't have a transaction open on this env.
+   // A copy that missed a write is thrown away and made again, after a 
+   // few of those the last copy holds off writers instead. Returns false,
+   // with the env untouched, if transactions were still open after 
+   // tuning.compactSwapWaitMs: try again later. If the copy can't be 
+   // swapped in or opened, the env is back on its original file when 
+   // this throws
+   bool compact();
+   
+   // count of write transactions committed on this env so far
+   size_t commitCount() const { return commitCount_.load(); }
+   // commitCount() as of when the calling thread's transaction began, its
+   // snapshot has at least these commits. SIZE_MAX if it has no transaction
+   size_t snapshotId() const;
+   
 private:
    LMDBEnv(const LMDBEnv&); // disallow copy
 };